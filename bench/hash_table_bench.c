@@ -0,0 +1,1088 @@
+/* hash_table_bench.c - Benchmarks of the table's main entry points:
+* Hash_Table_Insert, Hash_Table_Insert_No_Duplicate, Hash_Table_Match and
+* Hash_Table_First_Match (hits and misses), the same hits in groups through
+* Hash_Table_Match_Batch and Hash_Table_Match_Interleaved, and a mix of
+* lookups and inserts on a hash_table_concurrent_t from several threads,
+* its lookups taking the segment locks or, with -l free, none.
+*
+* Keys are drawn uniformly, Zipfian (a few keys take most of the traffic)
+* or adversarially (long keys sharing a prefix, whose byte sums collide, for
+* the weak -H sum hash). Each phase prints ns/op over the whole phase, the
+* p50 / p99 latency of every BENCH_SAMPLE_EVERY-th operation timed on its
+* own, and cache misses per operation when the perf counters can be read
+* (Linux perf_event_open). The memory line relates Hash_Table_Size and what
+* the table holds from the allocator to the number of objects. -p puts the
+* table on huge pages (see hash_table_pages.h) to compare against calloc.
+*
+* Build with "make bench", run "hash_table_bench -h" for the options.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* syscall for perf_event_open */
+#endif
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define BENCH_PERF 1
+#endif
+
+#include "hash_table.h"
+#include "hash_table_concurrent.h"
+#include "hash_table_define.h"
+#include "hash_table_pages.h"
+#include "hash_table_u64.h"
+
+/* Every this many operations one is timed on its own for the latencies */
+#define BENCH_SAMPLE_EVERY 16
+#define BENCH_MAX_THREADS 256
+#define BENCH_PREFIX_LENGTH 40 /* of adversarial keys */
+#define BENCH_MAX_MATCHES 16 /* max_num_records of Hash_Table_Match */
+/* Lookups a request makes at once, in the batched phases */
+#define BENCH_LOOKUP_GROUP 32
+/* max_bytes of the cache check, under one arena block of the default
+* slab_size so that a mostly empty block cannot be hidden */
+#define BENCH_CACHE_BYTES 30000
+
+/* The specialized table of the integer phases, as hash_table_define.h's
+* example has it */
+#define BENCH_ID_HASH(id) Hash_Table_Hash_Mix(id)
+#define BENCH_ID_EQUAL(id1, id2) ((id1) == (id2))
+HASH_TABLE_DEFINE(Bench_Id_Table, uint64_t, unsigned long, BENCH_ID_HASH,
+	BENCH_ID_EQUAL)
+
+typedef enum bench_keys_t {
+	BENCH_UNIFORM = 0,
+	BENCH_ZIPF = 1,
+	BENCH_ADVERSARIAL = 2
+} bench_keys_t;
+
+typedef struct bench_options_t {
+	unsigned long number_of_entries;
+	unsigned long number_of_operations; /* per lookup phase */
+	bench_keys_t keys;
+	double duplicate_ratio; /* share of the entries repeating a key */
+	double zipf_theta;
+	hash_table_storage_t storage;
+	int store_keys; /* -s stored */
+	int weak_hash; /* -H sum */
+	unsigned long number_of_threads; /* of the mixed phase, 0 skips it */
+	unsigned long write_percent; /* of the mixed phase's operations */
+	int lock_free; /* -l free, the mixed phase's lookups take no lock */
+	uint64_t seed;
+	int use_pages; /* -p, the table's memory from a hash_table_pages_t */
+	size_t huge_page_size;
+	hash_table_numa_t numa;
+} bench_options_t;
+
+/* An object in the table, its key living in the key arena */
+typedef struct bench_record_t {
+	char * key;
+	unsigned long id;
+} bench_record_t;
+
+/* Zipfian ranks over [0, n), after Gray et al., "Quickly Generating
+* Billion-Record Synthetic Databases" */
+typedef struct bench_zipf_t {
+	unsigned long n;
+	double theta, alpha, zetan, eta, half_pow_theta;
+} bench_zipf_t;
+
+typedef struct bench_phase_t {
+	const char * name;
+	unsigned long number_of_operations;
+	double seconds;
+	double * samples; /* ns, number_of_samples of them */
+	unsigned long number_of_samples;
+	long long cache_misses; /* -1 when not counted */
+} bench_phase_t;
+
+typedef struct bench_t {
+	bench_options_t options;
+	hash_table_config_t config;
+	hash_table_pages_t pages; /* the allocator's, with -p */
+
+	size_t key_stride;
+	char * key_arena; /* number_of_keys + number_of_misses keys */
+	unsigned long number_of_keys; /* distinct keys inserted */
+	unsigned long number_of_misses; /* keys never inserted (until the mix) */
+
+	bench_record_t * records; /* number_of_entries, in insertion order */
+	bench_record_t * miss_records; /* for the misses, inserted by the mix */
+	char ** lookups; /* number_of_operations keys of inserted records */
+	bench_zipf_t zipf;
+
+	int perf_fd;
+} bench_t;
+
+typedef struct bench_worker_t {
+	bench_t * bench;
+	hash_table_concurrent_t * table;
+	hash_table_reader_t * reader; /* with -l free, the thread's */
+	unsigned long index;
+	unsigned long number_of_operations;
+	uint64_t random;
+	double * samples;
+	unsigned long number_of_samples;
+	pthread_t thread;
+} bench_worker_t;
+
+/* Randomness */
+
+static uint64_t bench_split_mix(uint64_t * state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/* Uniform in [0, 1) */
+static double bench_uniform(uint64_t * state)
+{
+	return (double)(bench_split_mix(state) >> 11) / 9007199254740992.0;
+}
+
+static void bench_zipf_init(bench_zipf_t * zipf, unsigned long n,
+	double theta)
+{
+	unsigned long i;
+	double zeta2 = 1.0 + pow(0.5, theta);
+
+	zipf->n = n;
+	zipf->theta = theta;
+	zipf->alpha = 1.0 / (1.0 - theta);
+	zipf->half_pow_theta = pow(0.5, theta);
+
+	zipf->zetan = 0;
+	for (i = 1; i <= n; i++)
+		zipf->zetan += 1.0 / pow((double)i, theta);
+
+	zipf->eta = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) /
+		(1.0 - zeta2 / zipf->zetan);
+}
+
+static unsigned long bench_zipf_next(bench_zipf_t * zipf, uint64_t * state)
+{
+	double u = bench_uniform(state), uz = u * zipf->zetan;
+	unsigned long rank;
+
+	if (uz < 1.0)
+		return 0;
+	if (uz < 1.0 + zipf->half_pow_theta)
+		return zipf->n > 1 ? 1 : 0;
+
+	rank = (unsigned long)((double)zipf->n *
+		pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+	return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+/* Index of one of the inserted keys, by the key distribution */
+static unsigned long bench_pick(bench_t * bench, uint64_t * state)
+{
+	if (bench->options.keys == BENCH_ZIPF)
+		return bench_zipf_next(&bench->zipf, state);
+
+	return (unsigned long)(bench_split_mix(state) % bench->number_of_keys);
+}
+
+/* Keys and records */
+
+/* Key index of the arena, the misses after the inserted keys */
+static char * bench_key(bench_t * bench, unsigned long index)
+{
+	return bench->key_arena + index * bench->key_stride;
+}
+
+/* Write the key of index: hex of a bijective mix of index (distinct, and
+* unrelated to the order), or for adversarial keys a shared prefix and
+* index in decimal, so keys with the same digits have the same byte sum */
+static void bench_write_key(bench_t * bench, unsigned long index)
+{
+	uint64_t state = (uint64_t)index;
+	char * key = bench_key(bench, index);
+
+	if (bench->options.keys == BENCH_ADVERSARIAL)
+	{
+		memset(key, 'k', BENCH_PREFIX_LENGTH);
+		sprintf(key + BENCH_PREFIX_LENGTH, "%012lu", index);
+	}
+	else
+	{
+		state = bench_split_mix(&state) ^ bench->options.seed;
+		sprintf(key, "%08lx%08lx", (unsigned long)(state >> 32),
+			(unsigned long)(state & 0xFFFFFFFFUL));
+	}
+}
+
+static int bench_compare(void * object1, void * object2)
+{
+	return strcmp(((bench_record_t *)object1)->key,
+		((bench_record_t *)object2)->key);
+}
+
+static int bench_search(char * pattern, void * object)
+{
+	return strcmp(pattern, ((bench_record_t *)object)->key) == 0;
+}
+
+/* The weak hash of -H sum: byte sum, reduced by the table */
+static unsigned long bench_sum_hash(char * string, unsigned long max_number)
+{
+	unsigned long sum = 0;
+
+	while (*string != '\0')
+		sum += (unsigned char)*string++;
+
+	return sum % max_number;
+}
+
+/* Set up keys, records and the lookup sequence. Entries past the distinct
+* keys repeat a key picked by the distribution, and the insertion order is
+* shuffled so repeats are spread out.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int bench_setup(bench_t * bench)
+{
+	bench_options_t * options = &bench->options;
+	unsigned long i, j, number_of_repeats;
+	uint64_t state = options->seed;
+	bench_record_t swap;
+
+	number_of_repeats = (unsigned long)((double)options->number_of_entries *
+		options->duplicate_ratio);
+	if (number_of_repeats >= options->number_of_entries)
+		number_of_repeats = options->number_of_entries - 1;
+	bench->number_of_keys = options->number_of_entries - number_of_repeats;
+	bench->number_of_misses = options->number_of_operations;
+
+	bench->key_stride = options->keys == BENCH_ADVERSARIAL ?
+		BENCH_PREFIX_LENGTH + 16 : 24;
+	bench->key_arena = malloc((bench->number_of_keys +
+		bench->number_of_misses) * bench->key_stride);
+	bench->records = malloc(options->number_of_entries *
+		sizeof(bench_record_t));
+	bench->miss_records = malloc(bench->number_of_misses *
+		sizeof(bench_record_t));
+	bench->lookups = malloc(options->number_of_operations * sizeof(char *));
+	if (bench->key_arena == NULL || bench->records == NULL ||
+		bench->miss_records == NULL || bench->lookups == NULL)
+		return 0;
+
+	for (i = 0; i < bench->number_of_keys + bench->number_of_misses; i++)
+		bench_write_key(bench, i);
+
+	if (options->keys == BENCH_ZIPF)
+		bench_zipf_init(&bench->zipf, bench->number_of_keys,
+			options->zipf_theta);
+
+	for (i = 0; i < options->number_of_entries; i++)
+	{
+		bench->records[i].id = i;
+		bench->records[i].key = bench_key(bench, i < bench->number_of_keys ?
+			i : bench_pick(bench, &state));
+	}
+	for (i = options->number_of_entries - 1; i > 0; i--)
+	{
+		j = (unsigned long)(bench_split_mix(&state) % (i + 1));
+		swap = bench->records[i];
+		bench->records[i] = bench->records[j];
+		bench->records[j] = swap;
+	}
+
+	for (i = 0; i < bench->number_of_misses; i++)
+	{
+		bench->miss_records[i].id = options->number_of_entries + i;
+		bench->miss_records[i].key = bench_key(bench,
+			bench->number_of_keys + i);
+	}
+
+	for (i = 0; i < options->number_of_operations; i++)
+		bench->lookups[i] = bench_key(bench, bench_pick(bench, &state));
+
+	return 1;
+}
+
+/* Measuring */
+
+static double bench_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/* Open a cache miss counter for this process and the threads it starts
+* from now on, -1 if the system does not let us */
+static int bench_perf_open(void)
+{
+#if defined(BENCH_PERF)
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void bench_perf_start(bench_t * bench)
+{
+#if defined(BENCH_PERF)
+	if (bench->perf_fd >= 0)
+	{
+		ioctl(bench->perf_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(bench->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#else
+	(void)bench;
+#endif
+}
+
+/* Cache misses since bench_perf_start, -1 if not counted */
+static long long bench_perf_stop(bench_t * bench)
+{
+#if defined(BENCH_PERF)
+	long long count;
+
+	if (bench->perf_fd < 0)
+		return -1;
+
+	ioctl(bench->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(bench->perf_fd, &count, sizeof(count)) != sizeof(count))
+		return -1;
+	return count;
+#else
+	(void)bench;
+	return -1;
+#endif
+}
+
+static int bench_compare_samples(const void * sample1, const void * sample2)
+{
+	double a = *(const double *)sample1, b = *(const double *)sample2;
+
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static void bench_phase_begin(bench_t * bench, bench_phase_t * phase,
+	const char * name, unsigned long number_of_operations)
+{
+	phase->name = name;
+	phase->number_of_operations = number_of_operations;
+	phase->number_of_samples = 0;
+	phase->samples = malloc((number_of_operations / BENCH_SAMPLE_EVERY + 1) *
+		sizeof(double));
+
+	bench_perf_start(bench);
+	phase->seconds = bench_now();
+}
+
+static void bench_phase_end(bench_t * bench, bench_phase_t * phase)
+{
+	double p50 = 0, p99 = 0;
+
+	phase->seconds = bench_now() - phase->seconds;
+	phase->cache_misses = bench_perf_stop(bench);
+
+	if (phase->samples != NULL && phase->number_of_samples != 0)
+	{
+		qsort(phase->samples, phase->number_of_samples, sizeof(double),
+			bench_compare_samples);
+		p50 = phase->samples[phase->number_of_samples / 2];
+		p99 = phase->samples[(unsigned long)((double)
+			(phase->number_of_samples - 1) * 0.99)];
+	}
+
+	printf("%-22s %11lu %9.1f %8.0f %8.0f", phase->name,
+		phase->number_of_operations,
+		phase->seconds * 1e9 / (double)phase->number_of_operations, p50, p99);
+	if (phase->cache_misses >= 0)
+		printf(" %11.2f\n", (double)phase->cache_misses /
+			(double)phase->number_of_operations);
+	else
+		printf(" %11s\n", "-");
+
+	free(phase->samples);
+	phase->samples = NULL;
+}
+
+/* Run statement, timing it on its own every BENCH_SAMPLE_EVERY-th i */
+#define BENCH_TIMED(phase, i, statement) \
+	do { \
+		if ((i) % BENCH_SAMPLE_EVERY == 0 && (phase)->samples != NULL) \
+		{ \
+			double bench_start_ = bench_now(); \
+			statement; \
+			(phase)->samples[((phase)->number_of_samples)++] = \
+				(bench_now() - bench_start_) * 1e9; \
+		} \
+		else \
+		{ \
+			statement; \
+		} \
+	} while (0)
+
+/* Phases */
+
+static hash_table_t * bench_insert(bench_t * bench)
+{
+	bench_phase_t phase;
+	hash_table_t * table;
+	unsigned long i, n = bench->options.number_of_entries;
+
+	table = Hash_Table_Init_Config(&bench->config);
+	if (table == NULL)
+		return NULL;
+
+	bench_phase_begin(bench, &phase, "insert", n);
+	for (i = 0; i < n; i++)
+		BENCH_TIMED(&phase, i, Hash_Table_Insert(table, &bench->records[i],
+			bench->records[i].key));
+	bench_phase_end(bench, &phase);
+
+	return table;
+}
+
+static void bench_insert_no_duplicate(bench_t * bench)
+{
+	bench_phase_t phase;
+	hash_table_t * table;
+	void * found;
+	unsigned long i, n = bench->options.number_of_entries;
+
+	table = Hash_Table_Init_Config(&bench->config);
+	if (table == NULL)
+		return;
+
+	bench_phase_begin(bench, &phase, "insert_no_duplicate", n);
+	for (i = 0; i < n; i++)
+		BENCH_TIMED(&phase, i, Hash_Table_Insert_No_Duplicate(table,
+			&bench->records[i], bench->records[i].key, &found));
+	bench_phase_end(bench, &phase);
+
+	Hash_Table_Free(table);
+}
+
+static void bench_match(bench_t * bench, hash_table_t * table)
+{
+	bench_phase_t phase;
+	unsigned long i, found, n = bench->options.number_of_operations;
+
+	bench_phase_begin(bench, &phase, "match_hit", n);
+	for (i = 0; i < n; i++)
+		BENCH_TIMED(&phase, i, free(Hash_Table_Match(table, bench->lookups[i],
+			&found, BENCH_MAX_MATCHES)));
+	bench_phase_end(bench, &phase);
+}
+
+static void bench_first_match(bench_t * bench, hash_table_t * table)
+{
+	bench_phase_t phase;
+	unsigned long i, n = bench->options.number_of_operations;
+	volatile void * sink;
+
+	bench_phase_begin(bench, &phase, "first_match_hit", n);
+	for (i = 0; i < n; i++)
+		BENCH_TIMED(&phase, i, sink = Hash_Table_First_Match(table,
+			bench->lookups[i]));
+	bench_phase_end(bench, &phase);
+
+	bench_phase_begin(bench, &phase, "first_match_miss", n);
+	for (i = 0; i < n; i++)
+		BENCH_TIMED(&phase, i, sink = Hash_Table_First_Match(table,
+			bench->miss_records[i].key));
+	bench_phase_end(bench, &phase);
+	(void)sink;
+}
+
+/* The hits again, BENCH_LOOKUP_GROUP at a time through
+* Hash_Table_Match_Batch and Hash_Table_Match_Interleaved. Calls are not
+* timed one by one. */
+static void bench_match_grouped(bench_t * bench, hash_table_t * table)
+{
+	bench_phase_t phase;
+	void * results[BENCH_LOOKUP_GROUP];
+	unsigned long i, group, n = bench->options.number_of_operations;
+
+	bench_phase_begin(bench, &phase, "match_batch", n);
+	for (i = 0; i < n; i += group)
+	{
+		group = n - i < BENCH_LOOKUP_GROUP ? n - i : BENCH_LOOKUP_GROUP;
+		Hash_Table_Match_Batch(table, bench->lookups + i, group, results,
+			NULL);
+	}
+	bench_phase_end(bench, &phase);
+
+	bench_phase_begin(bench, &phase, "match_interleaved", n);
+	for (i = 0; i < n; i += group)
+	{
+		group = n - i < BENCH_LOOKUP_GROUP ? n - i : BENCH_LOOKUP_GROUP;
+		Hash_Table_Match_Interleaved(table, bench->lookups + i, group,
+			results, NULL, 0);
+	}
+	bench_phase_end(bench, &phase);
+}
+
+static void bench_memory(bench_t * bench, hash_table_t * table)
+{
+	hash_table_stats_t stats;
+	double objects = (double)bench->options.number_of_entries;
+
+	Hash_Table_Stats(table, &stats);
+
+	printf("memory: %lu objects, %lu keys, Hash_Table_Size %lu "
+		"(%.1f bytes/object), allocated %lu (%.1f bytes/object), "
+		"with allocator overhead %lu (%.1f bytes/object)\n",
+		stats.number_of_objects, stats.number_of_keys, stats.size,
+		(double)stats.size / objects, (unsigned long)stats.allocated_bytes,
+		(double)stats.allocated_bytes / objects,
+		(unsigned long)stats.allocator_bytes,
+		(double)stats.allocator_bytes / objects);
+	printf("chains: load factor %.2f, longest chain %lu, longest probe "
+		"%lu, most duplicates %lu\n", stats.load_factor,
+		stats.longest_chain, stats.longest_probe, stats.most_duplicates);
+}
+
+/* Do the table's collision count and a walk of its buckets agree: keys
+* past the first of their bucket (chained) or off their home slot (flat).
+* Returns 1 if they do, 0 if not. */
+static int bench_check_collisions(hash_table_t * table, const char * when)
+{
+	hash_table_stats_t stats;
+	unsigned long walked;
+
+	Hash_Table_Stats(table, &stats);
+	walked = stats.number_of_keys - (table->storage ==
+		HASH_TABLE_STORAGE_FLAT ? stats.probe_lengths[0] :
+		stats.number_of_buckets_filled);
+	if (walked == table->number_of_collisions)
+		return 1;
+
+	fprintf(stderr, "hash_table_bench: %s, %lu collisions counted but %lu "
+		"found\n", when, table->number_of_collisions, walked);
+	return 0;
+}
+
+/* Insert the records into an unpooled cache of BENCH_CACHE_BYTES, each
+* insert evicting as needed: Hash_Table_Size must then stay within them.
+* With -s stored and adversarial keys the keys go to the key arena.
+* Returns 1 if it does, 0 if not (or out of memory). */
+static int bench_check_cache(bench_t * bench)
+{
+	hash_table_config_t config = bench->config;
+	hash_table_t * table;
+	unsigned long i, size;
+
+	config.pooled = 0;
+	config.number_of_buckets = 64;
+	config.max_bytes = BENCH_CACHE_BYTES;
+	table = Hash_Table_Init_Config(&config);
+	if (table == NULL)
+		return 0;
+
+	for (i = 0; i < bench->options.number_of_entries; i++)
+	{
+		if (!Hash_Table_Insert(table, &bench->records[i],
+			bench->records[i].key))
+			break;
+		size = Hash_Table_Size(table);
+		if (size > BENCH_CACHE_BYTES)
+		{
+			fprintf(stderr, "hash_table_bench: cache of %d bytes holds %lu "
+				"after %lu inserts\n", BENCH_CACHE_BYTES, size, i + 1);
+			break;
+		}
+	}
+	Hash_Table_Free(table);
+
+	return i == bench->options.number_of_entries;
+}
+
+/* Remove every other key */
+static void bench_remove(bench_t * bench, hash_table_t * table)
+{
+	bench_phase_t phase;
+	unsigned long i, n = (bench->number_of_keys + 1) / 2;
+
+	bench_phase_begin(bench, &phase, "remove_key", n);
+	for (i = 0; i < n; i++)
+		BENCH_TIMED(&phase, i, Hash_Table_Remove_Key(table,
+			bench_key(bench, i * 2)));
+	bench_phase_end(bench, &phase);
+}
+
+/* Key of a keyed generic table holding uint64_t ids */
+static void bench_id_key(void * object, hash_table_key_t * key)
+{
+	key->key = object;
+	key->length = sizeof(uint64_t);
+}
+
+/* The keys again as random 64 bit ids, inserted and then looked up in a
+* keyed generic table, in hash_table_u64_t and in a HASH_TABLE_DEFINE
+* table, to show what specializing on the key type is worth */
+static void bench_integer(bench_t * bench)
+{
+	bench_phase_t phase;
+	hash_table_config_t config = bench->config;
+	hash_table_t * table;
+	hash_table_u64_t * u64_table;
+	Bench_Id_Table_t * define_table;
+	uint64_t * ids, * lookup_ids, state = bench->options.seed;
+	unsigned long i, n = bench->number_of_keys,
+		m = bench->options.number_of_operations, * found_value;
+	void * found;
+	volatile void * sink;
+
+	ids = malloc(n * sizeof(uint64_t));
+	lookup_ids = malloc(m * sizeof(uint64_t));
+	if (ids == NULL || lookup_ids == NULL)
+	{
+		free(ids);
+		free(lookup_ids);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		ids[i] = bench_split_mix(&state);
+	for (i = 0; i < m; i++)
+		lookup_ids[i] = ids[(unsigned long)(bench->lookups[i] -
+			bench->key_arena) / bench->key_stride];
+
+	config.key_function = bench_id_key;
+	config.store_keys = 0;
+	table = Hash_Table_Init_Config(&config);
+	if (table != NULL)
+	{
+		bench_phase_begin(bench, &phase, "id_insert_generic", n);
+		for (i = 0; i < n; i++)
+			BENCH_TIMED(&phase, i, Hash_Table_Insert_Bytes(table, &ids[i],
+				&ids[i], sizeof(uint64_t)));
+		bench_phase_end(bench, &phase);
+
+		bench_phase_begin(bench, &phase, "id_find_generic", m);
+		for (i = 0; i < m; i++)
+			BENCH_TIMED(&phase, i, sink = Hash_Table_First_Match_Bytes(table,
+				&lookup_ids[i], sizeof(uint64_t)));
+		bench_phase_end(bench, &phase);
+		Hash_Table_Free(table);
+	}
+
+	u64_table = Hash_Table_U64_Init(config.number_of_buckets, NULL,
+		&config.allocator);
+	if (u64_table != NULL)
+	{
+		bench_phase_begin(bench, &phase, "id_insert_u64", n);
+		for (i = 0; i < n; i++)
+			BENCH_TIMED(&phase, i, Hash_Table_U64_Insert(u64_table, ids[i],
+				&ids[i], &found));
+		bench_phase_end(bench, &phase);
+
+		bench_phase_begin(bench, &phase, "id_find_u64", m);
+		for (i = 0; i < m; i++)
+			BENCH_TIMED(&phase, i, sink = Hash_Table_U64_Find(u64_table,
+				lookup_ids[i]));
+		bench_phase_end(bench, &phase);
+		Hash_Table_U64_Free(u64_table);
+	}
+
+	define_table = Bench_Id_Table_Init(config.number_of_buckets,
+		&config.allocator);
+	if (define_table != NULL)
+	{
+		bench_phase_begin(bench, &phase, "id_insert_define", n);
+		for (i = 0; i < n; i++)
+			BENCH_TIMED(&phase, i, Bench_Id_Table_Insert(define_table, ids[i],
+				i, &found_value));
+		bench_phase_end(bench, &phase);
+
+		bench_phase_begin(bench, &phase, "id_find_define", m);
+		for (i = 0; i < m; i++)
+			BENCH_TIMED(&phase, i, sink = Bench_Id_Table_Find(define_table,
+				lookup_ids[i]));
+		bench_phase_end(bench, &phase);
+		Bench_Id_Table_Free(define_table);
+	}
+
+	(void)sink;
+	free(lookup_ids);
+	free(ids);
+}
+
+/* A lookup of the mixed phase, under the segment's read lock or through
+* the worker's reader */
+static void * bench_mix_find(bench_worker_t * worker, char * pattern)
+{
+	if (worker->reader != NULL)
+		return Hash_Table_Concurrent_Read_First_Match(worker->table,
+			worker->reader, pattern);
+
+	return Hash_Table_Concurrent_First_Match(worker->table, pattern);
+}
+
+/* One thread of the mixed phase: write_percent of its operations insert
+* one of its share of the miss records, the rest look up */
+static void * bench_mix_work(void * argument)
+{
+	bench_worker_t * worker = argument;
+	bench_t * bench = worker->bench;
+	unsigned long i, share, next_write, write_percent;
+	volatile void * sink;
+
+	write_percent = bench->options.write_percent;
+	share = bench->number_of_misses / bench->options.number_of_threads;
+	next_write = share * worker->index;
+
+	/* every thread makes one reader, so the table has room for them all */
+	worker->reader = bench->options.lock_free ?
+		Hash_Table_Concurrent_Reader(worker->table) : NULL;
+
+	for (i = 0; i < worker->number_of_operations; i++)
+	{
+		if (bench_split_mix(&worker->random) % 100 < write_percent &&
+			next_write < share * (worker->index + 1))
+		{
+			Hash_Table_Concurrent_Insert(worker->table,
+				&bench->miss_records[next_write],
+				bench->miss_records[next_write].key);
+			next_write++;
+		}
+		else if (i % BENCH_SAMPLE_EVERY == 0 && worker->samples != NULL)
+		{
+			double start = bench_now();
+
+			sink = bench_mix_find(worker, bench_key(bench,
+				bench_pick(bench, &worker->random)));
+			worker->samples[(worker->number_of_samples)++] =
+				(bench_now() - start) * 1e9;
+		}
+		else
+			sink = bench_mix_find(worker, bench_key(bench,
+				bench_pick(bench, &worker->random)));
+	}
+	(void)sink;
+
+	if (worker->reader != NULL)
+		Hash_Table_Concurrent_Reader_Release(worker->table, worker->reader);
+
+	return NULL;
+}
+
+static void bench_mix(bench_t * bench)
+{
+	bench_phase_t phase;
+	bench_worker_t workers[BENCH_MAX_THREADS];
+	hash_table_concurrent_t * table;
+	hash_table_config_t config = bench->config;
+	unsigned long i, j, number_of_threads = bench->options.number_of_threads,
+		n = bench->options.number_of_operations;
+	char name[64];
+
+	/* the segments share the buckets out */
+	config.number_of_buckets = config.number_of_buckets /
+		(number_of_threads * 4) + 1;
+	if (bench->options.lock_free)
+		table = Hash_Table_Concurrent_Init_Lock_Free(&config,
+			number_of_threads * 4, number_of_threads);
+	else
+		table = Hash_Table_Concurrent_Init(&config, number_of_threads * 4);
+	if (table == NULL)
+	{
+		fprintf(stderr, "hash_table_bench: no table for the mixed phase\n");
+		return;
+	}
+
+	for (i = 0; i < bench->options.number_of_entries; i++)
+		Hash_Table_Concurrent_Insert(table, &bench->records[i],
+			bench->records[i].key);
+
+	sprintf(name, "mix_%lut_%luw%s", number_of_threads,
+		bench->options.write_percent, bench->options.lock_free ?
+		"_lock_free" : "");
+	bench_phase_begin(bench, &phase, name, n);
+
+	for (i = 0; i < number_of_threads; i++)
+	{
+		workers[i].bench = bench;
+		workers[i].table = table;
+		workers[i].index = i;
+		workers[i].number_of_operations = n / number_of_threads +
+			(i < n % number_of_threads ? 1 : 0);
+		workers[i].random = bench->options.seed + 1 + i;
+		workers[i].samples = malloc((workers[i].number_of_operations /
+			BENCH_SAMPLE_EVERY + 1) * sizeof(double));
+		workers[i].number_of_samples = 0;
+	}
+	for (i = 0; i < number_of_threads; i++)
+		pthread_create(&workers[i].thread, NULL, bench_mix_work, &workers[i]);
+	for (i = 0; i < number_of_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	/* ns/op then reads as wall time per operation of the whole mix */
+	for (i = 0; i < number_of_threads; i++)
+	{
+		for (j = 0; j < workers[i].number_of_samples &&
+			phase.samples != NULL; j++)
+			phase.samples[(phase.number_of_samples)++] = workers[i].samples[j];
+		free(workers[i].samples);
+	}
+	bench_phase_end(bench, &phase);
+
+	Hash_Table_Concurrent_Free(table);
+}
+
+/* Command line */
+
+static void bench_usage(void)
+{
+	fprintf(stderr,
+		"usage: hash_table_bench [options]\n"
+		"  -n entries      objects inserted (default 1000000)\n"
+		"  -o operations   lookups per lookup phase (default entries, at most "
+		"10000000)\n"
+		"  -k keys         uniform, zipf or adversarial (default uniform)\n"
+		"  -d ratio        share of entries repeating a key, 0 to 1 "
+		"(default 0)\n"
+		"  -z theta        Zipfian skew, below 1 (default 0.99)\n"
+		"  -s storage      chained, flat or stored (chained, keys copied in)"
+		" (default chained)\n"
+		"  -H hash         default or sum (weak byte sum hash_function)\n"
+		"  -t threads      threads of the mixed phase, 0 to skip it "
+		"(default 0)\n"
+		"  -w percent      inserts among the mixed phase's operations "
+		"(default 10)\n"
+		"  -l locking      locked or free, lookups of the mixed phase under "
+		"the segment\n"
+		"                  locks or through lock free readers, free only "
+		"with -s chained\n"
+		"                  (default locked)\n"
+		"  -S seed         (default 1)\n"
+		"  -p pages        calloc, thp, 2m or 1g huge pages (default calloc)\n"
+		"  -N numa         default or interleave, with -p (default default)\n");
+}
+
+static int bench_options(bench_options_t * options, int argc, char ** argv)
+{
+	int i;
+	char * value;
+
+	options->number_of_entries = 1000000;
+	options->number_of_operations = 0;
+	options->keys = BENCH_UNIFORM;
+	options->duplicate_ratio = 0;
+	options->zipf_theta = 0.99;
+	options->storage = HASH_TABLE_STORAGE_CHAINED;
+	options->store_keys = 0;
+	options->weak_hash = 0;
+	options->number_of_threads = 0;
+	options->write_percent = 10;
+	options->lock_free = 0;
+	options->seed = 1;
+	options->use_pages = 0;
+	options->huge_page_size = HASH_TABLE_PAGES_TRANSPARENT;
+	options->numa = HASH_TABLE_NUMA_DEFAULT;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0')
+			return 0;
+
+		value = argv[i + 1];
+		switch (argv[i][1])
+		{
+		case 'n': options->number_of_entries = strtoul(value, NULL, 10); break;
+		case 'o': options->number_of_operations = strtoul(value, NULL, 10);
+			break;
+		case 'k':
+			if (strcmp(value, "uniform") == 0)
+				options->keys = BENCH_UNIFORM;
+			else if (strcmp(value, "zipf") == 0)
+				options->keys = BENCH_ZIPF;
+			else if (strcmp(value, "adversarial") == 0)
+				options->keys = BENCH_ADVERSARIAL;
+			else
+				return 0;
+			break;
+		case 'd': options->duplicate_ratio = atof(value); break;
+		case 'z': options->zipf_theta = atof(value); break;
+		case 's':
+			if (strcmp(value, "chained") == 0)
+				options->storage = HASH_TABLE_STORAGE_CHAINED;
+			else if (strcmp(value, "flat") == 0)
+				options->storage = HASH_TABLE_STORAGE_FLAT;
+			else if (strcmp(value, "stored") == 0)
+				options->store_keys = 1;
+			else
+				return 0;
+			break;
+		case 'H': options->weak_hash = strcmp(value, "sum") == 0; break;
+		case 't': options->number_of_threads = strtoul(value, NULL, 10);
+			break;
+		case 'w': options->write_percent = strtoul(value, NULL, 10); break;
+		case 'l':
+			if (strcmp(value, "free") == 0)
+				options->lock_free = 1;
+			else if (strcmp(value, "locked") == 0)
+				options->lock_free = 0;
+			else
+				return 0;
+			break;
+		case 'S': options->seed = strtoul(value, NULL, 10); break;
+		case 'p':
+			options->use_pages = strcmp(value, "calloc") != 0;
+			if (strcmp(value, "2m") == 0)
+				options->huge_page_size = HASH_TABLE_PAGES_2M;
+			else if (strcmp(value, "1g") == 0)
+				options->huge_page_size = HASH_TABLE_PAGES_1G;
+			else if (options->use_pages && strcmp(value, "thp") != 0)
+				return 0;
+			break;
+		case 'N':
+			if (strcmp(value, "interleave") == 0)
+				options->numa = HASH_TABLE_NUMA_INTERLEAVE;
+			else if (strcmp(value, "default") != 0)
+				return 0;
+			break;
+		default: return 0;
+		}
+	}
+
+	if (i != argc || options->number_of_entries == 0 ||
+		options->duplicate_ratio < 0 || options->duplicate_ratio >= 1 ||
+		options->zipf_theta <= 0 || options->zipf_theta >= 1 ||
+		options->number_of_threads > BENCH_MAX_THREADS ||
+		options->write_percent > 100 ||
+		(options->lock_free && (options->store_keys ||
+		options->storage != HASH_TABLE_STORAGE_CHAINED)))
+		return 0;
+
+	if (options->number_of_operations == 0)
+		options->number_of_operations = options->number_of_entries <
+			10000000 ? options->number_of_entries : 10000000;
+
+	return 1;
+}
+
+int main(int argc, char ** argv)
+{
+	bench_t bench;
+	hash_table_t * table;
+	int checked;
+
+	memset(&bench, 0, sizeof(bench));
+	if (!bench_options(&bench.options, argc, argv))
+	{
+		bench_usage();
+		return 2;
+	}
+
+	Hash_Table_Config_Default(&bench.config);
+	bench.config.storage = bench.options.storage;
+	bench.config.store_keys = bench.options.store_keys;
+	bench.config.compare_function = bench_compare;
+	bench.config.search_function = bench_search;
+	bench.config.hash_function = bench.options.weak_hash ? bench_sum_hash :
+		NULL;
+	bench.config.number_of_buckets = 1024;
+	if (bench.options.use_pages)
+	{
+		Hash_Table_Pages_Default(&bench.pages);
+		bench.pages.huge_page_size = bench.options.huge_page_size;
+		if (bench.pages.huge_page_size > bench.pages.min_size)
+			bench.pages.min_size = bench.pages.huge_page_size;
+		bench.pages.numa = bench.options.numa;
+		bench.pages.prefault_threads = bench.options.number_of_threads > 1 ?
+			bench.options.number_of_threads : 1;
+		bench.config.allocator = Hash_Table_Pages_Allocator(&bench.pages);
+	}
+
+	if (!bench_setup(&bench))
+	{
+		fprintf(stderr, "hash_table_bench: out of memory\n");
+		return 1;
+	}
+
+	bench.perf_fd = bench_perf_open();
+
+	printf("%lu entries, %lu keys, %s keys, %s storage%s\n",
+		bench.options.number_of_entries, bench.number_of_keys,
+		bench.options.keys == BENCH_UNIFORM ? "uniform" :
+		bench.options.keys == BENCH_ZIPF ? "zipf" : "adversarial",
+		bench.options.storage == HASH_TABLE_STORAGE_FLAT ? "flat" :
+		bench.options.store_keys ? "stored key" : "chained",
+		bench.options.weak_hash ? ", byte sum hash" : "");
+	printf("%-22s %11s %9s %8s %8s %11s\n", "phase", "ops", "ns/op",
+		"p50 ns", "p99 ns", "misses/op");
+
+	table = bench_insert(&bench);
+	if (table == NULL)
+	{
+		fprintf(stderr, "hash_table_bench: out of memory\n");
+		return 1;
+	}
+	bench_insert_no_duplicate(&bench);
+	bench_match(&bench, table);
+	bench_first_match(&bench, table);
+	bench_match_grouped(&bench, table);
+	bench_memory(&bench, table);
+	checked = bench_check_collisions(table, "after inserts");
+	bench_remove(&bench, table);
+	checked = bench_check_collisions(table, "after removes") && checked;
+	Hash_Table_Free(table);
+	checked = bench_check_cache(&bench) && checked;
+	if (!checked)
+		return 1;
+
+	bench_integer(&bench);
+
+	if (bench.options.number_of_threads > 0)
+		bench_mix(&bench);
+
+	if (bench.options.use_pages && bench.pages.huge_page_size !=
+		HASH_TABLE_PAGES_TRANSPARENT)
+		printf("pages: %lu blocks on explicit huge pages, %lu fell back to "
+			"transparent ones\n", bench.pages.number_of_huge_blocks,
+			bench.pages.number_of_fallbacks);
+
+	if (bench.perf_fd >= 0)
+		close(bench.perf_fd);
+	free(bench.lookups);
+	free(bench.miss_records);
+	free(bench.records);
+	free(bench.key_arena);
+
+	return 0;
+}
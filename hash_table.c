@@ -20,16 +20,81 @@
 *  See the License for the specific language governing permissions and
 *  limitations under the License.
 */
-#include "hash_table.h"
+#include "hash_table_index.h"
+#include "hash_table_internal.h"
+#include <string.h>
+
+#define DEFAULT_LOAD_FACTOR 0.875
+#define DEFAULT_REHASH_STEP 4
+/* While rehashing, an empty old bucket counts as 1/REHASH_EMPTY_VISITS of a
+* step */
+#define REHASH_EMPTY_VISITS 10
+#define DEFAULT_SLAB_SIZE 65536
+/* Keys a batch hashes and prefetches ahead of resolving them. Enough to
+* cover memory latency, few enough that the lines are still cached when
+* they are used. */
+#define BATCH_WINDOW 16
+
+/* Header at the start of every pool slab, nodes follow it */
+typedef struct hash_table_slab_t {
+	struct hash_table_slab_t * next_slab;
+	size_t unused; /* keeps the nodes after it 16 byte aligned */
+} hash_table_slab_t;
+
+/* Bytes an arena key of length bytes takes: the address of its block, the
+* bytes, rounded up to keep the next key's address aligned */
+#define KEY_RECORD_SIZE(length) \
+	((sizeof(hash_table_key_chunk_t *) + (length) + 7) & ~(size_t)7)
+
+/* Smallest slab that still holds a useful number of fills */
+#define MIN_SLAB_SIZE (sizeof(hash_table_slab_t) + \
+	16 * sizeof(hash_table_fill_t))
+
+static void * default_allocate(size_t size, void * context)
+{
+	(void)context;
+	return calloc(1, size);
+}
+
+static void default_release(void * memory, size_t size, void * context)
+{
+	(void)size;
+	(void)context;
+	free(memory);
+}
+
+/* allocator, or calloc/free if none was supplied */
+hash_table_allocator_t Hash_Table_Allocator_Or_Default(
+	hash_table_allocator_t * allocator)
+{
+	hash_table_allocator_t result = *allocator;
+
+	if (result.allocate == NULL)
+	{
+		result.allocate = default_allocate;
+		result.release = default_release;
+	}
+
+	return result;
+}
 
+/* Size of one element of the chained bucket array */
+static size_t chained_element_size(hash_table_t * table)
+{
+	if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+		return sizeof(hash_table_fill_t);
+
+	return sizeof(hash_table_bucket_t *);
+}
 
 /*
 * Returns a new allocated hash_table_t
 * number_of_buckets limits the size of the array holding buckets. Cannot be
-* changed.
+* changed (use Hash_Table_Init_Config for a table that grows).
 *
 * hash_fun should be a pointer to a function that takes an string
 * and hashes it into a unsigned long no larger than max_number_of_buckets - 1.
+* NULL uses Hash_Table_Hash_Wy.
 *
 * compare_fun should take two objects and return < 1 if object1 is before
 * object2, 0 if same/duplicate, > 1 if object1 is after object2
@@ -46,395 +111,3349 @@ hash_table_t * Hash_Table_Init(unsigned long number_of_buckets,
 	int(*compare_fun)(void * object1, void * object2),
 	int(*search_fun)(char * search_string, void * object),
 	void(*free_fun)(void * object))
+{
+	hash_table_config_t config;
+
+	Hash_Table_Config_Default(&config);
+	config.number_of_buckets = number_of_buckets;
+	config.hash_function = hash_fun;
+	config.compare_function = compare_fun;
+	config.search_function = search_fun;
+	config.free_function = free_fun;
+	config.max_load_factor = 0;
+
+	return Hash_Table_Init_Config(&config);
+}
+
+/* Sets config to the defaults: 16 chained buckets, no callbacks, grow past
+* a load factor of 7/8 rehashing 4 buckets per operation, calloc / free, no
+* pooling and no size limit. */
+void Hash_Table_Config_Default(hash_table_config_t * config)
+{
+	assert(config != NULL);
+
+	config->number_of_buckets = 16;
+	config->hash_function = NULL;
+	config->compare_function = NULL;
+	config->search_function = NULL;
+	config->free_function = NULL;
+	config->serialize_function = NULL;
+	config->deserialize_function = NULL;
+	config->storage = HASH_TABLE_STORAGE_CHAINED;
+
+	config->full_hash_function = NULL;
+	config->reduce_function = NULL;
+	config->key_function = NULL;
+	config->key_hash_function = NULL;
+	config->max_load_factor = DEFAULT_LOAD_FACTOR;
+	config->rehash_step = DEFAULT_REHASH_STEP;
+
+	config->allocator.allocate = NULL;
+	config->allocator.release = NULL;
+	config->allocator.context = NULL;
+	config->pooled = 0;
+	config->slab_size = 0;
+
+	config->layout = HASH_TABLE_LAYOUT_POINTERS;
+
+	config->max_entries = 0;
+	config->max_bytes = 0;
+
+	config->store_keys = 0;
+}
+
+/*
+* Returns a new allocated hash_table_t built as described by config.
+* Callback requirements are the same as for Hash_Table_Init.
+* returns NULL if there was an error allocating memory
+*/
+hash_table_t * Hash_Table_Init_Config(hash_table_config_t * config)
 {
 	hash_table_t * new_hash_table;
-	hash_table_bucket_t ** buckets;
+	void * buckets;
+	hash_table_allocator_t allocator;
+
+	assert(config != NULL);
+	assert(config->key_function != NULL || config->store_keys ||
+		(config->compare_function != NULL && config->search_function != NULL));
+	assert((config->allocator.allocate == NULL) ==
+		(config->allocator.release == NULL));
+
+	/* stored keys trail the fills, which only pointer layout chains have
+	* room for */
+	if (config->store_keys && (config->storage != HASH_TABLE_STORAGE_CHAINED ||
+		config->layout != HASH_TABLE_LAYOUT_POINTERS))
+		return NULL;
 
-	assert(hash_fun != NULL);
-	assert(compare_fun != NULL);
-	assert(search_fun != NULL);
+	allocator = Hash_Table_Allocator_Or_Default(&config->allocator);
 
-	new_hash_table = calloc(1, sizeof(hash_table_t));
+	new_hash_table = allocator.allocate(sizeof(hash_table_t),
+		allocator.context);
 	if (new_hash_table == NULL)
 		return NULL;
 
-	buckets = calloc(number_of_buckets, sizeof(hash_table_bucket_t *));
-	if (buckets == NULL)
-		return NULL;
+	new_hash_table->allocator = allocator;
+	new_hash_table->pooled = config->pooled;
+	new_hash_table->slab_size = config->slab_size > 0 ?
+		config->slab_size : DEFAULT_SLAB_SIZE;
+	if (new_hash_table->slab_size < MIN_SLAB_SIZE)
+		new_hash_table->slab_size = MIN_SLAB_SIZE;
+	new_hash_table->bucket_pool.node_size = sizeof(hash_table_bucket_t);
+	new_hash_table->fill_pool.node_size = sizeof(hash_table_fill_t);
+	new_hash_table->store_keys = config->store_keys != 0;
+	if (new_hash_table->store_keys)
+		new_hash_table->fill_pool.node_size +=
+			sizeof(hash_table_stored_key_t);
+
+	new_hash_table->storage = config->storage;
+	new_hash_table->layout = config->layout;
+	new_hash_table->max_load_factor = config->max_load_factor;
+	new_hash_table->rehash_step = config->rehash_step > 0 ?
+		config->rehash_step : 1;
+
+	if (config->storage == HASH_TABLE_STORAGE_FLAT)
+	{
+		if (!Hash_Table_Flat_Init(new_hash_table, config->number_of_buckets))
+		{
+			allocator.release(new_hash_table, sizeof(hash_table_t),
+				allocator.context);
+			return NULL;
+		}
+	}
+	else
+	{
+		assert(config->number_of_buckets > 0);
+
+		buckets = Hash_Table_Allocate(new_hash_table,
+			config->number_of_buckets, chained_element_size(new_hash_table));
+		new_hash_table->occupied = Hash_Table_Allocate(new_hash_table,
+			HASH_TABLE_OCCUPANCY_WORDS(config->number_of_buckets),
+			sizeof(uint64_t));
+		if (buckets == NULL || new_hash_table->occupied == NULL)
+		{
+			Hash_Table_Release(new_hash_table, buckets,
+				config->number_of_buckets,
+				chained_element_size(new_hash_table));
+			Hash_Table_Release(new_hash_table, new_hash_table->occupied,
+				HASH_TABLE_OCCUPANCY_WORDS(config->number_of_buckets),
+				sizeof(uint64_t));
+			allocator.release(new_hash_table, sizeof(hash_table_t),
+				allocator.context);
+			return NULL;
+		}
 
-	new_hash_table->buckets = buckets;
-	new_hash_table->number_of_total_buckets = number_of_buckets;
+		if (config->layout == HASH_TABLE_LAYOUT_INLINE)
+			new_hash_table->inline_fills = buckets;
+		else
+			new_hash_table->buckets = buckets;
+		new_hash_table->number_of_total_buckets = config->number_of_buckets;
+
+		if (config->max_load_factor > 0)
+			new_hash_table->grow_threshold = (unsigned long)(
+				config->number_of_buckets * config->max_load_factor) + 1;
+	}
 
 	new_hash_table->number_of_buckets_filled = 0;
 	new_hash_table->number_of_collisions = 0;
 	new_hash_table->number_of_duplicates = 0;
 
-	new_hash_table->hash_function = hash_fun;
-	new_hash_table->compare_function = compare_fun;
-	new_hash_table->search_function = search_fun;
-	new_hash_table->free_function = free_fun;
+	new_hash_table->hash_function = config->hash_function;
+	new_hash_table->compare_function = config->compare_function;
+	new_hash_table->search_function = config->search_function;
+	new_hash_table->free_function = config->free_function;
+	new_hash_table->serialize_function = config->serialize_function;
+	new_hash_table->deserialize_function = config->deserialize_function;
+	new_hash_table->full_hash_function = config->full_hash_function;
+	if (config->hash_function == NULL && config->full_hash_function == NULL)
+		new_hash_table->full_hash_function = Hash_Table_Hash_Wy;
+	new_hash_table->key_function = config->key_function;
+	new_hash_table->key_hash_function = config->key_hash_function != NULL ?
+		config->key_hash_function : Hash_Table_Hash_Bytes;
+	new_hash_table->reduce_function = config->reduce_function;
+
+	new_hash_table->max_entries = config->max_entries;
+	new_hash_table->max_bytes = config->max_bytes;
 
 	return new_hash_table;
 }
 
+/* Zeroed memory for count elements of size bytes from the table's
+* allocator, NULL on failure (or overflow). */
+void * Hash_Table_Allocate(hash_table_t * table, size_t count, size_t size)
+{
+	void * memory;
+
+	if (size != 0 && count > (size_t)-1 / size)
+		return NULL;
 
-/*
-* Insert a new object into the hash table. Pattern should be a string that
-* will be hashed for key
-* Return 1 if successful - 0 if failure (memory allocation).
-*/
-int Hash_Table_Insert(hash_table_t * table, void * object, char * pattern)
+	HASH_TABLE_COUNT(table, allocations);
+	memory = table->allocator.allocate(count * size, table->allocator.context);
+	if (memory != NULL)
+	{
+		table->allocated_bytes += count * size;
+		table->allocator_bytes += HASH_TABLE_ALLOCATION_COST(count * size);
+		(table->number_of_allocations)++;
+	}
+
+	return memory;
+}
+
+/* Give back memory from Hash_Table_Allocate, same count and size */
+void Hash_Table_Release(hash_table_t * table, void * memory, size_t count,
+	size_t size)
 {
-	unsigned long hashedIndex;
-	int compareVal, objectPlaced = 0;
-	hash_table_bucket_t * new_bucket = NULL;
-	hash_table_fill_t * new_bucket_fill = NULL, *current_bucket_fill = NULL,
-		*prev_bucket_fill = NULL;
-	hash_table_duplicate_t * new_node_duplicate = NULL, *current_dup = NULL;
+	if (memory == NULL)
+		return;
 
-	assert(table != NULL);
-	assert(object != NULL);
+	table->allocated_bytes -= count * size;
+	table->allocator_bytes -= HASH_TABLE_ALLOCATION_COST(count * size);
+	(table->number_of_allocations)--;
 
-	/* Hash pattern */
-	/* printf("Hashing: %s\n", pattern); */
-	
-	hashedIndex = table->hash_function(pattern, 
-		table->number_of_total_buckets);
+	table->allocator.release(memory, count * size, table->allocator.context);
+}
 
-	/* Now insert into table: go to hashed index, if there is already a record
-	* test if collision and/or duplicate */
+/* Zeroed node from pool when the table is pooled, the allocator otherwise */
+void * Hash_Table_Node_Alloc(hash_table_t * table, hash_table_pool_t * pool)
+{
+	void * node;
+	hash_table_slab_t * slab;
 
-	if (table->buckets[hashedIndex] == NULL)
-	{
-		
-		/* no bucket found, allocate and place */
-		new_bucket = calloc(1, sizeof(hash_table_bucket_t));
-		if (new_bucket == NULL)
-			return 0;
+	if (!table->pooled)
+		return Hash_Table_Allocate(table, 1, pool->node_size);
 
-		new_bucket_fill = calloc(1, sizeof(hash_table_fill_t));
-		if (new_bucket_fill == NULL)
-		{
-			free(new_bucket);
-			return 0;
-		}
+	/* Recycle a freed node first */
+	if (pool->free_list != NULL)
+	{
+		node = pool->free_list;
+		pool->free_list = *(void **)node;
+		memset(node, 0, pool->node_size);
+		return node;
+	}
 
-		new_bucket_fill->object = object;
+	/* Otherwise carve one off the newest slab, starting a new slab when it
+	* is used up */
+	if (pool->next_node == NULL ||
+		(size_t)(pool->slab_end - pool->next_node) < pool->node_size)
+	{
+		slab = Hash_Table_Allocate(table, 1, table->slab_size);
+		if (slab == NULL)
+			return NULL;
 
-		new_bucket->first_fill = new_bucket_fill;
-		new_bucket->last_fill = new_bucket_fill;
+		slab->next_slab = pool->slabs;
+		pool->slabs = slab;
+		(pool->number_of_slabs)++;
 
-		table->buckets[hashedIndex] = new_bucket;
-		(table->number_of_buckets_filled)++;
-		return 1;
+		pool->next_node = (char *)(slab + 1);
+		pool->slab_end = (char *)slab + table->slab_size;
 	}
-	else
+
+	node = pool->next_node;
+	pool->next_node += pool->node_size;
+	return node;
+}
+
+void Hash_Table_Node_Free(hash_table_t * table, hash_table_pool_t * pool,
+	void * node)
+{
+	if (!table->pooled)
 	{
+		Hash_Table_Release(table, node, 1, pool->node_size);
+		return;
+	}
 
-		/* Collision found - go through each one and see if any duplicates */
+	/* Freed nodes are chained through their first word */
+	*(void **)node = pool->free_list;
+	pool->free_list = node;
+}
 
-		current_bucket_fill = table->buckets[hashedIndex]->first_fill;
-		while (current_bucket_fill != NULL && !objectPlaced)
-		{
-			/* See if duplicate */
-			compareVal = table->compare_function(current_bucket_fill->object,
-				object);
-			if (compareVal == 0)
-			{
-				/* duplicate - add to duplicate list */
+/* Hand everything of pool from, filled by another table, to pool into: its
+* slabs, its free nodes and what is left of its newest slab (as free
+* nodes). from is left empty. */
+void Hash_Table_Pool_Merge(hash_table_pool_t * into, hash_table_pool_t * from)
+{
+	hash_table_slab_t * last_slab;
+	void * node;
 
-				current_dup = current_bucket_fill->last_duplicate;
-				
-				new_node_duplicate = calloc(1, sizeof(hash_table_duplicate_t));
-				if (new_node_duplicate == NULL)
-					return 0;
+	assert(into->node_size == from->node_size);
 
-				new_node_duplicate->object = object;
+	while (from->next_node != NULL &&
+		(size_t)(from->slab_end - from->next_node) >= from->node_size)
+	{
+		node = from->next_node;
+		from->next_node += from->node_size;
+		*(void **)node = from->free_list;
+		from->free_list = node;
+	}
 
-				if (current_dup != NULL)
-				{
-					/* We traversed a list of duplicates, update second last */
-					current_dup->next_duplicate = new_node_duplicate;
-				}
-				else
-				{
-					/* No duplicates found, add to start*/
-					current_bucket_fill->first_duplicate = new_node_duplicate;
-				}
-				current_bucket_fill->last_duplicate = new_node_duplicate;
+	while (from->free_list != NULL)
+	{
+		node = from->free_list;
+		from->free_list = *(void **)node;
+		*(void **)node = into->free_list;
+		into->free_list = node;
+	}
 
-				(table->number_of_duplicates)++;
-				objectPlaced = 1;
+	if (from->slabs != NULL)
+	{
+		for (last_slab = from->slabs; last_slab->next_slab != NULL;
+			last_slab = last_slab->next_slab)
+			;
+		last_slab->next_slab = into->slabs;
+		into->slabs = from->slabs;
+		into->number_of_slabs += from->number_of_slabs;
+	}
 
-			}
-			else if (compareVal < 0)
-			{
-				/* not duplicate - object we want to place is after current 
-				- traverse collision list */
-				prev_bucket_fill = current_bucket_fill;
-				current_bucket_fill = current_bucket_fill->next_fill;
-			}
-			else
-			{
-				/* not duplicate - we want to place new object before current
-				so we stop traversing list*/
-				break;
-			}
+	from->slabs = NULL;
+	from->next_node = NULL;
+	from->slab_end = NULL;
+	from->number_of_slabs = 0;
+}
 
-		}
+/* Release every slab of pool */
+static void pool_release(hash_table_t * table, hash_table_pool_t * pool)
+{
+	hash_table_slab_t * slab, * next_slab;
 
-		if (!objectPlaced)
-		{
-			/* not duplicate - add to current position of collision list */
+	for (slab = pool->slabs; slab != NULL; slab = next_slab)
+	{
+		next_slab = slab->next_slab;
+		Hash_Table_Release(table, slab, 1, table->slab_size);
+	}
 
-			new_bucket_fill = calloc(1, sizeof(hash_table_fill_t));
-			if (new_bucket_fill == NULL)
-				return 0;
+	pool->slabs = NULL;
+	pool->free_list = NULL;
+	pool->next_node = NULL;
+	pool->slab_end = NULL;
+	pool->number_of_slabs = 0;
+}
 
-			new_bucket_fill->object = object;
+/* Bytes held in node slabs, 0 unless pooled */
+unsigned long Hash_Table_Pools_Size(hash_table_t * table)
+{
+	return (table->bucket_pool.number_of_slabs +
+		table->fill_pool.number_of_slabs) * table->slab_size;
+}
 
-			if (current_bucket_fill != NULL)
-				new_bucket_fill->next_fill = current_bucket_fill;
-			else
-				table->buckets[hashedIndex]->last_fill = new_bucket_fill;
+/* Start a new arena block with room for a key of record_size bytes. A
+* cache's blocks are kept to an eighth of max_bytes, so a block that is
+* mostly empty cannot hold the table over its limit.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int key_arena_grow(hash_table_t * table, size_t record_size)
+{
+	hash_table_key_arena_t * arena = &table->key_arena;
+	hash_table_key_chunk_t * chunk;
+	size_t size = table->slab_size;
 
-			if (prev_bucket_fill != NULL)
-				prev_bucket_fill->next_fill = new_bucket_fill;
-			else
-				table->buckets[hashedIndex]->first_fill = new_bucket_fill;
+	if (table->max_bytes != 0 && table->max_bytes / 8 < size)
+		size = table->max_bytes / 8;
+	if (size < sizeof(hash_table_key_chunk_t) + record_size)
+		size = sizeof(hash_table_key_chunk_t) + record_size;
 
-			(table->number_of_collisions)++;
-		}
+	chunk = Hash_Table_Allocate(table, 1, size);
+	if (chunk == NULL)
+		return 0;
 
-		return 1;
-	}
+	chunk->prev_chunk = NULL;
+	chunk->next_chunk = arena->chunks;
+	chunk->size = size;
+	chunk->live_bytes = 0;
+	if (arena->chunks != NULL)
+		arena->chunks->prev_chunk = chunk;
+	arena->chunks = chunk;
+	arena->next = (unsigned char *)(chunk + 1);
+	arena->end = (unsigned char *)chunk + size;
+	arena->size += size;
+
+	return 1;
 }
 
-/* 
-* Insert a new object into the hash table only if it has no duplicates 
-	(given pattern).
-* Pattern should be a string that will be hashed for key 
-	(and be unique for each object).
-* Return 1 if successful, 0 already exists, -1 if failure (memory allocation).
-* If 0 is returned, found_duplicate we become a pointer to the first duplicate 
+/* Copy key into stored, into the table's arena when it is too long for
+* the fill. Return 1 if successful - 0 if failure (memory allocation).
 */
-int Hash_Table_Insert_No_Duplicate(hash_table_t * table, void * object,
-	char * pattern, void ** found_duplicate)
+int Hash_Table_Stored_Key_Set(hash_table_t * table,
+	hash_table_stored_key_t * stored, hash_table_key_t * key)
 {
-	unsigned long number_records = 0;
-	void ** object_temp = NULL;
-	
-	assert(table != NULL);
-	assert(object != NULL);
-	assert(pattern != NULL);
+	hash_table_key_arena_t * arena = &table->key_arena;
+	size_t record_size;
 
-	/* check if already in table */
-	object_temp = Hash_Table_Match(table, pattern,
-		&number_records, 1); 
-		/* 1 means we only need to see if found > 0 */
-		
-	if(number_records == 0)
+	if (key->length <= HASH_TABLE_INLINE_KEY)
 	{
-		/* Isn't in table yet, add it */			
-		if(Hash_Table_Insert(table, object, pattern) == 0)
-		{
-			/* error adding */
-			return -1;
-		}
-		else
-			return 1;
+		memcpy(stored->bytes, key->key, key->length);
+		stored->bytes[HASH_TABLE_INLINE_KEY] = (unsigned char)key->length;
+		return 1;
 	}
-	else
-	{
-		/* already exists */
-		*found_duplicate = object_temp[0];
-		free(object_temp);
+
+	if (key->length > (size_t)-1 - sizeof(hash_table_key_chunk_t) - 16)
 		return 0;
+	record_size = KEY_RECORD_SIZE(key->length);
+
+	if (arena->chunks == NULL || (size_t)(arena->end - arena->next) <
+		record_size)
+	{
+		if (!key_arena_grow(table, record_size))
+			return 0;
 	}
 
+	*(hash_table_key_chunk_t **)(void *)arena->next = arena->chunks;
+	memcpy(arena->next + sizeof(hash_table_key_chunk_t *), key->key,
+		key->length);
+	arena->chunks->live_bytes += record_size;
+
+	stored->arena.bytes = arena->next + sizeof(hash_table_key_chunk_t *);
+	stored->arena.length = key->length;
+	stored->bytes[HASH_TABLE_INLINE_KEY] = HASH_TABLE_ARENA_KEY;
+	arena->next += record_size;
+
+	return 1;
 }
 
-/* Free table and contained objects */
-void Hash_Table_Free(hash_table_t * table)
+/* Take stored's key out of the arena, if it is there. A block is freed
+* once empty, the newest one too (the next long key starts another). */
+void Hash_Table_Stored_Key_Release(hash_table_t * table,
+	hash_table_stored_key_t * stored)
 {
-	unsigned long i;
-	hash_table_bucket_t * current_bucket;
-	hash_table_fill_t * current_fill, * next_fill;
-	hash_table_duplicate_t * current_dup, *next_dup;
+	hash_table_key_arena_t * arena = &table->key_arena;
+	hash_table_key_chunk_t * chunk;
+
+	if (stored->bytes[HASH_TABLE_INLINE_KEY] != HASH_TABLE_ARENA_KEY)
+		return;
+
+	chunk = *(hash_table_key_chunk_t * const *)(const void *)
+		(stored->arena.bytes - sizeof(hash_table_key_chunk_t *));
+	chunk->live_bytes -= KEY_RECORD_SIZE(stored->arena.length);
+	stored->bytes[HASH_TABLE_INLINE_KEY] = 0;
 
-	for (i = 0; i < table->number_of_total_buckets; i++)
+	if (chunk->live_bytes > 0)
+		return;
+
+	if (chunk == arena->chunks)
 	{
-		/* for each bucket,   */
-		current_bucket = table->buckets[i];
+		/* the older blocks have no room at their end to carry on in */
+		arena->chunks = chunk->next_chunk;
+		arena->next = NULL;
+		arena->end = NULL;
+	}
+	else
+		chunk->prev_chunk->next_chunk = chunk->next_chunk;
+	if (chunk->next_chunk != NULL)
+		chunk->next_chunk->prev_chunk = chunk->prev_chunk;
+	arena->size -= chunk->size;
+	Hash_Table_Release(table, chunk, 1, chunk->size);
+}
 
-		if (current_bucket != NULL)
-		{
-			/* and then for each fill/collision */
-			current_fill = current_bucket->first_fill;
+/* The stored key as a hash_table_key_t, in *key */
+void Hash_Table_Stored_Key_Get(hash_table_stored_key_t * stored,
+	hash_table_key_t * key)
+{
+	if (stored->bytes[HASH_TABLE_INLINE_KEY] == HASH_TABLE_ARENA_KEY)
+	{
+		key->key = stored->arena.bytes;
+		key->length = stored->arena.length;
+	}
+	else
+	{
+		key->key = stored->bytes;
+		key->length = stored->bytes[HASH_TABLE_INLINE_KEY];
+	}
+}
 
-			while (current_fill != NULL)
-			{
-				/* and for each duplicate */
-				current_dup = current_fill->first_duplicate;
-				while (current_dup != NULL)
-				{
-					next_dup = current_dup->next_duplicate;
+/* Is the stored key key */
+int Hash_Table_Stored_Key_Matches(hash_table_stored_key_t * stored,
+	hash_table_key_t * key)
+{
+	hash_table_key_t stored_key;
 
-					/* free duplicate */
-					if (table->free_function != NULL)
-						table->free_function(current_dup->object);
+	Hash_Table_Stored_Key_Get(stored, &stored_key);
 
-					free(current_dup);
+	return stored_key.length == key->length &&
+		memcmp(stored_key.key, key->key, key->length) == 0;
+}
 
-					current_dup = next_dup;
-				}
+/* Order of the stored key against key, shorter first and then by bytes */
+int Hash_Table_Stored_Key_Compare(hash_table_stored_key_t * stored,
+	hash_table_key_t * key)
+{
+	hash_table_key_t stored_key;
 
-				next_fill = current_fill->next_fill;
+	Hash_Table_Stored_Key_Get(stored, &stored_key);
 
-				/* free fill */
-				if (table->free_function != NULL)
-					table->free_function(current_fill->object);
+	if (stored_key.length != key->length)
+		return stored_key.length < key->length ? -1 : 1;
 
-				free(current_fill);
+	return memcmp(stored_key.key, key->key, key->length);
+}
 
-				current_fill = next_fill;
-			}
-			
+/* Free every block of the arena */
+void Hash_Table_Key_Arena_Free(hash_table_t * table)
+{
+	hash_table_key_chunk_t * chunk, * next_chunk;
 
-			/* free bucket */
-			free(current_bucket);
-		}
+	for (chunk = table->key_arena.chunks; chunk != NULL; chunk = next_chunk)
+	{
+		next_chunk = chunk->next_chunk;
+		Hash_Table_Release(table, chunk, 1, chunk->size);
 	}
 
-	/* free table and bucket pointers */
-	free(table->buckets);
-	free(table);
-
+	memset(&table->key_arena, 0, sizeof(hash_table_key_arena_t));
 }
 
-/* Find an object in the table given pattern string, will hash key
-* and then return array of pointers to matches (duplicates).
-* number_of_objects_found will get changed to number found.
-* Returns NULL if nothing found (or there was an error).
-*/
-void ** Hash_Table_Match(hash_table_t * table, char * pattern,
-	unsigned long * number_of_objects_found, unsigned long max_num_records)
+/* Move the blocks of from (of another table with the same allocator) into
+* into, behind the block into is filling. from is left empty. */
+void Hash_Table_Key_Arena_Merge(hash_table_key_arena_t * into,
+	hash_table_key_arena_t * from)
 {
-	unsigned long key;
-	hash_table_bucket_t * bucket;
-	hash_table_fill_t * current_fill;
-	hash_table_duplicate_t * current_dup;
-	void ** found_records;
-
-	/* Hash key here */
-	key = table->hash_function(pattern, table->number_of_total_buckets);
+	hash_table_key_chunk_t * last_chunk;
 
-	/* Lookup table */
-	bucket = table->buckets[key];
+	if (from->chunks == NULL)
+		return;
 
-	/* See if exists */
-	if (bucket == NULL)
+	if (into->chunks == NULL)
 	{
-		*number_of_objects_found = 0;
-		return NULL;
+		*into = *from;
+		memset(from, 0, sizeof(hash_table_key_arena_t));
+		return;
 	}
-	else
-	{
-		/* Found possible match - check fills/collisions */
-		current_fill = bucket->first_fill;
 
-		while (current_fill != NULL)
-		{
-			if (table->search_function(pattern, current_fill->object) == 1)
-			{
-				/* Found match, add it and duplicates to return array */
-				found_records = calloc(max_num_records, 
-					sizeof(void *));
-				if (found_records == NULL)
-				{
-					printf("Error allocating memory for search.\n");
-					return NULL;
-				}
+	for (last_chunk = from->chunks; last_chunk->next_chunk != NULL;
+		last_chunk = last_chunk->next_chunk)
+		;
 
-				found_records[0] = current_fill->object;
-				(*number_of_objects_found)++;
+	last_chunk->next_chunk = into->chunks->next_chunk;
+	if (last_chunk->next_chunk != NULL)
+		last_chunk->next_chunk->prev_chunk = last_chunk;
+	into->chunks->next_chunk = from->chunks;
+	from->chunks->prev_chunk = into->chunks;
+	into->size += from->size;
 
-				current_dup = current_fill->first_duplicate;
-				while (current_dup != NULL &&
-					*number_of_objects_found < max_num_records)
-				{
-					found_records[*number_of_objects_found] =
-						current_dup->object;
-					(*number_of_objects_found)++;
+	memset(from, 0, sizeof(hash_table_key_arena_t));
+}
 
-					current_dup = current_dup->next_duplicate;
+/* Append object to the duplicates. Once the inline room is used up they
+* move to an array, which then doubles whenever it is full.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Duplicate_Append(hash_table_t * table,
+	hash_table_duplicates_t * duplicates, void * object)
+{
+	void ** new_objects;
+	uint32_t new_capacity;
 
-				}
+	if (duplicates->capacity == 0 &&
+		duplicates->number_of_duplicates < HASH_TABLE_INLINE_DUPLICATES)
+	{
+		duplicates->items.inline_objects[duplicates->number_of_duplicates] =
+			object;
+		HASH_TABLE_PUBLISH(duplicates->number_of_duplicates,
+			duplicates->number_of_duplicates + 1);
+		return 1;
+	}
 
-				return found_records;
-			}
-			else
-			{
-				/* Does not match current , go through collisions*/
-				current_fill = current_fill->next_fill;
-			}
+	if (duplicates->capacity == 0 ||
+		duplicates->number_of_duplicates == duplicates->capacity)
+	{
+		/* inline room or array full, grow */
+		if (duplicates->capacity > UINT32_MAX / 2)
+			return 0;
+
+		new_capacity = duplicates->capacity != 0 ?
+			duplicates->capacity * 2 : HASH_TABLE_INLINE_DUPLICATES * 4;
+
+		new_objects = Hash_Table_Allocate(table, new_capacity, sizeof(void *));
+		if (new_objects == NULL)
+			return 0;
+
+		memcpy(new_objects, HASH_TABLE_DUPLICATE_OBJECTS(duplicates),
+			duplicates->number_of_duplicates * sizeof(void *));
+
+		if (duplicates->capacity != 0)
+		{
+			Hash_Table_Release(table, duplicates->items.objects,
+				duplicates->capacity, sizeof(void *));
+			table->duplicate_capacity -= duplicates->capacity;
 		}
 
-		/* never found any match */
-		return NULL;
+		duplicates->items.objects = new_objects;
+		duplicates->capacity = new_capacity;
+		table->duplicate_capacity += new_capacity;
 	}
+
+	duplicates->items.objects[duplicates->number_of_duplicates] = object;
+	HASH_TABLE_PUBLISH(duplicates->number_of_duplicates,
+		duplicates->number_of_duplicates + 1);
+
+	return 1;
 }
 
-/* Find the first object in the table given pattern string.
-* Returns NULL if nothing found (or there was an error).
-*/
-void * Hash_Table_First_Match(hash_table_t * table, char * pattern)
+/* Pass each duplicate to free_function and release the array */
+void Hash_Table_Duplicates_Free(hash_table_t * table,
+	hash_table_duplicates_t * duplicates)
 {
-	void ** found_objects, * found_object;
-	unsigned long number_of_objects_found = 0;
-	
-	assert(table != NULL);
-	assert(pattern != NULL);
-	
-	found_objects = Hash_Table_Match(table,pattern,
-	&number_of_objects_found, 1);
-		/* We only want one object */
-	if(found_objects != NULL)
+	void ** objects;
+	uint32_t i;
+
+	if (table->free_function != NULL)
 	{
-		found_object = found_objects[0]; /* First one */
-		free(found_objects);
-		return found_object;
+		objects = HASH_TABLE_DUPLICATE_OBJECTS(duplicates);
+		for (i = 0; i < duplicates->number_of_duplicates; i++)
+			table->free_function(objects[i]);
 	}
-	else
+
+	if (duplicates->capacity != 0)
 	{
-		return NULL;
+		Hash_Table_Release(table, duplicates->items.objects,
+			duplicates->capacity, sizeof(void *));
+		table->duplicate_capacity -= duplicates->capacity;
 	}
 
+	duplicates->number_of_duplicates = 0;
+	duplicates->capacity = 0;
 }
 
-/* Returns number of bytes that the hash table currently has been
-* allocated not including objects table holds.
+/* Where object sits in an entry whose own object is first: 0 for first
+* itself, i + 1 for duplicate i.
+* Returns -1 if object is not one of the entry's.
 */
-unsigned long Hash_Table_Size(hash_table_t * table)
+long Hash_Table_Duplicates_Find(void * first,
+	hash_table_duplicates_t * duplicates, void * object)
 {
-	unsigned long table_size, bucket_size, bucket_fill_size, 
-		bucket_duplicate_size;
+	void ** objects;
+	uint32_t i;
 
+	if (first == object)
+		return 0;
 
-	table_size = sizeof(hash_table_t) +
-		table->number_of_total_buckets * sizeof(hash_table_bucket_t *);
+	objects = HASH_TABLE_DUPLICATE_OBJECTS(duplicates);
+	for (i = 0; i < duplicates->number_of_duplicates; i++)
+	{
+		if (objects[i] == object)
+			return (long)i + 1;
+	}
 
-	bucket_size = table->number_of_buckets_filled * 
-		sizeof(hash_table_bucket_t);
+	return -1;
+}
 
-	bucket_fill_size = (table->number_of_buckets_filled + 
-		table->number_of_collisions) *
-		sizeof(hash_table_fill_t);
+/* Take the object at position (see Hash_Table_Duplicates_Find) out of an
+* entry that has duplicates, keeping the order of the rest. Taking *first
+* moves the first duplicate up into it. An array down to what fits inline
+* is released. */
+void Hash_Table_Duplicates_Take(hash_table_t * table, void ** first,
+	hash_table_duplicates_t * duplicates, uint32_t position)
+{
+	void ** objects = HASH_TABLE_DUPLICATE_OBJECTS(duplicates);
+	uint32_t capacity = duplicates->capacity;
 
-	bucket_duplicate_size = table->number_of_duplicates * 
-		sizeof(hash_table_duplicate_t);
+	assert(duplicates->number_of_duplicates != 0);
 
+	if (position == 0)
+		*first = objects[0];
+	else
+		position--;
 
+	memmove(&objects[position], &objects[position + 1],
+		(duplicates->number_of_duplicates - position - 1) * sizeof(void *));
+	(duplicates->number_of_duplicates)--;
+	(table->number_of_duplicates)--;
 
-	return table_size + bucket_size + bucket_fill_size + bucket_duplicate_size;
-}
\ No newline at end of file
+	if (capacity != 0 &&
+		duplicates->number_of_duplicates <= HASH_TABLE_INLINE_DUPLICATES)
+	{
+		memcpy(duplicates->items.inline_objects, objects,
+			duplicates->number_of_duplicates * sizeof(void *));
+		duplicates->capacity = 0;
+		Hash_Table_Release(table, objects, capacity, sizeof(void *));
+		table->duplicate_capacity -= capacity;
+	}
+}
+
+/* Point cursor at duplicates */
+void Hash_Table_Cursor_Set(hash_table_cursor_t * cursor,
+	hash_table_duplicates_t * duplicates)
+{
+	/* the count first, the objects below it are then in place */
+	cursor->number_remaining = HASH_TABLE_READ(
+		duplicates->number_of_duplicates);
+	cursor->next_duplicate = HASH_TABLE_DUPLICATE_OBJECTS(duplicates);
+}
+
+/* Bytes held by the chained engine, counting only the nodes in use */
+static unsigned long chained_used_size(hash_table_t * table)
+{
+	unsigned long table_size, bucket_size, bucket_fill_size,
+		bucket_duplicate_size;
+
+	table_size = sizeof(hash_table_t) + (table->number_of_total_buckets +
+		table->number_of_old_buckets) * chained_element_size(table) +
+		(HASH_TABLE_OCCUPANCY_WORDS(table->number_of_total_buckets) +
+		HASH_TABLE_OCCUPANCY_WORDS(table->number_of_old_buckets)) *
+		sizeof(uint64_t);
+
+	/* the inline layout has no bucket structs and keeps the first fill of
+	* each bucket in the array */
+	if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+	{
+		bucket_size = 0;
+		bucket_fill_size = table->number_of_collisions *
+			sizeof(hash_table_fill_t);
+	}
+	else
+	{
+		bucket_size = table->number_of_buckets_filled *
+			sizeof(hash_table_bucket_t);
+
+		/* with any stored keys after each fill, and the arena's blocks
+		* as allocated (as the pooled size counts them) */
+		bucket_fill_size = (table->number_of_buckets_filled +
+			table->number_of_collisions) * table->fill_pool.node_size +
+			table->key_arena.size;
+	}
+
+	bucket_duplicate_size = table->duplicate_capacity * sizeof(void *);
+
+	return table_size + bucket_size + bucket_fill_size + bucket_duplicate_size;
+}
+
+/* Keyed tables: does object's key equal key */
+int Hash_Table_Key_Matches(hash_table_t * table, hash_table_key_t * key,
+	void * object)
+{
+	hash_table_key_t object_key;
+
+	table->key_function(object, &object_key);
+
+	return object_key.length == key->length &&
+		memcmp(object_key.key, key->key, key->length) == 0;
+}
+
+/* Keyed tables: order of two objects' keys, shorter first and then by
+* bytes */
+int Hash_Table_Key_Compare(hash_table_t * table, void * object1,
+	void * object2)
+{
+	hash_table_key_t key1, key2;
+
+	table->key_function(object1, &key1);
+	table->key_function(object2, &key2);
+
+	if (key1.length != key2.length)
+		return key1.length < key2.length ? -1 : 1;
+
+	return memcmp(key1.key, key2.key, key1.length);
+}
+
+/* Map a full hash onto one of number_of_buckets buckets */
+static unsigned long chained_reduce(hash_table_t * table, uint64_t hash,
+	unsigned long number_of_buckets)
+{
+	if (table->reduce_function != NULL)
+		return table->reduce_function(hash, number_of_buckets);
+
+	return Hash_Table_Reduce(hash, number_of_buckets);
+}
+
+/* Index of the bucket hash goes to in the current array */
+unsigned long Hash_Table_Bucket_Index(hash_table_t * table, uint64_t hash)
+{
+	return chained_reduce(table, hash, table->number_of_total_buckets);
+}
+
+/* Set (filled 1) or clear bucket index's bit of occupied */
+static void chained_occupy(uint64_t * occupied, unsigned long index,
+	int filled)
+{
+	uint64_t bit = (uint64_t)1 << (index % HASH_TABLE_OCCUPANCY_BITS);
+
+	if (filled)
+		occupied[index / HASH_TABLE_OCCUPANCY_BITS] |= bit;
+	else
+		occupied[index / HASH_TABLE_OCCUPANCY_BITS] &= ~bit;
+}
+
+/* A bucket of the chained engine in either layout: bucket_slot points at
+* the array entry for HASH_TABLE_LAYOUT_POINTERS, head at the inline first
+* fill for HASH_TABLE_LAYOUT_INLINE. occupied is the bitmap of the array it
+* is in and index its place there. */
+typedef struct chained_ref_t {
+	hash_table_bucket_t ** bucket_slot;
+	hash_table_fill_t * head;
+	uint64_t * occupied;
+	unsigned long index;
+} chained_ref_t;
+
+/* The bucket for hash: in the old array while it has not been rehashed yet,
+* otherwise in the current one */
+static chained_ref_t chained_locate(hash_table_t * table, uint64_t hash)
+{
+	chained_ref_t ref;
+	unsigned long index;
+
+	ref.bucket_slot = NULL;
+	ref.head = NULL;
+
+	if (table->number_of_old_buckets != 0)
+	{
+		index = chained_reduce(table, hash, table->number_of_old_buckets);
+		if (index >= table->rehash_position)
+		{
+			ref.occupied = table->old_occupied;
+			ref.index = index;
+			if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+				ref.head = &table->old_inline_fills[index];
+			else
+				ref.bucket_slot = &table->old_buckets[index];
+			return ref;
+		}
+	}
+
+	index = chained_reduce(table, hash, table->number_of_total_buckets);
+	ref.occupied = table->occupied;
+	ref.index = index;
+	if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+		ref.head = &table->inline_fills[index];
+	else
+		ref.bucket_slot = &table->buckets[index];
+	return ref;
+}
+
+/* First fill of the bucket, NULL if it is empty */
+static hash_table_fill_t * chained_first(chained_ref_t ref)
+{
+	hash_table_bucket_t * bucket;
+
+	if (ref.head != NULL)
+		return ref.head->object != NULL ? ref.head : NULL;
+
+	bucket = HASH_TABLE_READ(*ref.bucket_slot);
+	return bucket != NULL ? HASH_TABLE_READ(bucket->first_fill) : NULL;
+}
+
+/* Walk the sorted collision list from first for where object (with full
+* hash) belongs. Fills are ordered by hash and then by compare_function, so
+* compare_function only runs on fills with the same hash. A table storing
+* keys orders by the stored keys instead, key being object's.
+* Returns the ordering at the stopping point: 0 if *current is a duplicate
+* of object, otherwise object goes between *prev and *current (either can be
+* NULL).
+*/
+static int chained_position(hash_table_t * table, hash_table_fill_t * first,
+	void * object, uint64_t hash, hash_table_key_t * key,
+	hash_table_fill_t ** prev, hash_table_fill_t ** current)
+{
+	int compareVal = 1;
+	unsigned long compares_skipped = 0;
+
+	*prev = NULL;
+	*current = first;
+	while (*current != NULL)
+	{
+		if ((*current)->hash != hash)
+		{
+			compares_skipped++;
+			compareVal = (*current)->hash < hash ? -1 : 1;
+		}
+		else if (table->store_keys)
+		{
+			HASH_TABLE_COUNT(table, compare_calls);
+			compareVal = Hash_Table_Stored_Key_Compare(
+				HASH_TABLE_STORED_KEY(*current), key);
+		}
+		else
+			compareVal = HASH_TABLE_COMPARE(table, (*current)->object, object);
+
+		if (compareVal < 0)
+		{
+			/* object we want to place is after current */
+			*prev = *current;
+			*current = (*current)->next_fill;
+		}
+		else
+			break;
+	}
+
+	table->number_of_compares_skipped += compares_skipped;
+	return compareVal;
+}
+
+/* Link fill into bucket between prev and current, as found by
+* chained_position */
+static void chained_link(hash_table_bucket_t * bucket, hash_table_fill_t * fill,
+	hash_table_fill_t * prev, hash_table_fill_t * current)
+{
+	fill->next_fill = current;
+	if (current == NULL)
+		bucket->last_fill = fill;
+
+	if (prev != NULL)
+		HASH_TABLE_PUBLISH(prev->next_fill, fill);
+	else
+		HASH_TABLE_PUBLISH(bucket->first_fill, fill);
+}
+
+/* Link fill into an inline bucket between prev and current. The front of
+* the list lives in the array, so a new first fill swaps contents with the
+* node: the old head moves out into it and fill's contents move in. */
+static void chained_link_inline(hash_table_fill_t * head,
+	hash_table_fill_t * fill, hash_table_fill_t * prev,
+	hash_table_fill_t * current)
+{
+	hash_table_fill_t new_contents;
+
+	if (prev != NULL)
+	{
+		fill->next_fill = current;
+		prev->next_fill = fill;
+		return;
+	}
+
+	new_contents = *fill;
+	*fill = *head;
+	*head = new_contents;
+	head->next_fill = fill;
+}
+
+/* Put a new fill for object into the located bucket between prev and
+* current, as found by chained_position (both NULL for an empty bucket),
+* with a copy of key when the table stores keys.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int chained_add_fill(hash_table_t * table, chained_ref_t ref,
+	hash_table_fill_t * prev, hash_table_fill_t * current, void * object,
+	uint64_t hash, hash_table_key_t * key)
+{
+	hash_table_bucket_t * new_bucket;
+	hash_table_fill_t * new_bucket_fill;
+
+	if (chained_first(ref) == NULL)
+	{
+		/* no bucket found, allocate and place */
+		if (ref.head != NULL)
+		{
+			/* the inline fill is the bucket, nothing to allocate */
+			memset(ref.head, 0, sizeof(hash_table_fill_t));
+			ref.head->object = object;
+			ref.head->hash = hash;
+
+			chained_occupy(ref.occupied, ref.index, 1);
+			(table->number_of_buckets_filled)++;
+			return 1;
+		}
+
+		new_bucket = Hash_Table_Node_Alloc(table, &table->bucket_pool);
+		if (new_bucket == NULL)
+			return 0;
+
+		new_bucket_fill = Hash_Table_Node_Alloc(table, &table->fill_pool);
+		if (new_bucket_fill == NULL || (table->store_keys &&
+			!Hash_Table_Stored_Key_Set(table,
+			HASH_TABLE_STORED_KEY(new_bucket_fill), key)))
+		{
+			if (new_bucket_fill != NULL)
+				Hash_Table_Node_Free(table, &table->fill_pool,
+					new_bucket_fill);
+			Hash_Table_Node_Free(table, &table->bucket_pool, new_bucket);
+			return 0;
+		}
+
+		new_bucket_fill->object = object;
+		new_bucket_fill->hash = hash;
+
+		new_bucket->first_fill = new_bucket_fill;
+		new_bucket->last_fill = new_bucket_fill;
+
+		HASH_TABLE_PUBLISH(*ref.bucket_slot, new_bucket);
+		chained_occupy(ref.occupied, ref.index, 1);
+		(table->number_of_buckets_filled)++;
+		return 1;
+	}
+
+	/* not duplicate - add to current position of collision list */
+
+	new_bucket_fill = Hash_Table_Node_Alloc(table, &table->fill_pool);
+	if (new_bucket_fill == NULL)
+		return 0;
+
+	if (table->store_keys && !Hash_Table_Stored_Key_Set(table,
+		HASH_TABLE_STORED_KEY(new_bucket_fill), key))
+	{
+		Hash_Table_Node_Free(table, &table->fill_pool, new_bucket_fill);
+		return 0;
+	}
+
+	new_bucket_fill->object = object;
+	new_bucket_fill->hash = hash;
+
+	if (ref.head != NULL)
+		chained_link_inline(ref.head, new_bucket_fill, prev, current);
+	else
+		chained_link(*ref.bucket_slot, new_bucket_fill, prev, current);
+
+	(table->number_of_collisions)++;
+	return 1;
+}
+
+/* Release the duplicate array of duplicates, leaving the objects */
+static void duplicates_release(hash_table_t * table,
+	hash_table_duplicates_t * duplicates)
+{
+	if (duplicates->capacity == 0)
+		return;
+
+	table->duplicate_capacity -= duplicates->capacity;
+	if (table->retire_function != NULL)
+		table->retire_function(table->retire_context, table,
+			HASH_TABLE_RETIRE_ARRAY, NULL, duplicates->items.objects,
+			duplicates->capacity, sizeof(void *));
+	else
+		Hash_Table_Release(table, duplicates->items.objects,
+			duplicates->capacity, sizeof(void *));
+}
+
+/* Free an unlinked node of pool, or retire it when readers may still be on
+* it */
+static void chained_free_node(hash_table_t * table, hash_table_pool_t * pool,
+	void * node)
+{
+	if (table->store_keys && pool == &table->fill_pool)
+		Hash_Table_Stored_Key_Release(table, HASH_TABLE_STORED_KEY(node));
+
+	if (table->retire_function != NULL)
+		table->retire_function(table->retire_context, table,
+			HASH_TABLE_RETIRE_NODE, pool, node, 1, pool->node_size);
+	else
+		Hash_Table_Node_Free(table, pool, node);
+}
+
+/* Free (or retire) an unlinked fill node along with its duplicate array,
+* leaving the objects */
+static void chained_drop_fill(hash_table_t * table, hash_table_fill_t * fill)
+{
+	duplicates_release(table, &fill->duplicates);
+	chained_free_node(table, &table->fill_pool, fill);
+}
+
+/* Pass each object of an unlinked fill to free_function, once no reader
+* can still see them when there are lock free readers */
+static void chained_free_objects(hash_table_t * table,
+	hash_table_fill_t * fill)
+{
+	void ** objects = HASH_TABLE_DUPLICATE_OBJECTS(&fill->duplicates);
+	uint32_t i;
+
+	(void)HASH_TABLE_INDEX_EVENT(table, HASH_TABLE_INDEX_DROP_KEY, fill->object);
+
+	if (table->free_function == NULL)
+		return;
+
+	for (i = 0; i <= fill->duplicates.number_of_duplicates; i++)
+	{
+		if (table->retire_function != NULL)
+			table->retire_function(table->retire_context, table,
+				HASH_TABLE_RETIRE_OBJECT, NULL, i == 0 ? fill->object :
+				objects[i - 1], 1, 0);
+		else
+			table->free_function(i == 0 ? fill->object : objects[i - 1]);
+	}
+}
+
+/* Unlink fill (found in the located bucket after prev) from its bucket,
+* freeing the bucket once it is empty. The node goes back to its pool and
+* what fill held is copied into taken for the caller to deal with. An
+* inline head is refilled from the node after it, if any. */
+static void chained_unlink_fill(hash_table_t * table, chained_ref_t ref,
+	hash_table_fill_t * prev, hash_table_fill_t * fill,
+	hash_table_fill_t * taken)
+{
+	hash_table_bucket_t * bucket;
+	hash_table_fill_t * next_fill;
+
+	*taken = *fill;
+
+	if (ref.head != NULL)
+	{
+		if (fill == ref.head)
+		{
+			next_fill = fill->next_fill;
+			if (next_fill == NULL)
+			{
+				memset(ref.head, 0, sizeof(hash_table_fill_t));
+				chained_occupy(ref.occupied, ref.index, 0);
+				table->number_of_buckets_filled--;
+				return;
+			}
+
+			/* the next fill moves into the array */
+			*ref.head = *next_fill;
+			fill = next_fill;
+		}
+		else
+			prev->next_fill = fill->next_fill;
+
+		Hash_Table_Node_Free(table, &table->fill_pool, fill);
+		table->number_of_collisions--;
+		return;
+	}
+
+	bucket = *ref.bucket_slot;
+	if (prev == NULL && fill->next_fill == NULL)
+	{
+		HASH_TABLE_PUBLISH(*ref.bucket_slot, NULL);
+		chained_free_node(table, &table->bucket_pool, bucket);
+		chained_occupy(ref.occupied, ref.index, 0);
+		table->number_of_buckets_filled--;
+	}
+	else
+	{
+		if (prev != NULL)
+			HASH_TABLE_PUBLISH(prev->next_fill, fill->next_fill);
+		else
+			HASH_TABLE_PUBLISH(bucket->first_fill, fill->next_fill);
+
+		if (bucket->last_fill == fill)
+			bucket->last_fill = prev;
+		table->number_of_collisions--;
+	}
+
+	chained_free_node(table, &table->fill_pool, fill);
+}
+
+/* Put new_fill in the place of fill (found in bucket after prev), then
+* retire fill for the readers that may still be on it */
+static void chained_swap_fill(hash_table_t * table,
+	hash_table_bucket_t * bucket, hash_table_fill_t * prev,
+	hash_table_fill_t * fill, hash_table_fill_t * new_fill)
+{
+	new_fill->next_fill = fill->next_fill;
+
+	if (bucket->last_fill == fill)
+		bucket->last_fill = new_fill;
+
+	if (prev != NULL)
+		HASH_TABLE_PUBLISH(prev->next_fill, new_fill);
+	else
+		HASH_TABLE_PUBLISH(bucket->first_fill, new_fill);
+
+	chained_drop_fill(table, fill);
+}
+
+/* Lock free readers version of adding object to the duplicates of fill
+* (found in bucket after prev), for when the duplicates are full. Instead of
+* growing them in place fill is swapped for a copy holding a bigger array
+* and the old fill and array are retired.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int chained_replace_fill(hash_table_t * table,
+	hash_table_bucket_t * bucket, hash_table_fill_t * prev,
+	hash_table_fill_t * fill, void * object)
+{
+	hash_table_fill_t * new_fill;
+	hash_table_duplicates_t * duplicates = &fill->duplicates;
+	void ** new_objects;
+	uint32_t new_capacity;
+
+	if (duplicates->capacity > UINT32_MAX / 2)
+		return 0;
+
+	new_capacity = duplicates->capacity != 0 ?
+		duplicates->capacity * 2 : HASH_TABLE_INLINE_DUPLICATES * 4;
+
+	new_fill = Hash_Table_Node_Alloc(table, &table->fill_pool);
+	if (new_fill == NULL)
+		return 0;
+
+	new_objects = Hash_Table_Allocate(table, new_capacity, sizeof(void *));
+	if (new_objects == NULL)
+	{
+		Hash_Table_Node_Free(table, &table->fill_pool, new_fill);
+		return 0;
+	}
+
+	memcpy(new_objects, HASH_TABLE_DUPLICATE_OBJECTS(duplicates),
+		duplicates->number_of_duplicates * sizeof(void *));
+	new_objects[duplicates->number_of_duplicates] = object;
+
+	new_fill->object = fill->object;
+	new_fill->hash = fill->hash;
+	new_fill->duplicates.number_of_duplicates =
+		duplicates->number_of_duplicates + 1;
+	new_fill->duplicates.capacity = new_capacity;
+	new_fill->duplicates.items.objects = new_objects;
+	table->duplicate_capacity += new_capacity;
+
+	chained_swap_fill(table, bucket, prev, fill, new_fill);
+
+	return 1;
+}
+
+/* Lock free readers version of taking the object at position (see
+* Hash_Table_Duplicates_Find) out of fill, found in bucket after prev, when
+* it is not the only one: fill is swapped for a copy holding the rest.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int chained_replace_fill_without(hash_table_t * table,
+	hash_table_bucket_t * bucket, hash_table_fill_t * prev,
+	hash_table_fill_t * fill, uint32_t position)
+{
+	hash_table_fill_t * new_fill;
+	hash_table_duplicates_t * duplicates = &fill->duplicates;
+	void ** objects, ** new_objects;
+	uint32_t number_left, i;
+
+	number_left = duplicates->number_of_duplicates - 1;
+
+	new_fill = Hash_Table_Node_Alloc(table, &table->fill_pool);
+	if (new_fill == NULL)
+		return 0;
+
+	new_objects = new_fill->duplicates.items.inline_objects;
+	if (number_left > HASH_TABLE_INLINE_DUPLICATES)
+	{
+		new_objects = Hash_Table_Allocate(table, number_left, sizeof(void *));
+		if (new_objects == NULL)
+		{
+			Hash_Table_Node_Free(table, &table->fill_pool, new_fill);
+			return 0;
+		}
+
+		new_fill->duplicates.capacity = number_left;
+		new_fill->duplicates.items.objects = new_objects;
+		table->duplicate_capacity += number_left;
+	}
+
+	/* taking out the fill's own object moves the first duplicate up */
+	objects = HASH_TABLE_DUPLICATE_OBJECTS(duplicates);
+	new_fill->object = position != 0 ? fill->object : objects[0];
+	for (i = position != 0 ? 0 : 1; i < duplicates->number_of_duplicates; i++)
+	{
+		if (i + 1 != position)
+			*new_objects++ = objects[i];
+	}
+
+	new_fill->hash = fill->hash;
+	new_fill->duplicates.number_of_duplicates = number_left;
+
+	chained_swap_fill(table, bucket, prev, fill, new_fill);
+
+	return 1;
+}
+
+/* Move every fill of an old bucket into the current array. Any bucket a fill
+* lands in that is still empty needs a bucket struct, so take them all up
+* front (the old bucket itself plus one per extra fill) and the move cannot
+* fail half way.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int chained_move_bucket(hash_table_t * table,
+	hash_table_bucket_t * old_bucket)
+{
+	hash_table_bucket_t * spare_buckets, * new_bucket, ** bucket_slot;
+	hash_table_fill_t * current_fill, * next_fill, * prev, * current;
+	hash_table_key_t key;
+	unsigned long number_of_fills = 1, index;
+
+	spare_buckets = old_bucket;
+	current_fill = old_bucket->first_fill;
+	old_bucket->first_fill = NULL;
+
+	for (next_fill = current_fill->next_fill; next_fill != NULL;
+		next_fill = next_fill->next_fill)
+	{
+		new_bucket = Hash_Table_Node_Alloc(table, &table->bucket_pool);
+		if (new_bucket == NULL)
+		{
+			/* give up, put the old bucket back as it was */
+			while (spare_buckets != old_bucket)
+			{
+				new_bucket = (hash_table_bucket_t *)spare_buckets->first_fill;
+				Hash_Table_Node_Free(table, &table->bucket_pool,
+					spare_buckets);
+				spare_buckets = new_bucket;
+			}
+			old_bucket->first_fill = current_fill;
+			return 0;
+		}
+
+		/* spares are chained through first_fill until used */
+		new_bucket->first_fill = (hash_table_fill_t *)spare_buckets;
+		spare_buckets = new_bucket;
+		number_of_fills++;
+	}
+
+	table->number_of_buckets_filled--;
+	table->number_of_collisions -= number_of_fills - 1;
+
+	while (current_fill != NULL)
+	{
+		next_fill = current_fill->next_fill;
+		index = chained_reduce(table, current_fill->hash,
+			table->number_of_total_buckets);
+		bucket_slot = &table->buckets[index];
+
+		if (*bucket_slot == NULL)
+		{
+			new_bucket = spare_buckets;
+			spare_buckets = (hash_table_bucket_t *)new_bucket->first_fill;
+
+			current_fill->next_fill = NULL;
+			new_bucket->first_fill = current_fill;
+			new_bucket->last_fill = current_fill;
+			*bucket_slot = new_bucket;
+			chained_occupy(table->occupied, index, 1);
+			(table->number_of_buckets_filled)++;
+		}
+		else
+		{
+			if (table->store_keys)
+				Hash_Table_Stored_Key_Get(HASH_TABLE_STORED_KEY(current_fill),
+					&key);
+			chained_position(table, (*bucket_slot)->first_fill,
+				current_fill->object, current_fill->hash, &key, &prev,
+				&current);
+			chained_link(*bucket_slot, current_fill, prev, current);
+			(table->number_of_collisions)++;
+		}
+
+		current_fill = next_fill;
+	}
+
+	/* free whatever spares were not needed */
+	while (spare_buckets != NULL)
+	{
+		new_bucket = (hash_table_bucket_t *)spare_buckets->first_fill;
+		Hash_Table_Node_Free(table, &table->bucket_pool, spare_buckets);
+		spare_buckets = new_bucket;
+	}
+
+	return 1;
+}
+
+/* Inline layout version of chained_move_bucket. The fills' contents are
+* copied into the current array and the old nodes reused wherever a node is
+* needed. Placing n fills can need at most one node more than the n - 1
+* the old bucket frees up, so one is taken up front.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int chained_move_inline_bucket(hash_table_t * table,
+	hash_table_fill_t * old_head)
+{
+	hash_table_fill_t * spare_fills, * node, * next_node, * head, * prev,
+		* current, moving;
+	unsigned long number_of_fills = 0, index;
+
+	spare_fills = Hash_Table_Node_Alloc(table, &table->fill_pool);
+	if (spare_fills == NULL)
+		return 0;
+
+	/* spares are chained through next_fill */
+	spare_fills->next_fill = NULL;
+
+	moving = *old_head;
+	memset(old_head, 0, sizeof(hash_table_fill_t));
+	node = NULL;
+
+	for (;;)
+	{
+		next_node = moving.next_fill;
+		number_of_fills++;
+
+		index = chained_reduce(table, moving.hash,
+			table->number_of_total_buckets);
+		head = &table->inline_fills[index];
+
+		if (head->object == NULL)
+		{
+			*head = moving;
+			head->next_fill = NULL;
+			chained_occupy(table->occupied, index, 1);
+			(table->number_of_buckets_filled)++;
+
+			/* the node we copied from is free for reuse */
+			if (node != NULL)
+			{
+				node->next_fill = spare_fills;
+				spare_fills = node;
+			}
+		}
+		else
+		{
+			chained_position(table, head, moving.object, moving.hash, NULL,
+				&prev, &current);
+
+			if (node == NULL)
+			{
+				node = spare_fills;
+				spare_fills = spare_fills->next_fill;
+			}
+			*node = moving;
+			chained_link_inline(head, node, prev, current);
+			(table->number_of_collisions)++;
+		}
+
+		if (next_node == NULL)
+			break;
+
+		moving = *next_node;
+		node = next_node;
+	}
+
+	table->number_of_buckets_filled--;
+	table->number_of_collisions -= number_of_fills - 1;
+
+	while (spare_fills != NULL)
+	{
+		node = spare_fills->next_fill;
+		Hash_Table_Node_Free(table, &table->fill_pool, spare_fills);
+		spare_fills = node;
+	}
+
+	return 1;
+}
+
+/* Move up to rehash_step old buckets into the current array, freeing the old
+* array once it is empty.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int chained_rehash_step(hash_table_t * table)
+{
+	unsigned long moved = 0, visited = 0;
+	hash_table_bucket_t * bucket;
+	hash_table_fill_t * head;
+
+	while (table->number_of_old_buckets != 0 && moved < table->rehash_step &&
+		visited < table->rehash_step * REHASH_EMPTY_VISITS)
+	{
+		if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+		{
+			head = &table->old_inline_fills[table->rehash_position];
+			if (head->object != NULL)
+			{
+				if (!chained_move_inline_bucket(table, head))
+					return 0;
+
+				chained_occupy(table->old_occupied, table->rehash_position, 0);
+				moved++;
+			}
+		}
+		else
+		{
+			bucket = table->old_buckets[table->rehash_position];
+			if (bucket != NULL)
+			{
+				if (!chained_move_bucket(table, bucket))
+					return 0;
+
+				table->old_buckets[table->rehash_position] = NULL;
+				chained_occupy(table->old_occupied, table->rehash_position, 0);
+				moved++;
+			}
+		}
+		visited++;
+
+		(table->rehash_position)++;
+		if (table->rehash_position == table->number_of_old_buckets)
+		{
+			if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+				Hash_Table_Release(table, table->old_inline_fills,
+					table->number_of_old_buckets, sizeof(hash_table_fill_t));
+			else
+				Hash_Table_Release(table, table->old_buckets,
+					table->number_of_old_buckets, sizeof(hash_table_bucket_t *));
+			Hash_Table_Release(table, table->old_occupied,
+				HASH_TABLE_OCCUPANCY_WORDS(table->number_of_old_buckets),
+				sizeof(uint64_t));
+			table->old_buckets = NULL;
+			table->old_occupied = NULL;
+			table->old_inline_fills = NULL;
+			table->number_of_old_buckets = 0;
+			table->rehash_position = 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Finish any resize that is running, in one go.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int chained_finish_resize(hash_table_t * table)
+{
+	while (table->number_of_old_buckets != 0)
+	{
+		if (!chained_rehash_step(table))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Finish a running resize of a chained table.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Finish_Resize(hash_table_t * table)
+{
+	return chained_finish_resize(table);
+}
+
+/* Swap in an empty array of number_of_buckets, the old one is then drained
+* by chained_rehash_step.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int chained_start_resize(hash_table_t * table,
+	unsigned long number_of_buckets)
+{
+	void * new_buckets;
+	uint64_t * new_occupied;
+
+	assert(table->number_of_old_buckets == 0);
+
+	new_buckets = Hash_Table_Allocate(table, number_of_buckets,
+		chained_element_size(table));
+	if (new_buckets == NULL)
+		return 0;
+
+	new_occupied = Hash_Table_Allocate(table,
+		HASH_TABLE_OCCUPANCY_WORDS(number_of_buckets), sizeof(uint64_t));
+	if (new_occupied == NULL)
+	{
+		Hash_Table_Release(table, new_buckets, number_of_buckets,
+			chained_element_size(table));
+		return 0;
+	}
+
+	table->number_of_old_buckets = table->number_of_total_buckets;
+	table->rehash_position = 0;
+	table->old_occupied = table->occupied;
+	table->occupied = new_occupied;
+
+	if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+	{
+		table->old_inline_fills = table->inline_fills;
+		table->inline_fills = new_buckets;
+	}
+	else
+	{
+		table->old_buckets = table->buckets;
+		table->buckets = new_buckets;
+	}
+	table->number_of_total_buckets = number_of_buckets;
+
+	if (table->max_load_factor > 0)
+		table->grow_threshold = (unsigned long)(number_of_buckets *
+			table->max_load_factor) + 1;
+
+	return 1;
+}
+
+/* Free a collision list along with its duplicates and objects. first is
+* left alone when it is an inline fill (first_is_node 0), only its
+* contents are freed. */
+static void chained_free_fills(hash_table_t * table,
+	hash_table_fill_t * current_fill, int first_is_node)
+{
+	hash_table_fill_t * next_fill;
+	int release_nodes = !table->pooled;
+
+	while (current_fill != NULL)
+	{
+		/* and its duplicates */
+		Hash_Table_Duplicates_Free(table, &current_fill->duplicates);
+
+		next_fill = current_fill->next_fill;
+
+		/* free fill */
+		if (table->free_function != NULL)
+			table->free_function(current_fill->object);
+
+		if (release_nodes && first_is_node)
+			Hash_Table_Node_Free(table, &table->fill_pool, current_fill);
+
+		first_is_node = 1;
+		current_fill = next_fill;
+	}
+}
+
+/* Free every bucket from index first onwards along with its fills,
+* duplicates and objects, then the array. Pooled nodes are left for the
+* pools to release, so with nothing to pass to free_function and no
+* duplicate arrays the walk is skipped entirely. */
+static void chained_free_buckets(hash_table_t * table,
+	hash_table_bucket_t ** buckets, unsigned long first,
+	unsigned long number_of_buckets)
+{
+	unsigned long i;
+	hash_table_bucket_t * current_bucket;
+	int release_nodes = !table->pooled;
+
+	for (i = first; i < number_of_buckets && (release_nodes ||
+		table->free_function != NULL || table->duplicate_capacity != 0); i++)
+	{
+		/* for each bucket,   */
+		current_bucket = buckets[i];
+
+		if (current_bucket != NULL)
+		{
+			/* and then for each fill/collision */
+			chained_free_fills(table, current_bucket->first_fill, 1);
+
+			/* free bucket */
+			if (release_nodes)
+				Hash_Table_Node_Free(table, &table->bucket_pool,
+					current_bucket);
+		}
+	}
+
+	/* free bucket pointers */
+	Hash_Table_Release(table, buckets, number_of_buckets,
+		sizeof(hash_table_bucket_t *));
+}
+
+/* Inline layout version of chained_free_buckets */
+static void chained_free_inline_fills(hash_table_t * table,
+	hash_table_fill_t * inline_fills, unsigned long first,
+	unsigned long number_of_buckets)
+{
+	unsigned long i;
+
+	for (i = first; i < number_of_buckets && (!table->pooled ||
+		table->free_function != NULL || table->duplicate_capacity != 0); i++)
+	{
+		if (inline_fills[i].object != NULL)
+			chained_free_fills(table, &inline_fills[i], 0);
+	}
+
+	Hash_Table_Release(table, inline_fills, number_of_buckets,
+		sizeof(hash_table_fill_t));
+}
+
+/* Take object, one of pattern's, out of the table, or when object is NULL
+* pattern's fill with all of its objects (passed to free_function).
+* Returns the number of objects taken out, -1 if failure (memory
+* allocation, only with lock free readers).
+*/
+static long chained_remove(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object)
+{
+	chained_ref_t ref;
+	hash_table_fill_t * fill, * prev = NULL, taken;
+	long position, number_removed = 1;
+
+	/* Carry on with any resize first, as for an insert */
+	if (table->number_of_old_buckets != 0)
+		chained_rehash_step(table);
+
+	ref = chained_locate(table, hash);
+	for (fill = chained_first(ref); fill != NULL && fill->hash <= hash;
+		fill = fill->next_fill)
+	{
+		if (fill->hash == hash &&
+			HASH_TABLE_SEARCH_FILL(table, pattern, fill))
+			break;
+		prev = fill;
+	}
+
+	if (fill == NULL || fill->hash != hash)
+		return 0;
+
+	if (object != NULL)
+	{
+		position = Hash_Table_Duplicates_Find(fill->object, &fill->duplicates,
+			object);
+		if (position < 0)
+			return 0;
+
+		/* the fill stays for the objects left */
+		if (fill->duplicates.number_of_duplicates != 0)
+		{
+			if (table->retire_function == NULL)
+			{
+				Hash_Table_Duplicates_Take(table, &fill->object,
+					&fill->duplicates, (uint32_t)position);
+				return 1;
+			}
+
+			if (!chained_replace_fill_without(table, *ref.bucket_slot, prev,
+				fill, (uint32_t)position))
+				return -1;
+
+			table->number_of_duplicates--;
+			return 1;
+		}
+	}
+	else
+		number_removed += fill->duplicates.number_of_duplicates;
+
+	table->number_of_duplicates -= fill->duplicates.number_of_duplicates;
+	chained_unlink_fill(table, ref, prev, fill, &taken);
+
+	if (object == NULL)
+		chained_free_objects(table, &taken);
+	duplicates_release(table, &taken.duplicates);
+
+	return number_removed;
+}
+
+/* One CLOCK sweep of the old bucket array (the part not yet rehashed) or
+* the current one for a fill to evict, skipping fills of skip_hash. Set
+* reference bits are cleared on the way, so two turns round are enough.
+* Returns the number of objects evicted, 0 if nothing could be.
+*/
+static unsigned long chained_clock_sweep(hash_table_t * table, int old,
+	uint64_t skip_hash)
+{
+	chained_ref_t ref;
+	hash_table_fill_t * fill, * prev, taken;
+	unsigned long first = 0, number_of_buckets, visits, number_evicted;
+
+	number_of_buckets = table->number_of_total_buckets;
+	if (old)
+	{
+		first = table->rehash_position;
+		number_of_buckets = table->number_of_old_buckets;
+	}
+
+	if (table->clock_hand < first || table->clock_hand >= number_of_buckets)
+		table->clock_hand = first;
+
+	ref.bucket_slot = NULL;
+	ref.head = NULL;
+
+	ref.occupied = old ? table->old_occupied : table->occupied;
+
+	for (visits = 0; visits < 2 * (number_of_buckets - first); visits++)
+	{
+		ref.index = table->clock_hand;
+		if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+			ref.head = old ? &table->old_inline_fills[table->clock_hand] :
+				&table->inline_fills[table->clock_hand];
+		else
+			ref.bucket_slot = old ? &table->old_buckets[table->clock_hand] :
+				&table->buckets[table->clock_hand];
+
+		prev = NULL;
+		for (fill = chained_first(ref); fill != NULL; fill = fill->next_fill)
+		{
+			if (fill->hash != skip_hash)
+			{
+				if (!fill->referenced)
+				{
+					/* the hand stays, the rest of the bucket is next */
+					number_evicted = fill->duplicates.number_of_duplicates + 1;
+					table->number_of_duplicates -=
+						fill->duplicates.number_of_duplicates;
+
+					chained_unlink_fill(table, ref, prev, fill, &taken);
+					chained_free_objects(table, &taken);
+					duplicates_release(table, &taken.duplicates);
+					return number_evicted;
+				}
+
+				fill->referenced = 0;
+			}
+			prev = fill;
+		}
+
+		(table->clock_hand)++;
+		if (table->clock_hand == number_of_buckets)
+			table->clock_hand = first;
+	}
+
+	return 0;
+}
+
+/* Evict one key from a chained table, see chained_clock_sweep. Keys not
+* yet rehashed go first; once there are none left to take the resize is
+* finished so the sweep does not keep walking the empty old array.
+*/
+static unsigned long chained_evict(hash_table_t * table, uint64_t skip_hash)
+{
+	unsigned long number_evicted;
+
+	if (table->number_of_old_buckets != 0)
+	{
+		number_evicted = chained_clock_sweep(table, 1, skip_hash);
+		if (number_evicted != 0)
+			return number_evicted;
+
+		chained_finish_resize(table);
+	}
+
+	return chained_clock_sweep(table, 0, skip_hash);
+}
+
+/* Has the table gone over max_entries or max_bytes */
+static int cache_over(hash_table_t * table)
+{
+	unsigned long entries, bytes;
+
+	entries = table->number_of_buckets_filled + table->number_of_duplicates;
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		bytes = Hash_Table_Flat_Size(table);
+	else
+	{
+		entries += table->number_of_collisions;
+		bytes = chained_used_size(table);
+	}
+
+	return (table->max_entries != 0 && entries > table->max_entries) ||
+		(table->max_bytes != 0 && bytes > table->max_bytes);
+}
+
+/* Evict until the table is back within its limits, leaving the key of
+* skip_hash (just inserted) alone */
+static void cache_trim(hash_table_t * table, uint64_t skip_hash)
+{
+	unsigned long number_evicted;
+
+	while (cache_over(table))
+	{
+		if (table->storage == HASH_TABLE_STORAGE_FLAT)
+			number_evicted = Hash_Table_Flat_Evict(table, skip_hash);
+		else
+			number_evicted = chained_evict(table, skip_hash);
+
+		if (number_evicted == 0)
+			return; /* only the new key is left */
+
+		table->number_of_evictions += number_evicted;
+	}
+}
+
+/*
+* Insert a new object into the hash table. Pattern should be a string that
+* will be hashed for key
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Insert(hash_table_t * table, void * object, char * pattern)
+{
+	hash_table_key_t key;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+
+	HASH_TABLE_INSERT_KEY(table, pattern, &key);
+
+	/* Hash pattern */
+	/* printf("Hashing: %s\n", pattern); */
+
+	return Hash_Table_Insert_Hashed(table, object,
+		HASH_TABLE_HASH(table, pattern));
+}
+
+/* Grow a chained table once a new fill has taken it past the load
+* factor */
+static void chained_grow_check(hash_table_t * table)
+{
+	/* A cache only grows while the bigger array still fits in
+	* max_bytes. */
+	if (table->grow_threshold != 0 && table->number_of_buckets_filled +
+		table->number_of_collisions > table->grow_threshold &&
+		table->number_of_total_buckets <= ULONG_MAX / 2 &&
+		(table->max_bytes == 0 || chained_used_size(table) +
+		table->number_of_total_buckets * 2 * chained_element_size(table) <=
+		table->max_bytes))
+	{
+		if (chained_finish_resize(table))
+			chained_start_resize(table, table->number_of_total_buckets * 2);
+	}
+}
+
+/* Key of object, to be inserted into a table storing keys:
+* key_function's (held in *key_holder), otherwise the insert's pattern.
+* Returns NULL if the insert came without one. */
+static hash_table_key_t * chained_insert_key(hash_table_t * table,
+	void * object, hash_table_key_t * key_holder)
+{
+	if (table->key_function == NULL)
+		return table->insert_key;
+
+	table->key_function(object, key_holder);
+	return key_holder;
+}
+
+/* Chained engine part of Hash_Table_Insert_Hashed */
+static int chained_insert(hash_table_t * table, void * object, uint64_t hash)
+{
+	int compareVal;
+	chained_ref_t ref;
+	hash_table_fill_t * first_fill, *current_bucket_fill = NULL,
+		*prev_bucket_fill = NULL;
+	hash_table_key_t key_holder, * key = NULL;
+
+	if (table->store_keys)
+	{
+		key = chained_insert_key(table, object, &key_holder);
+		if (key == NULL)
+			return 0;
+	}
+
+	/* Carry on with any resize first so the bucket we pick stays put.
+	* Running out of memory here only delays the resize. */
+	if (table->number_of_old_buckets != 0)
+		chained_rehash_step(table);
+
+	/* Now insert into table: go to hashed index, if there is already a record
+	* test if collision and/or duplicate */
+
+	ref = chained_locate(table, hash);
+	first_fill = chained_first(ref);
+
+	if (first_fill != NULL)
+	{
+
+		/* Collision found - go through each one and see if any duplicates */
+
+		compareVal = chained_position(table, first_fill, object, hash, key,
+			&prev_bucket_fill, &current_bucket_fill);
+
+		if (current_bucket_fill != NULL && compareVal == 0)
+		{
+			/* duplicate - add to the key's duplicates. With lock free readers
+			* a full array cannot be grown under them. */
+			if (table->retire_function != NULL &&
+				(current_bucket_fill->duplicates.capacity == 0 ?
+				current_bucket_fill->duplicates.number_of_duplicates ==
+				HASH_TABLE_INLINE_DUPLICATES :
+				current_bucket_fill->duplicates.number_of_duplicates ==
+				current_bucket_fill->duplicates.capacity))
+			{
+				if (!chained_replace_fill(table, *ref.bucket_slot,
+					prev_bucket_fill, current_bucket_fill, object))
+					return 0;
+			}
+			else if (!Hash_Table_Duplicate_Append(table,
+				&current_bucket_fill->duplicates, object))
+				return 0;
+
+			(table->number_of_duplicates)++;
+			return 1;
+		}
+	}
+
+	if (!chained_add_fill(table, ref, prev_bucket_fill, current_bucket_fill,
+		object, hash, key))
+		return 0;
+
+	chained_grow_check(table);
+	return 1;
+}
+
+/* Chained engine part of Hash_Table_Find_Or_Insert_Hashed */
+static void * chained_find_or_insert(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object, void *(*create_function)(void * context),
+	void * context, int * result)
+{
+	int compareVal = 1;
+	unsigned long searches_skipped = 0;
+	chained_ref_t ref;
+	hash_table_fill_t * first_fill, *current_bucket_fill = NULL,
+		*prev_bucket_fill = NULL, *same_hash_prev, *fill;
+	hash_table_key_t key_holder, * key = (hash_table_key_t *)pattern;
+
+	if (table->store_keys && object != NULL)
+	{
+		key = chained_insert_key(table, object, &key_holder);
+		if (key == NULL)
+		{
+			*result = -1;
+			return NULL;
+		}
+	}
+
+	if (table->number_of_old_buckets != 0)
+		chained_rehash_step(table);
+
+	ref = chained_locate(table, hash);
+	first_fill = chained_first(ref);
+
+	if (object != NULL)
+	{
+		if (first_fill != NULL)
+			compareVal = chained_position(table, first_fill, object, hash,
+				key, &prev_bucket_fill, &current_bucket_fill);
+		fill = current_bucket_fill != NULL && compareVal == 0 ?
+			current_bucket_fill : NULL;
+	}
+	else
+	{
+		/* Fills are ordered by hash: pass the lower ones, then only those
+		* with the same hash can be the pattern's */
+		current_bucket_fill = first_fill;
+		while (current_bucket_fill != NULL && current_bucket_fill->hash < hash)
+		{
+			searches_skipped++;
+			prev_bucket_fill = current_bucket_fill;
+			current_bucket_fill = current_bucket_fill->next_fill;
+		}
+
+		for (fill = current_bucket_fill;
+			fill != NULL && fill->hash == hash; fill = fill->next_fill)
+		{
+			if (HASH_TABLE_SEARCH_FILL(table, pattern, fill))
+				break;
+		}
+		if (fill != NULL && fill->hash != hash)
+			fill = NULL;
+		table->number_of_searches_skipped += searches_skipped;
+	}
+
+	if (fill != NULL)
+	{
+		/* already exists */
+		if (table->max_entries + table->max_bytes != 0 &&
+			!table->shared_lookups && !fill->referenced)
+			fill->referenced = 1;
+
+		*result = 0;
+		return fill->object;
+	}
+
+	if (object == NULL)
+	{
+		object = create_function(context);
+		if (object == NULL)
+		{
+			*result = -1;
+			return NULL;
+		}
+
+		/* other keys with the same full hash, the new fill goes among them
+		* in compare_function order */
+		if (current_bucket_fill != NULL && current_bucket_fill->hash == hash)
+		{
+			chained_position(table, current_bucket_fill, object, hash, key,
+				&same_hash_prev, &current_bucket_fill);
+			if (same_hash_prev != NULL)
+				prev_bucket_fill = same_hash_prev;
+		}
+	}
+
+	if (!chained_add_fill(table, ref, prev_bucket_fill, current_bucket_fill,
+		object, hash, key))
+	{
+		/* an object made for the table goes back through free_function */
+		if (create_function != NULL && table->free_function != NULL)
+			table->free_function(object);
+
+		*result = -1;
+		return NULL;
+	}
+
+	chained_grow_check(table);
+
+	*result = 1;
+	return object;
+}
+
+/* Hash_Table_Insert for object whose pattern hashes to hash */
+int Hash_Table_Insert_Hashed(hash_table_t * table, void * object,
+	uint64_t hash)
+{
+	int result;
+
+	assert(table != NULL);
+	assert(object != NULL);
+
+	if (!HASH_TABLE_INDEX_EVENT(table, HASH_TABLE_INDEX_RESERVE, NULL))
+	{
+		table->insert_key = NULL;
+		return 0;
+	}
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		result = Hash_Table_Flat_Insert(table, object, hash);
+	else
+		result = chained_insert(table, object, hash);
+
+	(void)HASH_TABLE_INDEX_EVENT(table, result ? HASH_TABLE_INDEX_ADD :
+		HASH_TABLE_INDEX_CANCEL, object);
+	table->insert_key = NULL;
+
+	if (result && (table->max_entries != 0 || table->max_bytes != 0))
+		cache_trim(table, hash);
+
+	return result;
+}
+
+/* Look the key up and insert it if it is missing, in one probe. The key is
+* object's (matched with compare_function) when object is not NULL,
+* otherwise pattern's (matched with search_function), and a missing key
+* then gets the object create_function(context) returns.
+* Returns the object found or inserted, NULL if failure (memory allocation
+* or create_function returned NULL). result is 1 if inserted, 0 already
+* there, -1 if failure.
+*/
+void * Hash_Table_Find_Or_Insert_Hashed(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object, void *(*create_function)(void * context),
+	void * context, int * result)
+{
+	void * found;
+
+	assert(table != NULL);
+	assert(object != NULL || (pattern != NULL && create_function != NULL));
+	assert(result != NULL);
+
+	if (!HASH_TABLE_INDEX_EVENT(table, HASH_TABLE_INDEX_RESERVE, NULL))
+	{
+		table->insert_key = NULL;
+		*result = -1;
+		return NULL;
+	}
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		found = Hash_Table_Flat_Find_Or_Insert(table, pattern, hash, object,
+			create_function, context, result);
+	else
+		found = chained_find_or_insert(table, pattern, hash, object,
+			create_function, context, result);
+
+	(void)HASH_TABLE_INDEX_EVENT(table, *result == 1 ? HASH_TABLE_INDEX_ADD :
+		HASH_TABLE_INDEX_CANCEL, found);
+	table->insert_key = NULL;
+
+	if (*result == 1 && (table->max_entries != 0 || table->max_bytes != 0))
+		cache_trim(table, hash);
+
+	/* it was a lookup too */
+	if (!table->shared_lookups && *result >= 0)
+	{
+		if (*result == 0)
+			(table->number_of_hits)++;
+		else
+			(table->number_of_misses)++;
+	}
+
+	return found;
+}
+
+/* 
+* Insert a new object into the hash table only if it has no duplicates 
+	(given pattern).
+* Pattern should be a string that will be hashed for key 
+	(and be unique for each object).
+* Return 1 if successful, 0 already exists, -1 if failure (memory allocation).
+* If 0 is returned, found_duplicate we become a pointer to the first duplicate 
+*/
+int Hash_Table_Insert_No_Duplicate(hash_table_t * table, void * object,
+	char * pattern, void ** found_duplicate)
+{
+	hash_table_key_t key;
+	void * object_temp;
+	int result;
+	
+	assert(table != NULL);
+	assert(object != NULL);
+	assert(pattern != NULL);
+
+	HASH_TABLE_INSERT_KEY(table, pattern, &key);
+
+	/* one hash and one walk: the check and the insert are the same probe */
+	object_temp = Hash_Table_Find_Or_Insert_Hashed(table, NULL,
+		HASH_TABLE_HASH(table, pattern), object, NULL, NULL, &result);
+
+	if (result == 0)
+	{
+		/* already exists */
+		*found_duplicate = object_temp;
+	}
+
+	return result;
+}
+
+/* Return the object stored under pattern, and when there is none insert the
+* one create_function(context) makes, so it is only built for a new key.
+* create_function must not use the table. inserted (if not NULL) is set to 1
+* when the object is new, 0 when it was already there.
+* Returns NULL if failure (memory allocation, or create_function returned
+* NULL). An object made for a failed insert is passed to free_function.
+*/
+void * Hash_Table_Find_Or_Insert(hash_table_t * table, char * pattern,
+	void *(*create_function)(void * context), void * context, int * inserted)
+{
+	hash_table_key_t key;
+	void * object;
+	int result;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+	assert(create_function != NULL);
+
+	object = Hash_Table_Find_Or_Insert_Hashed(table,
+		HASH_TABLE_PATTERN(table, pattern, &key),
+		HASH_TABLE_HASH(table, pattern), NULL, create_function, context,
+		&result);
+
+	if (inserted != NULL)
+		*inserted = result == 1;
+
+	return object;
+}
+
+/* Take object, one of the objects stored under pattern, out of the table.
+* Ownership goes back to the caller, free_function is not called.
+* Returns 1 if it was removed, 0 if it was not in the table, -1 if failure
+* (memory allocation, only with retire_function set).
+*/
+int Hash_Table_Remove(hash_table_t * table, char * pattern, void * object)
+{
+	hash_table_key_t key;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+	assert(object != NULL);
+
+	return Hash_Table_Remove_Hashed(table,
+		HASH_TABLE_PATTERN(table, pattern, &key),
+		HASH_TABLE_HASH(table, pattern), object);
+}
+
+/* Hash_Table_Remove for pattern, which hashes to hash */
+int Hash_Table_Remove_Hashed(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object)
+{
+	int result;
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		result = (int)Hash_Table_Flat_Remove(table, pattern, hash, object);
+	else
+		result = (int)chained_remove(table, pattern, hash, object);
+
+	if (result == 1)
+		(void)HASH_TABLE_INDEX_EVENT(table, HASH_TABLE_INDEX_DROP, object);
+
+	return result;
+}
+
+/* Take pattern and all its duplicates out of the table, passing each
+* object to free_function.
+* Returns the number of objects removed, 0 if pattern was not found.
+*/
+unsigned long Hash_Table_Remove_Key(hash_table_t * table, char * pattern)
+{
+	hash_table_key_t key;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+
+	return Hash_Table_Remove_Key_Hashed(table,
+		HASH_TABLE_PATTERN(table, pattern, &key),
+		HASH_TABLE_HASH(table, pattern));
+}
+
+/* Hash_Table_Remove_Key for pattern, which hashes to hash */
+unsigned long Hash_Table_Remove_Key_Hashed(hash_table_t * table,
+	char * pattern, uint64_t hash)
+{
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		return Hash_Table_Flat_Remove(table, pattern, hash, NULL);
+
+	/* taking a whole fill out needs no memory, so cannot fail */
+	return (unsigned long)chained_remove(table, pattern, hash, NULL);
+}
+
+/* Free table and contained objects */
+void Hash_Table_Free(hash_table_t * table)
+{
+	/* the index goes first, so it is not told of each object */
+	(void)HASH_TABLE_INDEX_EVENT(table, HASH_TABLE_INDEX_FREE, NULL);
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		Hash_Table_Flat_Free(table);
+	else
+	{
+		if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+		{
+			if (table->number_of_old_buckets != 0)
+				chained_free_inline_fills(table, table->old_inline_fills,
+					table->rehash_position, table->number_of_old_buckets);
+
+			chained_free_inline_fills(table, table->inline_fills, 0,
+				table->number_of_total_buckets);
+		}
+		else
+		{
+			if (table->number_of_old_buckets != 0)
+				chained_free_buckets(table, table->old_buckets,
+					table->rehash_position, table->number_of_old_buckets);
+
+			chained_free_buckets(table, table->buckets, 0,
+				table->number_of_total_buckets);
+		}
+
+		Hash_Table_Release(table, table->old_occupied,
+			HASH_TABLE_OCCUPANCY_WORDS(table->number_of_old_buckets),
+			sizeof(uint64_t));
+		Hash_Table_Release(table, table->occupied,
+			HASH_TABLE_OCCUPANCY_WORDS(table->number_of_total_buckets),
+			sizeof(uint64_t));
+	}
+
+	/* free node slabs, stored keys and the table */
+	pool_release(table, &table->bucket_pool);
+	pool_release(table, &table->fill_pool);
+	Hash_Table_Key_Arena_Free(table);
+
+	table->allocator.release(table, sizeof(hash_table_t),
+		table->allocator.context);
+
+}
+
+/* Copy object and the duplicates left in cursor into records, at most
+* max_num_records in all. Returns the number copied. */
+static unsigned long cursor_copy(hash_table_cursor_t * cursor, void * object,
+	void ** records, unsigned long max_num_records)
+{
+	unsigned long number_of_duplicates;
+
+	records[0] = object;
+
+	number_of_duplicates = cursor->number_remaining;
+	if (number_of_duplicates > max_num_records - 1)
+		number_of_duplicates = max_num_records - 1;
+
+	memcpy(records + 1, cursor->next_duplicate,
+		number_of_duplicates * sizeof(void *));
+
+	return number_of_duplicates + 1;
+}
+
+/* Find an object in the table given pattern string, will hash key
+* and then return array of pointers to matches (duplicates).
+* number_of_objects_found will get changed to number found.
+* Returns NULL if nothing found (or there was an error).
+*/
+void ** Hash_Table_Match(hash_table_t * table, char * pattern,
+	unsigned long * number_of_objects_found, unsigned long max_num_records)
+{
+	hash_table_cursor_t cursor;
+	void * object, ** found_records;
+
+	*number_of_objects_found = 0;
+
+	assert(max_num_records > 0);
+
+	object = Hash_Table_Match_Cursor(table, pattern, &cursor);
+	if (object == NULL)
+		return NULL;
+
+	/* Found match, add it and duplicates to return array */
+	found_records = calloc(max_num_records, sizeof(void *));
+	if (found_records == NULL)
+	{
+		printf("Error allocating memory for search.\n");
+		return NULL;
+	}
+
+	*number_of_objects_found = cursor_copy(&cursor, object, found_records,
+		max_num_records);
+
+	return found_records;
+}
+
+/* Find an object in the table given pattern string and copy it and its
+* duplicates into records, at most max_num_records of them.
+* Returns the number copied, 0 if nothing found.
+*/
+unsigned long Hash_Table_Match_Into(hash_table_t * table, char * pattern,
+	void ** records, unsigned long max_num_records)
+{
+	hash_table_cursor_t cursor;
+	void * object;
+
+	assert(records != NULL || max_num_records == 0);
+
+	if (max_num_records == 0)
+		return 0;
+
+	object = Hash_Table_Match_Cursor(table, pattern, &cursor);
+	if (object == NULL)
+		return 0;
+
+	return cursor_copy(&cursor, object, records, max_num_records);
+}
+
+/* Find the first object in the table given pattern string and set cursor
+* up to walk its duplicates with Hash_Table_Cursor_Next.
+* Returns NULL if nothing found.
+*/
+void * Hash_Table_Match_Cursor(hash_table_t * table, char * pattern,
+	hash_table_cursor_t * cursor)
+{
+	hash_table_key_t key;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+
+	/* Hash key here */
+	return Hash_Table_Match_Cursor_Hashed(table,
+		HASH_TABLE_PATTERN(table, pattern, &key),
+		HASH_TABLE_HASH(table, pattern), cursor);
+}
+
+/* The step of a running resize each lookup carries on with, none when
+* lookups are shared */
+static void lookup_rehash_step(hash_table_t * table)
+{
+	if (table->shared_lookups || table->number_of_old_buckets == 0)
+		return;
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		Hash_Table_Flat_Rehash_Step(table);
+	else
+		chained_rehash_step(table);
+}
+
+/* Look pattern (hashing to hash) up without rehashing, see
+* Hash_Table_Match_Cursor */
+static void * lookup_find(hash_table_t * table, char * pattern,
+	uint64_t hash, hash_table_cursor_t * cursor)
+{
+	unsigned long searches_skipped = 0;
+	hash_table_fill_t * current_fill;
+	void * current_object;
+
+	cursor->next_duplicate = NULL;
+	cursor->number_remaining = 0;
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+	{
+		current_object = Hash_Table_Flat_Find(table, pattern, hash, cursor);
+		if (!table->shared_lookups)
+		{
+			if (current_object != NULL)
+				(table->number_of_hits)++;
+			else
+				(table->number_of_misses)++;
+		}
+		return current_object;
+	}
+
+	/* Lookup table. Found possible match - check fills/collisions. Only
+	* fills with the same full hash can match, and as they are ordered by
+	* hash we can stop once we pass it */
+	current_fill = chained_first(chained_locate(table, hash));
+
+	while (current_fill != NULL && current_fill->hash <= hash)
+	{
+		HASH_TABLE_COUNT(table, probes);
+		if (current_fill->hash == hash &&
+			HASH_TABLE_SEARCH_FILL(table, pattern, current_fill))
+		{
+			if (!table->shared_lookups)
+			{
+				table->number_of_searches_skipped += searches_skipped;
+				(table->number_of_hits)++;
+
+				/* only written when it changes, a hit on a hot key then
+				* leaves its line clean */
+				if (table->max_entries + table->max_bytes != 0 &&
+					!current_fill->referenced)
+					current_fill->referenced = 1;
+			}
+
+			Hash_Table_Cursor_Set(cursor, &current_fill->duplicates);
+			return current_fill->object;
+		}
+		else
+		{
+			/* Does not match current , go through collisions*/
+			if (current_fill->hash != hash)
+				searches_skipped++;
+			current_fill = HASH_TABLE_READ(current_fill->next_fill);
+		}
+	}
+
+	if (current_fill != NULL)
+		searches_skipped++; /* the fill we stopped at */
+	if (!table->shared_lookups)
+	{
+		table->number_of_searches_skipped += searches_skipped;
+		(table->number_of_misses)++;
+	}
+
+	/* never found any match */
+	return NULL;
+}
+
+/* Hash_Table_Match_Cursor for pattern, which hashes to hash */
+void * Hash_Table_Match_Cursor_Hashed(hash_table_t * table, char * pattern,
+	uint64_t hash, hash_table_cursor_t * cursor)
+{
+	assert(table != NULL);
+	assert(pattern != NULL);
+	assert(cursor != NULL);
+
+	lookup_rehash_step(table);
+
+	return lookup_find(table, pattern, hash, cursor);
+}
+
+/* Returns the next duplicate of the object found by Hash_Table_Match_Cursor,
+* NULL once there are no more.
+*/
+void * Hash_Table_Cursor_Next(hash_table_cursor_t * cursor)
+{
+	void * object;
+
+	assert(cursor != NULL);
+
+	if (cursor->number_remaining == 0)
+		return NULL;
+
+	object = *cursor->next_duplicate++;
+	cursor->number_remaining--;
+	return object;
+}
+
+/* Find the first object in the table given pattern string.
+* Returns NULL if nothing found.
+*/
+void * Hash_Table_First_Match(hash_table_t * table, char * pattern)
+{
+	hash_table_cursor_t cursor;
+
+	return Hash_Table_Match_Cursor(table, pattern, &cursor);
+}
+
+/* Keyed tables: the entry points above, taking the key as length bytes */
+
+int Hash_Table_Insert_Bytes(hash_table_t * table, void * object,
+	const void * key, size_t length)
+{
+	assert(table != NULL);
+	assert(table->key_function != NULL);
+
+	return Hash_Table_Insert_Hashed(table, object,
+		table->key_hash_function(key, length));
+}
+
+int Hash_Table_Insert_No_Duplicate_Bytes(hash_table_t * table, void * object,
+	const void * key, size_t length, void ** found_duplicate)
+{
+	void * object_temp;
+	int result;
+
+	assert(table != NULL);
+	assert(table->key_function != NULL);
+	assert(object != NULL);
+
+	object_temp = Hash_Table_Find_Or_Insert_Hashed(table, NULL,
+		table->key_hash_function(key, length), object, NULL, NULL, &result);
+
+	if (result == 0)
+	{
+		/* already exists */
+		*found_duplicate = object_temp;
+	}
+
+	return result;
+}
+
+void * Hash_Table_Find_Or_Insert_Bytes(hash_table_t * table, const void * key,
+	size_t length, void *(*create_function)(void * context), void * context,
+	int * inserted)
+{
+	hash_table_key_t pattern;
+	void * object;
+	int result;
+
+	assert(table != NULL);
+	assert(table->key_function != NULL);
+	assert(create_function != NULL);
+
+	pattern.key = key;
+	pattern.length = length;
+
+	object = Hash_Table_Find_Or_Insert_Hashed(table, (char *)&pattern,
+		table->key_hash_function(key, length), NULL, create_function,
+		context, &result);
+
+	if (inserted != NULL)
+		*inserted = result == 1;
+
+	return object;
+}
+
+void * Hash_Table_Match_Cursor_Bytes(hash_table_t * table, const void * key,
+	size_t length, hash_table_cursor_t * cursor)
+{
+	hash_table_key_t pattern;
+
+	assert(table != NULL);
+	assert(table->key_function != NULL);
+
+	pattern.key = key;
+	pattern.length = length;
+
+	return Hash_Table_Match_Cursor_Hashed(table, (char *)&pattern,
+		table->key_hash_function(key, length), cursor);
+}
+
+void * Hash_Table_First_Match_Bytes(hash_table_t * table, const void * key,
+	size_t length)
+{
+	hash_table_cursor_t cursor;
+
+	return Hash_Table_Match_Cursor_Bytes(table, key, length, &cursor);
+}
+
+unsigned long Hash_Table_Match_Into_Bytes(hash_table_t * table,
+	const void * key, size_t length, void ** records,
+	unsigned long max_num_records)
+{
+	hash_table_cursor_t cursor;
+	void * object;
+
+	assert(records != NULL || max_num_records == 0);
+
+	if (max_num_records == 0)
+		return 0;
+
+	object = Hash_Table_Match_Cursor_Bytes(table, key, length, &cursor);
+	if (object == NULL)
+		return 0;
+
+	return cursor_copy(&cursor, object, records, max_num_records);
+}
+
+int Hash_Table_Remove_Bytes(hash_table_t * table, const void * key,
+	size_t length, void * object)
+{
+	hash_table_key_t pattern;
+
+	assert(table != NULL);
+	assert(table->key_function != NULL);
+	assert(object != NULL);
+
+	pattern.key = key;
+	pattern.length = length;
+
+	return Hash_Table_Remove_Hashed(table, (char *)&pattern,
+		table->key_hash_function(key, length), object);
+}
+
+unsigned long Hash_Table_Remove_Key_Bytes(hash_table_t * table,
+	const void * key, size_t length)
+{
+	hash_table_key_t pattern;
+
+	assert(table != NULL);
+	assert(table->key_function != NULL);
+
+	pattern.key = key;
+	pattern.length = length;
+
+	return Hash_Table_Remove_Key_Hashed(table, (char *)&pattern,
+		table->key_hash_function(key, length));
+}
+
+/* Hash the count (at most BATCH_WINDOW) patterns into hashes and prefetch
+* what resolving each of them will load first. For chained buckets behind
+* pointers that is three dependent loads, which are staged across the whole
+* window so their latencies overlap: the bucket slots, then the buckets,
+* then the first fills. */
+static void batch_prefetch(hash_table_t * table, char ** patterns,
+	unsigned long count, uint64_t * hashes)
+{
+	chained_ref_t refs[BATCH_WINDOW];
+	hash_table_bucket_t * bucket;
+	unsigned long i;
+
+	for (i = 0; i < count; i++)
+		hashes[i] = HASH_TABLE_HASH(table, patterns[i]);
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+	{
+		for (i = 0; i < count; i++)
+		{
+			HASH_TABLE_PREFETCH(&table->controls[(unsigned long)(hashes[i] &
+				(table->number_of_total_buckets - 1))]);
+			HASH_TABLE_PREFETCH(&table->slots[(unsigned long)(hashes[i] &
+				(table->number_of_total_buckets - 1))]);
+		}
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		refs[i] = chained_locate(table, hashes[i]);
+		if (refs[i].head != NULL)
+			HASH_TABLE_PREFETCH(refs[i].head);
+		else
+			HASH_TABLE_PREFETCH(refs[i].bucket_slot);
+	}
+
+	if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+		return;
+
+	for (i = 0; i < count; i++)
+	{
+		bucket = *refs[i].bucket_slot;
+		if (bucket != NULL)
+			HASH_TABLE_PREFETCH(bucket);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		bucket = *refs[i].bucket_slot;
+		if (bucket != NULL && bucket->first_fill != NULL)
+			HASH_TABLE_PREFETCH(bucket->first_fill);
+	}
+}
+
+/* Insert count objects, objects[i] under patterns[i], in order. Patterns
+* are hashed and their buckets prefetched a window at a time, so the loads
+* of a batch overlap instead of each insert waiting on its own.
+* Returns the number inserted: count if successful, fewer if it stopped at
+* a failure (memory allocation).
+*/
+unsigned long Hash_Table_Insert_Batch(hash_table_t * table, void ** objects,
+	char ** patterns, unsigned long count)
+{
+	uint64_t hashes[BATCH_WINDOW];
+	hash_table_key_t key;
+	unsigned long done, window, i;
+
+	assert(table != NULL);
+	assert(count == 0 || (objects != NULL && patterns != NULL));
+
+	for (done = 0; done < count; done += window)
+	{
+		window = count - done < BATCH_WINDOW ? count - done : BATCH_WINDOW;
+
+		batch_prefetch(table, patterns + done, window, hashes);
+
+		for (i = 0; i < window; i++)
+		{
+			HASH_TABLE_INSERT_KEY(table, patterns[done + i], &key);
+			if (!Hash_Table_Insert_Hashed(table, objects[done + i], hashes[i]))
+				return done + i;
+		}
+	}
+
+	return count;
+}
+
+/* Look up count patterns together, prefetching like Hash_Table_Insert_Batch.
+* results[i] gets the first match of patterns[i], NULL if none. When cursors
+* is not NULL cursors[i] is set up for its duplicates; the rehash steps of
+* the batch are all taken before any lookup so these stay valid until the
+* table is next used. Does not allocate.
+* Returns the number of patterns found.
+*/
+unsigned long Hash_Table_Match_Batch(hash_table_t * table, char ** patterns,
+	unsigned long count, void ** results, hash_table_cursor_t * cursors)
+{
+	uint64_t hashes[BATCH_WINDOW];
+	hash_table_cursor_t cursor;
+	hash_table_key_t key;
+	unsigned long done, window, i, number_found = 0;
+
+	assert(table != NULL);
+	assert(count == 0 || (patterns != NULL && results != NULL));
+
+	/* the same resize work count separate lookups would do */
+	for (i = 0; i < count && table->number_of_old_buckets != 0; i++)
+		lookup_rehash_step(table);
+
+	for (done = 0; done < count; done += window)
+	{
+		window = count - done < BATCH_WINDOW ? count - done : BATCH_WINDOW;
+
+		batch_prefetch(table, patterns + done, window, hashes);
+
+		for (i = 0; i < window; i++)
+		{
+			results[done + i] = lookup_find(table,
+				HASH_TABLE_PATTERN(table, patterns[done + i], &key), hashes[i],
+				cursors != NULL ? &cursors[done + i] : &cursor);
+			if (results[done + i] != NULL)
+				number_found++;
+		}
+	}
+
+	return number_found;
+}
+
+/* Answer lookup with fill (NULL if there is no match), counted as
+* lookup_find counts */
+static int lookup_finish(hash_table_lookup_t * lookup,
+	hash_table_fill_t * fill)
+{
+	hash_table_t * table = lookup->table;
+
+	lookup->state = HASH_TABLE_LOOKUP_DONE;
+	lookup->object = NULL;
+	if (fill != NULL)
+	{
+		lookup->object = fill->object;
+		Hash_Table_Cursor_Set(&lookup->cursor, &fill->duplicates);
+	}
+
+	if (!table->shared_lookups)
+	{
+		table->number_of_searches_skipped += lookup->searches_skipped;
+		if (fill == NULL)
+			(table->number_of_misses)++;
+		else
+		{
+			(table->number_of_hits)++;
+			if (table->max_entries + table->max_bytes != 0 && !fill->referenced)
+				fill->referenced = 1;
+		}
+	}
+
+	return 1;
+}
+
+/* Go on to fill, next in the chain, for the next step */
+static int lookup_next(hash_table_lookup_t * lookup, hash_table_fill_t * fill)
+{
+	if (fill == NULL)
+		return lookup_finish(lookup, NULL);
+
+	HASH_TABLE_PREFETCH(fill);
+	lookup->fill = fill;
+	lookup->state = HASH_TABLE_LOOKUP_FILL;
+	return 0;
+}
+
+/* Look at lookup->fill, which is loaded by now. Fills are ordered by hash:
+* lower ones are passed, a higher one ends the lookup, and only a fill with
+* the hash needs its object (or stored key) matched. */
+static int lookup_fill(hash_table_lookup_t * lookup)
+{
+	hash_table_t * table = lookup->table;
+	hash_table_fill_t * fill = lookup->fill;
+
+	HASH_TABLE_COUNT(table, probes);
+	if (fill->hash != lookup->hash)
+	{
+		(lookup->searches_skipped)++;
+		if (fill->hash > lookup->hash)
+			return lookup_finish(lookup, NULL);
+		return lookup_next(lookup, HASH_TABLE_READ(fill->next_fill));
+	}
+
+	/* a stored key is in the fill already */
+	if (table->store_keys)
+	{
+		if (HASH_TABLE_SEARCH_FILL(table, lookup->pattern, fill))
+			return lookup_finish(lookup, fill);
+		return lookup_next(lookup, HASH_TABLE_READ(fill->next_fill));
+	}
+
+	HASH_TABLE_PREFETCH(fill->object);
+	lookup->state = HASH_TABLE_LOOKUP_OBJECT;
+	return 0;
+}
+
+/* Start looking pattern up in steps, see Hash_Table_Lookup_Step */
+void Hash_Table_Lookup_Start(hash_table_t * table,
+	hash_table_lookup_t * lookup, char * pattern)
+{
+	chained_ref_t ref;
+	unsigned long index;
+
+	assert(table != NULL);
+	assert(lookup != NULL);
+	assert(pattern != NULL);
+
+	lookup->table = table;
+	lookup->hash = HASH_TABLE_HASH(table, pattern);
+	lookup->pattern = HASH_TABLE_PATTERN(table, pattern, &lookup->key);
+	lookup->searches_skipped = 0;
+	lookup->object = NULL;
+	lookup->cursor.next_duplicate = NULL;
+	lookup->cursor.number_remaining = 0;
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+	{
+		index = (unsigned long)(lookup->hash &
+			(table->number_of_total_buckets - 1));
+		HASH_TABLE_PREFETCH(&table->controls[index]);
+		HASH_TABLE_PREFETCH(&table->slots[index]);
+		lookup->state = HASH_TABLE_LOOKUP_SLOT;
+		return;
+	}
+
+	ref = chained_locate(table, lookup->hash);
+	if (ref.head != NULL)
+	{
+		HASH_TABLE_PREFETCH(ref.head);
+		lookup->fill = ref.head;
+		lookup->state = HASH_TABLE_LOOKUP_HEAD;
+	}
+	else
+	{
+		HASH_TABLE_PREFETCH(ref.bucket_slot);
+		lookup->bucket_slot = ref.bucket_slot;
+		lookup->state = HASH_TABLE_LOOKUP_BUCKET;
+	}
+}
+
+/* Take the lookup's next step, reading what the last one prefetched.
+* Returns 1 once it is done, 0 if it needs more steps.
+*/
+int Hash_Table_Lookup_Step(hash_table_lookup_t * lookup)
+{
+	hash_table_t * table;
+
+	assert(lookup != NULL);
+
+	table = lookup->table;
+	switch (lookup->state)
+	{
+	case HASH_TABLE_LOOKUP_BUCKET:
+		lookup->bucket = HASH_TABLE_READ(*lookup->bucket_slot);
+		if (lookup->bucket == NULL)
+			return lookup_finish(lookup, NULL);
+		HASH_TABLE_PREFETCH(lookup->bucket);
+		lookup->state = HASH_TABLE_LOOKUP_FIRST_FILL;
+		return 0;
+
+	case HASH_TABLE_LOOKUP_FIRST_FILL:
+		return lookup_next(lookup, HASH_TABLE_READ(lookup->bucket->first_fill));
+
+	case HASH_TABLE_LOOKUP_HEAD:
+		/* an empty inline bucket has no object */
+		if (lookup->fill->object == NULL)
+			return lookup_finish(lookup, NULL);
+		return lookup_fill(lookup);
+
+	case HASH_TABLE_LOOKUP_FILL:
+		return lookup_fill(lookup);
+
+	case HASH_TABLE_LOOKUP_OBJECT:
+		if (HASH_TABLE_SEARCH(table, lookup->pattern, lookup->fill->object))
+			return lookup_finish(lookup, lookup->fill);
+		return lookup_next(lookup, HASH_TABLE_READ(lookup->fill->next_fill));
+
+	case HASH_TABLE_LOOKUP_SLOT:
+		lookup->object = Hash_Table_Flat_Find(table, lookup->pattern,
+			lookup->hash, &lookup->cursor);
+		if (!table->shared_lookups)
+		{
+			if (lookup->object != NULL)
+				(table->number_of_hits)++;
+			else
+				(table->number_of_misses)++;
+		}
+		lookup->state = HASH_TABLE_LOOKUP_DONE;
+		return 1;
+
+	case HASH_TABLE_LOOKUP_DONE:
+	default:
+		return 1;
+	}
+}
+
+/* Hash_Table_Match_Batch keeping up to width lookups in flight. Each round
+* gives every lookup in flight one step; a finished one hands its slot to
+* the next pattern.
+* Returns the number of patterns found.
+*/
+unsigned long Hash_Table_Match_Interleaved(hash_table_t * table,
+	char ** patterns, unsigned long count, void ** results,
+	hash_table_cursor_t * cursors, unsigned long width)
+{
+	hash_table_lookup_t lookups[HASH_TABLE_LOOKUP_MAX_WIDTH];
+	unsigned long positions[HASH_TABLE_LOOKUP_MAX_WIDTH];
+	unsigned long i, next_pattern, number_in_flight, number_found = 0;
+
+	assert(table != NULL);
+	assert(count == 0 || (patterns != NULL && results != NULL));
+
+	if (width == 0 || width > HASH_TABLE_LOOKUP_MAX_WIDTH)
+		width = HASH_TABLE_LOOKUP_MAX_WIDTH;
+
+	/* the same resize work count separate lookups would do, all before
+	* any lookup is in flight */
+	for (i = 0; i < count && table->number_of_old_buckets != 0; i++)
+		lookup_rehash_step(table);
+
+	for (i = 0; i < width && i < count; i++)
+	{
+		positions[i] = i;
+		Hash_Table_Lookup_Start(table, &lookups[i], patterns[i]);
+	}
+	next_pattern = number_in_flight = i;
+	for (; i < width; i++)
+		positions[i] = count;
+
+	while (number_in_flight > 0)
+	{
+		for (i = 0; i < width; i++)
+		{
+			/* count marks a slot with nothing left to start */
+			if (positions[i] == count || !Hash_Table_Lookup_Step(&lookups[i]))
+				continue;
+
+			results[positions[i]] = lookups[i].object;
+			if (cursors != NULL)
+				cursors[positions[i]] = lookups[i].cursor;
+			if (lookups[i].object != NULL)
+				number_found++;
+
+			if (next_pattern < count)
+			{
+				positions[i] = next_pattern;
+				Hash_Table_Lookup_Start(table, &lookups[i],
+					patterns[next_pattern]);
+				next_pattern++;
+			}
+			else
+			{
+				positions[i] = count;
+				number_in_flight--;
+			}
+		}
+	}
+
+	return number_found;
+}
+
+/* Index of the lowest set bit of word, which is not 0 */
+static unsigned long occupancy_lowest_bit(uint64_t word)
+{
+#if defined(__GNUC__)
+	return (unsigned long)__builtin_ctzll(word);
+#else
+	unsigned long i = 0;
+
+	while ((word & 1) == 0)
+	{
+		word >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+/* Index of the first bucket from position (and before end) whose bit is
+* set in occupied, end if none. Words with no bit set are skipped whole. */
+static unsigned long chained_next_occupied(const uint64_t * occupied,
+	unsigned long position, unsigned long end)
+{
+	uint64_t word;
+
+	if (position >= end)
+		return end;
+
+	word = occupied[position / HASH_TABLE_OCCUPANCY_BITS] &
+		(~(uint64_t)0 << (position % HASH_TABLE_OCCUPANCY_BITS));
+	position -= position % HASH_TABLE_OCCUPANCY_BITS;
+
+	while (word == 0)
+	{
+		position += HASH_TABLE_OCCUPANCY_BITS;
+		if (position >= end)
+			return end;
+
+		word = occupied[position / HASH_TABLE_OCCUPANCY_BITS];
+	}
+
+	position += occupancy_lowest_bit(word);
+	return position < end ? position : end;
+}
+
+/* The buckets [*first, *end) making up chunk of number_of_chunks */
+static void iterate_range(unsigned long number_of_buckets,
+	unsigned long chunk, unsigned long number_of_chunks,
+	unsigned long * first, unsigned long * end)
+{
+	unsigned long share = number_of_buckets / number_of_chunks,
+		extra = number_of_buckets % number_of_chunks;
+
+	*first = share * chunk + (chunk < extra ? chunk : extra);
+	*end = *first + share + (chunk < extra ? 1 : 0);
+}
+
+/* Set iterator up to walk chunk of number_of_chunks of the table (0 of 1
+* for all of it) with Hash_Table_Iterator_Next. Does not allocate.
+*/
+void Hash_Table_Iterator_Init(hash_table_t * table,
+	hash_table_iterator_t * iterator, unsigned long chunk,
+	unsigned long number_of_chunks)
+{
+	assert(table != NULL);
+	assert(iterator != NULL);
+	assert(chunk < number_of_chunks);
+
+	memset(iterator, 0, sizeof(hash_table_iterator_t));
+	iterator->table = table;
+
+	/* the old array's buckets below rehash_position have been moved */
+	iterator->old = 1;
+	iterate_range(table->number_of_old_buckets, chunk, number_of_chunks,
+		&iterator->position, &iterator->end);
+	if (iterator->position < table->rehash_position)
+		iterator->position = table->rehash_position;
+
+	iterate_range(table->number_of_total_buckets, chunk, number_of_chunks,
+		&iterator->next_position, &iterator->next_end);
+}
+
+/* Returns the next object of the walk, NULL once there are no more */
+void * Hash_Table_Iterator_Next(hash_table_iterator_t * iterator)
+{
+	hash_table_t * table;
+	hash_table_fill_t * fill;
+	hash_table_slot_t * slot;
+
+	assert(iterator != NULL);
+
+	if (iterator->duplicates.number_remaining != 0)
+		return Hash_Table_Cursor_Next(&iterator->duplicates);
+
+	table = iterator->table;
+	fill = iterator->next_fill;
+	while (fill == NULL)
+	{
+		if (table->storage == HASH_TABLE_STORAGE_FLAT)
+			iterator->position = Hash_Table_Flat_Next_Slot(table,
+				iterator->old, iterator->position, iterator->end);
+		else
+			iterator->position = chained_next_occupied(iterator->old ?
+				table->old_occupied : table->occupied, iterator->position,
+				iterator->end);
+
+		if (iterator->position == iterator->end)
+		{
+			/* on from the old array to the current one */
+			if (!iterator->old)
+				return NULL;
+
+			iterator->old = 0;
+			iterator->position = iterator->next_position;
+			iterator->end = iterator->next_end;
+			continue;
+		}
+
+		if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		{
+			slot = iterator->old ? &table->old_slots[iterator->position] :
+				&table->slots[iterator->position];
+			(iterator->position)++;
+
+			Hash_Table_Cursor_Set(&iterator->duplicates, &slot->duplicates);
+			iterator->hash = slot->hash;
+			return slot->object;
+		}
+
+		if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+			fill = iterator->old ?
+				&table->old_inline_fills[iterator->position] :
+				&table->inline_fills[iterator->position];
+		else
+			fill = iterator->old ?
+				table->old_buckets[iterator->position]->first_fill :
+				table->buckets[iterator->position]->first_fill;
+		(iterator->position)++;
+	}
+
+	iterator->next_fill = fill->next_fill;
+	Hash_Table_Cursor_Set(&iterator->duplicates, &fill->duplicates);
+	iterator->hash = fill->hash;
+	return fill->object;
+}
+
+/* Hash_Table_For_Each over chunk of number_of_chunks of the table.
+* Returns what callback last returned, 0 if every object was seen.
+*/
+int Hash_Table_For_Each_Chunk(hash_table_t * table, unsigned long chunk,
+	unsigned long number_of_chunks,
+	int(*callback)(void * object, void * context), void * context)
+{
+	hash_table_iterator_t iterator;
+	void * object;
+	int result;
+
+	assert(callback != NULL);
+
+	Hash_Table_Iterator_Init(table, &iterator, chunk, number_of_chunks);
+	while ((object = Hash_Table_Iterator_Next(&iterator)) != NULL)
+	{
+		result = callback(object, context);
+		if (result != 0)
+			return result;
+	}
+
+	return 0;
+}
+
+/* Call callback(object, context) on every object in the table until it
+* returns non 0.
+* Returns what callback last returned, 0 if every object was seen.
+*/
+int Hash_Table_For_Each(hash_table_t * table,
+	int(*callback)(void * object, void * context), void * context)
+{
+	return Hash_Table_For_Each_Chunk(table, 0, 1, callback, context);
+}
+
+/* Move the table to an array of number_of_buckets buckets (rounded up to a
+* power of 2 for flat storage), either to grow ahead of a bulk load or to
+* shrink. The move is spread over the following inserts and lookups like an
+* automatic grow. A resize already running is finished first.
+* Return 1 if successful - 0 if failure (memory allocation, or too few
+* slots to hold the flat table's entries).
+*/
+int Hash_Table_Resize(hash_table_t * table, unsigned long number_of_buckets)
+{
+	assert(table != NULL);
+	assert(number_of_buckets > 0);
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		return Hash_Table_Flat_Resize(table, number_of_buckets);
+
+	if (!chained_finish_resize(table))
+		return 0;
+
+	return chained_start_resize(table, number_of_buckets);
+}
+
+/* Returns number of bytes that the hash table currently has been
+* allocated not including objects table holds.
+*/
+unsigned long Hash_Table_Size(hash_table_t * table)
+{
+	unsigned long table_size;
+
+	/* an attached index's nodes */
+	table_size = table->index != NULL ? (unsigned long)table->index->size : 0;
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		return table_size + Hash_Table_Flat_Size(table);
+
+	if (!table->pooled)
+		return table_size + chained_used_size(table);
+
+	table_size += sizeof(hash_table_t) + (table->number_of_total_buckets +
+		table->number_of_old_buckets) * chained_element_size(table) +
+		(HASH_TABLE_OCCUPANCY_WORDS(table->number_of_total_buckets) +
+		HASH_TABLE_OCCUPANCY_WORDS(table->number_of_old_buckets)) *
+		sizeof(uint64_t);
+
+	return table_size + Hash_Table_Pools_Size(table) +
+		table->duplicate_capacity * sizeof(void *) + table->key_arena.size;
+}
+/* Count a bucket holding length keys into stats */
+void Hash_Table_Stats_Add_Chain(hash_table_stats_t * stats,
+	unsigned long length)
+{
+	(stats->number_of_buckets_filled)++;
+	(stats->chain_lengths[length < HASH_TABLE_HISTOGRAM_BINS ? length :
+		HASH_TABLE_HISTOGRAM_BINS - 1])++;
+	if (length > stats->longest_chain)
+		stats->longest_chain = length;
+}
+
+/* Count a key into stats, distance entries into its probe and with
+* number_of_duplicates duplicates */
+void Hash_Table_Stats_Add_Key(hash_table_stats_t * stats,
+	unsigned long distance, unsigned long number_of_duplicates)
+{
+	(stats->number_of_keys)++;
+	stats->number_of_objects += number_of_duplicates + 1;
+
+	(stats->probe_lengths[distance < HASH_TABLE_HISTOGRAM_BINS ? distance :
+		HASH_TABLE_HISTOGRAM_BINS - 1])++;
+	if (distance > stats->longest_probe)
+		stats->longest_probe = distance;
+
+	(stats->duplicate_counts[number_of_duplicates <
+		HASH_TABLE_HISTOGRAM_BINS ? number_of_duplicates :
+		HASH_TABLE_HISTOGRAM_BINS - 1])++;
+	if (number_of_duplicates > stats->most_duplicates)
+		stats->most_duplicates = number_of_duplicates;
+}
+
+/* Hash_Table_Stats of the old bucket array (the part not yet rehashed) or
+* the current one. Only the buckets set in the occupancy bitmap are
+* looked at. */
+static void chained_stats(hash_table_t * table, int old,
+	hash_table_stats_t * stats)
+{
+	const uint64_t * occupied = old ? table->old_occupied : table->occupied;
+	hash_table_fill_t * fill;
+	unsigned long position, end, chain_length;
+
+	position = old ? table->rehash_position : 0;
+	end = old ? table->number_of_old_buckets : table->number_of_total_buckets;
+
+	while ((position = chained_next_occupied(occupied, position, end)) != end)
+	{
+		if (table->layout == HASH_TABLE_LAYOUT_INLINE)
+			fill = old ? &table->old_inline_fills[position] :
+				&table->inline_fills[position];
+		else
+			fill = old ? table->old_buckets[position]->first_fill :
+				table->buckets[position]->first_fill;
+
+		for (chain_length = 0; fill != NULL; fill = fill->next_fill)
+		{
+			Hash_Table_Stats_Add_Key(stats, chain_length,
+				fill->duplicates.number_of_duplicates);
+			chain_length++;
+		}
+
+		Hash_Table_Stats_Add_Chain(stats, chain_length);
+		position++;
+	}
+}
+
+/* Fill stats in for table, walking every filled bucket. Does not
+* allocate.
+*/
+void Hash_Table_Stats(hash_table_t * table, hash_table_stats_t * stats)
+{
+	assert(table != NULL);
+	assert(stats != NULL);
+
+	memset(stats, 0, sizeof(hash_table_stats_t));
+
+	stats->number_of_buckets = table->number_of_total_buckets;
+	if (table->number_of_old_buckets != 0)
+		stats->number_of_buckets += table->number_of_old_buckets -
+			table->rehash_position;
+
+	if (table->storage == HASH_TABLE_STORAGE_FLAT)
+		Hash_Table_Flat_Stats(table, stats);
+	else
+	{
+		if (table->number_of_old_buckets != 0)
+			chained_stats(table, 1, stats);
+		chained_stats(table, 0, stats);
+	}
+
+	/* empty buckets were never walked */
+	stats->chain_lengths[0] += stats->number_of_buckets -
+		stats->number_of_buckets_filled;
+	if (stats->number_of_buckets != 0)
+		stats->load_factor = (double)stats->number_of_keys /
+			(double)stats->number_of_buckets;
+
+	/* the table struct comes straight from the allocator */
+	stats->allocated_bytes = table->allocated_bytes + sizeof(hash_table_t);
+	stats->allocator_bytes = table->allocator_bytes +
+		HASH_TABLE_ALLOCATION_COST(sizeof(hash_table_t));
+	stats->number_of_allocations = table->number_of_allocations + 1;
+	stats->size = Hash_Table_Size(table);
+
+	stats->counters = table->counters;
+	stats->number_of_hits = table->number_of_hits;
+	stats->number_of_misses = table->number_of_misses;
+	stats->number_of_compares_skipped = table->number_of_compares_skipped;
+	stats->number_of_searches_skipped = table->number_of_searches_skipped;
+}
+
+/* Zero the lookup counters to start a new measurement */
+void Hash_Table_Reset_Counters(hash_table_t * table)
+{
+	assert(table != NULL);
+
+	memset(&table->counters, 0, sizeof(hash_table_counters_t));
+	table->number_of_hits = 0;
+	table->number_of_misses = 0;
+	table->number_of_compares_skipped = 0;
+	table->number_of_searches_skipped = 0;
+}
@@ -1,8 +1,15 @@
 /* hash_table.h - Generic Hash Table with 2-d linked lists for collisions
 * and duplicates. Objects are mapped onto an unsigned long between 0 and 
 * number_of_buckets - 1. Not type safe
+* A second, flat storage engine keeps entries in one open-addressed slot array
+* (Robin Hood probing) behind the same API.
 * Collisions are listed in order so we can stop searching early if we go
-* over a certain value.
+* over a certain value. The order is by the full hash of the pattern (kept
+* in every fill) and then by compare_function, so the callbacks only run on
+* entries whose full hash matches.
+* Tables can grow once they pass a load factor. The move to the bigger array
+* is incremental: each insert and lookup rehashes a few buckets, so no single
+* call pays for the whole resize.
 *
 * Requires a predefined hash, compare, search & free function for
 * object in use.
@@ -28,7 +35,95 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
 
+/* Storage engine, picked once when the table is created */
+typedef enum hash_table_storage_t {
+	HASH_TABLE_STORAGE_CHAINED = 0, /* buckets -> fills -> duplicates */
+	HASH_TABLE_STORAGE_FLAT = 1 /* one slot array, Robin Hood probing */
+} hash_table_storage_t;
+
+/* Where the table gets its memory from. allocate must return zeroed memory
+* (like calloc) or NULL, release gets back the size that was asked for.
+* Leave both NULL for calloc / free.
+*/
+typedef struct hash_table_allocator_t {
+	void *(*allocate)(size_t size, void * context);
+	void(*release)(void * memory, size_t size, void * context);
+	void * context;
+} hash_table_allocator_t;
+
+/* Fixed size nodes carved out of large slabs, recycled through free_list.
+* One per node type when the table is pooled. */
+typedef struct hash_table_pool_t {
+	size_t node_size;
+	void * free_list;
+	struct hash_table_slab_t * slabs;
+	char * next_node; /* unused space at the end of the newest slab */
+	char * slab_end;
+	unsigned long number_of_slabs;
+} hash_table_pool_t;
+
+/* How the chained engine lays out its bucket array */
+typedef enum hash_table_layout_t {
+	HASH_TABLE_LAYOUT_POINTERS = 0, /* array of hash_table_bucket_t * */
+	HASH_TABLE_LAYOUT_INLINE = 1 /* array holding each first fill by value */
+} hash_table_layout_t;
+
+/* A key as bytes, for keyed tables (see hash_table_config_t.key_function) */
+typedef struct hash_table_key_t {
+	const void * key;
+	size_t length;
+} hash_table_key_t;
+
+/* A block of the key arena. Each key in it is the address of the block
+* followed by the key's bytes, so taking the key out can find the block;
+* a block none of whose keys are left is freed. */
+typedef struct hash_table_key_chunk_t {
+	struct hash_table_key_chunk_t * prev_chunk;
+	struct hash_table_key_chunk_t * next_chunk;
+	size_t size; /* of the whole block */
+	size_t live_bytes; /* of the keys still in it */
+} hash_table_key_chunk_t;
+
+/* Where a table storing keys (see hash_table_config_t.store_keys) keeps
+* those too long to go in their fill */
+typedef struct hash_table_key_arena_t {
+	hash_table_key_chunk_t * chunks; /* newest, the one being filled, first */
+	unsigned char * next; /* unused space at the end of the newest block */
+	unsigned char * end;
+	size_t size; /* bytes of every block */
+} hash_table_key_arena_t;
+
+/* What is handed to hash_table_t.retire_function */
+typedef enum hash_table_retire_t {
+	HASH_TABLE_RETIRE_NODE = 0, /* a node of pool (or the allocator's) */
+	HASH_TABLE_RETIRE_ARRAY = 1, /* count elements of size bytes */
+	HASH_TABLE_RETIRE_OBJECT = 2, /* an object for free_function */
+	HASH_TABLE_RETIRE_TABLE = 3 /* a whole table, keeping its objects */
+} hash_table_retire_t;
+
+/* What is handed to hash_table_t.index_function */
+typedef enum hash_table_index_event_t {
+	HASH_TABLE_INDEX_RESERVE = 0, /* an insert is about to happen */
+	HASH_TABLE_INDEX_ADD = 1, /* it inserted object */
+	HASH_TABLE_INDEX_CANCEL = 2, /* it inserted nothing */
+	HASH_TABLE_INDEX_DROP = 3, /* object was taken out */
+	HASH_TABLE_INDEX_DROP_KEY = 4, /* object and its duplicates are going */
+	HASH_TABLE_INDEX_FREE = 5 /* the table is being freed */
+} hash_table_index_event_t;
+
+/* Per operation counters. Only kept when the library is built with
+* HASH_TABLE_COUNTERS defined, otherwise they stay 0 and cost nothing.
+* Like the other counters they are not kept while lookups are shared.
+*/
+typedef struct hash_table_counters_t {
+	unsigned long probes; /* fills or slots lookups looked at */
+	unsigned long search_calls; /* search_function calls (key matches) */
+	unsigned long compare_calls; /* compare_function calls (key compares) */
+	unsigned long allocations; /* calls to the allocator */
+} hash_table_counters_t;
 
 typedef struct hash_table_t {
 	struct hash_table_bucket_t ** buckets;
@@ -43,9 +138,139 @@ typedef struct hash_table_t {
 	int(*compare_function)(void * object1, void * object2);	
 	int(*search_function)(char * search_string, void * object);	
 	void(*free_function)(void * object);
+
+	/* Turning objects into bytes and back, for streams (see
+	* hash_table_stream.h). NULL if the table is never streamed. */
+	size_t(*serialize_function)(void * object, const void ** bytes);
+	void *(*deserialize_function)(const void * bytes, size_t length);
+
+	hash_table_storage_t storage;
+	struct hash_table_slot_t * slots; /* HASH_TABLE_STORAGE_FLAT only */
+	unsigned char * controls; /* one per slot, see hash_table_slot_t */
+
+	uint64_t(*full_hash_function)(char * string);
+	unsigned long(*reduce_function)(uint64_t hash,
+		unsigned long number_of_buckets);
+
+	/* Keyed tables compare the bytes key_function gives for each object
+	* instead of calling compare_function / search_function */
+	void(*key_function)(void * object, hash_table_key_t * key);
+	uint64_t(*key_hash_function)(const void * key, size_t length);
+
+	/* Resizing. grow_threshold is the number of fills (distinct keys) that
+	* starts a grow, 0 if the table never grows. While a resize is running
+	* old_buckets / old_slots hold the previous array and everything below
+	* rehash_position has already been moved to the new one. */
+	unsigned long grow_threshold;
+	double max_load_factor;
+	unsigned long rehash_step;
+	struct hash_table_bucket_t ** old_buckets;
+	struct hash_table_slot_t * old_slots;
+	unsigned long number_of_old_buckets;
+	unsigned long rehash_position;
+
+	/* Longest probe in the flat slot arrays, bounds lookups in old_slots */
+	unsigned long max_probe_distance;
+	unsigned long old_max_probe_distance;
+
+	/* compare_function / search_function calls avoided because the stored
+	* full hash already told the entries apart */
+	unsigned long number_of_compares_skipped;
+	unsigned long number_of_searches_skipped;
+
+	/* Lookups that found their pattern and that did not (not counted when
+	* lookups are shared), and objects evicted to stay within max_entries /
+	* max_bytes */
+	unsigned long number_of_hits;
+	unsigned long number_of_misses;
+	unsigned long number_of_evictions;
+
+	/* Cache mode, see hash_table_config_t. clock_hand is the bucket (or
+	* slot) the next eviction looks at first. */
+	unsigned long max_entries;
+	size_t max_bytes;
+	unsigned long clock_hand;
+
+	/* Memory. When pooled, buckets and fills come from the pools below in
+	* slabs of slab_size bytes. Duplicate arrays always come straight from
+	* the allocator, duplicate_capacity objects' worth of them. */
+	hash_table_allocator_t allocator;
+	int pooled;
+	size_t slab_size;
+	hash_table_pool_t bucket_pool;
+	hash_table_pool_t fill_pool;
+	unsigned long duplicate_capacity;
+
+	/* What the table holds from the allocator right now, not counting the
+	* table struct itself: bytes asked for, the same with the allocator's
+	* own overhead estimated (see Hash_Table_Stats), and the number of
+	* blocks */
+	size_t allocated_bytes;
+	size_t allocator_bytes;
+	unsigned long number_of_allocations;
+
+	hash_table_counters_t counters;
+
+	/* HASH_TABLE_LAYOUT_INLINE keeps the first fill of every bucket in
+	* inline_fills (object NULL when empty) instead of buckets */
+	hash_table_layout_t layout;
+	struct hash_table_fill_t * inline_fills;
+	struct hash_table_fill_t * old_inline_fills;
+
+	/* Chained engine: a bit per bucket of the current (and old) array, set
+	* while the bucket holds a fill, so walks skip empty buckets 64 at a
+	* time instead of loading each one */
+	uint64_t * occupied;
+	uint64_t * old_occupied;
+
+	/* Set when lookups may run at the same time as each other (see
+	* hash_table_concurrent.h): they then never rehash or update counters,
+	* so they only read the table */
+	int shared_lookups;
+
+	/* Set (by hash_table_concurrent.c) when lookups run without any lock.
+	* Writes then never change a fill readers can see in place: memory and
+	* objects that get swapped or taken out are handed to retire_function
+	* to be freed once no reader can still hold them. Only chained tables
+	* with the pointer layout and no resizing support this. */
+	void (*retire_function)(void * context, struct hash_table_t * table,
+		hash_table_retire_t kind, hash_table_pool_t * pool, void * memory,
+		size_t count, size_t size);
+	void * retire_context;
+
+	/* Set (by hash_table_index.c) while an ordered index is attached. Told
+	* of every object that comes and goes; RESERVE returns 0 if the index
+	* cannot take another object (memory allocation), the insert then
+	* fails. */
+	int (*index_function)(struct hash_table_t * table,
+		hash_table_index_event_t event, void * object);
+	struct hash_table_index_t * index;
+
+	/* Keys copied into the table, see hash_table_config_t.store_keys.
+	* insert_key is the key of the insert under way, for tables without
+	* key_function, set by the entry points taking the object's pattern. */
+	int store_keys;
+	hash_table_key_arena_t key_arena;
+	hash_table_key_t * insert_key;
 	
 } hash_table_t;
 
+/* Number of duplicates a fill or slot holds without allocating */
+#define HASH_TABLE_INLINE_DUPLICATES 2
+
+/* The duplicates of one fill or slot, in insertion order. The first
+* HASH_TABLE_INLINE_DUPLICATES are kept in place, after that they all move
+* to an array of capacity objects.
+*/
+typedef struct hash_table_duplicates_t {
+	uint32_t number_of_duplicates;
+	uint32_t capacity; /* 0 while the duplicates are inline */
+	union {
+		void * inline_objects[HASH_TABLE_INLINE_DUPLICATES];
+		void ** objects;
+	} items;
+} hash_table_duplicates_t;
+
 typedef struct hash_table_bucket_t {
 	struct hash_table_fill_t * first_fill;
 	struct hash_table_fill_t * last_fill;
@@ -54,22 +279,214 @@ typedef struct hash_table_bucket_t {
 typedef struct hash_table_fill_t {
 	void * object;
 	struct hash_table_fill_t * next_fill;
-	struct hash_table_duplicate_t * first_duplicate;
-	struct hash_table_duplicate_t * last_duplicate;
+	hash_table_duplicates_t duplicates;
+	uint64_t hash; /* full hash of the pattern, to filter and rehash */
+	unsigned char referenced; /* CLOCK bit, set by lookups in cache mode */
 } hash_table_fill_t;
 
-typedef struct hash_table_duplicate_t {
+/* Longest key kept in its fill when keys are stored */
+#define HASH_TABLE_INLINE_KEY 23
+/* Last byte of a hash_table_stored_key_t whose key is in the arena */
+#define HASH_TABLE_ARENA_KEY 0xFF
+
+/* The copy of a fill's key a table storing keys keeps right after the
+* fill: the bytes themselves with their length in the last byte, or where
+* they are in the arena, the last byte then HASH_TABLE_ARENA_KEY */
+typedef union hash_table_stored_key_t {
+	unsigned char bytes[HASH_TABLE_INLINE_KEY + 1];
+	struct {
+		const unsigned char * bytes;
+		size_t length;
+	} arena;
+} hash_table_stored_key_t;
+
+/* One entry of the flat slot array. object is NULL when the slot is empty.
+* hash is the full (unreduced) hash of the pattern, used both as a
+* fingerprint and to work out how far the entry sits from its home slot.
+* Next to the current slot array is a control byte per slot: 0 when the
+* slot is empty, otherwise the top 7 bits of hash with the high bit set.
+* Lookups compare 16 control bytes at a time (one SSE2 / NEON compare) and
+* only look at the slots whose byte matches. The first 15 bytes are
+* repeated after the last so a group can start at any slot.
+*/
+typedef struct hash_table_slot_t {
+	void * object;
+	uint64_t hash;
+	hash_table_duplicates_t duplicates;
+	unsigned char referenced; /* CLOCK bit, set by lookups in cache mode */
+} hash_table_slot_t;
+
+/* Walks the duplicates of a lookup without allocating, see
+* Hash_Table_Match_Cursor. Points straight into the table's duplicate
+* array. */
+typedef struct hash_table_cursor_t {
+	void ** next_duplicate;
+	unsigned long number_remaining;
+} hash_table_cursor_t;
+
+/* Lookups in flight at most per Hash_Table_Match_Interleaved */
+#define HASH_TABLE_LOOKUP_MAX_WIDTH 16
+
+/* Where a hash_table_lookup_t is: the next thing it reads, which the last
+* step prefetched */
+typedef enum hash_table_lookup_state_t {
+	HASH_TABLE_LOOKUP_DONE = 0,
+	HASH_TABLE_LOOKUP_BUCKET = 1, /* the bucket pointer of the array */
+	HASH_TABLE_LOOKUP_FIRST_FILL = 2, /* the bucket */
+	HASH_TABLE_LOOKUP_HEAD = 3, /* the inline layout's first fill */
+	HASH_TABLE_LOOKUP_FILL = 4, /* a fill of the chain */
+	HASH_TABLE_LOOKUP_OBJECT = 5, /* the object of a fill with the hash */
+	HASH_TABLE_LOOKUP_SLOT = 6 /* the flat slot */
+} hash_table_lookup_state_t;
+
+/* One lookup run as a state machine, one memory access a step, see
+* Hash_Table_Lookup_Start. Must stay put while in flight. */
+typedef struct hash_table_lookup_t {
+	hash_table_t * table;
+	char * pattern; /* in the table's internal form */
+	hash_table_key_t key; /* what pattern points at for keyed tables */
+	uint64_t hash;
+	hash_table_lookup_state_t state;
+	hash_table_bucket_t ** bucket_slot;
+	hash_table_bucket_t * bucket;
+	hash_table_fill_t * fill;
+	unsigned long searches_skipped;
+
+	/* once done: the first match, NULL if none, and its duplicates */
 	void * object;
-	struct hash_table_duplicate_t * next_duplicate;
-} hash_table_duplicate_t;
+	hash_table_cursor_t cursor;
+} hash_table_lookup_t;
+
+/* Walks every object of a table, or of one chunk of it, see
+* Hash_Table_Iterator_Init. Old array of a running resize first. */
+typedef struct hash_table_iterator_t {
+	struct hash_table_t * table;
+	int old; /* walking the old array */
+	unsigned long position; /* next bucket (or slot) to look at */
+	unsigned long end;
+	unsigned long next_position; /* current array range, after the old */
+	unsigned long next_end;
+	struct hash_table_fill_t * next_fill; /* rest of the collision list */
+	hash_table_cursor_t duplicates; /* of the last object returned */
+	uint64_t hash; /* full hash of the key of the last object returned */
+} hash_table_iterator_t;
+
+/* Everything needed to create a table. Fill in with Hash_Table_Config_Default
+* and then override what is needed.
+*
+* storage selects the engine. With HASH_TABLE_STORAGE_FLAT number_of_buckets
+* is rounded up to a power of two and reduce_function is not used.
+*
+* full_hash_function should hash a string into the full 64 bit range and
+* reduce_function should map such a hash onto 0 .. number_of_buckets - 1
+* (NULL for the high bits of hash * number_of_buckets, which needs a hash
+* whose high bits are good). If full_hash_function is NULL the table calls
+* hash_function with max_number = ULONG_MAX and mixes the result for the
+* full hash. With neither, Hash_Table_Hash_Wy is used.
+*
+* key_function makes the table keyed: it points key at the bytes of an
+* object's key, and keys are equal when they have the same length and
+* bytes. compare_function, search_function and the string hashes are then
+* not used, keys hash with key_hash_function (NULL for Hash_Table_Hash_Bytes)
+* and the _Bytes entry points take (key, length). The char * entry points
+* still work, taking the pattern's strlen bytes as the key.
+*
+* serialize_function points bytes at what an object should be saved as and
+* returns how many bytes that is, deserialize_function makes a new object
+* from such bytes (NULL if failure). They are only used by streams and
+* can be NULL otherwise.
+*
+* max_load_factor is the average number of fills (distinct keys) per bucket
+* that triggers doubling the bucket array, 0 to keep number_of_buckets fixed
+* (the flat engine always grows, by default at 7/8 and never above 0.95).
+* rehash_step is how many old buckets each insert or lookup moves over
+* while a resize is running.
+*
+* layout picks the chained bucket array: pointers to bucket structs, or
+* the first fill of each bucket stored in the array itself so a hit on it
+* costs one load. Sparse tables where most buckets hold a single fill gain
+* the most.
+*
+* allocator supplies all of the table's memory. With pooled set, nodes are
+* carved out of slabs of slab_size bytes (0 for 64KiB) and reused through a
+* free list, and Hash_Table_Free releases whole slabs instead of each node.
+*
+* store_keys copies each key into the table: up to HASH_TABLE_INLINE_KEY
+* bytes go right after the fill, longer ones into an arena of slab_size
+* blocks. Lookups then match the pattern's bytes against the copy, without
+* loading the object or calling search_function, and keys are ordered by
+* length and bytes, so compare_function and search_function can be NULL.
+* The key is key_function's for a keyed table and otherwise the pattern
+* (its strlen bytes) given to the insert; inserts that come without a
+* pattern (loading a stream, Hash_Table_Sharded_Seal) then fail. Only
+* chained tables with the pointer layout store keys.
+*
+* max_entries and max_bytes (0 for no limit) turn the table into a cache.
+* max_entries bounds the number of objects, duplicates included, and
+* max_bytes the memory Hash_Table_Size reports, counting only the pool
+* nodes in use but every block of the key arena (a cache's blocks are at
+* most an eighth of max_bytes, unless a key needs more). Each insert that
+* goes over evicts whole keys, with all their duplicates handed to
+* free_function, picked by CLOCK: a lookup hit sets a key's reference bit,
+* and the eviction hand sweeping the array clears set bits and takes the
+* first key whose bit is clear. The key just inserted is never evicted for it.
+*/
+typedef struct hash_table_config_t {
+	unsigned long number_of_buckets;
+	unsigned long(*hash_function)(char * string, unsigned long max_number);
+	int(*compare_function)(void * object1, void * object2);
+	int(*search_function)(char * search_string, void * object);
+	void(*free_function)(void * object);
+	size_t(*serialize_function)(void * object, const void ** bytes);
+	void *(*deserialize_function)(const void * bytes, size_t length);
+	hash_table_storage_t storage;
+
+	uint64_t(*full_hash_function)(char * string);
+	unsigned long(*reduce_function)(uint64_t hash,
+		unsigned long number_of_buckets);
+	void(*key_function)(void * object, hash_table_key_t * key);
+	uint64_t(*key_hash_function)(const void * key, size_t length);
+	double max_load_factor;
+	unsigned long rehash_step;
+
+	hash_table_allocator_t allocator;
+	int pooled;
+	size_t slab_size;
+
+	hash_table_layout_t layout;
+
+	unsigned long max_entries;
+	size_t max_bytes;
+
+	int store_keys;
+} hash_table_config_t;
+
+/* Built in full_hash_function choices (see hash_table_hash.c), all hashing
+* a NUL terminated string into 64 bits.
+* Hash_Table_Hash_Wy - multiply and fold, 8 bytes at a time. The default.
+* Hash_Table_Hash_Crc32c - two independent CRC32C lanes, fast when built for
+*	the CRC32 instruction (-msse4.2 or ARM CRC), slow otherwise.
+* Hash_Table_Hash_Aes - AES rounds over 16 byte blocks when built with
+*	-maes, Hash_Table_Hash_Wy otherwise.
+*/
+uint64_t Hash_Table_Hash_Wy(char * string);
+uint64_t Hash_Table_Hash_Crc32c(char * string);
+uint64_t Hash_Table_Hash_Aes(char * string);
+
+/* Hash_Table_Hash_Wy of length bytes, the default key_hash_function */
+uint64_t Hash_Table_Hash_Bytes(const void * key, size_t length);
+
+/* Avalanche a weak 64 bit hash (murmur3's final mix, a bijection) */
+uint64_t Hash_Table_Hash_Mix(uint64_t hash);
 
 /* 
 * Returns a new allocated hash_table_t
 * number_of_buckets limits the size of the array holding buckets. Cannot be
-* changed.
+* changed (use Hash_Table_Init_Config for a table that grows).
 *
 * hash_fun should be a pointer to a function that takes an string
 * and hashes it into a unsigned long no larger than max_number_of_buckets - 1.
+* NULL uses Hash_Table_Hash_Wy.
 *
 * compare_fun should take two objects and return < 1 if object1 is before 
 * object2, 0 if same/duplicate, > 1 if object1 is after object2
@@ -87,6 +504,18 @@ hash_table_t * Hash_Table_Init(unsigned long number_of_buckets,
 	int(*search_fun)(char * search_string, void * object),
 	void(*free_fun)(void * object));
 
+/* Sets config to the defaults: 16 chained buckets, no callbacks, grow past
+* a load factor of 7/8 rehashing 4 buckets per operation, calloc / free, no
+* pooling and no size limit. */
+void Hash_Table_Config_Default(hash_table_config_t * config);
+
+/* 
+* Returns a new allocated hash_table_t built as described by config.
+* Callback requirements are the same as for Hash_Table_Init.
+* returns NULL if there was an error allocating memory
+*/
+hash_table_t * Hash_Table_Init_Config(hash_table_config_t * config);
+
 /* 
 * Insert a new object into the hash table. Pattern should be a string that 
 * will be hashed for key
@@ -105,6 +534,18 @@ int Hash_Table_Insert(hash_table_t * table, void * object, char * pattern);
 int Hash_Table_Insert_No_Duplicate(hash_table_t * table, void * object,
 	char * pattern, void ** found_duplicate);
 
+/* Return the object stored under pattern, or when there is none insert the
+* one create_function(context) returns, in a single probe so the object is
+* only built for a key that is missing. create_function must not use the
+* table. inserted (may be NULL) is set to 1 if the object is new, 0 if it
+* was already there.
+* Returns NULL if failure (memory allocation or create_function returned
+* NULL). An object made for an insert that then fails is passed to
+* free_function.
+*/
+void * Hash_Table_Find_Or_Insert(hash_table_t * table, char * pattern,
+	void *(*create_function)(void * context), void * context, int * inserted);
+
 /* Free table and contained objects */
 void Hash_Table_Free(hash_table_t * table);
 
@@ -117,14 +558,210 @@ void ** Hash_Table_Match(hash_table_t * table, char * pattern,
 	unsigned long * number_of_objects_found, unsigned long max_num_records);
 	
 /* Find the first object in the table given pattern string.
-* Returns NULL if nothing found (or there was an error).
+* Returns NULL if nothing found. Does not allocate.
 */
 void * Hash_Table_First_Match(hash_table_t * table, char * pattern);
 
+/* Find an object in the table given pattern string and copy it and its
+* duplicates into records, at most max_num_records of them.
+* Returns the number copied, 0 if nothing found. Does not allocate.
+*/
+unsigned long Hash_Table_Match_Into(hash_table_t * table, char * pattern,
+	void ** records, unsigned long max_num_records);
+
+/* Find the first object in the table given pattern string and set cursor
+* up to walk its duplicates with Hash_Table_Cursor_Next. The cursor is only
+* valid until the table is next used, as any call (lookups included) may move
+* the duplicates while rehashing. Does not allocate.
+* Returns NULL if nothing found.
+*/
+void * Hash_Table_Match_Cursor(hash_table_t * table, char * pattern,
+	hash_table_cursor_t * cursor);
+
+/* Returns the next duplicate of the object found by Hash_Table_Match_Cursor,
+* NULL once there are no more.
+*/
+void * Hash_Table_Cursor_Next(hash_table_cursor_t * cursor);
+
+/* Take object, one of the objects stored under pattern, out of the table.
+* Ownership goes back to the caller, free_function is not called. Nodes
+* freed up go back to the pools (when pooled) for the next inserts.
+* Returns 1 if it was removed, 0 if it was not in the table, -1 if failure
+* (memory allocation, only with retire_function set).
+*/
+int Hash_Table_Remove(hash_table_t * table, char * pattern, void * object);
+
+/* Take pattern and all its duplicates out of the table, passing each
+* object to free_function.
+* Returns the number of objects removed, 0 if pattern was not found.
+*/
+unsigned long Hash_Table_Remove_Key(hash_table_t * table, char * pattern);
+
+/* Keyed tables (see hash_table_config_t.key_function): the entry points
+* above taking the key as length bytes rather than a string. They behave
+* and return the same as their char * versions.
+*/
+int Hash_Table_Insert_Bytes(hash_table_t * table, void * object,
+	const void * key, size_t length);
+int Hash_Table_Insert_No_Duplicate_Bytes(hash_table_t * table, void * object,
+	const void * key, size_t length, void ** found_duplicate);
+void * Hash_Table_Find_Or_Insert_Bytes(hash_table_t * table, const void * key,
+	size_t length, void *(*create_function)(void * context), void * context,
+	int * inserted);
+void * Hash_Table_Match_Cursor_Bytes(hash_table_t * table, const void * key,
+	size_t length, hash_table_cursor_t * cursor);
+void * Hash_Table_First_Match_Bytes(hash_table_t * table, const void * key,
+	size_t length);
+unsigned long Hash_Table_Match_Into_Bytes(hash_table_t * table,
+	const void * key, size_t length, void ** records,
+	unsigned long max_num_records);
+int Hash_Table_Remove_Bytes(hash_table_t * table, const void * key,
+	size_t length, void * object);
+unsigned long Hash_Table_Remove_Key_Bytes(hash_table_t * table,
+	const void * key, size_t length);
+
+/* Insert count objects, objects[i] under patterns[i], in order. The batch
+* is hashed and its buckets prefetched a few keys ahead, so memory latency
+* is overlapped across the batch.
+* Returns the number inserted: count if successful, fewer if it stopped at
+* a failure (memory allocation).
+*/
+unsigned long Hash_Table_Insert_Batch(hash_table_t * table, void ** objects,
+	char ** patterns, unsigned long count);
+
+/* Look up count patterns together, prefetching like Hash_Table_Insert_Batch.
+* results[i] gets the first match of patterns[i], NULL if none. When cursors
+* is not NULL cursors[i] is set up for its duplicates, valid until the table
+* is next used. Does not allocate.
+* Returns the number of patterns found.
+*/
+unsigned long Hash_Table_Match_Batch(hash_table_t * table, char ** patterns,
+	unsigned long count, void ** results, hash_table_cursor_t * cursors);
+
+/* Start looking pattern up in steps: hash it and prefetch its bucket, then
+* Hash_Table_Lookup_Step until it returns 1. Each step reads what the last
+* one prefetched and prefetches the next link of the chain, so a thread
+* running many lookups a step at a time, round robin, keeps one miss of
+* each in flight however long their chains are. No resize work is done; the
+* table must not change until the lookup is done. pattern must stay valid.
+*/
+void Hash_Table_Lookup_Start(hash_table_t * table,
+	hash_table_lookup_t * lookup, char * pattern);
+
+/* Take the lookup's next step. Returns 1 once it is done, with the first
+* match (NULL if none) in lookup->object and its duplicates in
+* lookup->cursor, valid until the table is next changed. 0 if it needs more
+* steps.
+*/
+int Hash_Table_Lookup_Step(hash_table_lookup_t * lookup);
+
+/* Hash_Table_Match_Batch with up to width (at most
+* HASH_TABLE_LOOKUP_MAX_WIDTH, 0 for that) lookups in flight at a time, each
+* advanced a step in turn, and the next pattern started as soon as one is
+* done, so short chains do not wait on long ones.
+* Returns the number of patterns found.
+*/
+unsigned long Hash_Table_Match_Interleaved(hash_table_t * table,
+	char ** patterns, unsigned long count, void ** results,
+	hash_table_cursor_t * cursors, unsigned long width);
+
+/* Call callback(object, context) on every object in the table, each
+* key's duplicates straight after it, in no particular key order. The walk
+* stops early when callback returns non 0. callback must not change the
+* table. Returns what callback last returned, 0 if every object was seen.
+*/
+int Hash_Table_For_Each(hash_table_t * table,
+	int(*callback)(void * object, void * context), void * context);
+
+/* Hash_Table_For_Each over chunk (0 .. number_of_chunks - 1) of the table.
+* The chunks split the bucket range, so between them they visit every
+* object exactly once. Walks only read the table (no rehashing, no
+* counters), so different chunks can be walked on different threads at the
+* same time as long as nothing writes to the table meanwhile.
+*/
+int Hash_Table_For_Each_Chunk(hash_table_t * table, unsigned long chunk,
+	unsigned long number_of_chunks,
+	int(*callback)(void * object, void * context), void * context);
+
+/* Set iterator up to walk chunk of number_of_chunks of the table (0 of 1
+* for all of it) with Hash_Table_Iterator_Next. The iterator is only valid
+* until the table is next written to; like Hash_Table_For_Each_Chunk it
+* only reads the table. Does not allocate.
+*/
+void Hash_Table_Iterator_Init(hash_table_t * table,
+	hash_table_iterator_t * iterator, unsigned long chunk,
+	unsigned long number_of_chunks);
+
+/* Returns the next object of the walk, NULL once there are no more */
+void * Hash_Table_Iterator_Next(hash_table_iterator_t * iterator);
+
+/* Move the table to an array of number_of_buckets buckets (rounded up to a
+* power of 2 for flat storage), either to grow ahead of a bulk load or to
+* shrink. The move is spread over the following inserts and lookups like an
+* automatic grow. A resize already running is finished first.
+* Return 1 if successful - 0 if failure (memory allocation, or too few
+* slots to hold the flat table's entries).
+*/
+int Hash_Table_Resize(hash_table_t * table, unsigned long number_of_buckets);
+
 /* Returns number of bytes that the hash table currently has been 
 * allocated not including dereferenced objects table holds. 
+* Pooled tables count whole slabs.
 */
 unsigned long Hash_Table_Size(hash_table_t * table);
+
+/* Number of bins of the hash_table_stats_t histograms, the last one
+* counting everything from there up */
+#define HASH_TABLE_HISTOGRAM_BINS 16
+
+/* What Hash_Table_Stats finds in a table. A bucket of a flat table is a
+* home slot: its chain is the keys whose probes start there.
+*/
+typedef struct hash_table_stats_t {
+	unsigned long number_of_keys;
+	unsigned long number_of_objects; /* keys and their duplicates */
+	unsigned long number_of_buckets; /* including old ones not yet rehashed */
+	unsigned long number_of_buckets_filled;
+	double load_factor; /* keys per bucket */
+
+	/* chain_lengths[i] buckets with i keys. probe_lengths[i] keys a lookup
+	* reaches after stepping past i others: their place in the collision
+	* list, or their distance from home. duplicate_counts[i] keys with i
+	* duplicates. */
+	unsigned long chain_lengths[HASH_TABLE_HISTOGRAM_BINS];
+	unsigned long probe_lengths[HASH_TABLE_HISTOGRAM_BINS];
+	unsigned long duplicate_counts[HASH_TABLE_HISTOGRAM_BINS];
+	unsigned long longest_chain;
+	unsigned long longest_probe;
+	unsigned long most_duplicates;
+
+	/* Memory held from the allocator, table struct included. allocator_bytes
+	* adds HASH_TABLE_ALLOCATION_COST's estimate of the allocator's headers
+	* and rounding to each block. size is what Hash_Table_Size reports. */
+	size_t allocated_bytes;
+	size_t allocator_bytes;
+	unsigned long number_of_allocations;
+	unsigned long size;
+
+	/* the table's counters, so searches per lookup are
+	* search_calls / (number_of_hits + number_of_misses) */
+	hash_table_counters_t counters;
+	unsigned long number_of_hits;
+	unsigned long number_of_misses;
+	unsigned long number_of_compares_skipped;
+	unsigned long number_of_searches_skipped;
+} hash_table_stats_t;
+
+/* Fill stats in for table. Walks every filled bucket, so costs about as
+* much as Hash_Table_For_Each; like it, the walk only reads the table.
+* Does not allocate.
+*/
+void Hash_Table_Stats(hash_table_t * table, hash_table_stats_t * stats);
+
+/* Zero the lookup counters (hits, misses, calls skipped, the per operation
+* counters) to start a new measurement. Memory and key counts stay.
+*/
+void Hash_Table_Reset_Counters(hash_table_t * table);
 #endif
 
 
@@ -0,0 +1,402 @@
+/* hash_table_bulk.c - Multi threaded bulk load of a chained hash table.
+*
+* Three passes over the input, each split between the threads:
+* 1. hash every pattern (unless the hashes were given) and count, per
+*    thread, how many land in each part (a contiguous range of buckets, one
+*    part per thread);
+* 2. turn the counts into offsets and scatter the input indices so each
+*    part's indices are together, still in input order;
+* 3. each thread inserts one part through Hash_Table_Insert_Hashed on its
+*    own copy of the table header. The copies share the bucket array but
+*    never the same bucket (nor word of the occupancy bitmap), and have
+*    their own counters, node pools and key arenas, which are added back
+*    into the table when every thread is done.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include <pthread.h>
+#include <string.h>
+
+#include "hash_table_bulk.h"
+#include "hash_table_internal.h"
+
+#define BULK_MAX_THREADS 64
+/* Fewer objects than this per thread are loaded on the calling thread */
+#define BULK_MIN_PER_THREAD 1024
+
+typedef enum bulk_phase_t {
+	BULK_HASH = 0,
+	BULK_SCATTER = 1,
+	BULK_INSERT = 2
+} bulk_phase_t;
+
+typedef struct bulk_load_t {
+	hash_table_t * table;
+	void ** objects;
+	char ** patterns; /* NULL when the hashes were given */
+	unsigned long count;
+	unsigned long number_of_threads; /* also the number of parts */
+	unsigned long buckets_per_part;
+	bulk_phase_t phase;
+
+	uint64_t * hashes; /* of each pattern */
+	unsigned long * order; /* input indices, grouped by part */
+	/* count, then next position in order, of thread t's objects in part p
+	* at [t * number_of_threads + p] */
+	unsigned long * offsets;
+	unsigned long * part_starts; /* number_of_threads + 1 of them */
+} bulk_load_t;
+
+typedef struct bulk_worker_t {
+	bulk_load_t * load;
+	unsigned long index;
+	pthread_t thread;
+	int started;
+
+	/* The table as this worker inserts into it, see the top of the file */
+	hash_table_t part_table;
+	unsigned long number_inserted;
+} bulk_worker_t;
+
+/* The share of the input thread index hashes and scatters */
+static void bulk_range(bulk_load_t * load, unsigned long index,
+	unsigned long * first, unsigned long * end)
+{
+	unsigned long share = load->count / load->number_of_threads,
+		extra = load->count % load->number_of_threads;
+
+	*first = share * index + (index < extra ? index : extra);
+	*end = *first + share + (index < extra ? 1 : 0);
+}
+
+static unsigned long bulk_part(bulk_load_t * load, uint64_t hash)
+{
+	return Hash_Table_Bucket_Index(load->table, hash) /
+		load->buckets_per_part;
+}
+
+static void * bulk_work(void * argument)
+{
+	bulk_worker_t * worker = argument;
+	bulk_load_t * load = worker->load;
+	hash_table_key_t key;
+	unsigned long i, first, end, * offsets;
+
+	offsets = &load->offsets[worker->index * load->number_of_threads];
+
+	switch (load->phase)
+	{
+	case BULK_HASH:
+		bulk_range(load, worker->index, &first, &end);
+		for (i = first; i < end; i++)
+		{
+			if (load->patterns != NULL)
+				load->hashes[i] = HASH_TABLE_HASH(load->table,
+					load->patterns[i]);
+			offsets[bulk_part(load, load->hashes[i])]++;
+		}
+		break;
+
+	case BULK_SCATTER:
+		bulk_range(load, worker->index, &first, &end);
+		for (i = first; i < end; i++)
+			load->order[offsets[bulk_part(load, load->hashes[i])]++] = i;
+		break;
+
+	case BULK_INSERT:
+		for (i = load->part_starts[worker->index];
+			i < load->part_starts[worker->index + 1]; i++)
+		{
+			if (load->patterns != NULL)
+				HASH_TABLE_INSERT_KEY(&worker->part_table,
+					load->patterns[load->order[i]], &key);
+			if (!Hash_Table_Insert_Hashed(&worker->part_table,
+				load->objects[load->order[i]], load->hashes[load->order[i]]))
+				break;
+			(worker->number_inserted)++;
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+/* Run the current phase on every worker and wait for all of them. Workers
+* whose thread cannot be started run on the calling thread. */
+static void bulk_run(bulk_load_t * load, bulk_worker_t * workers)
+{
+	unsigned long i;
+
+	for (i = 1; i < load->number_of_threads; i++)
+		workers[i].started = pthread_create(&workers[i].thread, NULL,
+			bulk_work, &workers[i]) == 0;
+
+	bulk_work(&workers[0]);
+
+	for (i = 1; i < load->number_of_threads; i++)
+	{
+		if (workers[i].started)
+			pthread_join(workers[i].thread, NULL);
+		else
+			bulk_work(&workers[i]);
+	}
+}
+
+/* Turn the per thread counts into positions in order. Part p takes
+* order[part_starts[p] .. part_starts[p + 1]), thread 0's objects first. */
+static void bulk_offsets(bulk_load_t * load)
+{
+	unsigned long part, thread, position = 0, number_in_thread,
+		number_of_threads = load->number_of_threads;
+
+	for (part = 0; part < number_of_threads; part++)
+	{
+		load->part_starts[part] = position;
+		for (thread = 0; thread < number_of_threads; thread++)
+		{
+			number_in_thread = load->offsets[thread * number_of_threads + part];
+			load->offsets[thread * number_of_threads + part] = position;
+			position += number_in_thread;
+		}
+	}
+	load->part_starts[number_of_threads] = position;
+}
+
+/* Grow the table ahead of count more keys, so no worker has to.
+* Return 1 if successful - 0 if failure (memory allocation) left a resize
+* running. */
+static int bulk_presize(hash_table_t * table, unsigned long count)
+{
+	unsigned long number_of_keys, number_of_buckets;
+
+	if (!Hash_Table_Finish_Resize(table))
+		return 0;
+
+	number_of_keys = table->number_of_buckets_filled +
+		table->number_of_collisions;
+	if (table->grow_threshold == 0 || number_of_keys + count < count ||
+		number_of_keys + count <= table->grow_threshold)
+		return 1;
+
+	number_of_buckets = table->number_of_total_buckets;
+	while ((double)number_of_buckets * table->max_load_factor <
+		(double)(number_of_keys + count) && number_of_buckets <= ULONG_MAX / 2)
+		number_of_buckets *= 2;
+
+	/* a table that cannot grow just gets longer collision lists */
+	if (Hash_Table_Resize(table, number_of_buckets))
+		return Hash_Table_Finish_Resize(table);
+
+	return 1;
+}
+
+/* Set up worker's copy of the table: what it inserts is counted from 0 and
+* its nodes come from pools of its own */
+static void bulk_part_table(hash_table_t * table, bulk_worker_t * worker)
+{
+	hash_table_t * part_table = &worker->part_table;
+
+	*part_table = *table;
+	part_table->number_of_buckets_filled = 0;
+	part_table->number_of_collisions = 0;
+	part_table->number_of_duplicates = 0;
+	part_table->number_of_compares_skipped = 0;
+	part_table->number_of_searches_skipped = 0;
+	part_table->duplicate_capacity = 0;
+	part_table->grow_threshold = 0;
+	part_table->allocated_bytes = 0;
+	part_table->allocator_bytes = 0;
+	part_table->number_of_allocations = 0;
+	memset(&part_table->counters, 0, sizeof(hash_table_counters_t));
+
+	memset(&part_table->bucket_pool, 0, sizeof(hash_table_pool_t));
+	part_table->bucket_pool.node_size = table->bucket_pool.node_size;
+	memset(&part_table->fill_pool, 0, sizeof(hash_table_pool_t));
+	part_table->fill_pool.node_size = table->fill_pool.node_size;
+	memset(&part_table->key_arena, 0, sizeof(hash_table_key_arena_t));
+}
+
+/* Add what worker inserted back into the table */
+static void bulk_merge(hash_table_t * table, bulk_worker_t * worker)
+{
+	hash_table_t * part_table = &worker->part_table;
+
+	table->number_of_buckets_filled += part_table->number_of_buckets_filled;
+	table->number_of_collisions += part_table->number_of_collisions;
+	table->number_of_duplicates += part_table->number_of_duplicates;
+	table->number_of_compares_skipped +=
+		part_table->number_of_compares_skipped;
+	table->number_of_searches_skipped +=
+		part_table->number_of_searches_skipped;
+	table->duplicate_capacity += part_table->duplicate_capacity;
+	table->allocated_bytes += part_table->allocated_bytes;
+	table->allocator_bytes += part_table->allocator_bytes;
+	table->number_of_allocations += part_table->number_of_allocations;
+	table->counters.probes += part_table->counters.probes;
+	table->counters.search_calls += part_table->counters.search_calls;
+	table->counters.compare_calls += part_table->counters.compare_calls;
+	table->counters.allocations += part_table->counters.allocations;
+
+	if (table->pooled)
+	{
+		Hash_Table_Pool_Merge(&table->bucket_pool, &part_table->bucket_pool);
+		Hash_Table_Pool_Merge(&table->fill_pool, &part_table->fill_pool);
+	}
+	Hash_Table_Key_Arena_Merge(&table->key_arena, &part_table->key_arena);
+}
+
+/* Load on the calling thread, as far as the first failure */
+static unsigned long bulk_serial(hash_table_t * table, void ** objects,
+	char ** patterns, uint64_t * hashes, unsigned long count)
+{
+	unsigned long i;
+
+	if (patterns != NULL)
+		return Hash_Table_Insert_Batch(table, objects, patterns, count);
+
+	for (i = 0; i < count; i++)
+	{
+		if (!Hash_Table_Insert_Hashed(table, objects[i], hashes[i]))
+			return i;
+	}
+
+	return count;
+}
+
+/* Insert count objects on up to number_of_threads threads, hashing
+* patterns unless hashes is given.
+* Returns the number inserted: count if successful, fewer if failure
+* (memory allocation).
+*/
+static unsigned long bulk_insert(hash_table_t * table, void ** objects,
+	char ** patterns, uint64_t * hashes, unsigned long count,
+	unsigned long number_of_threads)
+{
+	bulk_load_t load;
+	bulk_worker_t * workers;
+	unsigned long i, number_inserted = 0;
+	int have_memory;
+
+	if (number_of_threads > BULK_MAX_THREADS)
+		number_of_threads = BULK_MAX_THREADS;
+	if (number_of_threads > count / BULK_MIN_PER_THREAD)
+		number_of_threads = count / BULK_MIN_PER_THREAD;
+
+	/* what the parts cannot be used for */
+	if (number_of_threads <= 1 ||
+		table->storage != HASH_TABLE_STORAGE_CHAINED ||
+		table->retire_function != NULL || table->index_function != NULL ||
+		table->max_entries != 0 || table->max_bytes != 0 ||
+		!bulk_presize(table, count))
+		return bulk_serial(table, objects, patterns, hashes, count);
+
+	memset(&load, 0, sizeof(load));
+	load.table = table;
+	load.objects = objects;
+	load.patterns = patterns;
+	load.count = count;
+	load.number_of_threads = number_of_threads;
+	/* whole words of the occupancy bitmap, which the parts write to */
+	load.buckets_per_part = (HASH_TABLE_OCCUPANCY_WORDS(
+		table->number_of_total_buckets) + number_of_threads - 1) /
+		number_of_threads * HASH_TABLE_OCCUPANCY_BITS;
+
+	load.hashes = hashes != NULL ? hashes :
+		Hash_Table_Allocate(table, count, sizeof(uint64_t));
+	load.order = Hash_Table_Allocate(table, count, sizeof(unsigned long));
+	load.offsets = Hash_Table_Allocate(table, number_of_threads *
+		number_of_threads, sizeof(unsigned long));
+	load.part_starts = Hash_Table_Allocate(table, number_of_threads + 1,
+		sizeof(unsigned long));
+	workers = Hash_Table_Allocate(table, number_of_threads,
+		sizeof(bulk_worker_t));
+
+	have_memory = load.hashes != NULL && load.order != NULL &&
+		load.offsets != NULL && load.part_starts != NULL && workers != NULL;
+	if (have_memory)
+	{
+		for (i = 0; i < number_of_threads; i++)
+		{
+			workers[i].load = &load;
+			workers[i].index = i;
+		}
+
+		load.phase = BULK_HASH;
+		bulk_run(&load, workers);
+
+		bulk_offsets(&load);
+		load.phase = BULK_SCATTER;
+		bulk_run(&load, workers);
+
+		for (i = 0; i < number_of_threads; i++)
+			bulk_part_table(table, &workers[i]);
+		load.phase = BULK_INSERT;
+		bulk_run(&load, workers);
+
+		for (i = 0; i < number_of_threads; i++)
+		{
+			bulk_merge(table, &workers[i]);
+			number_inserted += workers[i].number_inserted;
+		}
+	}
+
+	Hash_Table_Release(table, workers, number_of_threads,
+		sizeof(bulk_worker_t));
+	Hash_Table_Release(table, load.part_starts, number_of_threads + 1,
+		sizeof(unsigned long));
+	Hash_Table_Release(table, load.offsets, number_of_threads *
+		number_of_threads, sizeof(unsigned long));
+	Hash_Table_Release(table, load.order, count, sizeof(unsigned long));
+	if (hashes == NULL)
+		Hash_Table_Release(table, load.hashes, count, sizeof(uint64_t));
+
+	/* no memory for the parts, load it the slow way */
+	if (!have_memory)
+		return bulk_serial(table, objects, patterns, hashes, count);
+
+	return number_inserted;
+}
+
+/* Insert count objects on up to number_of_threads threads.
+* Returns the number inserted: count if successful, fewer if failure
+* (memory allocation).
+*/
+unsigned long Hash_Table_Insert_Bulk(hash_table_t * table, void ** objects,
+	char ** patterns, unsigned long count, unsigned long number_of_threads)
+{
+	assert(table != NULL);
+	assert(objects != NULL || count == 0);
+	assert(patterns != NULL || count == 0);
+
+	return bulk_insert(table, objects, patterns, NULL, count,
+		number_of_threads);
+}
+
+/* Hash_Table_Insert_Bulk of objects whose full hashes are known.
+* Returns the number inserted: count if successful, fewer if failure
+* (memory allocation).
+*/
+unsigned long Hash_Table_Insert_Bulk_Hashed(hash_table_t * table,
+	void ** objects, uint64_t * hashes, unsigned long count,
+	unsigned long number_of_threads)
+{
+	assert(table != NULL);
+	assert(objects != NULL || count == 0);
+	assert(hashes != NULL || count == 0);
+
+	return bulk_insert(table, objects, NULL, hashes, count,
+		number_of_threads);
+}
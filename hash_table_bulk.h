@@ -0,0 +1,45 @@
+/* hash_table_bulk.h - Loading a large array of objects into a chained hash
+* table on several threads. The patterns are hashed in parallel and their
+* indices partitioned by bucket range, one range per thread, then each
+* thread inserts its range into buckets no other thread touches, without
+* any locking. Inside a range objects go in in array order through the
+* ordinary insert, so collision lists come out in the same compare_function
+* order, and duplicates in the same order, as inserting the array in a loop.
+*
+* Needs POSIX threads (link with -lpthread).
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_BULK_H
+#define __HASH_TABLE_BULK_H
+
+#include "hash_table.h"
+
+/* Insert count objects, objects[i] under patterns[i], using up to
+* number_of_threads threads (the calling one included). A growing table is
+* first resized to hold them all. The hash, compare and search callbacks
+* and the allocator are called from several threads at once and must be
+* safe for that; nothing else may use the table meanwhile.
+* Flat tables, caches (max_entries / max_bytes) and tables with lock free
+* readers are loaded on the calling thread with Hash_Table_Insert_Batch.
+* Returns the number inserted: count if successful, fewer if failure
+* (memory allocation), in which case which of the objects went in depends
+* on where each thread stopped.
+*/
+unsigned long Hash_Table_Insert_Bulk(hash_table_t * table, void ** objects,
+	char ** patterns, unsigned long count, unsigned long number_of_threads);
+
+#endif
@@ -0,0 +1,862 @@
+/* hash_table_concurrent.c - Thread safe hash table made of independently
+* locked segments, see hash_table_concurrent.h
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L /* pthread_rwlock_t */
+#endif
+
+#include <string.h>
+#include <sched.h>
+
+#include "hash_table_concurrent.h"
+#include "hash_table_internal.h"
+
+/* Multiplier spreading the full hash over the segments (2^64 / golden
+* ratio), so hashes that only differ in their low bits still land in
+* different segments */
+#define SEGMENT_MULTIPLIER ((uint64_t)0x9E3779B9 << 32 | 0x7F4A7C15)
+
+/* Epochs are ordered with full barriers: a writer's unlink and a reader's
+* announcement must not both be missed by the other side */
+#if HASH_TABLE_ATOMICS
+#define EPOCH_LOAD(location) __atomic_load_n(&(location), __ATOMIC_SEQ_CST)
+#define EPOCH_STORE(location, value) \
+	__atomic_store_n(&(location), (value), __ATOMIC_SEQ_CST)
+#define EPOCH_ADVANCE(location) \
+	__atomic_add_fetch(&(location), 1, __ATOMIC_SEQ_CST)
+#define EPOCH_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define READER_CLAIM(location) \
+	(__atomic_exchange_n(&(location), 1, __ATOMIC_ACQUIRE) == 0)
+#else
+#define EPOCH_LOAD(location) (location)
+#define EPOCH_STORE(location, value) ((location) = (value))
+#define EPOCH_ADVANCE(location) (++(location))
+#define EPOCH_FENCE()
+#define READER_CLAIM(location) 0
+#endif
+
+/* The segment pattern (hashing to hash) belongs to. The segment's table
+* reduces the low bits, the top bits of the product pick the segment. */
+static hash_table_segment_t * concurrent_segment(
+	hash_table_concurrent_t * table, uint64_t hash)
+{
+	if (table->number_of_segments == 1)
+		return &table->segments[0].segment;
+
+	return &table->segments[(unsigned long)((hash * SEGMENT_MULTIPLIER) >>
+		table->segment_shift)].segment;
+}
+
+/* Full hash of pattern, every segment hashes the same way. Taken from the
+* config rather than a segment's table as a lock free reader may not touch
+* a table before it has announced its epoch. */
+static uint64_t concurrent_hash(hash_table_concurrent_t * table,
+	char * pattern)
+{
+	return HASH_TABLE_HASH(&table->segment_config, pattern);
+}
+
+/* Aligned to the next cache line boundary after memory */
+static void * concurrent_align(void * memory)
+{
+	return (char *)memory + (HASH_TABLE_CACHE_LINE -
+		(size_t)memory % HASH_TABLE_CACHE_LINE);
+}
+
+/* Oldest epoch a reader is still reading in, UINT64_MAX if none is */
+static uint64_t concurrent_oldest_epoch(hash_table_concurrent_t * table)
+{
+	uint64_t oldest = UINT64_MAX, epoch;
+	unsigned long i;
+
+	EPOCH_FENCE();
+
+	for (i = 0; i < table->max_readers; i++)
+	{
+		epoch = EPOCH_LOAD(table->readers[i].reader.epoch);
+		if (epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+
+	return oldest;
+}
+
+/* Free memory retired by a segment table, or the retired table itself
+* (leaving its objects, which live on in the table that replaced it) */
+static void concurrent_free_retired(hash_table_t * table,
+	hash_table_retire_t kind, hash_table_pool_t * pool, void * memory,
+	size_t count, size_t size)
+{
+	switch (kind)
+	{
+	case HASH_TABLE_RETIRE_TABLE:
+		table->free_function = NULL;
+		Hash_Table_Free(table);
+		break;
+	case HASH_TABLE_RETIRE_OBJECT:
+		if (table->free_function != NULL)
+			table->free_function(memory);
+		break;
+	case HASH_TABLE_RETIRE_NODE:
+		Hash_Table_Node_Free(table, pool, memory);
+		break;
+	default:
+		Hash_Table_Release(table, memory, count, size);
+		break;
+	}
+}
+
+/* Wait until every reader reading when it was called has finished */
+static void concurrent_synchronize(hash_table_concurrent_t * table)
+{
+	uint64_t epoch;
+
+	epoch = EPOCH_ADVANCE(table->global_epoch->epoch);
+	while (concurrent_oldest_epoch(table) < epoch)
+		sched_yield();
+}
+
+/* Queue memory on the segment until no reader can be using it. If there is
+* no memory to queue it with, wait for the readers instead.
+*/
+static void concurrent_retire(hash_table_segment_t * segment,
+	hash_table_t * table, hash_table_retire_t kind, hash_table_pool_t * pool,
+	void * memory, size_t count, size_t size)
+{
+	hash_table_concurrent_t * owner = segment->owner;
+	hash_table_retired_t * retired;
+
+	retired = owner->allocator.allocate(sizeof(hash_table_retired_t),
+		owner->allocator.context);
+	if (retired == NULL)
+	{
+		concurrent_synchronize(owner);
+		concurrent_free_retired(table, kind, pool, memory, count, size);
+		return;
+	}
+
+	retired->epoch = EPOCH_ADVANCE(owner->global_epoch->epoch);
+	retired->table = table;
+	retired->kind = kind;
+	retired->pool = pool;
+	retired->memory = memory;
+	retired->count = count;
+	retired->size = size;
+
+	if (segment->last_retired != NULL)
+		segment->last_retired->next = retired;
+	else
+		segment->first_retired = retired;
+	segment->last_retired = retired;
+}
+
+/* retire_function of the segment tables */
+static void concurrent_retire_function(void * context, hash_table_t * table,
+	hash_table_retire_t kind, hash_table_pool_t * pool, void * memory,
+	size_t count, size_t size)
+{
+	concurrent_retire(context, table, kind, pool, memory, count, size);
+}
+
+/* Free what the segment retired that no reader can still reach, all of it
+* if everything is true (no readers left) */
+static void concurrent_reclaim(hash_table_segment_t * segment, int everything)
+{
+	hash_table_concurrent_t * owner = segment->owner;
+	hash_table_retired_t * retired;
+	uint64_t oldest;
+
+	if (segment->first_retired == NULL)
+		return;
+
+	oldest = everything ? UINT64_MAX : concurrent_oldest_epoch(owner);
+
+	while (segment->first_retired != NULL &&
+		segment->first_retired->epoch <= oldest)
+	{
+		retired = segment->first_retired;
+		segment->first_retired = retired->next;
+
+		concurrent_free_retired(retired->table, retired->kind,
+			retired->pool, retired->memory, retired->count, retired->size);
+		owner->allocator.release(retired, sizeof(hash_table_retired_t),
+			owner->allocator.context);
+	}
+
+	if (segment->first_retired == NULL)
+		segment->last_retired = NULL;
+}
+
+/* Set table up as the segment's, marking lookups shared and routing its
+* retired memory to the segment when reads are lock free */
+static void concurrent_adopt(hash_table_segment_t * segment,
+	hash_table_t * table)
+{
+	hash_table_concurrent_t * owner = segment->owner;
+
+	table->shared_lookups = 1;
+
+	if (owner->lock_free)
+	{
+		table->retire_function = concurrent_retire_function;
+		table->retire_context = segment;
+
+		segment->grow_threshold = owner->max_load_factor > 0 ?
+			(unsigned long)(table->number_of_total_buckets *
+			owner->max_load_factor) + 1 : 0;
+	}
+}
+
+/* Lock free reads only: replace the segment's table with a copy twice the
+* size and retire the old one. Readers keep walking whichever copy they
+* started on. Called with the write lock held.
+* Return 1 if successful - 0 if failure (memory allocation), the old table
+* is then kept.
+*/
+static int concurrent_grow(hash_table_segment_t * segment)
+{
+	hash_table_t * table = segment->table, * new_table;
+	hash_table_config_t config = segment->owner->segment_config;
+	hash_table_bucket_t * bucket;
+	hash_table_fill_t * fill;
+	void ** objects;
+	unsigned long i;
+	uint32_t j;
+
+	if (table->number_of_total_buckets > ULONG_MAX / 2)
+		return 0;
+
+	/* the copy has no retire_function yet, evicting while copying would
+	* free objects readers can still reach through the old table */
+	config.number_of_buckets = table->number_of_total_buckets * 2;
+	config.max_entries = 0;
+	config.max_bytes = 0;
+
+	new_table = Hash_Table_Init_Config(&config);
+	if (new_table == NULL)
+		return 0;
+
+	for (i = 0; i < table->number_of_total_buckets; i++)
+	{
+		bucket = table->buckets[i];
+		if (bucket == NULL)
+			continue;
+
+		for (fill = bucket->first_fill; fill != NULL; fill = fill->next_fill)
+		{
+			if (!Hash_Table_Insert_Hashed(new_table, fill->object, fill->hash))
+				goto fail;
+
+			objects = HASH_TABLE_DUPLICATE_OBJECTS(&fill->duplicates);
+			for (j = 0; j < fill->duplicates.number_of_duplicates; j++)
+			{
+				if (!Hash_Table_Insert_Hashed(new_table, objects[j], fill->hash))
+					goto fail;
+			}
+		}
+	}
+
+	concurrent_adopt(segment, new_table);
+	new_table->max_entries = segment->owner->segment_config.max_entries;
+	new_table->max_bytes = segment->owner->segment_config.max_bytes;
+	HASH_TABLE_PUBLISH(segment->table, new_table);
+
+	concurrent_retire(segment, table, HASH_TABLE_RETIRE_TABLE, NULL, table, 1,
+		sizeof(hash_table_t));
+
+	return 1;
+
+	fail:
+	new_table->free_function = NULL;
+	Hash_Table_Free(new_table);
+	return 0;
+}
+
+/* Before a write with the lock held: grow a lock free segment that has
+* reached its threshold. Running out of memory only delays the grow. */
+static void concurrent_write_begin(hash_table_segment_t * segment)
+{
+	hash_table_t * table = segment->table;
+
+	if (segment->grow_threshold != 0 && table->number_of_buckets_filled +
+		table->number_of_collisions >= segment->grow_threshold)
+		concurrent_grow(segment);
+}
+
+/* Free the first number_of_segments segments and then table */
+static void concurrent_free(hash_table_concurrent_t * table,
+	unsigned long number_of_segments)
+{
+	unsigned long i;
+	hash_table_segment_t * segment;
+	hash_table_allocator_t allocator = table->allocator;
+
+	for (i = 0; i < number_of_segments; i++)
+	{
+		segment = &table->segments[i].segment;
+		concurrent_reclaim(segment, 1);
+		Hash_Table_Free(segment->table);
+		pthread_rwlock_destroy(&segment->lock);
+	}
+
+	if (table->segment_memory != NULL)
+		allocator.release(table->segment_memory, table->segment_memory_size,
+			allocator.context);
+
+	if (table->reader_memory != NULL)
+		allocator.release(table->reader_memory, table->reader_memory_size,
+			allocator.context);
+
+	allocator.release(table, sizeof(hash_table_concurrent_t),
+		allocator.context);
+}
+
+/* Shared by both kinds of init, max_readers is 0 unless lock_free */
+static hash_table_concurrent_t * concurrent_init(
+	hash_table_config_t * config, unsigned long number_of_segments,
+	int lock_free, unsigned long max_readers)
+{
+	hash_table_concurrent_t * new_table;
+	hash_table_allocator_t allocator;
+	hash_table_config_t segment_config;
+	hash_table_segment_t * segment;
+	hash_table_t * segment_table;
+	unsigned long rounded_segments = 1, i;
+	unsigned int segment_bits = 0;
+
+	assert(config != NULL);
+	assert(number_of_segments > 0);
+
+	while (rounded_segments < number_of_segments && segment_bits < 32)
+	{
+		rounded_segments *= 2;
+		segment_bits++;
+	}
+
+	allocator = Hash_Table_Allocator_Or_Default(&config->allocator);
+
+	new_table = allocator.allocate(sizeof(hash_table_concurrent_t),
+		allocator.context);
+	if (new_table == NULL)
+		return NULL;
+
+	new_table->allocator = allocator;
+	new_table->number_of_segments = rounded_segments;
+	new_table->segment_shift = 64 - segment_bits;
+	new_table->lock_free = lock_free;
+	new_table->max_readers = max_readers;
+
+	/* one extra line to align the segments to */
+	new_table->segment_memory_size = rounded_segments *
+		sizeof(hash_table_padded_segment_t) + HASH_TABLE_CACHE_LINE;
+	new_table->segment_memory = allocator.allocate(
+		new_table->segment_memory_size, allocator.context);
+	if (new_table->segment_memory == NULL)
+	{
+		concurrent_free(new_table, 0);
+		return NULL;
+	}
+	new_table->segments = concurrent_align(new_table->segment_memory);
+
+	if (lock_free)
+	{
+		/* the epoch on the first aligned line, then the readers */
+		new_table->reader_memory_size = sizeof(hash_table_epoch_t) +
+			max_readers * sizeof(hash_table_reader_t) + HASH_TABLE_CACHE_LINE;
+		new_table->reader_memory = allocator.allocate(
+			new_table->reader_memory_size, allocator.context);
+		if (new_table->reader_memory == NULL)
+		{
+			concurrent_free(new_table, 0);
+			return NULL;
+		}
+
+		new_table->global_epoch = concurrent_align(new_table->reader_memory);
+		new_table->global_epoch->epoch = 1;
+		new_table->readers = (hash_table_reader_t *)(new_table->global_epoch +
+			1);
+	}
+
+	segment_config = *config;
+	segment_config.allocator = allocator;
+	if (config->hash_function == NULL && config->full_hash_function == NULL)
+		segment_config.full_hash_function = Hash_Table_Hash_Wy;
+	if (config->key_function != NULL && config->key_hash_function == NULL)
+		segment_config.key_hash_function = Hash_Table_Hash_Bytes;
+	segment_config.number_of_buckets = (config->number_of_buckets +
+		rounded_segments - 1) / rounded_segments;
+	if (segment_config.number_of_buckets == 0)
+		segment_config.number_of_buckets = 1;
+
+	/* cache limits are shared out the same way */
+	segment_config.max_entries = (config->max_entries + rounded_segments - 1) /
+		rounded_segments;
+	segment_config.max_bytes = (config->max_bytes + rounded_segments - 1) /
+		rounded_segments;
+
+	/* a lock free segment grows by copying, never in place */
+	new_table->max_load_factor = config->max_load_factor;
+	if (lock_free)
+		segment_config.max_load_factor = 0;
+	new_table->segment_config = segment_config;
+
+	for (i = 0; i < rounded_segments; i++)
+	{
+		segment = &new_table->segments[i].segment;
+		segment->owner = new_table;
+
+		segment_table = Hash_Table_Init_Config(&segment_config);
+		if (segment_table == NULL)
+		{
+			concurrent_free(new_table, i);
+			return NULL;
+		}
+
+		if (pthread_rwlock_init(&segment->lock, NULL) != 0)
+		{
+			Hash_Table_Free(segment_table);
+			concurrent_free(new_table, i);
+			return NULL;
+		}
+
+		segment->table = segment_table;
+		concurrent_adopt(segment, segment_table);
+	}
+
+	return new_table;
+}
+
+/* Create a table of number_of_segments segments (rounded up to a power of
+* 2), each set up from config with config->number_of_buckets split between
+* them.
+* Returns NULL if failure (memory allocation or lock creation).
+*/
+hash_table_concurrent_t * Hash_Table_Concurrent_Init(
+	hash_table_config_t * config, unsigned long number_of_segments)
+{
+	return concurrent_init(config, number_of_segments, 0, 0);
+}
+
+/* Hash_Table_Concurrent_Init for a table that is also read without locks by
+* up to max_readers threads at a time.
+* Returns NULL if failure (memory allocation, lock creation or no atomics).
+*/
+hash_table_concurrent_t * Hash_Table_Concurrent_Init_Lock_Free(
+	hash_table_config_t * config, unsigned long number_of_segments,
+	unsigned long max_readers)
+{
+	assert(config != NULL);
+	assert(max_readers > 0);
+
+	/* every link a reader follows has to be a single pointer, and a stored
+	* key is freed along with its fill, not retired */
+	if (!HASH_TABLE_ATOMICS || config->storage != HASH_TABLE_STORAGE_CHAINED ||
+		config->layout != HASH_TABLE_LAYOUT_POINTERS || config->store_keys)
+		return NULL;
+
+	return concurrent_init(config, number_of_segments, 1, max_readers);
+}
+
+/* Register the calling thread as one of a lock free table's readers.
+* Returns NULL if max_readers are already registered.
+*/
+hash_table_reader_t * Hash_Table_Concurrent_Reader(
+	hash_table_concurrent_t * table)
+{
+	unsigned long i;
+
+	assert(table != NULL);
+	assert(table->lock_free);
+
+	for (i = 0; i < table->max_readers; i++)
+	{
+		if (READER_CLAIM(table->readers[i].reader.in_use))
+			return &table->readers[i];
+	}
+
+	return NULL;
+}
+
+/* Give back a reader from Hash_Table_Concurrent_Reader */
+void Hash_Table_Concurrent_Reader_Release(hash_table_concurrent_t * table,
+	hash_table_reader_t * reader)
+{
+	assert(table != NULL);
+	assert(reader != NULL);
+	assert(reader->reader.epoch == 0);
+
+	(void)table;
+	HASH_TABLE_PUBLISH(reader->reader.in_use, 0);
+}
+
+/* Start a lock free lookup: announce the epoch we read in, after which
+* nothing we can reach is freed until concurrent_read_exit */
+static void concurrent_read_enter(hash_table_concurrent_t * table,
+	hash_table_reader_t * reader)
+{
+	EPOCH_STORE(reader->reader.epoch, EPOCH_LOAD(table->global_epoch->epoch));
+	EPOCH_FENCE();
+}
+
+static void concurrent_read_exit(hash_table_reader_t * reader)
+{
+	HASH_TABLE_PUBLISH(reader->reader.epoch, 0);
+}
+
+/* Copy the object found by a lookup and its duplicates into records */
+static unsigned long concurrent_copy(void * object,
+	hash_table_cursor_t * cursor, void ** records,
+	unsigned long max_num_records)
+{
+	unsigned long number_of_duplicates;
+
+	records[0] = object;
+
+	number_of_duplicates = cursor->number_remaining;
+	if (number_of_duplicates > max_num_records - 1)
+		number_of_duplicates = max_num_records - 1;
+
+	memcpy(records + 1, cursor->next_duplicate,
+		number_of_duplicates * sizeof(void *));
+
+	return number_of_duplicates + 1;
+}
+
+/* Hash_Table_First_Match without any lock.
+* Returns NULL if nothing found.
+*/
+void * Hash_Table_Concurrent_Read_First_Match(hash_table_concurrent_t * table,
+	hash_table_reader_t * reader, char * pattern)
+{
+	uint64_t hash;
+	hash_table_key_t key;
+	hash_table_segment_t * segment;
+	hash_table_cursor_t cursor;
+	void * object;
+
+	assert(table != NULL);
+	assert(reader != NULL);
+	assert(pattern != NULL);
+
+	hash = concurrent_hash(table, pattern);
+	segment = concurrent_segment(table, hash);
+	pattern = HASH_TABLE_PATTERN(&table->segment_config, pattern, &key);
+
+	concurrent_read_enter(table, reader);
+	object = Hash_Table_Match_Cursor_Hashed(HASH_TABLE_READ(segment->table),
+		pattern, hash, &cursor);
+	concurrent_read_exit(reader);
+
+	return object;
+}
+
+/* Hash_Table_Match_Into without any lock.
+* Returns the number copied, 0 if nothing found.
+*/
+unsigned long Hash_Table_Concurrent_Read_Match_Into(
+	hash_table_concurrent_t * table, hash_table_reader_t * reader,
+	char * pattern, void ** records, unsigned long max_num_records)
+{
+	uint64_t hash;
+	hash_table_key_t key;
+	hash_table_segment_t * segment;
+	hash_table_cursor_t cursor;
+	void * object;
+	unsigned long number_of_objects_found = 0;
+
+	assert(table != NULL);
+	assert(reader != NULL);
+	assert(pattern != NULL);
+	assert(records != NULL || max_num_records == 0);
+
+	if (max_num_records == 0)
+		return 0;
+
+	hash = concurrent_hash(table, pattern);
+	segment = concurrent_segment(table, hash);
+	pattern = HASH_TABLE_PATTERN(&table->segment_config, pattern, &key);
+
+	concurrent_read_enter(table, reader);
+	object = Hash_Table_Match_Cursor_Hashed(HASH_TABLE_READ(segment->table),
+		pattern, hash, &cursor);
+	if (object != NULL)
+		number_of_objects_found = concurrent_copy(object, &cursor, records,
+			max_num_records);
+	concurrent_read_exit(reader);
+
+	return number_of_objects_found;
+}
+
+/* Free table and contained objects. No other thread may be using it. */
+void Hash_Table_Concurrent_Free(hash_table_concurrent_t * table)
+{
+	assert(table != NULL);
+
+	concurrent_free(table, table->number_of_segments);
+}
+
+/* Hash_Table_Insert under the segment's write lock.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Concurrent_Insert(hash_table_concurrent_t * table,
+	void * object, char * pattern)
+{
+	uint64_t hash;
+	hash_table_key_t key;
+	hash_table_segment_t * segment;
+	int result;
+
+	assert(table != NULL);
+	assert(object != NULL);
+	assert(pattern != NULL);
+
+	/* hash outside the lock */
+	hash = concurrent_hash(table, pattern);
+	segment = concurrent_segment(table, hash);
+
+	pthread_rwlock_wrlock(&segment->lock);
+	concurrent_write_begin(segment);
+	HASH_TABLE_INSERT_KEY(segment->table, pattern, &key);
+	result = Hash_Table_Insert_Hashed(segment->table, object, hash);
+	concurrent_reclaim(segment, 0);
+	pthread_rwlock_unlock(&segment->lock);
+
+	return result;
+}
+
+/* Hash_Table_Insert_No_Duplicate, with the check and the insert under one
+* write lock.
+* Return 1 if successful, 0 already exists, -1 if failure (memory
+* allocation).
+*/
+int Hash_Table_Concurrent_Insert_No_Duplicate(
+	hash_table_concurrent_t * table, void * object, char * pattern,
+	void ** found_duplicate)
+{
+	uint64_t hash;
+	hash_table_key_t key;
+	hash_table_segment_t * segment;
+	void * object_temp;
+	int result;
+
+	assert(table != NULL);
+	assert(object != NULL);
+	assert(pattern != NULL);
+
+	hash = concurrent_hash(table, pattern);
+	segment = concurrent_segment(table, hash);
+
+	pthread_rwlock_wrlock(&segment->lock);
+	concurrent_write_begin(segment);
+
+	/* the check and the insert are one probe */
+	HASH_TABLE_INSERT_KEY(segment->table, pattern, &key);
+	object_temp = Hash_Table_Find_Or_Insert_Hashed(segment->table, NULL, hash,
+		object, NULL, NULL, &result);
+	if (result == 0)
+	{
+		/* already exists */
+		*found_duplicate = object_temp;
+	}
+
+	concurrent_reclaim(segment, 0);
+	pthread_rwlock_unlock(&segment->lock);
+
+	return result;
+}
+
+/* Hash_Table_Remove under the segment's write lock. On a lock free table
+* this waits for the readers that may still see object, so the caller can
+* free it as soon as it returns.
+* Returns 1 if it was removed, 0 if it was not in the table, -1 if failure
+* (memory allocation).
+*/
+int Hash_Table_Concurrent_Remove(hash_table_concurrent_t * table,
+	char * pattern, void * object)
+{
+	uint64_t hash;
+	hash_table_key_t key;
+	hash_table_segment_t * segment;
+	int result;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+	assert(object != NULL);
+
+	hash = concurrent_hash(table, pattern);
+	segment = concurrent_segment(table, hash);
+	pattern = HASH_TABLE_PATTERN(&table->segment_config, pattern, &key);
+
+	pthread_rwlock_wrlock(&segment->lock);
+	result = Hash_Table_Remove_Hashed(segment->table, pattern, hash, object);
+	concurrent_reclaim(segment, 0);
+	pthread_rwlock_unlock(&segment->lock);
+
+	if (result == 1 && table->lock_free)
+		concurrent_synchronize(table);
+
+	return result;
+}
+
+/* Hash_Table_Remove_Key under the segment's write lock. On a lock free table
+* the objects only reach free_function once no reader can see them.
+* Returns the number of objects removed.
+*/
+unsigned long Hash_Table_Concurrent_Remove_Key(
+	hash_table_concurrent_t * table, char * pattern)
+{
+	uint64_t hash;
+	hash_table_key_t key;
+	hash_table_segment_t * segment;
+	unsigned long number_removed;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+
+	hash = concurrent_hash(table, pattern);
+	segment = concurrent_segment(table, hash);
+	pattern = HASH_TABLE_PATTERN(&table->segment_config, pattern, &key);
+
+	pthread_rwlock_wrlock(&segment->lock);
+	number_removed = Hash_Table_Remove_Key_Hashed(segment->table, pattern,
+		hash);
+	concurrent_reclaim(segment, 0);
+	pthread_rwlock_unlock(&segment->lock);
+
+	return number_removed;
+}
+
+/* Hash_Table_First_Match under the segment's read lock.
+* Returns NULL if nothing found.
+*/
+void * Hash_Table_Concurrent_First_Match(hash_table_concurrent_t * table,
+	char * pattern)
+{
+	uint64_t hash;
+	hash_table_key_t key;
+	hash_table_segment_t * segment;
+	hash_table_cursor_t cursor;
+	void * object;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+
+	hash = concurrent_hash(table, pattern);
+	segment = concurrent_segment(table, hash);
+	pattern = HASH_TABLE_PATTERN(&table->segment_config, pattern, &key);
+
+	pthread_rwlock_rdlock(&segment->lock);
+	object = Hash_Table_Match_Cursor_Hashed(segment->table, pattern, hash,
+		&cursor);
+	pthread_rwlock_unlock(&segment->lock);
+
+	return object;
+}
+
+/* Hash_Table_Match_Into under the segment's read lock.
+* Returns the number copied, 0 if nothing found.
+*/
+unsigned long Hash_Table_Concurrent_Match_Into(
+	hash_table_concurrent_t * table, char * pattern, void ** records,
+	unsigned long max_num_records)
+{
+	uint64_t hash;
+	hash_table_key_t key;
+	hash_table_segment_t * segment;
+	hash_table_cursor_t cursor;
+	void * object;
+	unsigned long number_of_objects_found = 0;
+
+	assert(table != NULL);
+	assert(pattern != NULL);
+	assert(records != NULL || max_num_records == 0);
+
+	if (max_num_records == 0)
+		return 0;
+
+	hash = concurrent_hash(table, pattern);
+	segment = concurrent_segment(table, hash);
+	pattern = HASH_TABLE_PATTERN(&table->segment_config, pattern, &key);
+
+	pthread_rwlock_rdlock(&segment->lock);
+
+	object = Hash_Table_Match_Cursor_Hashed(segment->table, pattern, hash,
+		&cursor);
+	if (object != NULL)
+		number_of_objects_found = concurrent_copy(object, &cursor, records,
+			max_num_records);
+
+	pthread_rwlock_unlock(&segment->lock);
+
+	return number_of_objects_found;
+}
+
+/* Sum of the segments' counters, each segment read under its lock */
+void Hash_Table_Concurrent_Counters(hash_table_concurrent_t * table,
+	unsigned long * number_of_buckets_filled,
+	unsigned long * number_of_collisions,
+	unsigned long * number_of_duplicates)
+{
+	unsigned long i, buckets_filled = 0, collisions = 0, duplicates = 0;
+	hash_table_segment_t * segment;
+
+	assert(table != NULL);
+
+	for (i = 0; i < table->number_of_segments; i++)
+	{
+		segment = &table->segments[i].segment;
+
+		pthread_rwlock_rdlock(&segment->lock);
+		buckets_filled += segment->table->number_of_buckets_filled;
+		collisions += segment->table->number_of_collisions;
+		duplicates += segment->table->number_of_duplicates;
+		pthread_rwlock_unlock(&segment->lock);
+	}
+
+	if (number_of_buckets_filled != NULL)
+		*number_of_buckets_filled = buckets_filled;
+	if (number_of_collisions != NULL)
+		*number_of_collisions = collisions;
+	if (number_of_duplicates != NULL)
+		*number_of_duplicates = duplicates;
+}
+
+/* Returns number of bytes allocated for all segments, not including objects
+* table holds.
+*/
+unsigned long Hash_Table_Concurrent_Size(hash_table_concurrent_t * table)
+{
+	unsigned long i, table_size;
+	hash_table_segment_t * segment;
+
+	assert(table != NULL);
+
+	table_size = sizeof(hash_table_concurrent_t) +
+		table->segment_memory_size;
+
+	for (i = 0; i < table->number_of_segments; i++)
+	{
+		segment = &table->segments[i].segment;
+
+		pthread_rwlock_rdlock(&segment->lock);
+		table_size += Hash_Table_Size(segment->table);
+		pthread_rwlock_unlock(&segment->lock);
+	}
+
+	return table_size;
+}
@@ -0,0 +1,216 @@
+/* hash_table_concurrent.h - Thread safe hash table made of independently
+* locked segments. Each key belongs to one segment, picked from its full
+* hash, and each segment is an ordinary hash_table_t behind its own
+* reader-writer lock. Lookups take the lock shared, so readers never wait on
+* each other and writers only hold up the one segment they change. Each
+* segment keeps its own counters, on its own cache lines.
+*
+* Tables made with Hash_Table_Concurrent_Init_Lock_Free can also be read
+* with no lock at all. Writers publish each change with a release store and
+* never change in place anything a reader may be looking at; what they swap
+* out is retired and only freed once every reader that might hold it has
+* finished (epoch based reclamation). Each reading thread registers once
+* with Hash_Table_Concurrent_Reader and passes that to the Read_ lookups.
+*
+* Needs POSIX threads (link with -lpthread). Lock free reads need GCC style
+* __atomic builtins.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_CONCURRENT_H
+#define __HASH_TABLE_CONCURRENT_H
+
+#include <pthread.h>
+
+#include "hash_table.h"
+
+#define HASH_TABLE_CACHE_LINE 64
+
+/* Memory waiting for the readers that might be using it to finish */
+typedef struct hash_table_retired_t {
+	struct hash_table_retired_t * next;
+	uint64_t epoch; /* free once no reader is in an older epoch */
+	hash_table_t * table; /* owner of memory */
+	hash_table_retire_t kind;
+	hash_table_pool_t * pool; /* pool memory goes back to, NULL if none */
+	void * memory; /* table itself for HASH_TABLE_RETIRE_TABLE */
+	size_t count;
+	size_t size;
+} hash_table_retired_t;
+
+typedef struct hash_table_segment_t {
+	pthread_rwlock_t lock;
+	hash_table_t * table;
+
+	/* Lock free reads only: retired memory, oldest first, and the fill
+	* count at which the segment is copied into one twice the size */
+	hash_table_retired_t * first_retired;
+	hash_table_retired_t * last_retired;
+	unsigned long grow_threshold;
+	struct hash_table_concurrent_t * owner;
+} hash_table_segment_t;
+
+/* A segment rounded up to whole cache lines, so a lock taken on one
+* segment never bounces the line of its neighbour */
+typedef union hash_table_padded_segment_t {
+	hash_table_segment_t segment;
+	char padding[(sizeof(hash_table_segment_t) + HASH_TABLE_CACHE_LINE - 1) /
+		HASH_TABLE_CACHE_LINE * HASH_TABLE_CACHE_LINE];
+} hash_table_padded_segment_t;
+
+/* The epoch a lock free reader is reading in (0 when it is not), on a
+* cache line of its own */
+typedef union hash_table_reader_t {
+	struct {
+		uint64_t epoch;
+		int in_use;
+	} reader;
+	char padding[HASH_TABLE_CACHE_LINE];
+} hash_table_reader_t;
+
+/* The current epoch, bumped on every retire, on a cache line of its own */
+typedef union hash_table_epoch_t {
+	uint64_t epoch;
+	char padding[HASH_TABLE_CACHE_LINE];
+} hash_table_epoch_t;
+
+typedef struct hash_table_concurrent_t {
+	hash_table_padded_segment_t * segments; /* cache line aligned */
+	void * segment_memory; /* what segments was carved from */
+	size_t segment_memory_size;
+	unsigned long number_of_segments; /* a power of 2 */
+	unsigned int segment_shift; /* 64 - log2(number_of_segments) */
+	hash_table_allocator_t allocator;
+
+	/* Lock free reads only, see Hash_Table_Concurrent_Init_Lock_Free */
+	int lock_free;
+	hash_table_epoch_t * global_epoch; /* cache line aligned */
+	hash_table_reader_t * readers; /* max_readers, after global_epoch */
+	unsigned long max_readers;
+	void * reader_memory; /* what global_epoch and readers were carved from */
+	size_t reader_memory_size;
+	hash_table_config_t segment_config; /* to make grown segments with */
+	double max_load_factor; /* of each segment, before it is copied */
+} hash_table_concurrent_t;
+
+/* Create a table of number_of_segments segments (rounded up to a power of
+* 2), each set up from config with config->number_of_buckets and the cache
+* limits split between them. The lookups of every segment are marked as
+* shared (see hash_table_t.shared_lookups), so an incremental resize is
+* only carried on by inserts and cache mode lookups set no reference bits:
+* segments then evict in roughly insertion order.
+* Returns NULL if failure (memory allocation or lock creation).
+*/
+hash_table_concurrent_t * Hash_Table_Concurrent_Init(
+	hash_table_config_t * config, unsigned long number_of_segments);
+
+/* Hash_Table_Concurrent_Init for a table that is also read without locks by
+* up to max_readers threads at a time. config must be for a chained table
+* with the pointer layout, not storing keys. Segments grow past
+* config->max_load_factor by being copied whole (once readers are off the
+* old copy it is freed), other resizing is not done. Locks are still taken
+* by writers and by the locked lookups, which can be mixed with the lock
+* free ones.
+* Returns NULL if failure (memory allocation, lock creation or no atomics).
+*/
+hash_table_concurrent_t * Hash_Table_Concurrent_Init_Lock_Free(
+	hash_table_config_t * config, unsigned long number_of_segments,
+	unsigned long max_readers);
+
+/* Register the calling thread as one of a lock free table's readers.
+* Returns NULL if max_readers are already registered.
+*/
+hash_table_reader_t * Hash_Table_Concurrent_Reader(
+	hash_table_concurrent_t * table);
+
+/* Give back a reader from Hash_Table_Concurrent_Reader */
+void Hash_Table_Concurrent_Reader_Release(hash_table_concurrent_t * table,
+	hash_table_reader_t * reader);
+
+/* Hash_Table_First_Match without any lock, reader must be the calling
+* thread's. Returns NULL if nothing found.
+*/
+void * Hash_Table_Concurrent_Read_First_Match(hash_table_concurrent_t * table,
+	hash_table_reader_t * reader, char * pattern);
+
+/* Hash_Table_Match_Into without any lock, reader must be the calling
+* thread's. Returns the number copied, 0 if nothing found.
+*/
+unsigned long Hash_Table_Concurrent_Read_Match_Into(
+	hash_table_concurrent_t * table, hash_table_reader_t * reader,
+	char * pattern, void ** records, unsigned long max_num_records);
+
+/* Free table and contained objects. No other thread may be using it. */
+void Hash_Table_Concurrent_Free(hash_table_concurrent_t * table);
+
+/* Hash_Table_Insert under the segment's write lock.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Concurrent_Insert(hash_table_concurrent_t * table,
+	void * object, char * pattern);
+
+/* Hash_Table_Insert_No_Duplicate, with the check and the insert under one
+* write lock so two threads cannot both add the same pattern.
+* Return 1 if successful, 0 already exists, -1 if failure (memory
+* allocation).
+*/
+int Hash_Table_Concurrent_Insert_No_Duplicate(
+	hash_table_concurrent_t * table, void * object, char * pattern,
+	void ** found_duplicate);
+
+/* Hash_Table_Remove under the segment's write lock. On a lock free table
+* this waits for the readers that may still see object, so the caller can
+* free it as soon as it returns.
+* Returns 1 if it was removed, 0 if it was not in the table, -1 if failure
+* (memory allocation).
+*/
+int Hash_Table_Concurrent_Remove(hash_table_concurrent_t * table,
+	char * pattern, void * object);
+
+/* Hash_Table_Remove_Key under the segment's write lock. On a lock free table
+* the objects only reach free_function once no reader can see them.
+* Returns the number of objects removed.
+*/
+unsigned long Hash_Table_Concurrent_Remove_Key(
+	hash_table_concurrent_t * table, char * pattern);
+
+/* Hash_Table_First_Match under the segment's read lock.
+* Returns NULL if nothing found.
+*/
+void * Hash_Table_Concurrent_First_Match(hash_table_concurrent_t * table,
+	char * pattern);
+
+/* Hash_Table_Match_Into under the segment's read lock. The copy is taken
+* while the lock is held, so records stays valid after it is dropped.
+* Returns the number copied, 0 if nothing found.
+*/
+unsigned long Hash_Table_Concurrent_Match_Into(
+	hash_table_concurrent_t * table, char * pattern, void ** records,
+	unsigned long max_num_records);
+
+/* Sum of the segments' counters, each segment read under its lock. Any of
+* the out pointers may be NULL. */
+void Hash_Table_Concurrent_Counters(hash_table_concurrent_t * table,
+	unsigned long * number_of_buckets_filled,
+	unsigned long * number_of_collisions,
+	unsigned long * number_of_duplicates);
+
+/* Returns number of bytes allocated for all segments, not including objects
+* table holds.
+*/
+unsigned long Hash_Table_Concurrent_Size(hash_table_concurrent_t * table);
+
+#endif
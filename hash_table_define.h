@@ -0,0 +1,358 @@
+/* hash_table_define.h - Header only, type specialized hash tables.
+* HASH_TABLE_DEFINE(name, key_type, value_type, hash, equal) writes out a
+* table keeping keys and values by value in its slots, with hash and equal
+* called directly, so the compiler sees (and can inline) all of a probe.
+* The algorithm is the one the flat storage engine uses: a power of 2 slot
+* array, Robin Hood linear probing and the full hash stored in each slot, so
+* equal only runs on slots whose hash already matches.
+*
+* hash(key) returns a uint64_t and equal(key1, key2) non zero when the keys
+* are the same; both take keys by value and may be functions or macros.
+* For example:
+*
+*	#define ID_HASH(id) Hash_Table_Hash_Mix(id)
+*	#define ID_EQUAL(id1, id2) ((id1) == (id2))
+*	HASH_TABLE_DEFINE(Record_Table, uint64_t, record_t, ID_HASH, ID_EQUAL)
+*
+* makes record_t Record_Table_t with Record_Table_Init, Record_Table_Free,
+* Record_Table_Insert, Record_Table_Find, Record_Table_Remove,
+* Record_Table_Count and Record_Table_Size. Everything is static, so each
+* file that uses a table defines it itself.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_DEFINE_H
+#define __HASH_TABLE_DEFINE_H
+
+#include "hash_table.h"
+
+/* Static and, where the compiler has a way to say it, inline, so unused
+* generated functions draw no warnings */
+#if defined(__GNUC__)
+#define HASH_TABLE_GENERATED static __inline__
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#define HASH_TABLE_GENERATED static inline
+#else
+#define HASH_TABLE_GENERATED static
+#endif
+
+/* Set in every stored hash, a slot is empty when its hash is 0 */
+#define HASH_TABLE_OCCUPIED ((uint64_t)1 << 63)
+
+#define HASH_TABLE_GENERATED_MIN_SLOTS 8
+
+/* grow once 7/8 of the slots are taken */
+#define HASH_TABLE_GENERATED_THRESHOLD(number_of_slots) \
+	((number_of_slots) - (number_of_slots) / 8)
+
+HASH_TABLE_GENERATED void * hash_table_generated_allocate(size_t size,
+	void * context)
+{
+	(void)context;
+
+	return calloc(1, size);
+}
+
+HASH_TABLE_GENERATED void hash_table_generated_release(void * memory,
+	size_t size, void * context)
+{
+	(void)size;
+	(void)context;
+
+	free(memory);
+}
+
+#define HASH_TABLE_DEFINE(name, key_type, value_type, hash, equal) \
+\
+typedef struct name##_slot_t { \
+	uint64_t hash; /* with HASH_TABLE_OCCUPIED set, 0 if empty */ \
+	key_type key; \
+	value_type value; \
+} name##_slot_t; \
+\
+typedef struct name##_t { \
+	name##_slot_t * slots; \
+	unsigned long number_of_slots; /* a power of 2 */ \
+	unsigned long number_of_entries; \
+	unsigned long grow_threshold; /* entries at which slots is doubled */ \
+	hash_table_allocator_t allocator; \
+} name##_t; \
+\
+HASH_TABLE_GENERATED name##_slot_t * name##_Allocate_Slots(name##_t * table, \
+	unsigned long number_of_slots) \
+{ \
+	if ((size_t)number_of_slots > (size_t)-1 / sizeof(name##_slot_t)) \
+		return NULL; \
+\
+	return (name##_slot_t *)table->allocator.allocate( \
+		(size_t)number_of_slots * sizeof(name##_slot_t), \
+		table->allocator.context); \
+} \
+\
+/* Robin Hood placement of an entry whose key is not in slots yet */ \
+HASH_TABLE_GENERATED void name##_Place(name##_slot_t * slots, \
+	unsigned long mask, name##_slot_t entry, unsigned long index, \
+	unsigned long distance) \
+{ \
+	name##_slot_t temp; \
+	unsigned long slot_distance; \
+\
+	while (slots[index].hash != 0) \
+	{ \
+		slot_distance = (index - (unsigned long)(slots[index].hash & mask)) & \
+			mask; \
+		if (slot_distance < distance) \
+		{ \
+			temp = slots[index]; \
+			slots[index] = entry; \
+			entry = temp; \
+			distance = slot_distance; \
+		} \
+\
+		index = (index + 1) & mask; \
+		distance++; \
+	} \
+\
+	slots[index] = entry; \
+} \
+\
+/* Move everything into a slot array twice the size. \
+* Return 1 if successful - 0 if failure (memory allocation). */ \
+HASH_TABLE_GENERATED int name##_Grow(name##_t * table) \
+{ \
+	name##_slot_t * new_slots; \
+	unsigned long i, number_of_slots = table->number_of_slots * 2; \
+\
+	if (number_of_slots < table->number_of_slots) \
+		return 0; \
+\
+	new_slots = name##_Allocate_Slots(table, number_of_slots); \
+	if (new_slots == NULL) \
+		return 0; \
+\
+	for (i = 0; i < table->number_of_slots; i++) \
+	{ \
+		if (table->slots[i].hash != 0) \
+			name##_Place(new_slots, number_of_slots - 1, table->slots[i], \
+				(unsigned long)(table->slots[i].hash & (number_of_slots - 1)), \
+				0); \
+	} \
+\
+	table->allocator.release(table->slots, (size_t)table->number_of_slots * \
+		sizeof(name##_slot_t), table->allocator.context); \
+	table->slots = new_slots; \
+	table->number_of_slots = number_of_slots; \
+	table->grow_threshold = HASH_TABLE_GENERATED_THRESHOLD(number_of_slots); \
+\
+	return 1; \
+} \
+\
+/* Index of the slot holding key, number_of_slots if none. When there is \
+* none, *end is where the walk stopped and *end_distance how far that is \
+* from key's home. */ \
+HASH_TABLE_GENERATED unsigned long name##_Locate(name##_t * table, \
+	key_type key, uint64_t key_hash, unsigned long * end, \
+	unsigned long * end_distance) \
+{ \
+	name##_slot_t * slots = table->slots; \
+	unsigned long mask = table->number_of_slots - 1, \
+		index = (unsigned long)(key_hash & mask), distance; \
+\
+	for (distance = 0; slots[index].hash != 0; distance++) \
+	{ \
+		if (slots[index].hash == key_hash && equal(slots[index].key, key)) \
+			return index; \
+\
+		/* key would have taken this slot had it been inserted */ \
+		if (((index - (unsigned long)(slots[index].hash & mask)) & mask) < \
+			distance) \
+			break; \
+\
+		index = (index + 1) & mask; \
+	} \
+\
+	*end = index; \
+	*end_distance = distance; \
+	return table->number_of_slots; \
+} \
+\
+/* Returns a new table with room for number_of_slots (rounded up to a power \
+* of 2) before it first grows. allocator may be NULL for calloc / free. \
+* Returns NULL if failure (memory allocation). */ \
+HASH_TABLE_GENERATED name##_t * name##_Init(unsigned long number_of_slots, \
+	hash_table_allocator_t * allocator) \
+{ \
+	name##_t * new_table; \
+	hash_table_allocator_t table_allocator; \
+	unsigned long rounded_slots = HASH_TABLE_GENERATED_MIN_SLOTS; \
+\
+	table_allocator.allocate = hash_table_generated_allocate; \
+	table_allocator.release = hash_table_generated_release; \
+	table_allocator.context = NULL; \
+	if (allocator != NULL && allocator->allocate != NULL) \
+		table_allocator = *allocator; \
+\
+	while (rounded_slots < number_of_slots && \
+		rounded_slots * 2 > rounded_slots) \
+		rounded_slots *= 2; \
+\
+	new_table = (name##_t *)table_allocator.allocate(sizeof(name##_t), \
+		table_allocator.context); \
+	if (new_table == NULL) \
+		return NULL; \
+\
+	new_table->allocator = table_allocator; \
+	new_table->number_of_entries = 0; \
+	new_table->number_of_slots = rounded_slots; \
+	new_table->grow_threshold = HASH_TABLE_GENERATED_THRESHOLD(rounded_slots); \
+\
+	new_table->slots = name##_Allocate_Slots(new_table, rounded_slots); \
+	if (new_table->slots == NULL) \
+	{ \
+		table_allocator.release(new_table, sizeof(name##_t), \
+			table_allocator.context); \
+		return NULL; \
+	} \
+\
+	return new_table; \
+} \
+\
+/* Free table. Keys and values are dropped as they are, anything they point \
+* to is the caller's. */ \
+HASH_TABLE_GENERATED void name##_Free(name##_t * table) \
+{ \
+	hash_table_allocator_t allocator; \
+\
+	assert(table != NULL); \
+\
+	allocator = table->allocator; \
+	allocator.release(table->slots, (size_t)table->number_of_slots * \
+		sizeof(name##_slot_t), allocator.context); \
+	allocator.release(table, sizeof(name##_t), allocator.context); \
+} \
+\
+/* Copy key and value into the table unless key is already there, in which \
+* case found_duplicate (if not NULL) points at its value. \
+* Return 1 if successful, 0 already exists, -1 if failure (memory \
+* allocation). */ \
+HASH_TABLE_GENERATED int name##_Insert(name##_t * table, key_type key, \
+	value_type value, value_type ** found_duplicate) \
+{ \
+	name##_slot_t entry; \
+	unsigned long index, end = 0, end_distance = 0; \
+\
+	assert(table != NULL); \
+\
+	entry.hash = (uint64_t)(hash(key)) | HASH_TABLE_OCCUPIED; \
+\
+	index = name##_Locate(table, key, entry.hash, &end, &end_distance); \
+	if (index != table->number_of_slots) \
+	{ \
+		/* already exists */ \
+		if (found_duplicate != NULL) \
+			*found_duplicate = &table->slots[index].value; \
+		return 0; \
+	} \
+\
+	if (table->number_of_entries >= table->grow_threshold) \
+	{ \
+		if (name##_Grow(table)) \
+			name##_Locate(table, key, entry.hash, &end, &end_distance); \
+		else if (table->number_of_entries == table->number_of_slots) \
+			return -1; \
+	} \
+\
+	entry.key = key; \
+	entry.value = value; \
+	name##_Place(table->slots, table->number_of_slots - 1, entry, end, \
+		end_distance); \
+	(table->number_of_entries)++; \
+\
+	return 1; \
+} \
+\
+/* Returns the value stored under key, NULL if none. It stays valid until \
+* the next insert or remove. */ \
+HASH_TABLE_GENERATED value_type * name##_Find(name##_t * table, \
+	key_type key) \
+{ \
+	unsigned long index, end, end_distance; \
+\
+	assert(table != NULL); \
+\
+	index = name##_Locate(table, key, \
+		(uint64_t)(hash(key)) | HASH_TABLE_OCCUPIED, &end, &end_distance); \
+	if (index == table->number_of_slots) \
+		return NULL; \
+\
+	return &table->slots[index].value; \
+} \
+\
+/* Take key out of the table, its value is copied to removed (if not NULL), \
+* and shift the entries after it back toward their home slots. \
+* Returns 1 if it was removed, 0 if it was not in the table. */ \
+HASH_TABLE_GENERATED int name##_Remove(name##_t * table, key_type key, \
+	value_type * removed) \
+{ \
+	name##_slot_t * slots; \
+	unsigned long mask, hole, next, end, end_distance; \
+\
+	assert(table != NULL); \
+\
+	hole = name##_Locate(table, key, \
+		(uint64_t)(hash(key)) | HASH_TABLE_OCCUPIED, &end, &end_distance); \
+	if (hole == table->number_of_slots) \
+		return 0; \
+\
+	slots = table->slots; \
+	mask = table->number_of_slots - 1; \
+	if (removed != NULL) \
+		*removed = slots[hole].value; \
+\
+	next = (hole + 1) & mask; \
+	while (slots[next].hash != 0 && \
+		(slots[next].hash & mask) != (uint64_t)next) \
+	{ \
+		slots[hole] = slots[next]; \
+		hole = next; \
+		next = (next + 1) & mask; \
+	} \
+\
+	slots[hole].hash = 0; \
+	(table->number_of_entries)--; \
+\
+	return 1; \
+} \
+\
+/* Returns number of keys in table */ \
+HASH_TABLE_GENERATED unsigned long name##_Count(name##_t * table) \
+{ \
+	assert(table != NULL); \
+\
+	return table->number_of_entries; \
+} \
+\
+/* Returns number of bytes allocated for table, not including anything \
+* keys and values point to */ \
+HASH_TABLE_GENERATED unsigned long name##_Size(name##_t * table) \
+{ \
+	assert(table != NULL); \
+\
+	return (unsigned long)(sizeof(name##_t) + \
+		table->number_of_slots * sizeof(name##_slot_t)); \
+}
+
+#endif
@@ -0,0 +1,981 @@
+/* hash_table_flat.c - Flat storage engine for the generic hash table.
+* Entries live in a single power of 2 sized slot array and are placed with
+* Robin Hood linear probing: an entry being inserted takes the slot of any
+* entry that sits closer to its home slot than the new one would. This keeps
+* probe lengths short and lets a lookup stop as soon as it meets an entry
+* nearer home than the pattern being searched for. A key's duplicates are
+* kept with its slot as the chained engine keeps them with a fill (see
+* hash_table_duplicates_t): in the slot while there are few, in an array of
+* their own after that.
+*
+* Lookups filter with the control bytes kept next to the slots (see
+* hash_table_slot_t): 16 of them are compared against the pattern's 7 bit
+* fingerprint at once, with SSE2 or NEON when the compiler targets them,
+* and only the slots that match are looked at. A probe run is never longer
+* than max_probe_distance, so a failed lookup usually costs one compare.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include <string.h>
+
+#include "hash_table_internal.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FLAT_GROUP_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define FLAT_GROUP_NEON 1
+#endif
+
+#define FLAT_DEFAULT_LOAD_FACTOR 0.875
+#define FLAT_MAX_LOAD_FACTOR 0.95
+#define FLAT_GROUP_WIDTH 16
+#define FLAT_MIN_SLOTS FLAT_GROUP_WIDTH
+/* While rehashing, an empty old slot counts as 1/FLAT_EMPTY_VISITS of a
+* step */
+#define FLAT_EMPTY_VISITS 10
+
+/* Control byte of a slot holding hash, never 0 (empty) */
+#define FLAT_CONTROL(hash) ((unsigned char)(0x80 | (unsigned)((hash) >> 57)))
+
+/* Number of control bytes for number_of_slots, the first group's worth
+* repeated at the end */
+#define FLAT_CONTROLS(number_of_slots) \
+	((number_of_slots) + FLAT_GROUP_WIDTH - 1)
+
+/* How far the entry in slot index is from its home slot */
+static unsigned long flat_distance(uint64_t hash, unsigned long index,
+	unsigned long mask)
+{
+	return (index - (unsigned long)(hash & mask)) & mask;
+}
+
+/* Set the control byte of slot index of the current array */
+static void flat_set_control(hash_table_t * table, unsigned long index,
+	unsigned char control)
+{
+	table->controls[index] = control;
+	if (index < FLAT_GROUP_WIDTH - 1)
+		table->controls[table->number_of_total_buckets + index] = control;
+}
+
+/* Bit i of the result is set when group[i] is control, bit i of *empty
+* when group[i] is 0 */
+static unsigned int flat_group_match(const unsigned char * group,
+	unsigned char control, unsigned int * empty)
+{
+#if defined(FLAT_GROUP_SSE2)
+	__m128i bytes = _mm_loadu_si128((const __m128i *)group);
+
+	*empty = ~(unsigned int)_mm_movemask_epi8(bytes) & 0xFFFF;
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes,
+		_mm_set1_epi8((char)control)));
+#elif defined(FLAT_GROUP_NEON)
+	static const unsigned char bit_values[FLAT_GROUP_WIDTH] = {1, 2, 4, 8,
+		16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t bytes = vld1q_u8(group), bits = vld1q_u8(bit_values), found;
+
+	found = vandq_u8(vceqq_u8(bytes, vdupq_n_u8(0)), bits);
+	*empty = vaddv_u8(vget_low_u8(found)) |
+		(unsigned int)vaddv_u8(vget_high_u8(found)) << 8;
+	found = vandq_u8(vceqq_u8(bytes, vdupq_n_u8(control)), bits);
+	return vaddv_u8(vget_low_u8(found)) |
+		(unsigned int)vaddv_u8(vget_high_u8(found)) << 8;
+#else
+	unsigned int i, match = 0;
+
+	*empty = 0;
+	for (i = 0; i < FLAT_GROUP_WIDTH; i++)
+	{
+		if (group[i] == control)
+			match |= 1U << i;
+		else if (group[i] == 0)
+			*empty |= 1U << i;
+	}
+	return match;
+#endif
+}
+
+/* Bit i of the result is set when group[i] holds an entry */
+static unsigned int flat_group_full(const unsigned char * group)
+{
+#if defined(FLAT_GROUP_SSE2)
+	/* only full slots have the high bit of their control set */
+	return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128(
+		(const __m128i *)group));
+#elif defined(FLAT_GROUP_NEON)
+	static const unsigned char bit_values[FLAT_GROUP_WIDTH] = {1, 2, 4, 8,
+		16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t found;
+
+	found = vandq_u8(vtstq_u8(vld1q_u8(group), vdupq_n_u8(0x80)),
+		vld1q_u8(bit_values));
+	return vaddv_u8(vget_low_u8(found)) |
+		(unsigned int)vaddv_u8(vget_high_u8(found)) << 8;
+#else
+	unsigned int i, full = 0;
+
+	for (i = 0; i < FLAT_GROUP_WIDTH; i++)
+	{
+		if (group[i] != 0)
+			full |= 1U << i;
+	}
+	return full;
+#endif
+}
+
+/* Index of the lowest set bit of bits, which is not 0 */
+static unsigned int flat_lowest_bit(unsigned int bits)
+{
+#if defined(__GNUC__)
+	return (unsigned int)__builtin_ctz(bits);
+#else
+	unsigned int i = 0;
+
+	while ((bits & 1) == 0)
+	{
+		bits >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+/* Does slot hold the key we are after: compare_function against object when
+* inserting, search_function against pattern when looking up */
+static int flat_matches(hash_table_t * table, hash_table_slot_t * slot,
+	uint64_t hash, char * pattern, void * object)
+{
+	if (object == NULL)
+		HASH_TABLE_COUNT(table, probes);
+
+	if (slot->hash != hash)
+	{
+		/* told apart by the stored hash, no callback needed */
+		if (object != NULL)
+			(table->number_of_compares_skipped)++;
+		else if (!table->shared_lookups)
+			(table->number_of_searches_skipped)++;
+		return 0;
+	}
+
+	if (object != NULL)
+		return HASH_TABLE_COMPARE(table, slot->object, object) == 0;
+
+	return HASH_TABLE_SEARCH(table, pattern, slot->object);
+}
+
+/* Place entry, known not to be in the table, into the current slot array
+* starting at index where it would be distance slots from home. Richer
+* entries get pushed along. number_of_collisions counts entries off their
+* home slot: entry is counted where it lands, and each pushed entry is
+* counted again where it lands, always off home. */
+static void flat_place(hash_table_t * table, unsigned long index,
+	unsigned long distance, hash_table_slot_t entry)
+{
+	hash_table_slot_t * slots = table->slots, displaced;
+	unsigned long mask = table->number_of_total_buckets - 1, slot_distance;
+
+	while (slots[index].object != NULL)
+	{
+		slot_distance = flat_distance(slots[index].hash, index, mask);
+		if (slot_distance < distance)
+		{
+			/* steal the slot and carry on placing the one we evicted */
+			if (distance > table->max_probe_distance)
+				table->max_probe_distance = distance;
+
+			displaced = slots[index];
+			slots[index] = entry;
+			flat_set_control(table, index, FLAT_CONTROL(entry.hash));
+			if (distance > 0)
+				(table->number_of_collisions)++;
+			if (slot_distance > 0)
+				table->number_of_collisions--;
+			entry = displaced;
+			distance = slot_distance;
+		}
+		index = (index + 1) & mask;
+		distance++;
+	}
+
+	if (distance > table->max_probe_distance)
+		table->max_probe_distance = distance;
+
+	slots[index] = entry;
+	flat_set_control(table, index, FLAT_CONTROL(entry.hash));
+	if (distance > 0)
+		(table->number_of_collisions)++;
+}
+
+/* Probe the current slot array. Returns the matching slot, or NULL with
+* stop_index / stop_distance set to where the key would be placed. */
+static hash_table_slot_t * flat_find(hash_table_t * table, uint64_t hash,
+	char * pattern, void * object, unsigned long * stop_index,
+	unsigned long * stop_distance)
+{
+	unsigned long mask = table->number_of_total_buckets - 1, index,
+		distance = 0;
+	hash_table_slot_t * slot;
+
+	index = (unsigned long)(hash & mask);
+	slot = &table->slots[index];
+
+	/* Walk until we reach an empty slot or an entry closer to home than we
+	* are, past that the key cannot be in the table */
+	while (slot->object != NULL &&
+		flat_distance(slot->hash, index, mask) >= distance)
+	{
+		if (flat_matches(table, slot, hash, pattern, object))
+			return slot;
+
+		index = (index + 1) & mask;
+		distance++;
+		slot = &table->slots[index];
+	}
+
+	*stop_index = index;
+	*stop_distance = distance;
+	return NULL;
+}
+
+/* flat_find for a lookup, a group of control bytes at a time. The key can
+* be no further than max_probe_distance from home, and an empty slot ends
+* its probe run, so the walk stops at whichever comes first. */
+static hash_table_slot_t * flat_find_group(hash_table_t * table,
+	uint64_t hash, char * pattern)
+{
+	unsigned long mask = table->number_of_total_buckets - 1, home, index,
+		offset;
+	unsigned int matches, empty;
+	unsigned char control = FLAT_CONTROL(hash);
+	hash_table_slot_t * slot;
+
+	/* a hit is most often in the home slot, start loading it alongside the
+	* control bytes rather than after them */
+	home = (unsigned long)(hash & mask);
+	HASH_TABLE_PREFETCH(&table->slots[home]);
+
+	for (offset = 0; offset <= table->max_probe_distance;
+		offset += FLAT_GROUP_WIDTH)
+	{
+		index = (home + offset) & mask;
+		matches = flat_group_match(&table->controls[index], control, &empty);
+
+		for (; matches != 0; matches &= matches - 1)
+		{
+			slot = &table->slots[(index + flat_lowest_bit(matches)) & mask];
+			if (flat_matches(table, slot, hash, pattern, NULL))
+				return slot;
+		}
+
+		if (empty != 0)
+			break;
+	}
+
+	return NULL;
+}
+
+/* Probe the old slot array of a running resize. Slots below rehash_position
+* have been moved out; they are stepped over rather than treated as empty so
+* the rest of each probe run is still found. Nothing sits further than
+* old_max_probe_distance from home, which bounds the walk. */
+static hash_table_slot_t * flat_find_old(hash_table_t * table, uint64_t hash,
+	char * pattern, void * object)
+{
+	unsigned long mask = table->number_of_old_buckets - 1, home, index,
+		distance;
+	hash_table_slot_t * slot;
+
+	home = (unsigned long)(hash & mask);
+	for (distance = 0; distance <= table->old_max_probe_distance; distance++)
+	{
+		index = (home + distance) & mask;
+		if (index < table->rehash_position)
+			continue;
+
+		slot = &table->old_slots[index];
+		if (slot->object == NULL ||
+			flat_distance(slot->hash, index, mask) < distance)
+			return NULL;
+
+		if (flat_matches(table, slot, hash, pattern, object))
+			return slot;
+	}
+
+	return NULL;
+}
+
+/* Find the slot holding the key in whichever array it is in, NULL if it is
+* not in the table */
+static hash_table_slot_t * flat_lookup(hash_table_t * table, uint64_t hash,
+	char * pattern, void * object, unsigned long * stop_index,
+	unsigned long * stop_distance)
+{
+	hash_table_slot_t * slot;
+
+	if (object == NULL)
+		slot = flat_find_group(table, hash, pattern);
+	else
+		slot = flat_find(table, hash, pattern, object, stop_index,
+			stop_distance);
+	if (slot == NULL && table->old_slots != NULL)
+		slot = flat_find_old(table, hash, pattern, object);
+
+	return slot;
+}
+
+/* Move up to rehash_step entries from the old slot array into the current
+* one, freeing the old array once it is empty. */
+static void flat_rehash_step(hash_table_t * table)
+{
+	unsigned long moved = 0, visited = 0;
+	hash_table_slot_t * slot;
+
+	while (table->old_slots != NULL && moved < table->rehash_step &&
+		visited < table->rehash_step * FLAT_EMPTY_VISITS)
+	{
+		slot = &table->old_slots[table->rehash_position];
+		if (slot->object != NULL)
+		{
+			/* flat_place counts it again in the current array */
+			if (flat_distance(slot->hash, table->rehash_position,
+				table->number_of_old_buckets - 1) > 0)
+				table->number_of_collisions--;
+			flat_place(table, (unsigned long)(slot->hash &
+				(table->number_of_total_buckets - 1)), 0, *slot);
+			slot->object = NULL;
+			moved++;
+		}
+		visited++;
+
+		(table->rehash_position)++;
+		if (table->rehash_position == table->number_of_old_buckets)
+		{
+			Hash_Table_Release(table, table->old_slots,
+				table->number_of_old_buckets, sizeof(hash_table_slot_t));
+			table->old_slots = NULL;
+			table->number_of_old_buckets = 0;
+			table->rehash_position = 0;
+			table->old_max_probe_distance = 0;
+		}
+	}
+}
+
+/* Smallest power of 2 slot count, at least FLAT_MIN_SLOTS, that is
+* >= number_of_slots */
+static unsigned long flat_round_slots(unsigned long number_of_slots)
+{
+	unsigned long rounded_slots = FLAT_MIN_SLOTS;
+
+	while (rounded_slots < number_of_slots && rounded_slots <= ULONG_MAX / 2)
+		rounded_slots *= 2;
+
+	return rounded_slots;
+}
+
+/* Number of entries number_of_slots can take before growing */
+static unsigned long flat_threshold(hash_table_t * table,
+	unsigned long number_of_slots)
+{
+	double load_factor = table->max_load_factor;
+
+	if (load_factor <= 0)
+		load_factor = FLAT_DEFAULT_LOAD_FACTOR;
+	else if (load_factor > FLAT_MAX_LOAD_FACTOR)
+		load_factor = FLAT_MAX_LOAD_FACTOR;
+
+	return (unsigned long)(number_of_slots * load_factor);
+}
+
+/* Swap in an empty array of number_of_slots, the old one is then drained by
+* flat_rehash_step.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int flat_start_resize(hash_table_t * table,
+	unsigned long number_of_slots)
+{
+	hash_table_slot_t * new_slots;
+	unsigned char * new_controls;
+
+	/* finish any resize that is running, flat moves cannot fail */
+	while (table->old_slots != NULL)
+		flat_rehash_step(table);
+
+	new_slots = Hash_Table_Allocate(table, number_of_slots,
+		sizeof(hash_table_slot_t));
+	if (new_slots == NULL)
+		return 0;
+
+	new_controls = Hash_Table_Allocate(table, FLAT_CONTROLS(number_of_slots),
+		1);
+	if (new_controls == NULL)
+	{
+		Hash_Table_Release(table, new_slots, number_of_slots,
+			sizeof(hash_table_slot_t));
+		return 0;
+	}
+
+	/* the old array is only probed slot by slot, its controls can go */
+	Hash_Table_Release(table, table->controls,
+		FLAT_CONTROLS(table->number_of_total_buckets), 1);
+	table->controls = new_controls;
+
+	table->old_slots = table->slots;
+	table->number_of_old_buckets = table->number_of_total_buckets;
+	table->old_max_probe_distance = table->max_probe_distance;
+	table->rehash_position = 0;
+
+	table->slots = new_slots;
+	table->number_of_total_buckets = number_of_slots;
+	table->max_probe_distance = 0;
+	table->grow_threshold = flat_threshold(table, number_of_slots);
+
+	return 1;
+}
+
+/* Allocate the slot array, number_of_slots gets rounded up to a power of 2.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Flat_Init(hash_table_t * table, unsigned long number_of_slots)
+{
+	unsigned long rounded_slots = flat_round_slots(number_of_slots);
+
+	table->slots = Hash_Table_Allocate(table, rounded_slots,
+		sizeof(hash_table_slot_t));
+	if (table->slots == NULL)
+		return 0;
+
+	table->controls = Hash_Table_Allocate(table, FLAT_CONTROLS(rounded_slots),
+		1);
+	if (table->controls == NULL)
+	{
+		Hash_Table_Release(table, table->slots, rounded_slots,
+			sizeof(hash_table_slot_t));
+		table->slots = NULL;
+		return 0;
+	}
+
+	table->number_of_total_buckets = rounded_slots;
+	table->grow_threshold = flat_threshold(table, rounded_slots);
+	return 1;
+}
+
+/* Start an incremental move to number_of_slots (rounded up to a power of 2).
+* Return 1 if successful - 0 if failure (memory allocation or too small).
+*/
+int Hash_Table_Flat_Resize(hash_table_t * table,
+	unsigned long number_of_slots)
+{
+	number_of_slots = flat_round_slots(number_of_slots);
+	if (table->number_of_buckets_filled >= flat_threshold(table,
+		number_of_slots))
+		return 0;
+
+	return flat_start_resize(table, number_of_slots);
+}
+
+/* Make room for one more entry before an insert probes, so the probe stays
+* valid. A cache that cannot afford the bigger array (next to the old one
+* while it drains) evicts instead, unless the key (object's, or pattern's
+* when object is NULL) is already there.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int flat_make_room(hash_table_t * table, uint64_t hash,
+	char * pattern, void * object)
+{
+	unsigned long index, distance;
+
+	if (table->number_of_buckets_filled + 1 > table->grow_threshold &&
+		table->number_of_total_buckets <= ULONG_MAX / 2)
+	{
+		if (table->max_bytes == 0 || Hash_Table_Flat_Size(table) +
+			table->number_of_total_buckets * 2 *
+			(sizeof(hash_table_slot_t) + 1) + FLAT_GROUP_WIDTH <=
+			table->max_bytes)
+		{
+			if (!flat_start_resize(table, table->number_of_total_buckets * 2))
+				return 0;
+		}
+		else if (flat_lookup(table, hash, pattern, object, &index,
+			&distance) == NULL)
+			table->number_of_evictions += Hash_Table_Flat_Evict(table, hash);
+	}
+
+	if (table->old_slots != NULL)
+		flat_rehash_step(table);
+
+	return 1;
+}
+
+/* Put a new entry for object where the probe of the current array
+* stopped */
+static void flat_add_entry(hash_table_t * table, unsigned long index,
+	unsigned long distance, void * object, uint64_t hash)
+{
+	hash_table_slot_t new_entry;
+
+	new_entry.object = object;
+	new_entry.hash = hash;
+	memset(&new_entry.duplicates, 0, sizeof(hash_table_duplicates_t));
+	new_entry.referenced = 0;
+
+	flat_place(table, index, distance, new_entry);
+
+	(table->number_of_buckets_filled)++;
+}
+
+int Hash_Table_Flat_Insert(hash_table_t * table, void * object,
+	uint64_t hash)
+{
+	unsigned long index, distance;
+	hash_table_slot_t * slot;
+
+	if (!flat_make_room(table, hash, NULL, object))
+		return 0;
+
+	slot = flat_lookup(table, hash, NULL, object, &index, &distance);
+	if (slot != NULL)
+	{
+		/* duplicate - add to the key's duplicates */
+		if (!Hash_Table_Duplicate_Append(table, &slot->duplicates, object))
+			return 0;
+
+		(table->number_of_duplicates)++;
+		return 1;
+	}
+
+	/* Not in table - it belongs where the probe of the current array
+	* stopped */
+	flat_add_entry(table, index, distance, object, hash);
+	return 1;
+}
+
+/* Hash_Table_Find_Or_Insert_Hashed for a flat table. The slot by slot
+* probe both finds the key and, when it is missing, where it goes. */
+void * Hash_Table_Flat_Find_Or_Insert(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object, void *(*create_function)(void * context),
+	void * context, int * result)
+{
+	unsigned long index, distance;
+	hash_table_slot_t * slot;
+
+	if (!flat_make_room(table, hash, pattern, object))
+	{
+		*result = -1;
+		return NULL;
+	}
+
+	slot = flat_find(table, hash, pattern, object, &index, &distance);
+	if (slot == NULL && table->old_slots != NULL)
+		slot = flat_find_old(table, hash, pattern, object);
+
+	if (slot != NULL)
+	{
+		/* already exists */
+		if (table->max_entries + table->max_bytes != 0 &&
+			!table->shared_lookups && !slot->referenced)
+			slot->referenced = 1;
+
+		*result = 0;
+		return slot->object;
+	}
+
+	if (object == NULL)
+	{
+		object = create_function(context);
+		if (object == NULL)
+		{
+			*result = -1;
+			return NULL;
+		}
+	}
+
+	flat_add_entry(table, index, distance, object, hash);
+
+	*result = 1;
+	return object;
+}
+
+/* Backward shift after the entry at hole has been taken out of slots: each
+* following entry of the probe run moves one place nearer home until the
+* run ends, so no lookup is cut short by the gap. In the old array of a
+* running resize, slots below moved have been rehashed away; they are
+* stepped over as lookups do, which can leave the gap more than one place
+* back, so an entry only moves if the gap is not before its home. */
+static void flat_close_hole(hash_table_t * table, hash_table_slot_t * slots,
+	unsigned long mask, unsigned long hole, unsigned long moved,
+	unsigned long max_distance)
+{
+	unsigned long index = hole, gap, distance;
+
+	for (;;)
+	{
+		index = (index + 1) & mask;
+		gap = (index - hole) & mask;
+		if (gap == 0 || gap > max_distance)
+			return;
+
+		if (index < moved)
+			continue;
+
+		if (slots[index].object == NULL)
+			return;
+
+		distance = flat_distance(slots[index].hash, index, mask);
+		if (distance < gap)
+			return; /* home is past the gap, and so is every later one's */
+
+		if (distance == gap)
+			table->number_of_collisions--; /* moves back home */
+
+		slots[hole] = slots[index];
+		slots[index].object = NULL;
+		if (slots == table->slots)
+		{
+			flat_set_control(table, hole, table->controls[index]);
+			flat_set_control(table, index, 0);
+		}
+		hole = index;
+	}
+}
+
+/* Pass the objects of slot to free_function and release its duplicates */
+static void flat_free_entry(hash_table_t * table, hash_table_slot_t * slot)
+{
+	(void)HASH_TABLE_INDEX_EVENT(table, HASH_TABLE_INDEX_DROP_KEY, slot->object);
+
+	table->number_of_duplicates -= slot->duplicates.number_of_duplicates;
+	Hash_Table_Duplicates_Free(table, &slot->duplicates);
+
+	if (table->free_function != NULL)
+		table->free_function(slot->object);
+}
+
+/* Empty slot, in either array, and close the gap it leaves */
+static void flat_take_slot(hash_table_t * table, hash_table_slot_t * slot)
+{
+	unsigned long index, mask, moved, max_distance;
+	hash_table_slot_t * slots = table->slots;
+
+	/* which array the entry was found in */
+	mask = table->number_of_total_buckets - 1;
+	moved = 0;
+	max_distance = table->max_probe_distance;
+	if (slot < slots || slot > &slots[mask])
+	{
+		slots = table->old_slots;
+		mask = table->number_of_old_buckets - 1;
+		moved = table->rehash_position;
+		max_distance = table->old_max_probe_distance;
+	}
+
+	index = (unsigned long)(slot - slots);
+	if (flat_distance(slot->hash, index, mask) > 0)
+		table->number_of_collisions--;
+
+	slot->object = NULL;
+	if (slots == table->slots)
+		flat_set_control(table, index, 0);
+	flat_close_hole(table, slots, mask, index, moved, max_distance);
+
+	table->number_of_buckets_filled--;
+}
+
+/* Take object out of the entry for pattern, or when object is NULL the
+* entry with all its objects (passed to free_function). Returns the number
+* of objects taken out. */
+unsigned long Hash_Table_Flat_Remove(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object)
+{
+	unsigned long index, distance, number_removed = 1;
+	hash_table_slot_t * slot;
+	long position;
+
+	if (table->old_slots != NULL)
+		flat_rehash_step(table);
+
+	slot = flat_lookup(table, hash, pattern, NULL, &index, &distance);
+	if (slot == NULL)
+		return 0;
+
+	if (object != NULL)
+	{
+		position = Hash_Table_Duplicates_Find(slot->object, &slot->duplicates,
+			object);
+		if (position < 0)
+			return 0;
+
+		/* the entry stays for the objects left */
+		if (slot->duplicates.number_of_duplicates != 0)
+		{
+			Hash_Table_Duplicates_Take(table, &slot->object,
+				&slot->duplicates, (uint32_t)position);
+			return 1;
+		}
+	}
+	else
+	{
+		number_removed += slot->duplicates.number_of_duplicates;
+		flat_free_entry(table, slot);
+	}
+
+	flat_take_slot(table, slot);
+	return number_removed;
+}
+
+/* One CLOCK sweep of the old slot array (the part not yet rehashed) or the
+* current one for an entry to evict, skipping entries of skip_hash. Set
+* reference bits are cleared on the way, so two turns round are enough.
+* Returns the number of objects evicted, 0 if nothing could be.
+*/
+static unsigned long flat_clock_sweep(hash_table_t * table, int old,
+	uint64_t skip_hash)
+{
+	hash_table_slot_t * slots = table->slots, * slot;
+	unsigned long first = 0, number_of_slots, visits, number_evicted;
+
+	number_of_slots = table->number_of_total_buckets;
+	if (old)
+	{
+		slots = table->old_slots;
+		first = table->rehash_position;
+		number_of_slots = table->number_of_old_buckets;
+	}
+
+	if (table->clock_hand < first || table->clock_hand >= number_of_slots)
+		table->clock_hand = first;
+
+	for (visits = 0; visits < 2 * (number_of_slots - first); visits++)
+	{
+		slot = &slots[table->clock_hand];
+		if (slot->object != NULL && slot->hash != skip_hash)
+		{
+			if (!slot->referenced)
+			{
+				/* the hand stays, whatever shifts back into the slot is
+				* next */
+				number_evicted = slot->duplicates.number_of_duplicates + 1;
+				flat_free_entry(table, slot);
+				flat_take_slot(table, slot);
+				return number_evicted;
+			}
+
+			slot->referenced = 0;
+		}
+
+		(table->clock_hand)++;
+		if (table->clock_hand == number_of_slots)
+			table->clock_hand = first;
+	}
+
+	return 0;
+}
+
+/* Evict one key, see flat_clock_sweep. Keys not yet rehashed go first;
+* once there are none left to take the resize is finished so the sweep
+* does not keep walking the empty old array.
+* Returns the number of objects evicted, 0 if nothing could be.
+*/
+unsigned long Hash_Table_Flat_Evict(hash_table_t * table, uint64_t skip_hash)
+{
+	unsigned long number_evicted;
+
+	if (table->old_slots != NULL)
+	{
+		number_evicted = flat_clock_sweep(table, 1, skip_hash);
+		if (number_evicted != 0)
+			return number_evicted;
+
+		while (table->old_slots != NULL)
+			flat_rehash_step(table);
+	}
+
+	return flat_clock_sweep(table, 0, skip_hash);
+}
+
+/* Carry a running resize on by one step, for a lookup */
+void Hash_Table_Flat_Rehash_Step(hash_table_t * table)
+{
+	if (table->old_slots != NULL)
+		flat_rehash_step(table);
+}
+
+/* Look pattern up, returning the first object and pointing cursor at its
+* duplicates. Returns NULL if nothing found. */
+void * Hash_Table_Flat_Find(hash_table_t * table, char * pattern,
+	uint64_t hash, hash_table_cursor_t * cursor)
+{
+	unsigned long index, distance;
+	hash_table_slot_t * slot;
+
+	slot = flat_lookup(table, hash, pattern, NULL, &index, &distance);
+	if (slot == NULL)
+		return NULL; /* never found any match */
+
+	/* only written when it changes, a hit on a hot key then leaves its line
+	* clean */
+	if (table->max_entries + table->max_bytes != 0 &&
+		!table->shared_lookups && !slot->referenced)
+		slot->referenced = 1;
+
+	Hash_Table_Cursor_Set(cursor, &slot->duplicates);
+	return slot->object;
+}
+
+/* Index of the first slot from position (and before end) holding an
+* entry, in the old array when old is set. The current array is scanned a
+* group of control bytes at a time, the old one has none left.
+* Returns end if none.
+*/
+unsigned long Hash_Table_Flat_Next_Slot(hash_table_t * table, int old,
+	unsigned long position, unsigned long end)
+{
+	unsigned int full;
+
+	if (old)
+	{
+		while (position < end && table->old_slots[position].object == NULL)
+			position++;
+		return position < end ? position : end;
+	}
+
+	for (; position < end; position += FLAT_GROUP_WIDTH)
+	{
+		/* the group may run into the repeated bytes past the last slot,
+		* which end cuts off */
+		full = flat_group_full(&table->controls[position]);
+		if (full != 0)
+		{
+			position += flat_lowest_bit(full);
+			return position < end ? position : end;
+		}
+	}
+
+	return end;
+}
+
+/* Free every entry of slots from index first onwards, then the array.
+* With nothing to hand to free_function and no duplicate arrays to release
+* the walk is skipped. */
+static void flat_free_slots(hash_table_t * table, hash_table_slot_t * slots,
+	unsigned long first, unsigned long number_of_slots)
+{
+	unsigned long i;
+
+	for (i = first; i < number_of_slots && (table->free_function != NULL ||
+		table->duplicate_capacity != 0); i++)
+	{
+		if (slots[i].object != NULL)
+		{
+			Hash_Table_Duplicates_Free(table, &slots[i].duplicates);
+
+			if (table->free_function != NULL)
+				table->free_function(slots[i].object);
+		}
+	}
+
+	Hash_Table_Release(table, slots, number_of_slots,
+		sizeof(hash_table_slot_t));
+}
+
+/* Free slot array and contained objects, not the table itself */
+void Hash_Table_Flat_Free(hash_table_t * table)
+{
+	if (table->old_slots != NULL)
+		flat_free_slots(table, table->old_slots, table->rehash_position,
+			table->number_of_old_buckets);
+	flat_free_slots(table, table->slots, 0, table->number_of_total_buckets);
+	Hash_Table_Release(table, table->controls,
+		FLAT_CONTROLS(table->number_of_total_buckets), 1);
+
+	table->old_slots = NULL;
+	table->slots = NULL;
+	table->controls = NULL;
+}
+
+/* Hash_Table_Flat_Stats of count slots from start on (round the end of
+* the array), mask being the number of slots - 1. The keys of one home
+* slot sit together in its probe run, so each is counted as a chain when a
+* key from another home (or an empty slot) follows. */
+static void flat_stats_slots(hash_table_slot_t * slots, unsigned long mask,
+	unsigned long start, unsigned long count, hash_table_stats_t * stats)
+{
+	unsigned long i, index, distance, home, chain_home = 0,
+		chain_length = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		index = (start + i) & mask;
+		if (slots[index].object == NULL)
+		{
+			if (chain_length != 0)
+				Hash_Table_Stats_Add_Chain(stats, chain_length);
+			chain_length = 0;
+			continue;
+		}
+
+		distance = flat_distance(slots[index].hash, index, mask);
+		home = (index - distance) & mask;
+		if (chain_length != 0 && home != chain_home)
+		{
+			Hash_Table_Stats_Add_Chain(stats, chain_length);
+			chain_length = 0;
+		}
+		chain_home = home;
+		chain_length++;
+
+		Hash_Table_Stats_Add_Key(stats, distance,
+			slots[index].duplicates.number_of_duplicates);
+	}
+
+	if (chain_length != 0)
+		Hash_Table_Stats_Add_Chain(stats, chain_length);
+}
+
+/* Hash_Table_Stats of the slot arrays, through
+* Hash_Table_Stats_Add_Chain / _Key */
+void Hash_Table_Flat_Stats(hash_table_t * table, hash_table_stats_t * stats)
+{
+	unsigned long start;
+
+	/* the old array's slots below rehash_position have been moved */
+	if (table->old_slots != NULL)
+		flat_stats_slots(table->old_slots, table->number_of_old_buckets - 1,
+			table->rehash_position,
+			table->number_of_old_buckets - table->rehash_position, stats);
+
+	/* start after an empty slot (there always is one) so no probe run is
+	* split by wrapping round */
+	for (start = 0; start < table->number_of_total_buckets &&
+		table->slots[start].object != NULL; start++)
+		;
+	flat_stats_slots(table->slots, table->number_of_total_buckets - 1,
+		start + 1, table->number_of_total_buckets, stats);
+}
+
+unsigned long Hash_Table_Flat_Size(hash_table_t * table)
+{
+	unsigned long table_size;
+
+	table_size = sizeof(hash_table_t) + (table->number_of_total_buckets +
+		table->number_of_old_buckets) * sizeof(hash_table_slot_t) +
+		FLAT_CONTROLS(table->number_of_total_buckets);
+
+	return table_size + Hash_Table_Pools_Size(table) +
+		table->duplicate_capacity * sizeof(void *);
+}
@@ -0,0 +1,307 @@
+/* hash_table_hash.c - Built in hash functions for full_hash_function, and
+* the default reduction of a full hash onto the bucket array.
+*
+* Hash_Table_Hash_Wy is a wyhash style multiply and fold hash reading 8
+* bytes at a time. Hash_Table_Hash_Crc32c and Hash_Table_Hash_Aes use the
+* CRC32 and AES instructions when the compiler targets them (-msse4.2,
+* -maes, or an ARM CPU with the CRC extension) and portable code otherwise.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include <string.h>
+
+#include "hash_table_internal.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define HASH_CRC32C_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HASH_CRC32C_ARM 1
+#endif
+
+#if defined(__AES__) && defined(__SSE2__)
+#include <wmmintrin.h>
+#define HASH_AES_NI 1
+#endif
+
+/* 64 bit constants spelt out in halves, C89 has no long long literals */
+#define HASH_CONSTANT(high, low) ((uint64_t)(high) << 32 | (uint64_t)(low))
+
+#define WY_SECRET_0 HASH_CONSTANT(0xa0761d64, 0x78bd642f)
+#define WY_SECRET_1 HASH_CONSTANT(0xe7037ed1, 0xa0b428db)
+#define WY_SECRET_2 HASH_CONSTANT(0x8ebc6af0, 0x9c88c6e3)
+#define WY_SECRET_3 HASH_CONSTANT(0x589965cc, 0x75374cc3)
+
+/* Reflected CRC32C (Castagnoli) polynomial */
+#define CRC32C_POLYNOMIAL 0x82F63B78UL
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 hash_uint128_t;
+#endif
+
+/* Full 128 bit product of a and b */
+static void hash_multiply(uint64_t a, uint64_t b, uint64_t * low,
+	uint64_t * high)
+{
+#if defined(__SIZEOF_INT128__)
+	hash_uint128_t product = (hash_uint128_t)a * b;
+
+	*low = (uint64_t)product;
+	*high = (uint64_t)(product >> 64);
+#else
+	uint64_t a_low = a & 0xFFFFFFFF, a_high = a >> 32,
+		b_low = b & 0xFFFFFFFF, b_high = b >> 32, cross_1, cross_2, bottom;
+
+	bottom = a_low * b_low;
+	cross_1 = a_high * b_low + (bottom >> 32);
+	cross_2 = a_low * b_high + (cross_1 & 0xFFFFFFFF);
+
+	*low = (cross_2 << 32) | (bottom & 0xFFFFFFFF);
+	*high = a_high * b_high + (cross_1 >> 32) + (cross_2 >> 32);
+#endif
+}
+
+/* Multiply and fold the two halves of the product together */
+static uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+	uint64_t low, high;
+
+	hash_multiply(a, b, &low, &high);
+	return low ^ high;
+}
+
+static uint64_t hash_read_64(const unsigned char * bytes)
+{
+	uint64_t value;
+
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+static uint64_t hash_read_32(const unsigned char * bytes)
+{
+	uint32_t value;
+
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+/* Final avalanche of murmur3 (fmix64), a bijection */
+uint64_t Hash_Table_Hash_Mix(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= HASH_CONSTANT(0xff51afd7, 0xed558ccd);
+	hash ^= hash >> 33;
+	hash *= HASH_CONSTANT(0xc4ceb9fe, 0x1a85ec53);
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+/* wyhash style hash of length bytes */
+static uint64_t hash_wy(const unsigned char * bytes, size_t length)
+{
+	uint64_t seed, seed_1, seed_2, a, b;
+	size_t remaining = length;
+
+	seed = hash_mix(WY_SECRET_0, WY_SECRET_1);
+
+	if (length <= 16)
+	{
+		if (length >= 4)
+		{
+			/* two overlapping reads from each end cover 4 .. 16 bytes */
+			a = hash_read_32(bytes) << 32 |
+				hash_read_32(bytes + ((length >> 3) << 2));
+			b = hash_read_32(bytes + length - 4) << 32 |
+				hash_read_32(bytes + length - 4 - ((length >> 3) << 2));
+		}
+		else if (length > 0)
+		{
+			a = (uint64_t)bytes[0] << 16 | (uint64_t)bytes[length >> 1] << 8 |
+				bytes[length - 1];
+			b = 0;
+		}
+		else
+			a = b = 0;
+	}
+	else
+	{
+		if (remaining > 48)
+		{
+			/* three independent lanes keep the multipliers busy */
+			seed_1 = seed;
+			seed_2 = seed;
+			do
+			{
+				seed = hash_mix(hash_read_64(bytes) ^ WY_SECRET_1,
+					hash_read_64(bytes + 8) ^ seed);
+				seed_1 = hash_mix(hash_read_64(bytes + 16) ^ WY_SECRET_2,
+					hash_read_64(bytes + 24) ^ seed_1);
+				seed_2 = hash_mix(hash_read_64(bytes + 32) ^ WY_SECRET_3,
+					hash_read_64(bytes + 40) ^ seed_2);
+				bytes += 48;
+				remaining -= 48;
+			} while (remaining > 48);
+
+			seed ^= seed_1 ^ seed_2;
+		}
+
+		while (remaining > 16)
+		{
+			seed = hash_mix(hash_read_64(bytes) ^ WY_SECRET_1,
+				hash_read_64(bytes + 8) ^ seed);
+			bytes += 16;
+			remaining -= 16;
+		}
+
+		/* the last 16 bytes, overlapping what was already read */
+		a = hash_read_64(bytes + remaining - 16);
+		b = hash_read_64(bytes + remaining - 8);
+	}
+
+	hash_multiply(a ^ WY_SECRET_1, b ^ seed, &a, &b);
+	return hash_mix(a ^ WY_SECRET_0 ^ (uint64_t)length, b ^ WY_SECRET_1);
+}
+
+/* wyhash style hash of string, the default full_hash_function */
+uint64_t Hash_Table_Hash_Wy(char * string)
+{
+	assert(string != NULL);
+
+	return hash_wy((const unsigned char *)string, strlen(string));
+}
+
+/* Hash_Table_Hash_Wy of length bytes, the default key_hash_function */
+uint64_t Hash_Table_Hash_Bytes(const void * key, size_t length)
+{
+	assert(key != NULL || length == 0);
+
+	return hash_wy((const unsigned char *)key, length);
+}
+
+/* CRC32C of the 8 bytes of word (lowest first) carried on from crc */
+static uint32_t hash_crc32c(uint32_t crc, uint64_t word)
+{
+#if defined(HASH_CRC32C_SSE42)
+	return (uint32_t)_mm_crc32_u64(crc, word);
+#elif defined(HASH_CRC32C_ARM)
+	return __crc32cd(crc, word);
+#else
+	int bit;
+
+	/* bit at a time, gives the same values as the instructions */
+	for (bit = 0; bit < 64; bit++)
+	{
+		crc ^= (uint32_t)(word >> bit) & 1;
+		crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0U - (crc & 1)));
+	}
+
+	return crc;
+#endif
+}
+
+/* Two CRC32C lanes make the 64 bits. A CRC is linear, so a second lane over
+* the same words would only add a constant to the first; the second lane
+* reads every word multiplied by an odd constant instead, which no linear
+* map undoes. A multiply and fold with the length then spreads them. Fast
+* with the CRC32 instruction, slow without it. */
+uint64_t Hash_Table_Hash_Crc32c(char * string)
+{
+	const unsigned char * bytes = (const unsigned char *)string;
+	size_t length, remaining;
+	uint32_t crc_1 = 0xFFFFFFFFUL, crc_2 = 0x9E3779B9UL;
+	uint64_t word;
+
+	assert(string != NULL);
+
+	length = strlen(string);
+	for (remaining = length; remaining >= 8; remaining -= 8, bytes += 8)
+	{
+		word = hash_read_64(bytes);
+		crc_1 = hash_crc32c(crc_1, word);
+		crc_2 = hash_crc32c(crc_2, word * WY_SECRET_2);
+	}
+
+	/* the last 0 .. 7 bytes, zero padded */
+	word = 0;
+	memcpy(&word, bytes, remaining);
+	crc_1 = hash_crc32c(crc_1, word);
+	crc_2 = hash_crc32c(crc_2, word * WY_SECRET_2);
+
+	return hash_mix(((uint64_t)crc_1 << 32 | crc_2) ^ WY_SECRET_0,
+		(uint64_t)length ^ WY_SECRET_1);
+}
+
+/* Rounds of AES over the string in 16 byte blocks. Without the AES
+* instructions this is Hash_Table_Hash_Wy, so the values depend on how the
+* library was built. */
+uint64_t Hash_Table_Hash_Aes(char * string)
+{
+#if defined(HASH_AES_NI)
+	const unsigned char * bytes = (const unsigned char *)string;
+	unsigned char tail[16];
+	size_t length, remaining;
+	__m128i state, key, block;
+	uint64_t halves[2];
+
+	assert(string != NULL);
+
+	length = strlen(string);
+	key = _mm_set_epi32(0x2d358dcc, (int)0xaa6c78a5, (int)0x8bb84b93,
+		(int)0x962eacc9);
+	state = _mm_xor_si128(key, _mm_set_epi32(0, 0, 0, (int)length));
+
+	for (remaining = length; remaining >= 16; remaining -= 16, bytes += 16)
+	{
+		block = _mm_loadu_si128((const __m128i *)bytes);
+		state = _mm_aesenc_si128(_mm_xor_si128(state, block), key);
+	}
+
+	if (remaining > 0)
+	{
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, bytes, remaining);
+		block = _mm_loadu_si128((const __m128i *)tail);
+		state = _mm_aesenc_si128(_mm_xor_si128(state, block), key);
+	}
+
+	/* two more rounds so every input bit reaches every output bit */
+	state = _mm_aesenc_si128(state, key);
+	state = _mm_aesenc_si128(state, key);
+
+	_mm_storeu_si128((__m128i *)halves, state);
+	return halves[0] ^ halves[1];
+#else
+	return Hash_Table_Hash_Wy(string);
+#endif
+}
+
+/* Map hash onto 0 .. number_of_buckets - 1 by the high bits of the product
+* (fastrange) rather than a division */
+unsigned long Hash_Table_Reduce(uint64_t hash, unsigned long number_of_buckets)
+{
+	uint64_t low, high;
+
+	if ((uint64_t)number_of_buckets > 0xFFFFFFFF)
+	{
+		hash_multiply(hash, (uint64_t)number_of_buckets, &low, &high);
+		return (unsigned long)high;
+	}
+
+	return (unsigned long)(((hash >> 32) * number_of_buckets) >> 32);
+}
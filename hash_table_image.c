@@ -0,0 +1,617 @@
+/* hash_table_image.c - Writing tables out as images and looking up in them
+* where they are mapped, see hash_table_image.h for the file layout.
+*
+* Writing walks the table twice: once to count the keys of each image
+* bucket, then to place each key's entry in its bucket's range and append
+* its objects' bytes, which go after the index and so are written first.
+* The index (bucket starts, entries, object offsets) is built in memory
+* and written in front of them at the end.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IMAGE_MMAP 1
+#endif
+
+#include "hash_table_image.h"
+#include "hash_table_internal.h"
+
+#define IMAGE_BYTE_ORDER ((uint64_t)0x01020304 << 32 | 0x05060708)
+/* Round offset up to the next multiple of 8 */
+#define IMAGE_ALIGN(offset) (((offset) + 7) & ~(uint64_t)7)
+
+/* Append object's length and bytes to file, padded to a multiple of 8.
+* Return 1 if successful - 0 if failure (I/O).
+*/
+static int image_write_object(FILE * file, const void * bytes,
+	uint64_t length)
+{
+	static const char padding[8] = {0};
+
+	if (fwrite(&length, sizeof(uint64_t), 1, file) != 1)
+		return 0;
+	if (length != 0 && fwrite(bytes, (size_t)length, 1, file) != 1)
+		return 0;
+	if (IMAGE_ALIGN(length) != length && fwrite(padding,
+		(size_t)(IMAGE_ALIGN(length) - length), 1, file) != 1)
+		return 0;
+
+	return 1;
+}
+
+/* Walk table placing each key's entry into its bucket's range of entries
+* (bucket_starts holds where each range starts and is left holding where
+* each ends) and appending its objects to file from offset *position on,
+* which is moved on past them.
+* Return 1 if successful - 0 if failure (I/O).
+*/
+static int image_write_objects(hash_table_t * table, FILE * file,
+	size_t(*object_function)(void * object, const void ** bytes),
+	uint64_t * position, unsigned long number_of_buckets,
+	uint64_t * bucket_starts, hash_table_image_entry_t * entries,
+	uint64_t * objects)
+{
+	hash_table_iterator_t iterator;
+	hash_table_image_entry_t * entry;
+	unsigned long object_index = 0, i;
+	const void * bytes;
+	void * object;
+	size_t length;
+
+	Hash_Table_Iterator_Init(table, &iterator, 0, 1);
+	object = Hash_Table_Iterator_Next(&iterator);
+	while (object != NULL)
+	{
+		entry = &entries[bucket_starts[Hash_Table_Reduce(iterator.hash,
+			number_of_buckets)]++];
+		entry->hash = iterator.hash;
+		entry->first_object = object_index;
+		entry->number_of_objects = iterator.duplicates.number_remaining + 1;
+
+		for (i = 0; i < entry->number_of_objects; i++)
+		{
+			if (i > 0)
+				object = Hash_Table_Iterator_Next(&iterator);
+
+			length = object_function(object, &bytes);
+			if (!image_write_object(file, bytes, length))
+				return 0;
+
+			/* objects point past the length, at the bytes */
+			objects[object_index++] = *position + sizeof(uint64_t);
+			*position += sizeof(uint64_t) + IMAGE_ALIGN(length);
+		}
+
+		object = Hash_Table_Iterator_Next(&iterator);
+	}
+
+	return 1;
+}
+
+/* Save table to the file at path.
+* Return 1 if successful - 0 if failure (memory allocation or I/O).
+*/
+int Hash_Table_Image_Write(hash_table_t * table, const char * path,
+	size_t(*object_function)(void * object, const void ** bytes))
+{
+	hash_table_image_header_t header;
+	hash_table_iterator_t iterator;
+	hash_table_image_entry_t * entries;
+	uint64_t * bucket_starts, * objects;
+	unsigned long number_of_keys, number_of_objects, number_of_buckets, i;
+	FILE * file;
+	int written = 0;
+
+	assert(table != NULL);
+	assert(path != NULL);
+	assert(object_function != NULL);
+
+	number_of_keys = table->number_of_buckets_filled;
+	if (table->storage == HASH_TABLE_STORAGE_CHAINED)
+		number_of_keys += table->number_of_collisions;
+	number_of_objects = number_of_keys + table->number_of_duplicates;
+
+	/* about one key per bucket, the keys of a bucket being side by side */
+	number_of_buckets = number_of_keys > 0 ? number_of_keys : 1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HASH_TABLE_IMAGE_MAGIC, sizeof(header.magic));
+	header.byte_order = IMAGE_BYTE_ORDER;
+	header.keyed = table->key_function != NULL;
+	header.number_of_buckets = number_of_buckets;
+	header.number_of_keys = number_of_keys;
+	header.number_of_objects = number_of_objects;
+	header.bucket_starts_offset = sizeof(header);
+	header.entries_offset = header.bucket_starts_offset +
+		((uint64_t)number_of_buckets + 1) * sizeof(uint64_t);
+	header.objects_offset = header.entries_offset +
+		(uint64_t)number_of_keys * sizeof(hash_table_image_entry_t);
+
+	bucket_starts = Hash_Table_Allocate(table, number_of_buckets + 1,
+		sizeof(uint64_t));
+	entries = Hash_Table_Allocate(table, number_of_keys,
+		sizeof(hash_table_image_entry_t));
+	objects = Hash_Table_Allocate(table, number_of_objects, sizeof(uint64_t));
+	file = fopen(path, "wb");
+
+	if (bucket_starts != NULL && (entries != NULL || number_of_keys == 0) &&
+		(objects != NULL || number_of_objects == 0) && file != NULL)
+	{
+		/* count the keys of each bucket, then turn the counts into where
+		* each bucket's keys start */
+		Hash_Table_Iterator_Init(table, &iterator, 0, 1);
+		while (Hash_Table_Iterator_Next(&iterator) != NULL)
+		{
+			bucket_starts[Hash_Table_Reduce(iterator.hash,
+				number_of_buckets) + 1]++;
+			iterator.duplicates.number_remaining = 0;
+		}
+		for (i = 0; i < number_of_buckets; i++)
+			bucket_starts[i + 1] += bucket_starts[i];
+
+		header.size = header.objects_offset +
+			(uint64_t)number_of_objects * sizeof(uint64_t);
+		written = header.size <= (uint64_t)LONG_MAX &&
+			fseek(file, (long)header.size, SEEK_SET) == 0 &&
+			image_write_objects(table, file, object_function, &header.size,
+			number_of_buckets, bucket_starts, entries, objects);
+
+		if (written)
+		{
+			/* each start was moved on to the end of its bucket, which is
+			* where the next bucket starts */
+			for (i = number_of_buckets; i > 0; i--)
+				bucket_starts[i] = bucket_starts[i - 1];
+			bucket_starts[0] = 0;
+
+			written = fseek(file, 0, SEEK_SET) == 0 &&
+				fwrite(&header, sizeof(header), 1, file) == 1 &&
+				fwrite(bucket_starts, sizeof(uint64_t), number_of_buckets + 1,
+				file) == number_of_buckets + 1 &&
+				fwrite(entries, sizeof(hash_table_image_entry_t),
+				number_of_keys, file) == number_of_keys &&
+				fwrite(objects, sizeof(uint64_t), number_of_objects, file) ==
+				number_of_objects;
+		}
+	}
+
+	if (file != NULL && fclose(file) != 0)
+		written = 0;
+	if (file != NULL && !written)
+		remove(path);
+
+	Hash_Table_Release(table, objects, number_of_objects, sizeof(uint64_t));
+	Hash_Table_Release(table, entries, number_of_keys,
+		sizeof(hash_table_image_entry_t));
+	Hash_Table_Release(table, bucket_starts, number_of_buckets + 1,
+		sizeof(uint64_t));
+
+	return written;
+}
+
+/* Map (or read) the file at path into image->base.
+* Return 1 if successful - 0 if failure (memory allocation or I/O).
+*/
+static int image_load(hash_table_image_t * image, const char * path)
+{
+#if defined(IMAGE_MMAP)
+	struct stat file_status;
+	void * memory;
+	int descriptor;
+
+	descriptor = open(path, O_RDONLY);
+	if (descriptor < 0)
+		return 0;
+
+	if (fstat(descriptor, &file_status) != 0 || file_status.st_size <
+		(off_t)sizeof(hash_table_image_header_t))
+	{
+		close(descriptor);
+		return 0;
+	}
+
+	memory = mmap(NULL, (size_t)file_status.st_size, PROT_READ, MAP_SHARED,
+		descriptor, 0);
+	close(descriptor);
+	if (memory == MAP_FAILED)
+		return 0;
+
+	image->base = memory;
+	image->size = (size_t)file_status.st_size;
+	image->mapped = 1;
+	return 1;
+#else
+	FILE * file;
+	unsigned char * memory;
+	long size;
+
+	file = fopen(path, "rb");
+	if (file == NULL)
+		return 0;
+
+	if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) <
+		(long)sizeof(hash_table_image_header_t) ||
+		fseek(file, 0, SEEK_SET) != 0)
+	{
+		fclose(file);
+		return 0;
+	}
+
+	memory = image->allocator.allocate((size_t)size, image->allocator.context);
+	if (memory == NULL || fread(memory, (size_t)size, 1, file) != 1)
+	{
+		if (memory != NULL)
+			image->allocator.release(memory, (size_t)size,
+				image->allocator.context);
+		fclose(file);
+		return 0;
+	}
+
+	fclose(file);
+	image->base = memory;
+	image->size = (size_t)size;
+	return 1;
+#endif
+}
+
+/* Does every index the image holds stay inside it: bucket starts going up
+* from 0 to number_of_keys, each entry's objects among number_of_objects,
+* each object 8 byte aligned and its length and bytes between the index
+* (ending at objects_end) and the end of the image. Checked once on open
+* so lookups can follow them without bounds checks.
+* Returns 1 if they do, 0 if not.
+*/
+static int image_check_index(hash_table_image_t * image, uint64_t objects_end)
+{
+	const hash_table_image_entry_t * entry;
+	uint64_t size = image->size, offset, i;
+
+	if (image->bucket_starts[0] != 0 ||
+		image->bucket_starts[image->number_of_buckets] !=
+		image->number_of_keys)
+		return 0;
+	for (i = 0; i < image->number_of_buckets; i++)
+	{
+		if (image->bucket_starts[i] > image->bucket_starts[i + 1])
+			return 0;
+	}
+
+	for (i = 0; i < image->number_of_keys; i++)
+	{
+		entry = &image->entries[i];
+		if (entry->number_of_objects == 0 ||
+			entry->first_object >= image->number_of_objects ||
+			entry->number_of_objects >
+			image->number_of_objects - entry->first_object)
+			return 0;
+	}
+
+	for (i = 0; i < image->number_of_objects; i++)
+	{
+		/* the length sits in the 8 bytes before the offset */
+		offset = image->objects[i];
+		if (offset % sizeof(uint64_t) != 0 ||
+			offset < objects_end + sizeof(uint64_t) || offset > size ||
+			((const uint64_t *)(image->base + offset))[-1] > size - offset)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Does the header describe an image of the loaded size, in this byte
+* order, keyed as the config. The parts are then where the header says.
+* Returns 1 if it does, 0 if not.
+*/
+static int image_check(hash_table_image_t * image, int keyed)
+{
+	const hash_table_image_header_t * header =
+		(const hash_table_image_header_t *)image->base;
+	uint64_t size = image->size;
+
+	if (memcmp(header->magic, HASH_TABLE_IMAGE_MAGIC,
+		sizeof(header->magic)) != 0 ||
+		header->byte_order != IMAGE_BYTE_ORDER ||
+		header->keyed != (uint64_t)keyed || header->size != size)
+		return 0;
+
+	/* the counts are bounded by the size first, so nothing overflows */
+	if (header->number_of_buckets == 0 ||
+		header->number_of_buckets >= size / sizeof(uint64_t) ||
+		header->number_of_keys > size / sizeof(hash_table_image_entry_t) ||
+		header->number_of_objects > size / sizeof(uint64_t) ||
+		header->number_of_buckets > ULONG_MAX ||
+		header->number_of_objects > ULONG_MAX)
+		return 0;
+
+	if (header->bucket_starts_offset != sizeof(hash_table_image_header_t) ||
+		header->entries_offset != header->bucket_starts_offset +
+		(header->number_of_buckets + 1) * sizeof(uint64_t) ||
+		header->objects_offset != header->entries_offset +
+		header->number_of_keys * sizeof(hash_table_image_entry_t) ||
+		header->objects_offset + header->number_of_objects *
+		sizeof(uint64_t) > size)
+		return 0;
+
+	image->number_of_buckets = (unsigned long)header->number_of_buckets;
+	image->number_of_keys = (unsigned long)header->number_of_keys;
+	image->number_of_objects = (unsigned long)header->number_of_objects;
+	image->bucket_starts = (const uint64_t *)(image->base +
+		header->bucket_starts_offset);
+	image->entries = (const hash_table_image_entry_t *)(image->base +
+		header->entries_offset);
+	image->objects = (const uint64_t *)(image->base + header->objects_offset);
+
+	return image_check_index(image, header->objects_offset +
+		header->number_of_objects * sizeof(uint64_t));
+}
+
+/*
+* Returns the image at path opened for lookups
+* Returns NULL if failure (memory allocation, I/O, or not a readable image).
+*/
+hash_table_image_t * Hash_Table_Image_Open(const char * path,
+	hash_table_config_t * config)
+{
+	hash_table_image_t * image;
+	hash_table_allocator_t allocator;
+
+	assert(path != NULL);
+	assert(config != NULL);
+	assert(config->key_function != NULL || config->search_function != NULL);
+
+	allocator = Hash_Table_Allocator_Or_Default(&config->allocator);
+	image = allocator.allocate(sizeof(hash_table_image_t), allocator.context);
+	if (image == NULL)
+		return NULL;
+
+	image->allocator = allocator;
+	image->hash_function = config->hash_function;
+	image->search_function = config->search_function;
+	image->full_hash_function = config->full_hash_function;
+	if (config->hash_function == NULL && config->full_hash_function == NULL)
+		image->full_hash_function = Hash_Table_Hash_Wy;
+	image->key_function = config->key_function;
+	image->key_hash_function = config->key_hash_function != NULL ?
+		config->key_hash_function : Hash_Table_Hash_Bytes;
+
+	if (!image_load(image, path))
+	{
+		allocator.release(image, sizeof(hash_table_image_t),
+			allocator.context);
+		return NULL;
+	}
+
+	if (!image_check(image, config->key_function != NULL))
+	{
+		Hash_Table_Image_Close(image);
+		return NULL;
+	}
+
+	return image;
+}
+
+/* Unmap (or free) the image */
+void Hash_Table_Image_Close(hash_table_image_t * image)
+{
+	hash_table_allocator_t allocator;
+
+	assert(image != NULL);
+
+	allocator = image->allocator;
+#if defined(IMAGE_MMAP)
+	if (image->mapped)
+		munmap((void *)image->base, image->size);
+	else
+#endif
+		allocator.release((void *)image->base, image->size,
+			allocator.context);
+	allocator.release(image, sizeof(hash_table_image_t), allocator.context);
+}
+
+/* A copy of image in memory from allocator.
+* Returns NULL if failure (memory allocation).
+*/
+hash_table_image_t * Hash_Table_Image_Copy(hash_table_image_t * image,
+	hash_table_allocator_t * allocator)
+{
+	hash_table_image_t * copy;
+	hash_table_allocator_t copy_allocator;
+	unsigned char * base;
+
+	assert(image != NULL);
+	assert(allocator != NULL);
+
+	copy_allocator = Hash_Table_Allocator_Or_Default(allocator);
+	copy = copy_allocator.allocate(sizeof(hash_table_image_t),
+		copy_allocator.context);
+	if (copy == NULL)
+		return NULL;
+
+	base = copy_allocator.allocate(image->size, copy_allocator.context);
+	if (base == NULL)
+	{
+		copy_allocator.release(copy, sizeof(hash_table_image_t),
+			copy_allocator.context);
+		return NULL;
+	}
+	memcpy(base, image->base, image->size);
+
+	/* the same parts, at the same offsets in the copy */
+	*copy = *image;
+	copy->base = base;
+	copy->mapped = 0;
+	copy->allocator = copy_allocator;
+	copy->bucket_starts = (const uint64_t *)(base +
+		((const unsigned char *)image->bucket_starts - image->base));
+	copy->entries = (const hash_table_image_entry_t *)(base +
+		((const unsigned char *)image->entries - image->base));
+	copy->objects = (const uint64_t *)(base +
+		((const unsigned char *)image->objects - image->base));
+
+	return copy;
+}
+
+/* The saved bytes of object index */
+static void * image_object(hash_table_image_t * image, uint64_t index)
+{
+	return (void *)(image->base + image->objects[index]);
+}
+
+/* Entry of the key with full hash: key (when keyed) or pattern for
+* search_function. Returns NULL if it is not in the image. */
+static const hash_table_image_entry_t * image_find(hash_table_image_t * image,
+	char * pattern, const hash_table_key_t * key, uint64_t hash)
+{
+	const hash_table_image_entry_t * entry;
+	hash_table_key_t object_key;
+	unsigned long bucket;
+	uint64_t i;
+
+	bucket = Hash_Table_Reduce(hash, image->number_of_buckets);
+	for (i = image->bucket_starts[bucket];
+		i < image->bucket_starts[bucket + 1]; i++)
+	{
+		entry = &image->entries[i];
+		if (entry->hash != hash)
+			continue;
+
+		if (key != NULL)
+		{
+			image->key_function(image_object(image, entry->first_object),
+				&object_key);
+			if (object_key.length == key->length &&
+				memcmp(object_key.key, key->key, key->length) == 0)
+				return entry;
+		}
+		else if (image->search_function(pattern,
+			image_object(image, entry->first_object)) == 1)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Copy the objects of entry (may be NULL) into records, at most
+* max_num_records of them. Returns the number copied. */
+static unsigned long image_copy(hash_table_image_t * image,
+	const hash_table_image_entry_t * entry, void ** records,
+	unsigned long max_num_records)
+{
+	unsigned long i;
+
+	if (entry == NULL)
+		return 0;
+
+	for (i = 0; i < entry->number_of_objects && i < max_num_records; i++)
+		records[i] = image_object(image, entry->first_object + i);
+
+	return i;
+}
+
+/* The entry pattern is the key of, for either kind of image */
+static const hash_table_image_entry_t * image_find_pattern(
+	hash_table_image_t * image, char * pattern)
+{
+	hash_table_key_t key;
+
+	if (image->key_function != NULL)
+	{
+		key.key = pattern;
+		key.length = strlen(pattern);
+		return image_find(image, pattern, &key,
+			HASH_TABLE_HASH(image, pattern));
+	}
+
+	return image_find(image, pattern, NULL, HASH_TABLE_HASH(image, pattern));
+}
+
+/* The entry of key, length bytes long, in a keyed image */
+static const hash_table_image_entry_t * image_find_bytes(
+	hash_table_image_t * image, const void * key, size_t length)
+{
+	hash_table_key_t pattern;
+
+	assert(image->key_function != NULL);
+
+	pattern.key = key;
+	pattern.length = length;
+	return image_find(image, NULL, &pattern,
+		image->key_hash_function(key, length));
+}
+
+/* Returns the first object saved under pattern, NULL if none */
+void * Hash_Table_Image_First_Match(hash_table_image_t * image,
+	char * pattern)
+{
+	const hash_table_image_entry_t * entry;
+
+	assert(image != NULL);
+	assert(pattern != NULL);
+
+	entry = image_find_pattern(image, pattern);
+	return entry != NULL ? image_object(image, entry->first_object) : NULL;
+}
+
+/* Copy the objects saved under pattern into records, at most
+* max_num_records. Returns the number copied, 0 if nothing found. */
+unsigned long Hash_Table_Image_Match_Into(hash_table_image_t * image,
+	char * pattern, void ** records, unsigned long max_num_records)
+{
+	assert(image != NULL);
+	assert(pattern != NULL);
+	assert(records != NULL || max_num_records == 0);
+
+	return image_copy(image, image_find_pattern(image, pattern), records,
+		max_num_records);
+}
+
+void * Hash_Table_Image_First_Match_Bytes(hash_table_image_t * image,
+	const void * key, size_t length)
+{
+	const hash_table_image_entry_t * entry;
+
+	assert(image != NULL);
+
+	entry = image_find_bytes(image, key, length);
+	return entry != NULL ? image_object(image, entry->first_object) : NULL;
+}
+
+unsigned long Hash_Table_Image_Match_Into_Bytes(hash_table_image_t * image,
+	const void * key, size_t length, void ** records,
+	unsigned long max_num_records)
+{
+	assert(image != NULL);
+	assert(records != NULL || max_num_records == 0);
+
+	return image_copy(image, image_find_bytes(image, key, length), records,
+		max_num_records);
+}
+
+/* Number of bytes saved for object, one returned by an image lookup */
+size_t Hash_Table_Image_Object_Length(const void * object)
+{
+	assert(object != NULL);
+
+	return (size_t)((const uint64_t *)object)[-1];
+}
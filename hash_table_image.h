@@ -0,0 +1,141 @@
+/* hash_table_image.h - Snapshots of a table as a file that is looked up in
+* place. Hash_Table_Image_Write saves the table with every pointer turned
+* into an offset, so Hash_Table_Image_Open only has to map the file
+* read-only (POSIX mmap, a plain read elsewhere) to serve lookups: nothing
+* is parsed or rebuilt at startup, and processes mapping the same image
+* share its pages in the page cache. Opening does read the index once (not
+* the objects' bytes) to check every offset in it stays inside the file.
+*
+* Objects are saved as the bytes object_function gives for each of them,
+* and lookups hand back pointers to those bytes in the image. The search
+* and key functions used with the image see these copies, not the original
+* objects, so they must work on them (objects without pointers saved as
+* themselves need nothing special).
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_IMAGE_H
+#define __HASH_TABLE_IMAGE_H
+
+#include "hash_table.h"
+
+/* File layout, all fields native uint64_t and every part at an offset
+* (from the start of the file) that is a multiple of 8:
+*   header
+*   bucket_starts - number_of_buckets + 1 entry indices, bucket b's keys
+*                   being entries[bucket_starts[b] .. bucket_starts[b + 1])
+*   entries       - number_of_keys hash_table_image_entry_t
+*   objects       - number_of_objects offsets of object bytes, each key's
+*                   objects together in insertion order
+*   object bytes  - each preceded by its length
+* Buckets are picked by Hash_Table_Reduce of the full hash.
+*/
+#define HASH_TABLE_IMAGE_MAGIC "HTIMAGE1"
+
+typedef struct hash_table_image_header_t {
+	char magic[8];
+	uint64_t byte_order; /* 0x0102030405060708 as written */
+	uint64_t keyed; /* 1 if written from a table with key_function */
+	uint64_t number_of_buckets;
+	uint64_t number_of_keys;
+	uint64_t number_of_objects;
+	uint64_t bucket_starts_offset;
+	uint64_t entries_offset;
+	uint64_t objects_offset;
+	uint64_t size; /* of the whole file */
+} hash_table_image_header_t;
+
+typedef struct hash_table_image_entry_t {
+	uint64_t hash; /* full hash of the key */
+	uint64_t first_object; /* index into objects */
+	uint64_t number_of_objects; /* 1 + number of duplicates */
+} hash_table_image_entry_t;
+
+/* An open image: the file's bytes and the callbacks to look them up with */
+typedef struct hash_table_image_t {
+	const unsigned char * base;
+	size_t size;
+	int mapped; /* base is a mapping of the file rather than a copy */
+
+	unsigned long number_of_buckets;
+	unsigned long number_of_keys;
+	unsigned long number_of_objects;
+	const uint64_t * bucket_starts;
+	const hash_table_image_entry_t * entries;
+	const uint64_t * objects;
+
+	/* as in hash_table_t, taken from the config the image is opened with */
+	unsigned long(*hash_function)(char * string, unsigned long max_number);
+	int(*search_function)(char * search_string, void * object);
+	uint64_t(*full_hash_function)(char * string);
+	void(*key_function)(void * object, hash_table_key_t * key);
+	uint64_t(*key_hash_function)(const void * key, size_t length);
+
+	hash_table_allocator_t allocator;
+} hash_table_image_t;
+
+/* Save table to the file at path (replaced if it exists). object_function
+* points *bytes at what should be saved for object and returns how many
+* bytes that is. Nothing may write to the table meanwhile. Images being
+* served should be replaced by writing a new file and renaming it over the
+* old one, never by writing into a file that is mapped.
+* Return 1 if successful - 0 if failure (memory allocation or I/O).
+*/
+int Hash_Table_Image_Write(hash_table_t * table, const char * path,
+	size_t(*object_function)(void * object, const void ** bytes));
+
+/* Open the image at path for lookups. config must have the hash, search
+* and key functions (and keyed or not) of the table that was written, its
+* allocator is used for the image struct (and the copy of the file when it
+* cannot be mapped). The rest of config is not used.
+* Returns NULL if failure (memory allocation, I/O, or not an image this
+* build and config can read, including one truncated or with offsets out of
+* bounds).
+*/
+hash_table_image_t * Hash_Table_Image_Open(const char * path,
+	hash_table_config_t * config);
+
+/* A copy of image in memory from allocator, looked up the same way. With
+* an allocator from Hash_Table_Pages_Allocator bound to a NUMA node this
+* makes a replica local to that node's threads, one per node for a table
+* read from them all (see hash_table_pages.h).
+* Returns NULL if failure (memory allocation).
+*/
+hash_table_image_t * Hash_Table_Image_Copy(hash_table_image_t * image,
+	hash_table_allocator_t * allocator);
+
+/* Unmap (or free) the image. Objects taken from it are gone with it. */
+void Hash_Table_Image_Close(hash_table_image_t * image);
+
+/* Lookups, as Hash_Table_First_Match / Hash_Table_Match_Into (and their
+* _Bytes versions for keyed images) but handing back the saved bytes of
+* the objects. Do not allocate. Any number of threads can look up in an
+* image at the same time.
+*/
+void * Hash_Table_Image_First_Match(hash_table_image_t * image,
+	char * pattern);
+unsigned long Hash_Table_Image_Match_Into(hash_table_image_t * image,
+	char * pattern, void ** records, unsigned long max_num_records);
+void * Hash_Table_Image_First_Match_Bytes(hash_table_image_t * image,
+	const void * key, size_t length);
+unsigned long Hash_Table_Image_Match_Into_Bytes(hash_table_image_t * image,
+	const void * key, size_t length, void ** records,
+	unsigned long max_num_records);
+
+/* Number of bytes saved for object, one returned by an image lookup */
+size_t Hash_Table_Image_Object_Length(const void * object);
+
+#endif
@@ -0,0 +1,438 @@
+/* hash_table_index.c - Ordered skip list index over a table's objects.
+*
+* Every object, duplicates included, has a node of 1 to
+* HASH_TABLE_INDEX_MAX_HEIGHT levels, each level up taken with a 1/4
+* chance. Objects of one key sit together, newest last. The table calls
+* index_function around each insert: RESERVE allocates the node first, so
+* running out of memory fails the insert rather than leaving the index
+* short, then ADD links it (CANCEL keeps it for the next insert). Removals
+* find their nodes again by comparing objects, so the objects must still be
+* alive when DROP / DROP_KEY are sent.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include <string.h>
+
+#include "hash_table_index.h"
+#include "hash_table_internal.h"
+
+/* Bytes of a node of height levels */
+#define INDEX_NODE_SIZE(height) (sizeof(hash_table_index_node_t) + \
+	((height) - 1) * sizeof(hash_table_index_node_t *))
+
+/* Keyed tables: order of two keys as bytes, a key before the longer keys
+* it starts */
+static int index_key_order(const void * key1, size_t length1,
+	const void * key2, size_t length2)
+{
+	int order;
+
+	order = memcmp(key1, key2, length1 < length2 ? length1 : length2);
+	if (order != 0 || length1 == length2)
+		return order;
+
+	return length1 < length2 ? -1 : 1;
+}
+
+/* Order of object1 against object2 in the index */
+static int index_compare(hash_table_t * table, void * object1,
+	void * object2)
+{
+	hash_table_key_t key1, key2;
+
+	HASH_TABLE_COUNT(table, compare_calls);
+	if (table->key_function == NULL)
+		return table->compare_function(object1, object2);
+
+	table->key_function(object1, &key1);
+	table->key_function(object2, &key2);
+	return index_key_order(key1.key, key1.length, key2.key, key2.length);
+}
+
+/* Order of pattern against object's key */
+static int index_order(hash_table_t * table, char * pattern, void * object)
+{
+	hash_table_key_t key;
+
+	if (table->index->order_function != NULL)
+		return table->index->order_function(pattern, object);
+
+	table->key_function(object, &key);
+	return index_key_order(pattern, strlen(pattern), key.key, key.length);
+}
+
+/* Does object's key start with prefix */
+static int index_has_prefix(hash_table_t * table, char * prefix,
+	void * object)
+{
+	hash_table_key_t key;
+	size_t length;
+
+	if (table->index->prefix_function != NULL)
+		return table->index->prefix_function(prefix, object) == 1;
+
+	table->key_function(object, &key);
+	length = strlen(prefix);
+	return key.length >= length && memcmp(key.key, prefix, length) == 0;
+}
+
+static void index_release_node(hash_table_t * table,
+	hash_table_index_node_t * node)
+{
+	table->index->size -= INDEX_NODE_SIZE(node->height);
+	Hash_Table_Release(table, node, 1, INDEX_NODE_SIZE(node->height));
+}
+
+/* A node of random height, NULL if failure (memory allocation) */
+static hash_table_index_node_t * index_new_node(hash_table_t * table)
+{
+	hash_table_index_t * index = table->index;
+	hash_table_index_node_t * node;
+	unsigned int height = 1;
+	uint64_t bits;
+
+	/* two bits of a mixed counter per level */
+	bits = Hash_Table_Hash_Mix(++(index->random));
+	while ((bits & 3) == 0 && height < HASH_TABLE_INDEX_MAX_HEIGHT)
+	{
+		height++;
+		bits >>= 2;
+	}
+
+	node = Hash_Table_Allocate(table, 1, INDEX_NODE_SIZE(height));
+	if (node == NULL)
+		return NULL;
+
+	node->height = height;
+	index->size += INDEX_NODE_SIZE(height);
+	return node;
+}
+
+/* Fill before[] with the last node on each level whose object sorts
+* before object, or not after it when after_equal is set */
+static void index_find(hash_table_t * table, void * object, int after_equal,
+	hash_table_index_node_t ** before)
+{
+	hash_table_index_t * index = table->index;
+	hash_table_index_node_t * node = index->head;
+	unsigned int level = HASH_TABLE_INDEX_MAX_HEIGHT;
+	int order;
+
+	while (level-- > 0)
+	{
+		while (level < index->height && node->next[level] != NULL)
+		{
+			order = index_compare(table, node->next[level]->object, object);
+			if (order > 0 || (order == 0 && !after_equal))
+				break;
+			node = node->next[level];
+		}
+		before[level] = node;
+	}
+}
+
+/* Link node in for object, after the objects of the same key */
+static void index_link(hash_table_t * table, hash_table_index_node_t * node,
+	void * object)
+{
+	hash_table_index_t * index = table->index;
+	hash_table_index_node_t * before[HASH_TABLE_INDEX_MAX_HEIGHT];
+	unsigned int level;
+
+	index_find(table, object, 1, before);
+
+	node->object = object;
+	for (level = 0; level < node->height; level++)
+	{
+		node->next[level] = before[level]->next[level];
+		before[level]->next[level] = node;
+	}
+
+	if (node->height > index->height)
+		index->height = node->height;
+	(index->number_of_objects)++;
+}
+
+/* Levels at the top left empty by a removal are no longer used */
+static void index_lower(hash_table_index_t * index)
+{
+	while (index->height > 0 && index->head->next[index->height - 1] == NULL)
+		(index->height)--;
+}
+
+/* Take the node of object out, or those of its whole key */
+static void index_unlink(hash_table_t * table, void * object, int whole_key)
+{
+	hash_table_index_t * index = table->index;
+	hash_table_index_node_t * before[HASH_TABLE_INDEX_MAX_HEIGHT], * node,
+		* next, * previous;
+	unsigned int level;
+
+	index_find(table, object, 0, before);
+
+	if (whole_key)
+	{
+		/* unlink the key's run on every level, then free it along level 0 */
+		node = before[0]->next[0];
+		for (level = 0; level < index->height; level++)
+		{
+			while (before[level]->next[level] != NULL &&
+				index_compare(table, before[level]->next[level]->object,
+				object) == 0)
+				before[level]->next[level] =
+					before[level]->next[level]->next[level];
+		}
+
+		for (; node != before[0]->next[0]; node = next)
+		{
+			next = node->next[0];
+			(index->number_of_objects)--;
+			index_release_node(table, node);
+		}
+	}
+	else
+	{
+		/* the node is somewhere in its key's run */
+		for (node = before[0]->next[0]; node != NULL && node->object != object;
+			node = node->next[0])
+		{
+			if (index_compare(table, node->object, object) != 0)
+				return;
+		}
+		if (node == NULL)
+			return;
+
+		for (level = 0; level < node->height; level++)
+		{
+			for (previous = before[level]; previous->next[level] != node;
+				previous = previous->next[level])
+				;
+			previous->next[level] = node->next[level];
+		}
+
+		(index->number_of_objects)--;
+		index_release_node(table, node);
+	}
+
+	index_lower(index);
+}
+
+/* Free every node and the index, leaving the table without one */
+static void index_free(hash_table_t * table)
+{
+	hash_table_index_t * index = table->index;
+	hash_table_index_node_t * node, * next;
+
+	for (node = index->head; node != NULL; node = next)
+	{
+		next = node->next[0];
+		index_release_node(table, node);
+	}
+	if (index->reserved != NULL)
+		index_release_node(table, index->reserved);
+
+	Hash_Table_Release(table, index, 1, sizeof(hash_table_index_t));
+	table->index = NULL;
+	table->index_function = NULL;
+}
+
+/* index_function of tables with an index */
+static int index_event(hash_table_t * table, hash_table_index_event_t event,
+	void * object)
+{
+	hash_table_index_t * index = table->index;
+
+	switch (event)
+	{
+	case HASH_TABLE_INDEX_RESERVE:
+		if (index->reserved == NULL)
+			index->reserved = index_new_node(table);
+		return index->reserved != NULL;
+	case HASH_TABLE_INDEX_ADD:
+		index_link(table, index->reserved, object);
+		index->reserved = NULL;
+		break;
+	case HASH_TABLE_INDEX_CANCEL:
+		break; /* the node is kept for the next insert */
+	case HASH_TABLE_INDEX_DROP:
+		index_unlink(table, object, 0);
+		break;
+	case HASH_TABLE_INDEX_DROP_KEY:
+		index_unlink(table, object, 1);
+		break;
+	case HASH_TABLE_INDEX_FREE:
+		index_free(table);
+		break;
+	}
+
+	return 1;
+}
+
+/* Add each object of the table as it is walked */
+static int index_attach_object(void * object, void * context)
+{
+	hash_table_t * table = context;
+
+	if (!index_event(table, HASH_TABLE_INDEX_RESERVE, NULL))
+		return 1;
+
+	index_event(table, HASH_TABLE_INDEX_ADD, object);
+	return 0;
+}
+
+/* Build an index of table's objects and keep it with the table.
+* Return 1 if successful - 0 if failure (memory allocation, an index is
+* already attached or lookups are shared).
+*/
+int Hash_Table_Index_Attach(hash_table_t * table,
+	int(*order_function)(char * pattern, void * object),
+	int(*prefix_function)(char * prefix, void * object))
+{
+	hash_table_index_t * index;
+
+	assert(table != NULL);
+	assert(order_function != NULL || table->key_function != NULL);
+
+	/* the index sorts objects, a table storing keys without key_function
+	* still has to be able to compare them */
+	if (table->index != NULL || table->shared_lookups ||
+		(table->key_function == NULL && table->compare_function == NULL))
+		return 0;
+
+	index = Hash_Table_Allocate(table, 1, sizeof(hash_table_index_t));
+	if (index == NULL)
+		return 0;
+
+	index->order_function = order_function;
+	index->prefix_function = prefix_function;
+	index->random = (uint64_t)(size_t)table;
+	table->index = index;
+
+	index->head = Hash_Table_Allocate(table, 1,
+		INDEX_NODE_SIZE(HASH_TABLE_INDEX_MAX_HEIGHT));
+	if (index->head == NULL)
+	{
+		Hash_Table_Release(table, index, 1, sizeof(hash_table_index_t));
+		table->index = NULL;
+		return 0;
+	}
+	index->head->height = HASH_TABLE_INDEX_MAX_HEIGHT;
+	index->size = INDEX_NODE_SIZE(HASH_TABLE_INDEX_MAX_HEIGHT);
+
+	if (Hash_Table_For_Each(table, index_attach_object, table) != 0)
+	{
+		index_free(table);
+		return 0;
+	}
+
+	table->index_function = index_event;
+	return 1;
+}
+
+/* Free table's index, the table goes on without one */
+void Hash_Table_Index_Detach(hash_table_t * table)
+{
+	assert(table != NULL);
+
+	if (table->index != NULL)
+		index_free(table);
+}
+
+/* First node whose key is not before pattern, NULL if none */
+static hash_table_index_node_t * index_lower_bound(hash_table_t * table,
+	char * pattern)
+{
+	hash_table_index_t * index = table->index;
+	hash_table_index_node_t * node = index->head;
+	unsigned int level = index->height;
+
+	if (pattern == NULL)
+		return node->next[0];
+
+	while (level-- > 0)
+	{
+		while (node->next[level] != NULL &&
+			index_order(table, pattern, node->next[level]->object) > 0)
+			node = node->next[level];
+	}
+
+	return node->next[0];
+}
+
+/* First object of the index whose key is not before pattern, NULL if there
+* is none */
+void * Hash_Table_Index_Lower_Bound(hash_table_t * table, char * pattern)
+{
+	hash_table_index_node_t * node;
+
+	assert(table != NULL);
+	assert(table->index != NULL);
+
+	node = index_lower_bound(table, pattern);
+	return node != NULL ? node->object : NULL;
+}
+
+/* Call callback on every object whose key is from low to high, in order.
+* Returns what callback last returned, 0 if every object was seen.
+*/
+int Hash_Table_Index_Range(hash_table_t * table, char * low, char * high,
+	int(*callback)(void * object, void * context), void * context)
+{
+	hash_table_index_node_t * node;
+	int result;
+
+	assert(table != NULL);
+	assert(table->index != NULL);
+	assert(callback != NULL);
+
+	for (node = index_lower_bound(table, low); node != NULL &&
+		(high == NULL || index_order(table, high, node->object) >= 0);
+		node = node->next[0])
+	{
+		result = callback(node->object, context);
+		if (result != 0)
+			return result;
+	}
+
+	return 0;
+}
+
+/* Hash_Table_Index_Range over the objects whose key starts with prefix */
+int Hash_Table_Index_Prefix(hash_table_t * table, char * prefix,
+	int(*callback)(void * object, void * context), void * context)
+{
+	hash_table_index_node_t * node;
+	int result;
+
+	assert(table != NULL);
+	assert(table->index != NULL);
+	assert(prefix != NULL);
+	assert(callback != NULL);
+	assert(table->index->prefix_function != NULL ||
+		table->key_function != NULL);
+
+	/* the keys starting with prefix all sort together, from prefix on */
+	for (node = index_lower_bound(table, prefix);
+		node != NULL && index_has_prefix(table, prefix, node->object);
+		node = node->next[0])
+	{
+		result = callback(node->object, context);
+		if (result != 0)
+			return result;
+	}
+
+	return 0;
+}
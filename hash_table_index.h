@@ -0,0 +1,93 @@
+/* hash_table_index.h - An ordered index over a table's objects, for range
+* and prefix scans that a hash cannot answer without walking everything.
+*
+* The index is a skip list of the table's objects sorted by
+* compare_function (by key bytes for keyed tables, a key before the longer
+* keys it starts), each key's duplicates in insertion order. Once attached
+* it is kept up to date by every insert and removal, evictions included,
+* and freed with the table. Its nodes come from the table's allocator and are
+* counted by Hash_Table_Size.
+*
+* Scans are bounded by patterns, placed among the objects by the
+* order_function given when attaching: it returns < 0 if pattern sorts
+* before object's key, 0 if it is the key, > 0 if after, consistent with
+* compare_function.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_INDEX_H
+#define __HASH_TABLE_INDEX_H
+
+#include "hash_table.h"
+
+/* Levels of the skip list, enough for any number of objects at a 1/4
+* chance of each level up */
+#define HASH_TABLE_INDEX_MAX_HEIGHT 32
+
+typedef struct hash_table_index_node_t {
+	void * object;
+	unsigned int height;
+	struct hash_table_index_node_t * next[1]; /* height of them */
+} hash_table_index_node_t;
+
+typedef struct hash_table_index_t {
+	int(*order_function)(char * pattern, void * object);
+	int(*prefix_function)(char * prefix, void * object);
+
+	/* HASH_TABLE_INDEX_MAX_HEIGHT levels, height of them in use */
+	hash_table_index_node_t * head;
+	unsigned int height;
+	unsigned long number_of_objects;
+	size_t size; /* bytes of nodes, head included */
+
+	hash_table_index_node_t * reserved; /* for the insert under way */
+	uint64_t random; /* state picking node heights */
+} hash_table_index_t;
+
+/* Build an index of table's objects and keep it with the table.
+* order_function is needed unless the table is keyed, where patterns are
+* then taken as their strlen bytes. prefix_function (object's key starts
+* with prefix, 1 if it does) is only needed for Hash_Table_Index_Prefix,
+* keyed tables again defaulting to the key bytes. Tables whose lookups are
+* shared (those of a hash_table_concurrent_t) cannot have an index.
+* Return 1 if successful - 0 if failure (memory allocation, an index is
+* already attached, lookups are shared or the table stores keys without a
+* compare_function or key_function to sort by).
+*/
+int Hash_Table_Index_Attach(hash_table_t * table,
+	int(*order_function)(char * pattern, void * object),
+	int(*prefix_function)(char * prefix, void * object));
+
+/* Free table's index, the table goes on without one */
+void Hash_Table_Index_Detach(hash_table_t * table);
+
+/* Call callback(object, context) on every object whose key is from low to
+* high (both included, either NULL for no bound), in order. The scan stops
+* early when callback returns non 0. callback must not change the table.
+* Returns what callback last returned, 0 if every object was seen.
+*/
+int Hash_Table_Index_Range(hash_table_t * table, char * low, char * high,
+	int(*callback)(void * object, void * context), void * context);
+
+/* Hash_Table_Index_Range over the objects whose key starts with prefix */
+int Hash_Table_Index_Prefix(hash_table_t * table, char * prefix,
+	int(*callback)(void * object, void * context), void * context);
+
+/* First object of the index whose key is not before pattern (the first
+* object overall when pattern is NULL), NULL if there is none */
+void * Hash_Table_Index_Lower_Bound(hash_table_t * table, char * pattern);
+
+#endif
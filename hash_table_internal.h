@@ -0,0 +1,347 @@
+/* hash_table_internal.h - Declarations shared between the hash table
+* translation units. Not part of the public interface.
+*
+* 
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+* 
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_INTERNAL_H
+#define __HASH_TABLE_INTERNAL_H
+
+#include <string.h>
+
+#include "hash_table.h"
+
+/* Full 64 bit hash of pattern, from full_hash_function when the table has
+* one, otherwise from the legacy callback given the whole unsigned long
+* range. Legacy hashes are often weak in their high bits, so they are
+* mixed before use. */
+#define HASH_TABLE_HASH(table, pattern) \
+	((table)->key_function != NULL ? \
+	(table)->key_hash_function((pattern), strlen(pattern)) : \
+	(table)->full_hash_function != NULL ? \
+	(table)->full_hash_function(pattern) : \
+	Hash_Table_Hash_Mix((uint64_t)(table)->hash_function((pattern), \
+	ULONG_MAX)))
+
+/* Internally the pattern of a keyed table, or of one storing keys, is
+* always a hash_table_key_t, HASH_TABLE_PATTERN turns a string pattern
+* into one (held in *key) */
+#define HASH_TABLE_PATTERN(table, pattern, key_holder) \
+	((table)->key_function != NULL || (table)->store_keys ? \
+	((key_holder)->key = (pattern), \
+	(key_holder)->length = strlen(pattern), (char *)(key_holder)) : \
+	(pattern))
+
+/* Bump one of table's per operation counters (hash_table_counters_t),
+* nothing unless built with HASH_TABLE_COUNTERS */
+#if defined(HASH_TABLE_COUNTERS)
+#define HASH_TABLE_COUNT(table, counter) \
+	((table)->shared_lookups ? (void)0 : (void)((table)->counters.counter++))
+#else
+#define HASH_TABLE_COUNT(table, counter) ((void)0)
+#endif
+
+/* Is object the one pattern (in the table's internal form) is after */
+#define HASH_TABLE_SEARCH(table, pattern, object) \
+	(HASH_TABLE_COUNT(table, search_calls), \
+	(table)->key_function != NULL ? \
+	Hash_Table_Key_Matches((table), (hash_table_key_t *)(pattern), \
+	(object)) : (table)->search_function((pattern), (object)) == 1)
+
+/* HASH_TABLE_SEARCH against the object of fill (of a chained table),
+* matching the stored copy of the key when the table keeps one */
+#define HASH_TABLE_SEARCH_FILL(table, pattern, fill) \
+	((table)->store_keys ? (HASH_TABLE_COUNT(table, search_calls), \
+	Hash_Table_Stored_Key_Matches(HASH_TABLE_STORED_KEY(fill), \
+	(hash_table_key_t *)(pattern))) : \
+	HASH_TABLE_SEARCH(table, pattern, (fill)->object))
+
+/* Tables storing keys without key_function get the key of an insert from
+* its pattern: point table->insert_key at it, held in *key */
+#define HASH_TABLE_INSERT_KEY(table, pattern, key_holder) \
+	((table)->store_keys && (table)->key_function == NULL ? \
+	(void)((key_holder)->key = (pattern), \
+	(key_holder)->length = strlen(pattern), \
+	(table)->insert_key = (key_holder)) : (void)0)
+
+/* Order of object1 against object2 (compare_function's convention) */
+#define HASH_TABLE_COMPARE(table, object1, object2) \
+	(HASH_TABLE_COUNT(table, compare_calls), \
+	(table)->key_function != NULL ? \
+	Hash_Table_Key_Compare((table), (object1), (object2)) : \
+	(table)->compare_function((object1), (object2)))
+
+/* Tell an attached ordered index (see hash_table_index.h) of event, 1 when
+* there is none */
+#define HASH_TABLE_INDEX_EVENT(table, event, object) \
+	((table)->index_function == NULL || \
+	(table)->index_function((table), (event), (object)))
+
+/* Publishing to lock free readers (see hash_table_concurrent.h). Anything
+* a reader can reach is written in full before a HASH_TABLE_PUBLISH of the
+* pointer (or count) that makes it reachable, and readers pick those up with
+* HASH_TABLE_READ. Without compiler support the table cannot be read
+* without locks and these are plain accesses. */
+#if defined(__GNUC__)
+#define HASH_TABLE_ATOMICS 1
+#define HASH_TABLE_PUBLISH(location, value) \
+	__atomic_store_n(&(location), (value), __ATOMIC_RELEASE)
+#define HASH_TABLE_READ(location) \
+	__atomic_load_n(&(location), __ATOMIC_ACQUIRE)
+#else
+#define HASH_TABLE_ATOMICS 0
+#define HASH_TABLE_PUBLISH(location, value) ((location) = (value))
+#define HASH_TABLE_READ(location) (location)
+#endif
+
+/* Ask for the cache line at address to be loaded ahead of use */
+#if defined(__GNUC__)
+#define HASH_TABLE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define HASH_TABLE_PREFETCH(address) ((void)(address))
+#endif
+
+/* Memory */
+
+/* allocator, or calloc/free if none was supplied */
+hash_table_allocator_t Hash_Table_Allocator_Or_Default(
+	hash_table_allocator_t * allocator);
+
+/* Bytes a block of size bytes is taken to really cost, for
+* hash_table_t.allocator_bytes: a malloc style header and rounding up to
+* 16 bytes (glibc on 64 bit). Define it when building the library to fit
+* another allocator. */
+#ifndef HASH_TABLE_ALLOCATION_COST
+#define HASH_TABLE_ALLOCATION_COST(size) \
+	((size) + 8 + 15 < 32 ? (size_t)32 : ((size) + 8 + 15) & ~(size_t)15)
+#endif
+
+/* Zeroed memory for count elements of size bytes from the table's
+* allocator, NULL on failure (or overflow). */
+void * Hash_Table_Allocate(hash_table_t * table, size_t count, size_t size);
+
+/* Give back memory from Hash_Table_Allocate, same count and size */
+void Hash_Table_Release(hash_table_t * table, void * memory, size_t count,
+	size_t size);
+
+/* Zeroed node from pool when the table is pooled, the allocator otherwise */
+void * Hash_Table_Node_Alloc(hash_table_t * table, hash_table_pool_t * pool);
+
+void Hash_Table_Node_Free(hash_table_t * table, hash_table_pool_t * pool,
+	void * node);
+
+/* Bytes held in node slabs, 0 unless pooled */
+unsigned long Hash_Table_Pools_Size(hash_table_t * table);
+
+/* Move the slabs and free nodes of from (of another table with the same
+* allocator and slab_size) into into */
+void Hash_Table_Pool_Merge(hash_table_pool_t * into, hash_table_pool_t * from);
+
+/* Statistics */
+
+/* Count a bucket holding length keys into stats */
+void Hash_Table_Stats_Add_Chain(hash_table_stats_t * stats,
+	unsigned long length);
+
+/* Count a key into stats, distance entries into its probe and with
+* number_of_duplicates duplicates */
+void Hash_Table_Stats_Add_Key(hash_table_stats_t * stats,
+	unsigned long distance, unsigned long number_of_duplicates);
+
+/* Duplicate arrays, shared by fills and flat slots */
+
+/* Where the duplicates of a hash_table_duplicates_t currently live */
+#define HASH_TABLE_DUPLICATE_OBJECTS(duplicates) \
+	((duplicates)->capacity != 0 ? (duplicates)->items.objects : \
+	(duplicates)->items.inline_objects)
+
+/* Append object to the duplicates. Return 1 if successful - 0 if failure
+* (memory allocation).
+*/
+int Hash_Table_Duplicate_Append(hash_table_t * table,
+	hash_table_duplicates_t * duplicates, void * object);
+
+/* Pass each duplicate to free_function and release the array */
+void Hash_Table_Duplicates_Free(hash_table_t * table,
+	hash_table_duplicates_t * duplicates);
+
+/* Where object sits in an entry whose own object is first: 0 for first
+* itself, i + 1 for duplicate i.
+* Returns -1 if object is not one of the entry's.
+*/
+long Hash_Table_Duplicates_Find(void * first,
+	hash_table_duplicates_t * duplicates, void * object);
+
+/* Take the object at position out of an entry that has duplicates, keeping
+* the order of the rest (taking *first moves the first duplicate up) */
+void Hash_Table_Duplicates_Take(hash_table_t * table, void ** first,
+	hash_table_duplicates_t * duplicates, uint32_t position);
+
+/* Point cursor at duplicates */
+void Hash_Table_Cursor_Set(hash_table_cursor_t * cursor,
+	hash_table_duplicates_t * duplicates);
+
+/* Entry points taking the full hash of the pattern, already worked out */
+
+/* Hash_Table_Insert for object whose pattern hashes to hash */
+int Hash_Table_Insert_Hashed(hash_table_t * table, void * object,
+	uint64_t hash);
+
+/* Hash_Table_Insert_Bulk of objects[i] under hashes[i] (hash_table_bulk.c).
+* Returns the number inserted, fewer than count if failure. */
+unsigned long Hash_Table_Insert_Bulk_Hashed(hash_table_t * table,
+	void ** objects, uint64_t * hashes, unsigned long count,
+	unsigned long number_of_threads);
+
+/* Hash_Table_Match_Cursor for pattern, which hashes to hash */
+void * Hash_Table_Match_Cursor_Hashed(hash_table_t * table, char * pattern,
+	uint64_t hash, hash_table_cursor_t * cursor);
+
+/* Hash_Table_Insert_No_Duplicate (object not NULL) or
+* Hash_Table_Find_Or_Insert (object NULL, pattern in the table's internal
+* form) for a key that hashes to hash. result is 1 if inserted, 0 already
+* there, -1 if failure. Returns the object found or inserted, NULL if
+* failure. */
+void * Hash_Table_Find_Or_Insert_Hashed(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object, void *(*create_function)(void * context),
+	void * context, int * result);
+
+/* Hash_Table_Remove for pattern, which hashes to hash */
+int Hash_Table_Remove_Hashed(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object);
+
+/* Hash_Table_Remove_Key for pattern, which hashes to hash */
+unsigned long Hash_Table_Remove_Key_Hashed(hash_table_t * table,
+	char * pattern, uint64_t hash);
+
+/* Keyed tables: does object's key equal key, and the order of two objects'
+* keys (shorter first, then by bytes) */
+int Hash_Table_Key_Matches(hash_table_t * table, hash_table_key_t * key,
+	void * object);
+int Hash_Table_Key_Compare(hash_table_t * table, void * object1,
+	void * object2);
+
+/* Stored keys (hash_table_config_t.store_keys) */
+
+/* The copy of the key kept right after a fill */
+#define HASH_TABLE_STORED_KEY(fill) \
+	((hash_table_stored_key_t *)((hash_table_fill_t *)(fill) + 1))
+
+/* Copy key into stored, into the table's arena when it is too long for
+* the fill. Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Stored_Key_Set(hash_table_t * table,
+	hash_table_stored_key_t * stored, hash_table_key_t * key);
+
+/* Take stored's key out of the arena, if it is there */
+void Hash_Table_Stored_Key_Release(hash_table_t * table,
+	hash_table_stored_key_t * stored);
+
+/* Is the stored key key, and the order of a stored key against key
+* (shorter first, then by bytes) */
+int Hash_Table_Stored_Key_Matches(hash_table_stored_key_t * stored,
+	hash_table_key_t * key);
+int Hash_Table_Stored_Key_Compare(hash_table_stored_key_t * stored,
+	hash_table_key_t * key);
+
+/* The stored key as a hash_table_key_t, in *key */
+void Hash_Table_Stored_Key_Get(hash_table_stored_key_t * stored,
+	hash_table_key_t * key);
+
+/* Free every block of the arena */
+void Hash_Table_Key_Arena_Free(hash_table_t * table);
+
+/* Move the blocks of from (of another table with the same allocator)
+* into into */
+void Hash_Table_Key_Arena_Merge(hash_table_key_arena_t * into,
+	hash_table_key_arena_t * from);
+
+/* Map hash onto 0 .. number_of_buckets - 1 by the high bits of the product
+* (fastrange), the default reduce_function */
+unsigned long Hash_Table_Reduce(uint64_t hash,
+	unsigned long number_of_buckets);
+
+/* Chained engine */
+
+/* Finish a running resize.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Finish_Resize(hash_table_t * table);
+
+/* Index of the bucket hash goes to in the current array */
+unsigned long Hash_Table_Bucket_Index(hash_table_t * table, uint64_t hash);
+
+/* Buckets covered by a word of hash_table_t.occupied, and the number of
+* words for number_of_buckets */
+#define HASH_TABLE_OCCUPANCY_BITS 64
+#define HASH_TABLE_OCCUPANCY_WORDS(number_of_buckets) \
+	(((number_of_buckets) + HASH_TABLE_OCCUPANCY_BITS - 1) / \
+	HASH_TABLE_OCCUPANCY_BITS)
+
+/* Flat (open addressing) storage, see hash_table_flat.c */
+
+/* Allocate the slot array, number_of_slots gets rounded up to a power of 2.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Flat_Init(hash_table_t * table, unsigned long number_of_slots);
+
+/* Start an incremental move to number_of_slots (rounded up to a power of 2).
+* Return 1 if successful - 0 if failure (memory allocation or too small).
+*/
+int Hash_Table_Flat_Resize(hash_table_t * table,
+	unsigned long number_of_slots);
+
+int Hash_Table_Flat_Insert(hash_table_t * table, void * object,
+	uint64_t hash);
+
+/* Hash_Table_Find_Or_Insert_Hashed for a flat table */
+void * Hash_Table_Flat_Find_Or_Insert(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object, void *(*create_function)(void * context),
+	void * context, int * result);
+
+/* Take object out of the entry for pattern, or when object is NULL the
+* entry with all its objects (passed to free_function). Returns the number
+* of objects taken out. */
+unsigned long Hash_Table_Flat_Remove(hash_table_t * table, char * pattern,
+	uint64_t hash, void * object);
+
+/* Evict one key picked by CLOCK, never one of skip_hash. Returns the
+* number of objects evicted, 0 if nothing could be. */
+unsigned long Hash_Table_Flat_Evict(hash_table_t * table, uint64_t skip_hash);
+
+/* Carry a running resize on by one step, for a lookup */
+void Hash_Table_Flat_Rehash_Step(hash_table_t * table);
+
+/* Look pattern (with full hash) up, returning the first object and
+* pointing cursor at its duplicates. Does not rehash.
+* Returns NULL if nothing found. */
+void * Hash_Table_Flat_Find(hash_table_t * table, char * pattern,
+	uint64_t hash, hash_table_cursor_t * cursor);
+
+/* Index of the first slot from position (and before end) holding an
+* entry, in the old array when old is set. Returns end if none. */
+unsigned long Hash_Table_Flat_Next_Slot(hash_table_t * table, int old,
+	unsigned long position, unsigned long end);
+
+/* Free slot array and contained objects, not the table itself */
+void Hash_Table_Flat_Free(hash_table_t * table);
+
+unsigned long Hash_Table_Flat_Size(hash_table_t * table);
+
+/* Hash_Table_Stats of the slot arrays, through
+* Hash_Table_Stats_Add_Chain / _Key */
+void Hash_Table_Flat_Stats(hash_table_t * table, hash_table_stats_t * stats);
+
+#endif
@@ -0,0 +1,379 @@
+/* hash_table_pages.c - Huge page and NUMA aware allocator for large blocks.
+*
+* Every large block is a mapping of its own, so it can be given its own
+* page size and memory policy and be unmapped as a whole. The length mapped
+* is worked out again from the size on release: size rounded up to the
+* explicit huge page size, or to whole pages. Blocks of 2MiB and up are
+* mapped 2MiB aligned, which the kernel needs to back them with transparent
+* huge pages.
+* NUMA placement goes straight to the mbind system call, so nothing beyond
+* the C library is linked.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* MAP_ANONYMOUS, MAP_HUGETLB, syscall */
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define PAGES_MMAP 1
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#define PAGES_LINUX 1
+#endif
+
+#include "hash_table_pages.h"
+#include "hash_table_internal.h"
+
+/* Transparent huge pages are this size and alignment */
+#define PAGES_TRANSPARENT_SIZE ((size_t)2 << 20)
+#define PAGES_MAX_THREADS 64
+
+/* Nodes a node mask has room for, and mbind's policies (linux/mempolicy.h) */
+#define PAGES_MAX_NODES 1024
+#define PAGES_MASK_WORDS (PAGES_MAX_NODES / (8 * sizeof(unsigned long)))
+#define PAGES_MPOL_BIND 2
+#define PAGES_MPOL_INTERLEAVE 3
+
+#if HASH_TABLE_ATOMICS
+#define PAGES_COUNT(counter) \
+	((void)__atomic_add_fetch(&(counter), 1, __ATOMIC_RELAXED))
+#else
+#define PAGES_COUNT(counter) ((void)(counter)++)
+#endif
+
+typedef struct pages_toucher_t {
+	volatile unsigned char * first;
+	size_t length;
+	size_t stride;
+	pthread_t thread;
+	int started;
+} pages_toucher_t;
+
+/* Sets pages to the defaults */
+void Hash_Table_Pages_Default(hash_table_pages_t * pages)
+{
+	assert(pages != NULL);
+
+	memset(pages, 0, sizeof(hash_table_pages_t));
+	pages->huge_page_size = HASH_TABLE_PAGES_TRANSPARENT;
+	pages->min_size = PAGES_TRANSPARENT_SIZE;
+	pages->numa = HASH_TABLE_NUMA_DEFAULT;
+	pages->prefault_threads = 1;
+}
+
+/* Set a bit in mask for every online node, as listed in sysfs ("0-3,6").
+* Returns the highest node + 1, 0 if the list cannot be read. */
+static int pages_online_nodes(unsigned long * mask)
+{
+	FILE * file;
+	int first, last, node, number_of_nodes = 0;
+	char separator;
+
+	memset(mask, 0, PAGES_MASK_WORDS * sizeof(unsigned long));
+
+	file = fopen("/sys/devices/system/node/online", "r");
+	if (file == NULL)
+		return 0;
+
+	while (fscanf(file, "%d", &first) == 1)
+	{
+		last = first;
+		separator = (char)fgetc(file);
+		if (separator == '-' && fscanf(file, "%d", &last) == 1)
+			separator = (char)fgetc(file);
+
+		for (node = first; node <= last && node >= 0 &&
+			node < PAGES_MAX_NODES; node++)
+		{
+			mask[node / (8 * sizeof(unsigned long))] |=
+				1UL << (node % (8 * sizeof(unsigned long)));
+			number_of_nodes = node + 1;
+		}
+
+		if (separator != ',')
+			break;
+	}
+
+	fclose(file);
+	return number_of_nodes;
+}
+
+/* Number of NUMA nodes */
+int Hash_Table_Pages_Nodes(void)
+{
+	unsigned long mask[PAGES_MASK_WORDS];
+	int number_of_nodes = pages_online_nodes(mask);
+
+	return number_of_nodes > 0 ? number_of_nodes : 1;
+}
+
+/* Node the calling thread is running on */
+int Hash_Table_Pages_Current_Node(void)
+{
+#if defined(PAGES_LINUX) && defined(SYS_getcpu)
+	unsigned int cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return (int)node;
+#endif
+	return 0;
+}
+
+#if defined(PAGES_MMAP)
+/* Bytes mapped for a block of size bytes */
+static size_t pages_length(hash_table_pages_t * pages, size_t size)
+{
+	size_t unit = pages->huge_page_size != HASH_TABLE_PAGES_TRANSPARENT ?
+		pages->huge_page_size : (size_t)sysconf(_SC_PAGESIZE);
+
+	if (size > (size_t)-1 - unit)
+		return 0;
+
+	return (size + unit - 1) / unit * unit;
+}
+
+/* Apply pages' NUMA policy to the block. Best effort: memory the policy
+* cannot be set on stays under the system's. */
+static void pages_place(hash_table_pages_t * pages, void * memory,
+	size_t length)
+{
+#if defined(PAGES_LINUX) && defined(SYS_mbind)
+	unsigned long mask[PAGES_MASK_WORDS];
+	int policy;
+
+	if (pages->numa == HASH_TABLE_NUMA_INTERLEAVE)
+	{
+		if (pages_online_nodes(mask) <= 1)
+			return;
+		policy = PAGES_MPOL_INTERLEAVE;
+	}
+	else if (pages->numa == HASH_TABLE_NUMA_BIND)
+	{
+		if (pages->node < 0 || pages->node >= PAGES_MAX_NODES)
+			return;
+		memset(mask, 0, sizeof(mask));
+		mask[pages->node / (8 * sizeof(unsigned long))] =
+			1UL << (pages->node % (8 * sizeof(unsigned long)));
+		policy = PAGES_MPOL_BIND;
+	}
+	else
+		return;
+
+	(void)syscall(SYS_mbind, memory, length, policy, mask,
+		(unsigned long)PAGES_MAX_NODES + 1, 0UL);
+#else
+	(void)pages;
+	(void)memory;
+	(void)length;
+#endif
+}
+
+/* Write a zero to every stride'th byte of toucher's range. The block is
+* already zero, the write only faults the pages in. */
+static void * pages_touch(void * argument)
+{
+	pages_toucher_t * toucher = argument;
+	size_t i;
+
+	for (i = 0; i < toucher->length; i += toucher->stride)
+		toucher->first[i] = 0;
+
+	return NULL;
+}
+
+/* Fault every page of the block in, its pages split between
+* pages->prefault_threads threads */
+static void pages_prefault(hash_table_pages_t * pages, void * memory,
+	size_t length, size_t stride)
+{
+	pages_toucher_t touchers[PAGES_MAX_THREADS];
+	unsigned long number_of_threads = pages->prefault_threads, i;
+	size_t number_of_pages = length / stride, first_page, end_page;
+
+	if (number_of_threads > PAGES_MAX_THREADS)
+		number_of_threads = PAGES_MAX_THREADS;
+	if (number_of_threads > number_of_pages)
+		number_of_threads = (unsigned long)number_of_pages;
+	if (number_of_threads == 0)
+		return;
+
+	for (i = 0; i < number_of_threads; i++)
+	{
+		first_page = number_of_pages * i / number_of_threads;
+		end_page = number_of_pages * (i + 1) / number_of_threads;
+		touchers[i].first = (volatile unsigned char *)memory +
+			first_page * stride;
+		touchers[i].length = (end_page - first_page) * stride;
+		touchers[i].stride = stride;
+		touchers[i].started = i > 0 && pthread_create(&touchers[i].thread,
+			NULL, pages_touch, &touchers[i]) == 0;
+	}
+
+	for (i = 0; i < number_of_threads; i++)
+	{
+		if (!touchers[i].started)
+			pages_touch(&touchers[i]);
+	}
+	for (i = 1; i < number_of_threads; i++)
+	{
+		if (touchers[i].started)
+			pthread_join(touchers[i].thread, NULL);
+	}
+}
+
+/* Map length bytes aligned to alignment. Returns NULL if failure. */
+static void * pages_map_aligned(size_t length, size_t alignment)
+{
+	unsigned char * memory, * aligned;
+	size_t head;
+
+	if (length > (size_t)-1 - alignment)
+		return NULL;
+
+	memory = mmap(NULL, length + alignment, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		return NULL;
+
+	/* unmap what lies outside the aligned part */
+	aligned = memory + (alignment - (size_t)memory % alignment) % alignment;
+	head = (size_t)(aligned - memory);
+	if (head > 0)
+		munmap(memory, head);
+	munmap(aligned + length, alignment - head);
+
+	return aligned;
+}
+
+/* Map length bytes with explicit huge pages. Returns NULL if there are
+* not enough free (or they are not supported). */
+static void * pages_map_huge(hash_table_pages_t * pages, size_t length)
+{
+#if defined(PAGES_LINUX) && defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+	void * memory;
+	int page_shift = 0;
+
+	while (((size_t)1 << page_shift) < pages->huge_page_size)
+		page_shift++;
+
+	memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+		MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+
+	return memory == MAP_FAILED ? NULL : memory;
+#else
+	(void)pages;
+	(void)length;
+	return NULL;
+#endif
+}
+#endif
+
+/* hash_table_allocator_t.allocate of Hash_Table_Pages_Allocator */
+static void * pages_allocate(size_t size, void * context)
+{
+	hash_table_pages_t * pages = context;
+#if defined(PAGES_MMAP)
+	void * memory = NULL;
+	size_t length, stride;
+
+	if (size < pages->min_size || size == 0)
+		return calloc(1, size);
+
+	length = pages_length(pages, size);
+	if (length == 0)
+		return NULL;
+
+	stride = (size_t)sysconf(_SC_PAGESIZE);
+	if (pages->huge_page_size != HASH_TABLE_PAGES_TRANSPARENT)
+	{
+		memory = pages_map_huge(pages, length);
+		if (memory != NULL)
+		{
+			PAGES_COUNT(pages->number_of_huge_blocks);
+			stride = pages->huge_page_size;
+		}
+		else
+			PAGES_COUNT(pages->number_of_fallbacks);
+	}
+
+	if (memory == NULL)
+	{
+		memory = pages_map_aligned(length, length >= PAGES_TRANSPARENT_SIZE ?
+			PAGES_TRANSPARENT_SIZE : (size_t)sysconf(_SC_PAGESIZE));
+		if (memory == NULL)
+			return NULL;
+#if defined(MADV_HUGEPAGE)
+		(void)madvise(memory, length, MADV_HUGEPAGE);
+#endif
+	}
+
+	/* before anything is faulted in, so the policy places every page */
+	pages_place(pages, memory, length);
+	pages_prefault(pages, memory, length, stride);
+
+	return memory;
+#else
+	(void)pages;
+	return calloc(1, size);
+#endif
+}
+
+/* hash_table_allocator_t.release of Hash_Table_Pages_Allocator */
+static void pages_release(void * memory, size_t size, void * context)
+{
+	hash_table_pages_t * pages = context;
+
+#if defined(PAGES_MMAP)
+	if (size >= pages->min_size && size != 0)
+	{
+		munmap(memory, pages_length(pages, size));
+		return;
+	}
+#else
+	(void)pages;
+	(void)size;
+#endif
+	free(memory);
+}
+
+/* An allocator mapping blocks as pages describes */
+hash_table_allocator_t Hash_Table_Pages_Allocator(hash_table_pages_t * pages)
+{
+	hash_table_allocator_t allocator;
+
+	assert(pages != NULL);
+	assert(pages->huge_page_size == HASH_TABLE_PAGES_TRANSPARENT ||
+		(pages->huge_page_size & (pages->huge_page_size - 1)) == 0);
+
+	allocator.allocate = pages_allocate;
+	allocator.release = pages_release;
+	allocator.context = pages;
+
+	return allocator;
+}
@@ -0,0 +1,87 @@
+/* hash_table_pages.h - An allocator for tables too big for 4KiB pages.
+* Plugged in as hash_table_config_t.allocator, it maps every block of at
+* least min_size bytes (bucket and slot arrays, large slabs) on its own,
+* and can:
+* - back it with huge pages, so random lookups over a large array miss the
+*   TLB far less: explicit 2MiB or 1GiB pages reserved by the system
+*   (hugetlbfs), falling back to transparent huge pages when none are free;
+* - place it across NUMA nodes: interleaved page by page over every node,
+*   or bound to one node (a per node replica, see Hash_Table_Image_Copy);
+* - fault it in up front from several threads in parallel, instead of page
+*   by page from whichever thread first touches it.
+* Smaller blocks come from calloc. Memory is only placed as asked where the
+* system supports it (Linux for huge pages and NUMA, mmap on other POSIX
+* systems); otherwise every block comes from calloc.
+*
+* Needs POSIX threads (link with -lpthread) to prefault in parallel.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_PAGES_H
+#define __HASH_TABLE_PAGES_H
+
+#include "hash_table.h"
+
+/* hash_table_pages_t.huge_page_size choices */
+#define HASH_TABLE_PAGES_TRANSPARENT 0 /* madvise for transparent pages */
+#define HASH_TABLE_PAGES_2M ((size_t)2 << 20)
+#define HASH_TABLE_PAGES_1G ((size_t)1 << 30)
+
+/* Where blocks are placed among the NUMA nodes */
+typedef enum hash_table_numa_t {
+	HASH_TABLE_NUMA_DEFAULT = 0, /* the system's policy, first touch */
+	HASH_TABLE_NUMA_INTERLEAVE = 1, /* round robin over every node */
+	HASH_TABLE_NUMA_BIND = 2 /* all on node */
+} hash_table_numa_t;
+
+/* How an allocator from Hash_Table_Pages_Allocator maps blocks. Fill in
+* with Hash_Table_Pages_Default and then override what is needed. The
+* struct is the allocator's context and must outlive every table using it.
+*
+* With an explicit huge_page_size blocks are rounded up to a multiple of
+* it, so min_size should not be much below it. prefault_threads is the
+* number of threads (the calling one included) that touch every page of a
+* block as it is allocated, 0 to leave pages to fault in on first use.
+* number_of_huge_blocks and number_of_fallbacks count the blocks mapped
+* with explicit huge pages and those that asked for them but got
+* transparent ones, updated atomically when the compiler allows.
+*/
+typedef struct hash_table_pages_t {
+	size_t huge_page_size;
+	size_t min_size;
+	hash_table_numa_t numa;
+	int node;
+	unsigned long prefault_threads;
+
+	unsigned long number_of_huge_blocks;
+	unsigned long number_of_fallbacks;
+} hash_table_pages_t;
+
+/* Sets pages to the defaults: transparent huge pages for blocks of 2MiB
+* and up, the system's NUMA policy and prefaulting on the calling thread */
+void Hash_Table_Pages_Default(hash_table_pages_t * pages);
+
+/* An allocator mapping blocks as pages describes */
+hash_table_allocator_t Hash_Table_Pages_Allocator(hash_table_pages_t * pages);
+
+/* Number of NUMA nodes, 1 when unknown */
+int Hash_Table_Pages_Nodes(void);
+
+/* Node of the processor the calling thread is running on, 0 when unknown.
+* For picking the replica to look up in. */
+int Hash_Table_Pages_Current_Node(void);
+
+#endif
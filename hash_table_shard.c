@@ -0,0 +1,321 @@
+/* hash_table_shard.c - Per thread shards and merging them into one table.
+*
+* Sealing takes two steps:
+* 1. each shard is walked by one of the threads, which writes its objects
+*    and their full hashes into the shard's own range of two arrays
+*    (shards are laid out in order, so the arrays end up in shard order);
+* 2. the arrays are bulk loaded into the new table, which splits them by
+*    bucket range between the threads again.
+* Nothing is taken out of the shards until every object is in the new
+* table, so a failure can drop the new table and leave the shards whole.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include <pthread.h>
+#include <string.h>
+
+#include "hash_table_shard.h"
+#include "hash_table_internal.h"
+
+#define SHARD_MAX_THREADS 64
+
+typedef struct shard_gather_t {
+	hash_table_sharded_t * sharded;
+	void ** objects;
+	uint64_t * hashes;
+	unsigned long * starts; /* of each shard's objects in the arrays */
+	unsigned long number_of_threads;
+} shard_gather_t;
+
+typedef struct shard_worker_t {
+	shard_gather_t * gather;
+	unsigned long index;
+	pthread_t thread;
+	int started;
+} shard_worker_t;
+
+/* Objects in table, duplicates included */
+static unsigned long shard_count(hash_table_t * table)
+{
+	unsigned long count = table->number_of_buckets_filled +
+		table->number_of_duplicates;
+
+	if (table->storage == HASH_TABLE_STORAGE_CHAINED)
+		count += table->number_of_collisions;
+
+	return count;
+}
+
+/* Free the first number_of_shards shards and then sharded */
+static void shard_free(hash_table_sharded_t * sharded,
+	unsigned long number_of_shards)
+{
+	hash_table_allocator_t allocator = sharded->allocator;
+	unsigned long i;
+
+	for (i = 0; i < number_of_shards; i++)
+		Hash_Table_Free(sharded->shards[i]);
+
+	if (sharded->shards != NULL)
+		allocator.release(sharded->shards, sharded->number_of_shards *
+			sizeof(hash_table_t *), allocator.context);
+
+	allocator.release(sharded, sizeof(hash_table_sharded_t),
+		allocator.context);
+}
+
+/* Create number_of_shards tables set up from config.
+* Returns NULL if failure (memory allocation).
+*/
+hash_table_sharded_t * Hash_Table_Sharded_Init(hash_table_config_t * config,
+	unsigned long number_of_shards)
+{
+	hash_table_sharded_t * new_sharded;
+	hash_table_allocator_t allocator;
+	hash_table_config_t shard_config;
+	unsigned long i;
+
+	assert(config != NULL);
+	assert(number_of_shards > 0);
+
+	allocator = Hash_Table_Allocator_Or_Default(&config->allocator);
+
+	new_sharded = allocator.allocate(sizeof(hash_table_sharded_t),
+		allocator.context);
+	if (new_sharded == NULL)
+		return NULL;
+
+	new_sharded->allocator = allocator;
+	new_sharded->number_of_shards = number_of_shards;
+	new_sharded->config = *config;
+	new_sharded->config.allocator = allocator;
+
+	new_sharded->shards = allocator.allocate(number_of_shards *
+		sizeof(hash_table_t *), allocator.context);
+	if (new_sharded->shards == NULL)
+	{
+		shard_free(new_sharded, 0);
+		return NULL;
+	}
+
+	/* each shard gets its share, like the segments of a concurrent table */
+	shard_config = new_sharded->config;
+	shard_config.number_of_buckets = (config->number_of_buckets +
+		number_of_shards - 1) / number_of_shards;
+	if (shard_config.number_of_buckets == 0)
+		shard_config.number_of_buckets = 1;
+	shard_config.max_entries = (config->max_entries + number_of_shards - 1) /
+		number_of_shards;
+	shard_config.max_bytes = (config->max_bytes + number_of_shards - 1) /
+		number_of_shards;
+
+	for (i = 0; i < number_of_shards; i++)
+	{
+		new_sharded->shards[i] = Hash_Table_Init_Config(&shard_config);
+		if (new_sharded->shards[i] == NULL)
+		{
+			shard_free(new_sharded, i);
+			return NULL;
+		}
+	}
+
+	return new_sharded;
+}
+
+/* The shard a thread inserts into */
+hash_table_t * Hash_Table_Sharded_Shard(hash_table_sharded_t * sharded,
+	unsigned long index)
+{
+	assert(sharded != NULL);
+	assert(index < sharded->number_of_shards);
+
+	return sharded->shards[index];
+}
+
+/* The first object matching pattern in any shard, NULL if none */
+void * Hash_Table_Sharded_First_Match(hash_table_sharded_t * sharded,
+	char * pattern)
+{
+	hash_table_t * table;
+	hash_table_cursor_t cursor;
+	hash_table_key_t key;
+	void * object;
+	char * internal_pattern;
+	uint64_t hash;
+	unsigned long i;
+
+	assert(sharded != NULL);
+	assert(pattern != NULL);
+
+	/* the shards share their hash, so hash once for all of them */
+	table = sharded->shards[0];
+	internal_pattern = HASH_TABLE_PATTERN(table, pattern, &key);
+	hash = HASH_TABLE_HASH(table, pattern);
+
+	for (i = 0; i < sharded->number_of_shards; i++)
+	{
+		object = Hash_Table_Match_Cursor_Hashed(sharded->shards[i],
+			internal_pattern, hash, &cursor);
+		if (object != NULL)
+			return object;
+	}
+
+	return NULL;
+}
+
+/* Free sharded and every object in its shards */
+void Hash_Table_Sharded_Free(hash_table_sharded_t * sharded)
+{
+	assert(sharded != NULL);
+
+	shard_free(sharded, sharded->number_of_shards);
+}
+
+/* Copy the objects of every number_of_threads'th shard from the worker's
+* index on, with their hashes, into their place in the arrays */
+static void * shard_work(void * argument)
+{
+	shard_worker_t * worker = argument;
+	shard_gather_t * gather = worker->gather;
+	hash_table_iterator_t iterator;
+	unsigned long i, position;
+	void * object;
+
+	for (i = worker->index; i < gather->sharded->number_of_shards;
+		i += gather->number_of_threads)
+	{
+		position = gather->starts[i];
+
+		Hash_Table_Iterator_Init(gather->sharded->shards[i], &iterator, 0, 1);
+		while ((object = Hash_Table_Iterator_Next(&iterator)) != NULL)
+		{
+			gather->objects[position] = object;
+			gather->hashes[position] = iterator.hash;
+			position++;
+		}
+	}
+
+	return NULL;
+}
+
+/* Run shard_work on every worker and wait for all of them. Workers whose
+* thread cannot be started run on the calling thread. */
+static void shard_run(shard_gather_t * gather, shard_worker_t * workers)
+{
+	unsigned long i;
+
+	for (i = 1; i < gather->number_of_threads; i++)
+		workers[i].started = pthread_create(&workers[i].thread, NULL,
+			shard_work, &workers[i]) == 0;
+
+	shard_work(&workers[0]);
+
+	for (i = 1; i < gather->number_of_threads; i++)
+	{
+		if (workers[i].started)
+			pthread_join(workers[i].thread, NULL);
+		else
+			shard_work(&workers[i]);
+	}
+}
+
+/* Merge the shards into one table and free sharded.
+* Returns the new table, NULL if failure (memory allocation).
+*/
+hash_table_t * Hash_Table_Sharded_Seal(hash_table_sharded_t * sharded,
+	unsigned long number_of_threads)
+{
+	hash_table_t * new_table;
+	shard_gather_t gather;
+	shard_worker_t * workers;
+	unsigned long i, count = 0, number_inserted = 0;
+	int have_memory;
+
+	assert(sharded != NULL);
+
+	new_table = Hash_Table_Init_Config(&sharded->config);
+	if (new_table == NULL)
+		return NULL;
+
+	if (number_of_threads > SHARD_MAX_THREADS)
+		number_of_threads = SHARD_MAX_THREADS;
+	if (number_of_threads > sharded->number_of_shards)
+		number_of_threads = sharded->number_of_shards;
+	if (number_of_threads == 0)
+		number_of_threads = 1;
+
+	memset(&gather, 0, sizeof(gather));
+	gather.sharded = sharded;
+	gather.number_of_threads = number_of_threads;
+
+	gather.starts = Hash_Table_Allocate(new_table, sharded->number_of_shards,
+		sizeof(unsigned long));
+	if (gather.starts != NULL)
+	{
+		for (i = 0; i < sharded->number_of_shards; i++)
+		{
+			gather.starts[i] = count;
+			count += shard_count(sharded->shards[i]);
+		}
+	}
+
+	gather.objects = Hash_Table_Allocate(new_table, count, sizeof(void *));
+	gather.hashes = Hash_Table_Allocate(new_table, count, sizeof(uint64_t));
+	workers = Hash_Table_Allocate(new_table, number_of_threads,
+		sizeof(shard_worker_t));
+
+	have_memory = gather.starts != NULL && workers != NULL &&
+		((gather.objects != NULL && gather.hashes != NULL) || count == 0);
+	if (have_memory)
+	{
+		for (i = 0; i < number_of_threads; i++)
+		{
+			workers[i].gather = &gather;
+			workers[i].index = i;
+		}
+		shard_run(&gather, workers);
+
+		/* the shards kept to their share of the cache limits, evicting
+		* while merging would free objects the shards still hold */
+		new_table->max_entries = 0;
+		new_table->max_bytes = 0;
+		number_inserted = Hash_Table_Insert_Bulk_Hashed(new_table,
+			gather.objects, gather.hashes, count, number_of_threads);
+		new_table->max_entries = sharded->config.max_entries;
+		new_table->max_bytes = sharded->config.max_bytes;
+	}
+
+	Hash_Table_Release(new_table, workers, number_of_threads,
+		sizeof(shard_worker_t));
+	Hash_Table_Release(new_table, gather.hashes, count, sizeof(uint64_t));
+	Hash_Table_Release(new_table, gather.objects, count, sizeof(void *));
+	Hash_Table_Release(new_table, gather.starts, sharded->number_of_shards,
+		sizeof(unsigned long));
+
+	/* the objects are still in the shards, drop only the new copy */
+	if (!have_memory || number_inserted != count)
+	{
+		new_table->free_function = NULL;
+		Hash_Table_Free(new_table);
+		return NULL;
+	}
+
+	for (i = 0; i < sharded->number_of_shards; i++)
+		sharded->shards[i]->free_function = NULL;
+	shard_free(sharded, sharded->number_of_shards);
+
+	return new_table;
+}
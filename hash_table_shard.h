@@ -0,0 +1,76 @@
+/* hash_table_shard.h - A table split into shards, one per writing thread,
+* for ingest where many threads insert and reads are rare. Each thread
+* inserts into its own shard, an ordinary hash_table_t, through the
+* ordinary entry points with no locking at all. Sealing then merges the
+* shards into a single table for reading.
+*
+* The merge walks the shards in parallel, one thread per shard, gathering
+* each object with the full hash it was stored under, and bulk loads them
+* (see hash_table_bulk.h) into a new table without hashing anything again.
+* Collision lists come out in compare_function order as usual. A key's
+* duplicates keep their insertion order within a shard, and shard 0's come
+* first, then shard 1's and so on.
+*
+* Needs POSIX threads (link with -lpthread).
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_SHARD_H
+#define __HASH_TABLE_SHARD_H
+
+#include "hash_table.h"
+
+typedef struct hash_table_sharded_t {
+	hash_table_t ** shards;
+	unsigned long number_of_shards;
+	hash_table_allocator_t allocator;
+	hash_table_config_t config; /* of the sealed table */
+} hash_table_sharded_t;
+
+/* Create number_of_shards tables set up from config, with
+* config->number_of_buckets and the cache limits split between them. The
+* callbacks and the allocator are called from every writing thread at once
+* and must be safe for that.
+* Returns NULL if failure (memory allocation).
+*/
+hash_table_sharded_t * Hash_Table_Sharded_Init(hash_table_config_t * config,
+	unsigned long number_of_shards);
+
+/* The shard a thread inserts into. Only one thread may use a shard at a
+* time; give each thread its own. */
+hash_table_t * Hash_Table_Sharded_Shard(hash_table_sharded_t * sharded,
+	unsigned long index);
+
+/* The first object matching pattern in any shard (shard 0 first), NULL if
+* there is none. No shard may be written to meanwhile.
+*/
+void * Hash_Table_Sharded_First_Match(hash_table_sharded_t * sharded,
+	char * pattern);
+
+/* Free sharded and every object in its shards */
+void Hash_Table_Sharded_Free(hash_table_sharded_t * sharded);
+
+/* Merge the shards, using up to number_of_threads threads (the calling one
+* included), into one table made from config, and free sharded. No shard
+* may be written to meanwhile. Nothing is evicted while merging: a cache
+* holds whatever its shards held, within a shard's rounding of its limits.
+* Returns the new table, NULL if failure (memory allocation), in which case
+* sharded is left as it was.
+*/
+hash_table_t * Hash_Table_Sharded_Seal(hash_table_sharded_t * sharded,
+	unsigned long number_of_threads);
+
+#endif
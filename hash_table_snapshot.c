@@ -0,0 +1,948 @@
+/* hash_table_snapshot.c - Copy on write snapshots of a table.
+*
+* Each snapshot has its own array of page pointers; pages and buckets are
+* stamped with the number of the snapshot that made them. The draft (the
+* next snapshot) starts as a copy of the current page array. Writing to a
+* page or bucket with an older stamp copies it first and records the
+* original as garbage, which is freed along with the current snapshot: the
+* newer snapshots no longer hold it, and the older ones are always freed
+* first. Anything stamped with the draft's own number is private to the
+* draft and changed in place.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include <string.h>
+
+#include "hash_table_snapshot.h"
+#include "hash_table_internal.h"
+
+/* A bucket's hashes, then its objects */
+#define SNAPSHOT_HASHES(bucket) ((uint64_t *)((bucket) + 1))
+#define SNAPSHOT_OBJECTS(bucket) \
+	((void **)(SNAPSHOT_HASHES(bucket) + (bucket)->capacity))
+#define SNAPSHOT_BUCKET_SIZE(capacity) \
+	(sizeof(hash_table_snapshot_bucket_t) + \
+	(size_t)(capacity) * (sizeof(uint64_t) + sizeof(void *)))
+
+#define SNAPSHOT_PAGES(number_of_buckets) \
+	(((number_of_buckets) + HASH_TABLE_SNAPSHOT_PAGE - 1) / \
+	HASH_TABLE_SNAPSHOT_PAGE)
+
+#define SNAPSHOT_MIN_GARBAGE 16
+
+static void * snapshot_allocate(hash_table_snapshots_t * snapshots,
+	size_t size)
+{
+	return snapshots->allocator.allocate(size, snapshots->allocator.context);
+}
+
+static void snapshot_release(hash_table_snapshots_t * snapshots,
+	void * memory, size_t size)
+{
+	if (memory != NULL)
+		snapshots->allocator.release(memory, size,
+			snapshots->allocator.context);
+}
+
+/* Is object the one pattern (in internal form) is after */
+static int snapshot_matches(hash_table_snapshots_t * snapshots,
+	char * pattern, void * object)
+{
+	hash_table_key_t object_key, * key;
+
+	if (snapshots->config.key_function == NULL)
+		return snapshots->config.search_function(pattern, object) == 1;
+
+	key = (hash_table_key_t *)pattern;
+	snapshots->config.key_function(object, &object_key);
+	return object_key.length == key->length &&
+		memcmp(object_key.key, key->key, key->length) == 0;
+}
+
+/* Make room for number_of_items more in garbage.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int garbage_reserve(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_garbage_t * garbage, unsigned long number_of_items)
+{
+	unsigned long capacity = garbage->capacity;
+	void ** items;
+
+	if (number_of_items > ULONG_MAX / 2 - garbage->number_of_items)
+		return 0;
+
+	if (garbage->number_of_items + number_of_items <= capacity)
+		return 1;
+
+	if (capacity < SNAPSHOT_MIN_GARBAGE)
+		capacity = SNAPSHOT_MIN_GARBAGE;
+	while (capacity < garbage->number_of_items + number_of_items)
+		capacity *= 2;
+
+	if (capacity > (size_t)-1 / sizeof(void *))
+		return 0;
+	items = snapshot_allocate(snapshots, capacity * sizeof(void *));
+	if (items == NULL)
+		return 0;
+
+	if (garbage->number_of_items > 0)
+		memcpy(items, garbage->items,
+			garbage->number_of_items * sizeof(void *));
+	snapshot_release(snapshots, garbage->items,
+		garbage->capacity * sizeof(void *));
+	garbage->items = items;
+	garbage->capacity = capacity;
+
+	return 1;
+}
+
+/* Add item to garbage, which has room reserved for it */
+static void garbage_add(hash_table_snapshot_garbage_t * garbage, void * item)
+{
+	assert(garbage->number_of_items < garbage->capacity);
+
+	garbage->items[(garbage->number_of_items)++] = item;
+}
+
+static void garbage_release(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_garbage_t * garbage)
+{
+	snapshot_release(snapshots, garbage->items,
+		garbage->capacity * sizeof(void *));
+	memset(garbage, 0, sizeof(hash_table_snapshot_garbage_t));
+}
+
+static void bucket_release(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_bucket_t * bucket)
+{
+	snapshot_release(snapshots, bucket, SNAPSHOT_BUCKET_SIZE(bucket->capacity));
+}
+
+/* New empty snapshot numbered number with number_of_buckets buckets.
+* Returns NULL if failure (memory allocation).
+*/
+static hash_table_snapshot_t * snapshot_new(hash_table_snapshots_t * snapshots,
+	unsigned long number, unsigned long number_of_buckets)
+{
+	hash_table_snapshot_t * snapshot;
+
+	snapshot = snapshot_allocate(snapshots, sizeof(hash_table_snapshot_t));
+	if (snapshot == NULL)
+		return NULL;
+
+	snapshot->owner = snapshots;
+	snapshot->number = number;
+	snapshot->number_of_buckets = number_of_buckets;
+	snapshot->number_of_pages = SNAPSHOT_PAGES(number_of_buckets);
+	snapshot->pages = snapshot_allocate(snapshots,
+		snapshot->number_of_pages * sizeof(hash_table_snapshot_page_t *));
+	if (snapshot->pages == NULL)
+	{
+		snapshot_release(snapshots, snapshot, sizeof(hash_table_snapshot_t));
+		return NULL;
+	}
+
+	return snapshot;
+}
+
+/* Free snapshot along with its garbage. What it holds itself is either
+* shared with the next snapshot or in the garbage. */
+static void snapshot_free(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_t * snapshot)
+{
+	unsigned long i;
+
+	for (i = 0; i < snapshot->objects_garbage.number_of_items; i++)
+	{
+		if (snapshots->config.free_function != NULL)
+			snapshots->config.free_function(
+				snapshot->objects_garbage.items[i]);
+	}
+	for (i = 0; i < snapshot->buckets_garbage.number_of_items; i++)
+		bucket_release(snapshots, snapshot->buckets_garbage.items[i]);
+	for (i = 0; i < snapshot->pages_garbage.number_of_items; i++)
+		snapshot_release(snapshots, snapshot->pages_garbage.items[i],
+			sizeof(hash_table_snapshot_page_t));
+
+	garbage_release(snapshots, &snapshot->objects_garbage);
+	garbage_release(snapshots, &snapshot->buckets_garbage);
+	garbage_release(snapshots, &snapshot->pages_garbage);
+
+	snapshot_release(snapshots, snapshot->pages,
+		snapshot->number_of_pages * sizeof(hash_table_snapshot_page_t *));
+	snapshot_release(snapshots, snapshot, sizeof(hash_table_snapshot_t));
+}
+
+/* Unlink the oldest snapshots that are neither read nor current, with the
+* lock held. Returns the first of them, linked up to stop (the new
+* oldest). */
+static hash_table_snapshot_t * snapshot_collect(
+	hash_table_snapshots_t * snapshots, hash_table_snapshot_t ** stop)
+{
+	hash_table_snapshot_t * first = snapshots->oldest;
+
+	while (snapshots->oldest != snapshots->current &&
+		snapshots->oldest->number_of_readers == 0)
+		snapshots->oldest = snapshots->oldest->next_snapshot;
+
+	*stop = snapshots->oldest;
+	return first;
+}
+
+/* Free the snapshots from first up to stop, as unlinked by
+* snapshot_collect */
+static void snapshot_free_collected(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_t * first, hash_table_snapshot_t * stop)
+{
+	hash_table_snapshot_t * next_snapshot;
+
+	for (; first != stop; first = next_snapshot)
+	{
+		next_snapshot = first->next_snapshot;
+		snapshot_free(snapshots, first);
+	}
+}
+
+/*
+* Returns a new table of snapshots, its first snapshot empty.
+* Returns NULL if failure (memory allocation or lock creation).
+*/
+hash_table_snapshots_t * Hash_Table_Snapshots_Init(
+	hash_table_config_t * config)
+{
+	hash_table_snapshots_t * new_snapshots;
+	hash_table_allocator_t allocator;
+
+	assert(config != NULL);
+	assert(config->key_function != NULL || config->search_function != NULL);
+
+	allocator = Hash_Table_Allocator_Or_Default(&config->allocator);
+
+	new_snapshots = allocator.allocate(sizeof(hash_table_snapshots_t),
+		allocator.context);
+	if (new_snapshots == NULL)
+		return NULL;
+
+	new_snapshots->allocator = allocator;
+	new_snapshots->config = *config;
+	new_snapshots->config.allocator = allocator;
+	new_snapshots->config.store_keys = 0;
+	if (config->hash_function == NULL && config->full_hash_function == NULL)
+		new_snapshots->config.full_hash_function = Hash_Table_Hash_Wy;
+	if (config->key_hash_function == NULL)
+		new_snapshots->config.key_hash_function = Hash_Table_Hash_Bytes;
+
+	new_snapshots->current = snapshot_new(new_snapshots, 1,
+		config->number_of_buckets > 0 ? config->number_of_buckets : 1);
+	if (new_snapshots->current == NULL)
+	{
+		allocator.release(new_snapshots, sizeof(hash_table_snapshots_t),
+			allocator.context);
+		return NULL;
+	}
+	new_snapshots->current->number_of_readers = 1;
+	new_snapshots->oldest = new_snapshots->current;
+
+	if (pthread_mutex_init(&new_snapshots->lock, NULL) != 0)
+	{
+		snapshot_free(new_snapshots, new_snapshots->current);
+		allocator.release(new_snapshots, sizeof(hash_table_snapshots_t),
+			allocator.context);
+		return NULL;
+	}
+
+	return new_snapshots;
+}
+
+/* The draft, started from the current snapshot if there is none.
+* Returns NULL if failure (memory allocation).
+*/
+static hash_table_snapshot_t * snapshot_draft(
+	hash_table_snapshots_t * snapshots)
+{
+	hash_table_snapshot_t * current = snapshots->current, * draft;
+
+	if (snapshots->draft != NULL)
+		return snapshots->draft;
+
+	draft = snapshot_new(snapshots, current->number + 1,
+		current->number_of_buckets);
+	if (draft == NULL)
+		return NULL;
+
+	memcpy(draft->pages, current->pages,
+		current->number_of_pages * sizeof(hash_table_snapshot_page_t *));
+	draft->number_of_objects = current->number_of_objects;
+	draft->number_of_keys = current->number_of_keys;
+
+	snapshots->draft = draft;
+	return draft;
+}
+
+/* Page page_index of the draft, ready to be written to: copied if it is
+* shared, made if it is empty and create is set.
+* Returns NULL if failure (memory allocation) or empty.
+*/
+static hash_table_snapshot_page_t * snapshot_page(
+	hash_table_snapshots_t * snapshots, hash_table_snapshot_t * draft,
+	unsigned long page_index, int create)
+{
+	hash_table_snapshot_page_t * page = draft->pages[page_index], * new_page;
+
+	if (page != NULL && page->number == draft->number)
+		return page;
+	if (page == NULL && !create)
+		return NULL;
+
+	if (page != NULL && !garbage_reserve(snapshots, &draft->pages_garbage, 1))
+		return NULL;
+
+	new_page = snapshot_allocate(snapshots,
+		sizeof(hash_table_snapshot_page_t));
+	if (new_page == NULL)
+		return NULL;
+
+	if (page != NULL)
+	{
+		memcpy(new_page->buckets, page->buckets, sizeof(page->buckets));
+		garbage_add(&draft->pages_garbage, page);
+	}
+	new_page->number = draft->number;
+
+	draft->pages[page_index] = new_page;
+	return new_page;
+}
+
+/* A bucket for the draft with capacity entries: those of bucket (if any)
+* with a gap of gap_length entries at position (gap_length may be
+* negative, dropping that many from position on instead).
+* Returns NULL if failure (memory allocation).
+*/
+static hash_table_snapshot_bucket_t * bucket_copy(
+	hash_table_snapshots_t * snapshots, hash_table_snapshot_t * draft,
+	hash_table_snapshot_bucket_t * bucket, uint32_t capacity,
+	uint32_t position, long gap_length)
+{
+	hash_table_snapshot_bucket_t * new_bucket;
+	uint32_t number_of_entries = bucket != NULL ?
+		bucket->number_of_entries : 0, tail_from, tail_to;
+
+	new_bucket = snapshot_allocate(snapshots, SNAPSHOT_BUCKET_SIZE(capacity));
+	if (new_bucket == NULL)
+		return NULL;
+
+	new_bucket->number = draft->number;
+	new_bucket->capacity = capacity;
+	new_bucket->number_of_entries = (uint32_t)(number_of_entries + gap_length);
+	if (bucket == NULL)
+		return new_bucket;
+
+	tail_from = gap_length < 0 ? position + (uint32_t)-gap_length : position;
+	tail_to = gap_length > 0 ? position + (uint32_t)gap_length : position;
+
+	memcpy(SNAPSHOT_HASHES(new_bucket), SNAPSHOT_HASHES(bucket),
+		position * sizeof(uint64_t));
+	memcpy(SNAPSHOT_OBJECTS(new_bucket), SNAPSHOT_OBJECTS(bucket),
+		position * sizeof(void *));
+	memcpy(SNAPSHOT_HASHES(new_bucket) + tail_to,
+		SNAPSHOT_HASHES(bucket) + tail_from,
+		(number_of_entries - tail_from) * sizeof(uint64_t));
+	memcpy(SNAPSHOT_OBJECTS(new_bucket) + tail_to,
+		SNAPSHOT_OBJECTS(bucket) + tail_from,
+		(number_of_entries - tail_from) * sizeof(void *));
+
+	return new_bucket;
+}
+
+/* Where the entries of pattern's key are in bucket: from *first, *length
+* of them, or where they would go (*length 0) */
+static void bucket_find(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_bucket_t * bucket, char * pattern, uint64_t hash,
+	uint32_t * first, uint32_t * length)
+{
+	uint64_t * hashes = SNAPSHOT_HASHES(bucket);
+	void ** objects = SNAPSHOT_OBJECTS(bucket);
+	uint32_t i = 0, run_length = 0;
+
+	while (i < bucket->number_of_entries && hashes[i] < hash)
+		i++;
+
+	/* a key's entries are together among those with its hash */
+	for (; i < bucket->number_of_entries && hashes[i] == hash; i++)
+	{
+		if (snapshot_matches(snapshots, pattern, objects[i]))
+			run_length++;
+		else if (run_length > 0)
+			break;
+	}
+
+	*first = i - run_length;
+	*length = run_length;
+}
+
+/* Insert object under pattern into the draft.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+int Hash_Table_Snapshots_Insert(hash_table_snapshots_t * snapshots,
+	void * object, char * pattern)
+{
+	hash_table_snapshot_t * draft;
+	hash_table_snapshot_page_t * page;
+	hash_table_snapshot_bucket_t * bucket, * new_bucket;
+	hash_table_key_t key;
+	uint64_t hash;
+	uint32_t first = 0, length = 0, position, capacity;
+	unsigned long index;
+
+	assert(snapshots != NULL);
+	assert(object != NULL);
+	assert(pattern != NULL);
+
+	hash = HASH_TABLE_HASH(&snapshots->config, pattern);
+	pattern = HASH_TABLE_PATTERN(&snapshots->config, pattern, &key);
+
+	draft = snapshot_draft(snapshots);
+	if (draft == NULL)
+		return 0;
+
+	index = Hash_Table_Reduce(hash, draft->number_of_buckets);
+	page = snapshot_page(snapshots, draft, index / HASH_TABLE_SNAPSHOT_PAGE, 1);
+	if (page == NULL)
+		return 0;
+	bucket = page->buckets[index % HASH_TABLE_SNAPSHOT_PAGE];
+
+	if (bucket != NULL)
+	{
+		if (bucket->number_of_entries == UINT32_MAX)
+			return 0;
+		bucket_find(snapshots, bucket, pattern, hash, &first, &length);
+	}
+	position = first + length; /* after the key's duplicates */
+
+	if (bucket != NULL && bucket->number == draft->number &&
+		bucket->number_of_entries < bucket->capacity)
+	{
+		/* the draft's own, with room */
+		memmove(SNAPSHOT_HASHES(bucket) + position + 1,
+			SNAPSHOT_HASHES(bucket) + position,
+			(bucket->number_of_entries - position) * sizeof(uint64_t));
+		memmove(SNAPSHOT_OBJECTS(bucket) + position + 1,
+			SNAPSHOT_OBJECTS(bucket) + position,
+			(bucket->number_of_entries - position) * sizeof(void *));
+		(bucket->number_of_entries)++;
+		new_bucket = bucket;
+	}
+	else
+	{
+		/* a shared bucket is copied to the size it needs, a full one of
+		* the draft's doubles */
+		if (bucket == NULL)
+			capacity = 1;
+		else if (bucket->number != draft->number)
+			capacity = bucket->number_of_entries + 1;
+		else
+			capacity = bucket->capacity <= UINT32_MAX / 2 ?
+				bucket->capacity * 2 : UINT32_MAX;
+
+		if (bucket != NULL && bucket->number != draft->number &&
+			!garbage_reserve(snapshots, &draft->buckets_garbage, 1))
+			return 0;
+		new_bucket = bucket_copy(snapshots, draft, bucket, capacity,
+			position, 1);
+		if (new_bucket == NULL)
+			return 0;
+
+		if (bucket != NULL && bucket->number != draft->number)
+			garbage_add(&draft->buckets_garbage, bucket);
+		else if (bucket != NULL)
+			bucket_release(snapshots, bucket);
+		page->buckets[index % HASH_TABLE_SNAPSHOT_PAGE] = new_bucket;
+	}
+
+	SNAPSHOT_HASHES(new_bucket)[position] = hash;
+	SNAPSHOT_OBJECTS(new_bucket)[position] = object;
+
+	(draft->number_of_objects)++;
+	if (length == 0)
+		(draft->number_of_keys)++;
+
+	return 1;
+}
+
+/* Take object (every object of the key when NULL) of pattern out of the
+* draft. Returns the number removed, -1 if failure (memory allocation).
+*/
+static long snapshot_remove(hash_table_snapshots_t * snapshots,
+	char * pattern, void * object)
+{
+	hash_table_snapshot_t * draft;
+	hash_table_snapshot_page_t * page;
+	hash_table_snapshot_bucket_t * bucket, * new_bucket = NULL;
+	hash_table_key_t key;
+	uint64_t hash;
+	uint32_t first, length, number_removed, i;
+	unsigned long index;
+
+	hash = HASH_TABLE_HASH(&snapshots->config, pattern);
+	pattern = HASH_TABLE_PATTERN(&snapshots->config, pattern, &key);
+
+	/* nothing is copied unless there is something to remove */
+	draft = snapshots->draft != NULL ? snapshots->draft : snapshots->current;
+	index = Hash_Table_Reduce(hash, draft->number_of_buckets);
+	page = draft->pages[index / HASH_TABLE_SNAPSHOT_PAGE];
+	bucket = page != NULL ? page->buckets[index % HASH_TABLE_SNAPSHOT_PAGE] :
+		NULL;
+	if (bucket == NULL)
+		return 0;
+
+	bucket_find(snapshots, bucket, pattern, hash, &first, &length);
+	number_removed = length;
+	if (object != NULL)
+	{
+		for (i = first; i < first + length &&
+			SNAPSHOT_OBJECTS(bucket)[i] != object; i++)
+			;
+		if (i == first + length)
+			return 0;
+		first = i;
+		number_removed = 1;
+	}
+	if (number_removed == 0)
+		return 0;
+
+	draft = snapshot_draft(snapshots);
+	if (draft == NULL ||
+		!garbage_reserve(snapshots, &draft->objects_garbage, number_removed) ||
+		(bucket->number != draft->number &&
+		!garbage_reserve(snapshots, &draft->buckets_garbage, 1)))
+		return -1;
+
+	page = snapshot_page(snapshots, draft, index / HASH_TABLE_SNAPSHOT_PAGE, 0);
+	if (page == NULL)
+		return -1;
+
+	if (bucket->number != draft->number &&
+		bucket->number_of_entries > number_removed)
+	{
+		new_bucket = bucket_copy(snapshots, draft, bucket,
+			bucket->number_of_entries - number_removed, first,
+			-(long)number_removed);
+		if (new_bucket == NULL)
+			return -1;
+	}
+
+	/* older snapshots may still be reading them */
+	for (i = first; i < first + number_removed; i++)
+		garbage_add(&draft->objects_garbage, SNAPSHOT_OBJECTS(bucket)[i]);
+
+	if (bucket->number != draft->number)
+		garbage_add(&draft->buckets_garbage, bucket);
+	else if (bucket->number_of_entries == number_removed)
+		bucket_release(snapshots, bucket);
+	else
+	{
+		memmove(SNAPSHOT_HASHES(bucket) + first,
+			SNAPSHOT_HASHES(bucket) + first + number_removed,
+			(bucket->number_of_entries - first - number_removed) *
+			sizeof(uint64_t));
+		memmove(SNAPSHOT_OBJECTS(bucket) + first,
+			SNAPSHOT_OBJECTS(bucket) + first + number_removed,
+			(bucket->number_of_entries - first - number_removed) *
+			sizeof(void *));
+		bucket->number_of_entries -= number_removed;
+		new_bucket = bucket;
+	}
+	page->buckets[index % HASH_TABLE_SNAPSHOT_PAGE] = new_bucket;
+
+	draft->number_of_objects -= number_removed;
+	if (number_removed == length)
+		(draft->number_of_keys)--;
+
+	return (long)number_removed;
+}
+
+/* Take object, stored under pattern, out of the draft.
+* Returns 1 if it was removed, 0 if it was not there, -1 if failure (memory
+* allocation).
+*/
+int Hash_Table_Snapshots_Remove(hash_table_snapshots_t * snapshots,
+	char * pattern, void * object)
+{
+	assert(snapshots != NULL);
+	assert(pattern != NULL);
+	assert(object != NULL);
+
+	return (int)snapshot_remove(snapshots, pattern, object);
+}
+
+/* Take every object under pattern out of the draft.
+* Returns the number removed, 0 if failure (memory allocation) or none.
+*/
+unsigned long Hash_Table_Snapshots_Remove_Key(
+	hash_table_snapshots_t * snapshots, char * pattern)
+{
+	long number_removed;
+
+	assert(snapshots != NULL);
+	assert(pattern != NULL);
+
+	number_removed = snapshot_remove(snapshots, pattern, NULL);
+	return number_removed > 0 ? (unsigned long)number_removed : 0;
+}
+
+/* Append an entry to *slot, a bucket of the draft, doubling it when full.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int bucket_append(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_t * draft, hash_table_snapshot_bucket_t ** slot,
+	uint64_t hash, void * object)
+{
+	hash_table_snapshot_bucket_t * bucket = *slot, * new_bucket;
+
+	if (bucket == NULL || bucket->number_of_entries == bucket->capacity)
+	{
+		if (bucket != NULL && bucket->capacity > UINT32_MAX / 2)
+			return 0;
+		new_bucket = bucket_copy(snapshots, draft, bucket,
+			bucket != NULL ? bucket->capacity * 2 : 2,
+			bucket != NULL ? bucket->number_of_entries : 0, 0);
+		if (new_bucket == NULL)
+			return 0;
+		if (bucket != NULL)
+			bucket_release(snapshots, bucket);
+		*slot = bucket = new_bucket;
+	}
+
+	SNAPSHOT_HASHES(bucket)[bucket->number_of_entries] = hash;
+	SNAPSHOT_OBJECTS(bucket)[bucket->number_of_entries] = object;
+	(bucket->number_of_entries)++;
+
+	return 1;
+}
+
+/* Free pages (number_of_pages of them) and the buckets in them that are
+* the draft's own; the others go to the draft's garbage, which has room */
+static void snapshot_drop_pages(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_t * draft, hash_table_snapshot_page_t ** pages,
+	unsigned long number_of_pages)
+{
+	hash_table_snapshot_bucket_t * bucket;
+	unsigned long i, j;
+
+	for (i = 0; i < number_of_pages; i++)
+	{
+		if (pages[i] == NULL)
+			continue;
+
+		for (j = 0; j < HASH_TABLE_SNAPSHOT_PAGE; j++)
+		{
+			bucket = pages[i]->buckets[j];
+			if (bucket == NULL)
+				continue;
+			if (bucket->number == draft->number)
+				bucket_release(snapshots, bucket);
+			else
+				garbage_add(&draft->buckets_garbage, bucket);
+		}
+
+		if (pages[i]->number == draft->number)
+			snapshot_release(snapshots, pages[i],
+				sizeof(hash_table_snapshot_page_t));
+		else
+			garbage_add(&draft->pages_garbage, pages[i]);
+	}
+
+	snapshot_release(snapshots, pages,
+		number_of_pages * sizeof(hash_table_snapshot_page_t *));
+}
+
+/* Move the draft into twice the buckets. A key's entries all go to one of
+* the two buckets its old one splits into (the hash is reduced by its
+* high bits) and keep their order, so each bucket is rebuilt by appending.
+* Nothing is shared with the current snapshot afterwards. Gives up, leaving
+* the draft as it was, if memory runs out. */
+static void snapshot_grow(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_t * draft)
+{
+	hash_table_snapshot_t grown;
+	hash_table_snapshot_page_t * page;
+	hash_table_snapshot_bucket_t * bucket;
+	unsigned long i, j, index, number_shared_pages = 0,
+		number_shared_buckets = 0;
+	uint32_t k;
+
+	if (draft->number_of_buckets > ULONG_MAX / 2)
+		return;
+
+	/* room to record everything shared, before changing anything */
+	for (i = 0; i < draft->number_of_pages; i++)
+	{
+		page = draft->pages[i];
+		if (page == NULL)
+			continue;
+		if (page->number != draft->number)
+			number_shared_pages++;
+		for (j = 0; j < HASH_TABLE_SNAPSHOT_PAGE; j++)
+		{
+			if (page->buckets[j] != NULL &&
+				page->buckets[j]->number != draft->number)
+				number_shared_buckets++;
+		}
+	}
+	if (!garbage_reserve(snapshots, &draft->pages_garbage,
+		number_shared_pages) || !garbage_reserve(snapshots,
+		&draft->buckets_garbage, number_shared_buckets))
+		return;
+
+	grown = *draft;
+	grown.number_of_buckets = draft->number_of_buckets * 2;
+	grown.number_of_pages = SNAPSHOT_PAGES(grown.number_of_buckets);
+	if (grown.number_of_pages > (size_t)-1 /
+		sizeof(hash_table_snapshot_page_t *))
+		return;
+	grown.pages = snapshot_allocate(snapshots,
+		grown.number_of_pages * sizeof(hash_table_snapshot_page_t *));
+	if (grown.pages == NULL)
+		return;
+
+	for (i = 0; i < draft->number_of_pages; i++)
+	{
+		if (draft->pages[i] == NULL)
+			continue;
+		for (j = 0; j < HASH_TABLE_SNAPSHOT_PAGE; j++)
+		{
+			bucket = draft->pages[i]->buckets[j];
+			for (k = 0; bucket != NULL && k < bucket->number_of_entries; k++)
+			{
+				index = Hash_Table_Reduce(SNAPSHOT_HASHES(bucket)[k],
+					grown.number_of_buckets);
+				page = snapshot_page(snapshots, &grown,
+					index / HASH_TABLE_SNAPSHOT_PAGE, 1);
+				if (page == NULL || !bucket_append(snapshots, &grown,
+					&page->buckets[index % HASH_TABLE_SNAPSHOT_PAGE],
+					SNAPSHOT_HASHES(bucket)[k], SNAPSHOT_OBJECTS(bucket)[k]))
+				{
+					/* everything in grown is its own */
+					snapshot_drop_pages(snapshots, &grown, grown.pages,
+						grown.number_of_pages);
+					return;
+				}
+			}
+		}
+	}
+
+	snapshot_drop_pages(snapshots, draft, draft->pages,
+		draft->number_of_pages);
+	draft->pages = grown.pages;
+	draft->number_of_pages = grown.number_of_pages;
+	draft->number_of_buckets = grown.number_of_buckets;
+}
+
+/* Publish the draft as the current snapshot */
+void Hash_Table_Snapshots_Commit(hash_table_snapshots_t * snapshots)
+{
+	hash_table_snapshot_t * draft, * previous, * first, * stop;
+
+	assert(snapshots != NULL);
+
+	draft = snapshots->draft;
+	if (draft == NULL)
+		return;
+
+	if (snapshots->config.max_load_factor > 0 && (double)draft->number_of_keys >
+		(double)draft->number_of_buckets * snapshots->config.max_load_factor)
+		snapshot_grow(snapshots, draft);
+
+	/* what the draft replaced goes once the current snapshot does */
+	previous = snapshots->current;
+	previous->pages_garbage = draft->pages_garbage;
+	previous->buckets_garbage = draft->buckets_garbage;
+	previous->objects_garbage = draft->objects_garbage;
+	memset(&draft->pages_garbage, 0, sizeof(hash_table_snapshot_garbage_t));
+	memset(&draft->buckets_garbage, 0, sizeof(hash_table_snapshot_garbage_t));
+	memset(&draft->objects_garbage, 0, sizeof(hash_table_snapshot_garbage_t));
+	snapshots->draft = NULL;
+
+	draft->number_of_readers = 1;
+
+	pthread_mutex_lock(&snapshots->lock);
+	previous->next_snapshot = draft;
+	snapshots->current = draft;
+	(previous->number_of_readers)--;
+	first = snapshot_collect(snapshots, &stop);
+	pthread_mutex_unlock(&snapshots->lock);
+
+	snapshot_free_collected(snapshots, first, stop);
+}
+
+/* The current snapshot, held until Hash_Table_Snapshots_Release */
+hash_table_snapshot_t * Hash_Table_Snapshots_Pin(
+	hash_table_snapshots_t * snapshots)
+{
+	hash_table_snapshot_t * snapshot;
+
+	assert(snapshots != NULL);
+
+	pthread_mutex_lock(&snapshots->lock);
+	snapshot = snapshots->current;
+	(snapshot->number_of_readers)++;
+	pthread_mutex_unlock(&snapshots->lock);
+
+	return snapshot;
+}
+
+/* Give back a pinned snapshot */
+void Hash_Table_Snapshots_Release(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_t * snapshot)
+{
+	hash_table_snapshot_t * first, * stop;
+
+	assert(snapshots != NULL);
+	assert(snapshot != NULL);
+
+	pthread_mutex_lock(&snapshots->lock);
+	assert(snapshot->number_of_readers > 0);
+	(snapshot->number_of_readers)--;
+	first = snapshot_collect(snapshots, &stop);
+	pthread_mutex_unlock(&snapshots->lock);
+
+	snapshot_free_collected(snapshots, first, stop);
+}
+
+/* Hash_Table_Match_Cursor on a pinned snapshot */
+void * Hash_Table_Snapshot_Match_Cursor(hash_table_snapshot_t * snapshot,
+	char * pattern, hash_table_cursor_t * cursor)
+{
+	hash_table_snapshots_t * snapshots;
+	hash_table_snapshot_page_t * page;
+	hash_table_snapshot_bucket_t * bucket;
+	hash_table_key_t key;
+	uint64_t hash;
+	uint32_t first, length;
+	unsigned long index;
+
+	assert(snapshot != NULL);
+	assert(pattern != NULL);
+	assert(cursor != NULL);
+
+	snapshots = snapshot->owner;
+	cursor->next_duplicate = NULL;
+	cursor->number_remaining = 0;
+
+	hash = HASH_TABLE_HASH(&snapshots->config, pattern);
+	pattern = HASH_TABLE_PATTERN(&snapshots->config, pattern, &key);
+
+	index = Hash_Table_Reduce(hash, snapshot->number_of_buckets);
+	page = snapshot->pages[index / HASH_TABLE_SNAPSHOT_PAGE];
+	bucket = page != NULL ? page->buckets[index % HASH_TABLE_SNAPSHOT_PAGE] :
+		NULL;
+	if (bucket == NULL)
+		return NULL;
+
+	bucket_find(snapshots, bucket, pattern, hash, &first, &length);
+	if (length == 0)
+		return NULL;
+
+	/* the duplicates are the entries after the first */
+	cursor->next_duplicate = SNAPSHOT_OBJECTS(bucket) + first + 1;
+	cursor->number_remaining = length - 1;
+	return SNAPSHOT_OBJECTS(bucket)[first];
+}
+
+/* The first object under pattern in the snapshot, NULL if none */
+void * Hash_Table_Snapshot_First_Match(hash_table_snapshot_t * snapshot,
+	char * pattern)
+{
+	hash_table_cursor_t cursor;
+
+	return Hash_Table_Snapshot_Match_Cursor(snapshot, pattern, &cursor);
+}
+
+/* Copy up to max_num_records of the objects under pattern into records.
+* Returns the number copied, 0 if nothing found.
+*/
+unsigned long Hash_Table_Snapshot_Match_Into(hash_table_snapshot_t * snapshot,
+	char * pattern, void ** records, unsigned long max_num_records)
+{
+	hash_table_cursor_t cursor;
+	void * object;
+	unsigned long number_found = 0;
+
+	assert(records != NULL || max_num_records == 0);
+
+	if (max_num_records == 0)
+		return 0;
+
+	object = Hash_Table_Snapshot_Match_Cursor(snapshot, pattern, &cursor);
+	while (object != NULL && number_found < max_num_records)
+	{
+		records[number_found++] = object;
+		object = Hash_Table_Cursor_Next(&cursor);
+	}
+
+	return number_found;
+}
+
+/* Free every snapshot and object */
+void Hash_Table_Snapshots_Free(hash_table_snapshots_t * snapshots)
+{
+	hash_table_snapshot_t * current, * first, * stop;
+	hash_table_snapshot_page_t * page;
+	hash_table_snapshot_bucket_t * bucket;
+	hash_table_allocator_t allocator;
+	unsigned long i, j;
+	uint32_t k;
+
+	assert(snapshots != NULL);
+
+	Hash_Table_Snapshots_Commit(snapshots);
+
+	pthread_mutex_lock(&snapshots->lock);
+	first = snapshot_collect(snapshots, &stop);
+	pthread_mutex_unlock(&snapshots->lock);
+	snapshot_free_collected(snapshots, first, stop);
+
+	/* only the current snapshot is left, all it holds is its own */
+	current = snapshots->current;
+	assert(snapshots->oldest == current && current->number_of_readers == 1);
+
+	for (i = 0; i < current->number_of_pages; i++)
+	{
+		page = current->pages[i];
+		if (page == NULL)
+			continue;
+
+		for (j = 0; j < HASH_TABLE_SNAPSHOT_PAGE; j++)
+		{
+			bucket = page->buckets[j];
+			if (bucket == NULL)
+				continue;
+
+			for (k = 0; snapshots->config.free_function != NULL &&
+				k < bucket->number_of_entries; k++)
+				snapshots->config.free_function(SNAPSHOT_OBJECTS(bucket)[k]);
+			bucket_release(snapshots, bucket);
+		}
+		snapshot_release(snapshots, page, sizeof(hash_table_snapshot_page_t));
+	}
+	snapshot_free(snapshots, current);
+
+	pthread_mutex_destroy(&snapshots->lock);
+
+	allocator = snapshots->allocator;
+	allocator.release(snapshots, sizeof(hash_table_snapshots_t),
+		allocator.context);
+}
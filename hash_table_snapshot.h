@@ -0,0 +1,168 @@
+/* hash_table_snapshot.h - A table read through consistent snapshots while
+* a writer prepares the next one.
+*
+* Readers pin the current snapshot and look up in it for as long as they
+* like: it never changes. The writer's inserts and removals go into a draft
+* that nobody sees until Hash_Table_Snapshots_Commit publishes all of them
+* at once. The draft only copies what it changes: the buckets it writes to,
+* and the page of bucket pointers each of those sits in. Every other page
+* and bucket is shared with the snapshots before it, so a batch of updates
+* costs memory in proportion to the batch, not to the table.
+*
+* A snapshot is freed once it is released by its last reader and every
+* older snapshot is gone too. Whatever it held that the next snapshot
+* replaced goes with it, removed objects (through free_function) included.
+*
+* Buckets are arrays of hashes and objects, a key's duplicates next to each
+* other in insertion order, so a lookup in a snapshot runs no search_function
+* on other hashes and walks no lists.
+*
+* Needs POSIX threads (link with -lpthread).
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_SNAPSHOT_H
+#define __HASH_TABLE_SNAPSHOT_H
+
+#include <pthread.h>
+
+#include "hash_table.h"
+
+/* Buckets per page of a snapshot's bucket pointers, the unit pages are
+* copied in */
+#define HASH_TABLE_SNAPSHOT_PAGE 256
+
+/* number_of_entries hashes followed by their objects */
+typedef struct hash_table_snapshot_bucket_t {
+	unsigned long number; /* of the snapshot that made it */
+	uint32_t number_of_entries;
+	uint32_t capacity;
+} hash_table_snapshot_bucket_t;
+
+typedef struct hash_table_snapshot_page_t {
+	unsigned long number; /* of the snapshot that made it */
+	hash_table_snapshot_bucket_t * buckets[HASH_TABLE_SNAPSHOT_PAGE];
+} hash_table_snapshot_page_t;
+
+/* What a snapshot frees when it goes: what the next one no longer holds */
+typedef struct hash_table_snapshot_garbage_t {
+	void ** items;
+	unsigned long number_of_items;
+	unsigned long capacity;
+} hash_table_snapshot_garbage_t;
+
+typedef struct hash_table_snapshot_t {
+	struct hash_table_snapshots_t * owner;
+	unsigned long number; /* counts up from 1 */
+	unsigned long number_of_readers; /* pins, + 1 while current */
+	struct hash_table_snapshot_t * next_snapshot; /* the newer one */
+
+	hash_table_snapshot_page_t ** pages; /* NULL for an empty page */
+	unsigned long number_of_pages;
+	unsigned long number_of_buckets;
+	unsigned long number_of_objects;
+	unsigned long number_of_keys;
+
+	hash_table_snapshot_garbage_t pages_garbage;
+	hash_table_snapshot_garbage_t buckets_garbage;
+	hash_table_snapshot_garbage_t objects_garbage; /* removed objects */
+} hash_table_snapshot_t;
+
+typedef struct hash_table_snapshots_t {
+	hash_table_config_t config; /* with the default hashes filled in */
+	hash_table_allocator_t allocator;
+
+	/* oldest to current, the ones not freed yet. lock guards the list and
+	* the reader counts. */
+	pthread_mutex_t lock;
+	hash_table_snapshot_t * oldest;
+	hash_table_snapshot_t * current;
+
+	hash_table_snapshot_t * draft; /* NULL until the writer changes something */
+} hash_table_snapshots_t;
+
+/* A table of snapshots set up from config: hashing, search_function (or
+* key_function), free_function, allocator, number_of_buckets and
+* max_load_factor (the draft being committed doubles its buckets past it)
+* are used. compare_function is not needed. The first snapshot is empty.
+* Returns NULL if failure (memory allocation or lock creation).
+*/
+hash_table_snapshots_t * Hash_Table_Snapshots_Init(
+	hash_table_config_t * config);
+
+/* Writer side. There is one writer at a time: callers serialize these
+* themselves. Changes go to the draft and are seen once committed. */
+
+/* Insert object under pattern. Duplicates go after the key's others.
+* Return 1 if successful - 0 if failure (memory allocation), the draft is
+* then as it was.
+*/
+int Hash_Table_Snapshots_Insert(hash_table_snapshots_t * snapshots,
+	void * object, char * pattern);
+
+/* Take object, stored under pattern, out of the draft. The snapshots
+* still holding it keep it: it goes to free_function once the last of them
+* is freed, and must not be inserted again.
+* Returns 1 if it was removed, 0 if it was not there, -1 if failure (memory
+* allocation).
+*/
+int Hash_Table_Snapshots_Remove(hash_table_snapshots_t * snapshots,
+	char * pattern, void * object);
+
+/* Hash_Table_Snapshots_Remove of every object under pattern.
+* Returns the number removed, 0 if failure (memory allocation) or none.
+*/
+unsigned long Hash_Table_Snapshots_Remove_Key(
+	hash_table_snapshots_t * snapshots, char * pattern);
+
+/* Publish the draft as the current snapshot, for the next pins. Readers
+* of the one before keep it until they release it. Does nothing without a
+* draft. Growing the buckets past max_load_factor is skipped when memory
+* runs out.
+*/
+void Hash_Table_Snapshots_Commit(hash_table_snapshots_t * snapshots);
+
+/* Reader side, from any thread */
+
+/* The current snapshot, held until Hash_Table_Snapshots_Release */
+hash_table_snapshot_t * Hash_Table_Snapshots_Pin(
+	hash_table_snapshots_t * snapshots);
+
+/* Give back a snapshot from Hash_Table_Snapshots_Pin, freeing what no
+* snapshot needs any more */
+void Hash_Table_Snapshots_Release(hash_table_snapshots_t * snapshots,
+	hash_table_snapshot_t * snapshot);
+
+/* Hash_Table_Match_Cursor on a pinned snapshot. The cursor walks the
+* duplicates while the snapshot is pinned. */
+void * Hash_Table_Snapshot_Match_Cursor(hash_table_snapshot_t * snapshot,
+	char * pattern, hash_table_cursor_t * cursor);
+
+/* The first object under pattern in the snapshot, NULL if none */
+void * Hash_Table_Snapshot_First_Match(hash_table_snapshot_t * snapshot,
+	char * pattern);
+
+/* Copy up to max_num_records of the objects under pattern into records.
+* Returns the number copied, 0 if nothing found.
+*/
+unsigned long Hash_Table_Snapshot_Match_Into(hash_table_snapshot_t * snapshot,
+	char * pattern, void ** records, unsigned long max_num_records);
+
+/* Free every snapshot and object, committing any draft first. No snapshot
+* may still be pinned. */
+void Hash_Table_Snapshots_Free(hash_table_snapshots_t * snapshots);
+
+#endif
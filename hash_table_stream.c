@@ -0,0 +1,807 @@
+/* hash_table_stream.c - Streaming a table out and back in, see
+* hash_table_stream.h.
+*
+* A stream is the 8 byte magic followed by blocks, each a varint raw
+* length (0 ends the stream), a varint stored length (0 when the block is
+* stored as it is) and the stored bytes. Together the blocks' raw bytes
+* are the records: per key a varint hash difference and a varint number
+* of objects, then for each object a varint length and its bytes. Records
+* run on from one block into the next.
+*
+* Compression is the LZ4 block format, done here so the table needs no
+* library: a greedy compressor with one position per hash of 4 bytes, and a
+* decompressor that checks every length and offset against the buffers.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include <pthread.h>
+#include <string.h>
+
+#include "hash_table_stream.h"
+#include "hash_table_internal.h"
+
+#define STREAM_MAGIC "HTSTRM1"
+#define STREAM_MAGIC_LENGTH 8
+#define STREAM_BLOCK_SIZE 65536
+/* Blocks the reading thread can have ready ahead of the inserts */
+#define STREAM_PIPELINE_BLOCKS 4
+#define STREAM_VARINT_MAX 10
+
+/* Largest LZ4 block length bytes can compress to */
+#define LZ4_BOUND(length) ((length) + (length) / 255 + 16)
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+/* The last 5 bytes are always literals and no match starts in the last
+* 12, as the format requires */
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+
+static uint32_t lz4_read32(const unsigned char * bytes)
+{
+	uint32_t value;
+
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+/* Write a token nibble's overflow, length - 15, as runs of 255 */
+static unsigned char * lz4_put_length(unsigned char * output, size_t length)
+{
+	for (length -= 15; length >= 255; length -= 255)
+		*output++ = 255;
+	*output++ = (unsigned char)length;
+
+	return output;
+}
+
+/* Write one sequence: literals, then (unless match_length is 0) a match
+* offset bytes back */
+static unsigned char * lz4_put_sequence(unsigned char * output,
+	const unsigned char * literals, size_t number_of_literals,
+	size_t offset, size_t match_length)
+{
+	unsigned char * token = output++;
+	size_t match_code = match_length != 0 ? match_length - LZ4_MIN_MATCH : 0;
+
+	*token = (unsigned char)((number_of_literals < 15 ?
+		number_of_literals : 15) << 4);
+	if (number_of_literals >= 15)
+		output = lz4_put_length(output, number_of_literals);
+	memcpy(output, literals, number_of_literals);
+	output += number_of_literals;
+
+	if (match_length == 0)
+		return output;
+
+	*output++ = (unsigned char)(offset & 0xFF);
+	*output++ = (unsigned char)(offset >> 8);
+	*token |= (unsigned char)(match_code < 15 ? match_code : 15);
+	if (match_code >= 15)
+		output = lz4_put_length(output, match_code);
+
+	return output;
+}
+
+/* Compress length bytes of source into output (LZ4_BOUND(length) bytes)
+* using positions (1 << LZ4_HASH_BITS of them) as the match finder.
+* Returns the compressed length. */
+static size_t lz4_compress(const unsigned char * source, size_t length,
+	unsigned char * output, uint32_t * positions)
+{
+	unsigned char * start = output;
+	size_t position = 0, anchor = 0, candidate, match_length;
+	uint32_t sequence, slot;
+
+	memset(positions, 0, ((size_t)1 << LZ4_HASH_BITS) * sizeof(uint32_t));
+
+	while (length > LZ4_MATCH_LIMIT && position < length - LZ4_MATCH_LIMIT)
+	{
+		sequence = lz4_read32(source + position);
+		slot = (uint32_t)(sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+
+		/* positions hold position + 1, 0 being none */
+		candidate = positions[slot];
+		positions[slot] = (uint32_t)(position + 1);
+
+		if (candidate == 0 || position - (candidate - 1) > LZ4_MAX_OFFSET ||
+			lz4_read32(source + candidate - 1) != sequence)
+		{
+			position++;
+			continue;
+		}
+
+		candidate--;
+		match_length = LZ4_MIN_MATCH;
+		while (position + match_length < length - LZ4_LAST_LITERALS &&
+			source[candidate + match_length] == source[position + match_length])
+			match_length++;
+
+		output = lz4_put_sequence(output, source + anchor, position - anchor,
+			position - candidate, match_length);
+		position += match_length;
+		anchor = position;
+	}
+
+	output = lz4_put_sequence(output, source + anchor, length - anchor, 0, 0);
+	return (size_t)(output - start);
+}
+
+/* Read a token nibble's overflow at *position (before end) onto *length.
+* Return 1 if successful - 0 if the input runs out. */
+static int lz4_get_length(const unsigned char * input, size_t * position,
+	size_t end, size_t * length)
+{
+	unsigned char byte;
+
+	do
+	{
+		if (*position >= end)
+			return 0;
+
+		byte = input[(*position)++];
+		*length += byte;
+	} while (byte == 255);
+
+	return 1;
+}
+
+/* Decompress length bytes of input into exactly raw_length bytes of output.
+* Return 1 if successful - 0 if input is not such an LZ4 block. */
+static int lz4_decompress(const unsigned char * input, size_t length,
+	unsigned char * output, size_t raw_length)
+{
+	size_t position = 0, written = 0, number_of_literals, offset,
+		match_length, i;
+	unsigned char token;
+
+	while (position < length)
+	{
+		token = input[position++];
+
+		number_of_literals = token >> 4;
+		if (number_of_literals == 15 && !lz4_get_length(input, &position,
+			length, &number_of_literals))
+			return 0;
+		if (number_of_literals > length - position ||
+			number_of_literals > raw_length - written)
+			return 0;
+
+		memcpy(output + written, input + position, number_of_literals);
+		position += number_of_literals;
+		written += number_of_literals;
+
+		/* the last sequence has no match */
+		if (position == length)
+			break;
+
+		if (length - position < 2)
+			return 0;
+		offset = input[position] | (size_t)input[position + 1] << 8;
+		position += 2;
+		if (offset == 0 || offset > written)
+			return 0;
+
+		match_length = token & 15;
+		if (match_length == 15 && !lz4_get_length(input, &position, length,
+			&match_length))
+			return 0;
+		match_length += LZ4_MIN_MATCH;
+		if (match_length > raw_length - written)
+			return 0;
+
+		/* byte by byte, the match may overlap what it copies */
+		for (i = 0; i < match_length; i++)
+			output[written + i] = output[written - offset + i];
+		written += match_length;
+	}
+
+	return written == raw_length;
+}
+
+/* Write value as a varint (7 bits a byte, low first) into bytes, which has
+* room for STREAM_VARINT_MAX. Returns the number of bytes written. */
+static size_t varint_put(unsigned char * bytes, uint64_t value)
+{
+	size_t length = 0;
+
+	while (value >= 0x80)
+	{
+		bytes[length++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	bytes[length++] = (unsigned char)value;
+
+	return length;
+}
+
+typedef struct stream_writer_t {
+	hash_table_t * table;
+	int(*write_function)(void * context, const void * bytes, size_t length);
+	void * context;
+
+	unsigned char * block; /* STREAM_BLOCK_SIZE bytes */
+	size_t length;
+	/* NULL when not compressing */
+	unsigned char * compressed;
+	uint32_t * positions;
+} stream_writer_t;
+
+/* Write out the block built so far, compressed if that makes it smaller.
+* Return 1 if successful - 0 if failure (write_function failed).
+*/
+static int writer_flush(stream_writer_t * writer)
+{
+	unsigned char header[2 * STREAM_VARINT_MAX];
+	const unsigned char * bytes = writer->block;
+	size_t header_length, stored_length = 0;
+
+	if (writer->length == 0)
+		return 1;
+
+	if (writer->compressed != NULL)
+	{
+		stored_length = lz4_compress(writer->block, writer->length,
+			writer->compressed, writer->positions);
+		if (stored_length < writer->length)
+			bytes = writer->compressed;
+		else
+			stored_length = 0;
+	}
+
+	header_length = varint_put(header, writer->length);
+	header_length += varint_put(header + header_length, stored_length);
+
+	if (!writer->write_function(writer->context, header, header_length) ||
+		!writer->write_function(writer->context, bytes, stored_length != 0 ?
+		stored_length : writer->length))
+		return 0;
+
+	writer->length = 0;
+	return 1;
+}
+
+/* Add length bytes to the records, writing out each block as it fills.
+* Return 1 if successful - 0 if failure (write_function failed).
+*/
+static int writer_put(stream_writer_t * writer, const void * bytes,
+	size_t length)
+{
+	const unsigned char * next = bytes;
+	size_t part;
+
+	while (length > 0)
+	{
+		part = STREAM_BLOCK_SIZE - writer->length;
+		if (part > length)
+			part = length;
+
+		memcpy(writer->block + writer->length, next, part);
+		writer->length += part;
+		next += part;
+		length -= part;
+
+		if (writer->length == STREAM_BLOCK_SIZE && !writer_flush(writer))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int writer_put_varint(stream_writer_t * writer, uint64_t value)
+{
+	unsigned char bytes[STREAM_VARINT_MAX];
+
+	return writer_put(writer, bytes, varint_put(bytes, value));
+}
+
+/* Write the records of every key in table.
+* Return 1 if successful - 0 if failure (write_function failed).
+*/
+static int writer_put_table(stream_writer_t * writer)
+{
+	hash_table_t * table = writer->table;
+	hash_table_iterator_t iterator;
+	unsigned long number_of_objects, i;
+	uint64_t previous_hash = 0;
+	const void * bytes;
+	void * object;
+	size_t length;
+
+	Hash_Table_Iterator_Init(table, &iterator, 0, 1);
+	object = Hash_Table_Iterator_Next(&iterator);
+	while (object != NULL)
+	{
+		number_of_objects = iterator.duplicates.number_remaining + 1;
+
+		/* wraps round when the order is not by hash, still exact */
+		if (!writer_put_varint(writer, iterator.hash - previous_hash) ||
+			!writer_put_varint(writer, number_of_objects))
+			return 0;
+		previous_hash = iterator.hash;
+
+		for (i = 0; i < number_of_objects; i++)
+		{
+			if (i > 0)
+				object = Hash_Table_Iterator_Next(&iterator);
+
+			length = table->serialize_function(object, &bytes);
+			if (!writer_put_varint(writer, length) ||
+				!writer_put(writer, bytes, length))
+				return 0;
+		}
+
+		object = Hash_Table_Iterator_Next(&iterator);
+	}
+
+	return 1;
+}
+
+/* Write every object of table to write_function.
+* Return 1 if successful - 0 if failure (memory allocation or
+* write_function failed).
+*/
+int Hash_Table_Stream_Write(hash_table_t * table, int flags,
+	int(*write_function)(void * context, const void * bytes, size_t length),
+	void * context)
+{
+	stream_writer_t writer;
+	static const unsigned char end_of_stream = 0;
+	int written = 0;
+
+	assert(table != NULL);
+	assert(table->serialize_function != NULL);
+	assert(write_function != NULL);
+
+	memset(&writer, 0, sizeof(writer));
+	writer.table = table;
+	writer.write_function = write_function;
+	writer.context = context;
+
+	writer.block = Hash_Table_Allocate(table, STREAM_BLOCK_SIZE, 1);
+	if (flags & HASH_TABLE_STREAM_COMPRESS)
+	{
+		writer.compressed = Hash_Table_Allocate(table,
+			LZ4_BOUND(STREAM_BLOCK_SIZE), 1);
+		writer.positions = Hash_Table_Allocate(table,
+			(size_t)1 << LZ4_HASH_BITS, sizeof(uint32_t));
+	}
+
+	if (writer.block != NULL && ((flags & HASH_TABLE_STREAM_COMPRESS) == 0 ||
+		(writer.compressed != NULL && writer.positions != NULL)))
+		written = write_function(context, STREAM_MAGIC,
+			STREAM_MAGIC_LENGTH) && writer_put_table(&writer) &&
+			writer_flush(&writer) &&
+			write_function(context, &end_of_stream, 1);
+
+	Hash_Table_Release(table, writer.positions, (size_t)1 << LZ4_HASH_BITS,
+		sizeof(uint32_t));
+	Hash_Table_Release(table, writer.compressed, LZ4_BOUND(STREAM_BLOCK_SIZE),
+		1);
+	Hash_Table_Release(table, writer.block, STREAM_BLOCK_SIZE, 1);
+
+	return written;
+}
+
+typedef struct stream_reader_t {
+	hash_table_t * table;
+	size_t(*read_function)(void * context, void * buffer, size_t size);
+	void * context;
+
+	/* Blocks read ahead by the reading thread: count of them from first
+	* on are ready, first being the one the inserts are on. Without a
+	* thread only blocks[0] is used, read when it is needed. */
+	unsigned char * blocks[STREAM_PIPELINE_BLOCKS];
+	size_t lengths[STREAM_PIPELINE_BLOCKS];
+	unsigned long first;
+	unsigned long count;
+	unsigned char * compressed; /* LZ4_BOUND(STREAM_BLOCK_SIZE) bytes */
+	int threaded;
+	int done; /* the reading side reached the end of the stream or failed */
+	int failed;
+	int stop; /* the inserting side has finished with the stream */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t emptied;
+
+	/* Where the inserts are in their block, holding once they have one */
+	const unsigned char * position;
+	const unsigned char * end;
+	int holding;
+
+	/* An object split across blocks is put together here */
+	unsigned char * scratch;
+	size_t scratch_size;
+} stream_reader_t;
+
+/* Read exactly length bytes from the stream.
+* Return 1 if successful - 0 if failure (read_function failed or the
+* stream ended).
+*/
+static int reader_read(stream_reader_t * reader, void * buffer,
+	size_t length)
+{
+	unsigned char * next = buffer;
+	size_t number_read;
+
+	while (length > 0)
+	{
+		number_read = reader->read_function(reader->context, next, length);
+		if (number_read == 0 || number_read > length)
+			return 0;
+
+		next += number_read;
+		length -= number_read;
+	}
+
+	return 1;
+}
+
+/* Read a varint from the stream a byte at a time, so nothing past it is
+* read. Return 1 if successful - 0 if failure. */
+static int reader_read_varint(stream_reader_t * reader, uint64_t * value)
+{
+	unsigned char byte;
+	unsigned int shift;
+
+	*value = 0;
+	for (shift = 0; shift < 7 * STREAM_VARINT_MAX; shift += 7)
+	{
+		if (!reader_read(reader, &byte, 1))
+			return 0;
+
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Read the next block of the stream into block.
+* Returns 1 if it was read, 0 at the end of the stream, -1 if failure
+* (read_function failed or a malformed block).
+*/
+static int reader_fill(stream_reader_t * reader, unsigned char * block,
+	size_t * length)
+{
+	uint64_t raw_length, stored_length;
+
+	if (!reader_read_varint(reader, &raw_length))
+		return -1;
+	if (raw_length == 0)
+		return 0;
+
+	if (!reader_read_varint(reader, &stored_length) ||
+		raw_length > STREAM_BLOCK_SIZE ||
+		stored_length > LZ4_BOUND(STREAM_BLOCK_SIZE))
+		return -1;
+
+	if (stored_length == 0)
+	{
+		if (!reader_read(reader, block, (size_t)raw_length))
+			return -1;
+	}
+	else if (!reader_read(reader, reader->compressed, (size_t)stored_length) ||
+		!lz4_decompress(reader->compressed, (size_t)stored_length, block,
+		(size_t)raw_length))
+		return -1;
+
+	*length = (size_t)raw_length;
+	return 1;
+}
+
+/* The reading thread: fill free blocks until the end of the stream, a
+* failure, or the inserting side stops */
+static void * reader_thread(void * argument)
+{
+	stream_reader_t * reader = argument;
+	unsigned long index;
+	int result;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&reader->lock);
+		while (reader->count == STREAM_PIPELINE_BLOCKS && !reader->stop)
+			pthread_cond_wait(&reader->emptied, &reader->lock);
+		if (reader->stop)
+		{
+			pthread_mutex_unlock(&reader->lock);
+			break;
+		}
+		index = (reader->first + reader->count) % STREAM_PIPELINE_BLOCKS;
+		pthread_mutex_unlock(&reader->lock);
+
+		/* only this thread touches blocks that are not ready */
+		result = reader_fill(reader, reader->blocks[index],
+			&reader->lengths[index]);
+
+		pthread_mutex_lock(&reader->lock);
+		if (result > 0)
+			(reader->count)++;
+		else
+		{
+			reader->done = 1;
+			reader->failed = result < 0;
+		}
+		pthread_cond_signal(&reader->filled);
+		pthread_mutex_unlock(&reader->lock);
+
+		if (result <= 0)
+			break;
+	}
+
+	return NULL;
+}
+
+/* Hand the block the inserts are done with back and move them onto the
+* next. Returns 1 if there is one, 0 at the end of the stream or if the
+* reading side failed. */
+static int reader_next_block(stream_reader_t * reader)
+{
+	int result;
+
+	if (!reader->threaded)
+	{
+		result = reader_fill(reader, reader->blocks[0], &reader->lengths[0]);
+		reader->failed = result < 0;
+		if (result <= 0)
+			return 0;
+	}
+	else
+	{
+		pthread_mutex_lock(&reader->lock);
+		if (reader->holding)
+		{
+			reader->first = (reader->first + 1) % STREAM_PIPELINE_BLOCKS;
+			(reader->count)--;
+			pthread_cond_signal(&reader->emptied);
+		}
+		while (reader->count == 0 && !reader->done)
+			pthread_cond_wait(&reader->filled, &reader->lock);
+		result = reader->count != 0;
+		pthread_mutex_unlock(&reader->lock);
+
+		if (!result)
+			return 0;
+	}
+
+	reader->position = reader->blocks[reader->first];
+	reader->end = reader->position + reader->lengths[reader->first];
+	reader->holding = 1;
+	return 1;
+}
+
+/* Is there another record. Returns 1 if so, 0 at the end of the stream. */
+static int reader_more(stream_reader_t * reader)
+{
+	while (reader->position == reader->end)
+	{
+		if (!reader_next_block(reader))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Take length bytes of the records into buffer, across blocks as needed.
+* Return 1 if successful - 0 if the stream ends first (or failed).
+*/
+static int reader_get(stream_reader_t * reader, void * buffer,
+	size_t length)
+{
+	unsigned char * next = buffer;
+	size_t part;
+
+	while (length > 0)
+	{
+		if (!reader_more(reader))
+			return 0;
+
+		part = (size_t)(reader->end - reader->position);
+		if (part > length)
+			part = length;
+
+		memcpy(next, reader->position, part);
+		reader->position += part;
+		next += part;
+		length -= part;
+	}
+
+	return 1;
+}
+
+static int reader_get_varint(stream_reader_t * reader, uint64_t * value)
+{
+	unsigned char byte;
+	unsigned int shift;
+
+	*value = 0;
+	for (shift = 0; shift < 7 * STREAM_VARINT_MAX; shift += 7)
+	{
+		if (!reader_get(reader, &byte, 1))
+			return 0;
+
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Make the next object, length bytes long, with deserialize_function.
+* Bytes inside the current block are used where they are, ones split
+* across blocks are gathered in scratch first. scratch grows with the
+* bytes that arrive rather than by the length up front, so a corrupt
+* length fails at the end of the stream instead of allocating it.
+* Returns the object, NULL if failure (memory allocation, the stream
+* ended, or deserialize_function failed).
+*/
+static void * reader_get_object(stream_reader_t * reader, uint64_t length)
+{
+	hash_table_t * table = reader->table;
+	const unsigned char * bytes;
+	unsigned char * new_scratch;
+	size_t gathered = 0, part, new_size;
+
+	if (length > (uint64_t)(size_t)-1)
+		return NULL;
+
+	if (length <= (uint64_t)(reader->end - reader->position))
+	{
+		bytes = reader->position;
+		reader->position += length;
+		return table->deserialize_function(bytes, (size_t)length);
+	}
+
+	while (gathered < length)
+	{
+		if (gathered == reader->scratch_size)
+		{
+			new_size = reader->scratch_size < STREAM_BLOCK_SIZE ?
+				STREAM_BLOCK_SIZE : reader->scratch_size * 2;
+			if (new_size > length || new_size < reader->scratch_size)
+				new_size = (size_t)length;
+
+			new_scratch = Hash_Table_Allocate(table, new_size, 1);
+			if (new_scratch == NULL)
+				return NULL;
+
+			if (gathered != 0)
+				memcpy(new_scratch, reader->scratch, gathered);
+			Hash_Table_Release(table, reader->scratch, reader->scratch_size,
+				1);
+			reader->scratch = new_scratch;
+			reader->scratch_size = new_size;
+		}
+
+		part = reader->scratch_size - gathered;
+		if (part > length - gathered)
+			part = (size_t)length - gathered;
+		if (!reader_get(reader, reader->scratch + gathered, part))
+			return NULL;
+		gathered += part;
+	}
+
+	return table->deserialize_function(reader->scratch, (size_t)length);
+}
+
+/* Insert every object of the stream's records into the table.
+* Return 1 if successful - 0 if failure.
+*/
+static int reader_get_table(stream_reader_t * reader)
+{
+	hash_table_t * table = reader->table;
+	uint64_t hash = 0, difference, number_of_objects, length, i;
+	void * object;
+
+	while (reader_more(reader))
+	{
+		if (!reader_get_varint(reader, &difference) ||
+			!reader_get_varint(reader, &number_of_objects) ||
+			number_of_objects == 0)
+			return 0;
+		hash += difference;
+
+		for (i = 0; i < number_of_objects; i++)
+		{
+			if (!reader_get_varint(reader, &length))
+				return 0;
+
+			object = reader_get_object(reader, length);
+			if (object == NULL)
+				return 0;
+
+			if (!Hash_Table_Insert_Hashed(table, object, hash))
+			{
+				if (table->free_function != NULL)
+					table->free_function(object);
+				return 0;
+			}
+		}
+	}
+
+	return !reader->failed;
+}
+
+/* Insert every object of a stream written by Hash_Table_Stream_Write into
+* table.
+* Return 1 if successful - 0 if failure.
+*/
+int Hash_Table_Stream_Read(hash_table_t * table,
+	size_t(*read_function)(void * context, void * buffer, size_t size),
+	void * context)
+{
+	stream_reader_t reader;
+	unsigned char magic[STREAM_MAGIC_LENGTH];
+	unsigned long i;
+	int have_memory = 1, result = 0;
+
+	assert(table != NULL);
+	assert(table->deserialize_function != NULL);
+	assert(read_function != NULL);
+
+	memset(&reader, 0, sizeof(reader));
+	reader.table = table;
+	reader.read_function = read_function;
+	reader.context = context;
+
+	reader.compressed = Hash_Table_Allocate(table,
+		LZ4_BOUND(STREAM_BLOCK_SIZE), 1);
+	for (i = 0; i < STREAM_PIPELINE_BLOCKS; i++)
+	{
+		reader.blocks[i] = Hash_Table_Allocate(table, STREAM_BLOCK_SIZE, 1);
+		have_memory = have_memory && reader.blocks[i] != NULL;
+	}
+
+	if (have_memory && reader.compressed != NULL &&
+		reader_read(&reader, magic, STREAM_MAGIC_LENGTH) &&
+		memcmp(magic, STREAM_MAGIC, STREAM_MAGIC_LENGTH) == 0)
+	{
+		pthread_mutex_init(&reader.lock, NULL);
+		pthread_cond_init(&reader.filled, NULL);
+		pthread_cond_init(&reader.emptied, NULL);
+
+		/* without a thread the blocks are read as the inserts want them */
+		reader.threaded = pthread_create(&reader.thread, NULL, reader_thread,
+			&reader) == 0;
+
+		result = reader_get_table(&reader);
+
+		if (reader.threaded)
+		{
+			pthread_mutex_lock(&reader.lock);
+			reader.stop = 1;
+			pthread_cond_signal(&reader.emptied);
+			pthread_mutex_unlock(&reader.lock);
+			pthread_join(reader.thread, NULL);
+		}
+
+		pthread_cond_destroy(&reader.emptied);
+		pthread_cond_destroy(&reader.filled);
+		pthread_mutex_destroy(&reader.lock);
+	}
+
+	Hash_Table_Release(table, reader.scratch, reader.scratch_size, 1);
+	for (i = 0; i < STREAM_PIPELINE_BLOCKS; i++)
+		Hash_Table_Release(table, reader.blocks[i], STREAM_BLOCK_SIZE, 1);
+	Hash_Table_Release(table, reader.compressed, LZ4_BOUND(STREAM_BLOCK_SIZE),
+		1);
+
+	return result;
+}
@@ -0,0 +1,67 @@
+/* hash_table_stream.h - Saving a table to, and loading it from, a stream of
+* bytes (a socket, a pipe, a file) in a compact encoding, through read and
+* write callbacks so the stream can be anything.
+*
+* The table is walked bucket by bucket and each key written as the varint
+* difference of its full hash from the previous key's (chained buckets
+* come out in hash order, so these are small), its number of objects and
+* each object as a varint length and the bytes serialize_function gives.
+* The records are cut into blocks of at most 64KiB, each optionally LZ4
+* compressed. Writing and reading hold a block or a few at a time, then,
+* whatever the size of the table.
+*
+* Loading inserts each object deserialize_function makes, under the saved
+* hash, into a table created with the same hash, compare and search
+* functions. Blocks are read and decompressed on a thread of their own
+* while the calling thread inserts, so the I/O overlaps building the
+* table. Needs POSIX threads (link with -lpthread).
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_STREAM_H
+#define __HASH_TABLE_STREAM_H
+
+#include "hash_table.h"
+
+/* Hash_Table_Stream_Write flags */
+#define HASH_TABLE_STREAM_COMPRESS 1 /* LZ4 compress blocks that shrink */
+
+/* Write every object of table, through serialize_function, to
+* write_function, which should write all length bytes and return 1, or 0
+* if it cannot. Nothing may write to the table meanwhile.
+* Return 1 if successful - 0 if failure (memory allocation or
+* write_function failed).
+*/
+int Hash_Table_Stream_Write(hash_table_t * table, int flags,
+	int(*write_function)(void * context, const void * bytes, size_t length),
+	void * context);
+
+/* Insert every object of a stream written by Hash_Table_Stream_Write into
+* table, each made by deserialize_function. read_function should read up
+* to size bytes into buffer and return how many it read, 0 at the end of
+* the stream or on an error. It is called from a thread of its own (or
+* the calling thread if one cannot be started), never two calls at once.
+* Nothing past the end of the saved table is read, so the stream can carry
+* more after it.
+* Return 1 if successful - 0 if failure (memory allocation, read_function
+* failed, a malformed stream, or deserialize_function returned NULL).
+* Objects inserted before a failure are left in the table.
+*/
+int Hash_Table_Stream_Read(hash_table_t * table,
+	size_t(*read_function)(void * context, void * buffer, size_t size),
+	void * context);
+
+#endif
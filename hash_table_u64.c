@@ -0,0 +1,322 @@
+/* hash_table_u64.c - Hash table keyed by uint64_t. Keys are hashed and
+* compared inline rather than through callbacks, and live in the slot array
+* next to their object, so a probe touches one cache line and makes no
+* indirect call. A key's hash is cheap enough to work out again, so slots
+* do not store it.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#include "hash_table_u64.h"
+#include "hash_table_internal.h"
+
+#define U64_MIN_SLOTS 8
+/* grow once 7/8 of the slots are taken */
+#define U64_GROW_THRESHOLD(number_of_slots) \
+	((number_of_slots) - (number_of_slots) / 8)
+
+/* Hash_Table_Hash_Mix, here so the compiler can inline it. IDs are often
+* sequential, this spreads them over the whole 64 bits. */
+static uint64_t u64_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= (uint64_t)0xff51afd7 << 32 | 0xed558ccd;
+	key ^= key >> 33;
+	key *= (uint64_t)0xc4ceb9fe << 32 | 0x1a85ec53;
+	key ^= key >> 33;
+
+	return key;
+}
+
+/* How far the key in slot index is from its home slot */
+static unsigned long u64_distance(uint64_t key, unsigned long index,
+	unsigned long mask)
+{
+	return (index - (unsigned long)(u64_hash(key) & mask)) & mask;
+}
+
+static hash_table_u64_slot_t * u64_allocate_slots(hash_table_u64_t * table,
+	unsigned long number_of_slots)
+{
+	if ((size_t)number_of_slots > (size_t)-1 / sizeof(hash_table_u64_slot_t))
+		return NULL;
+
+	return table->allocator.allocate((size_t)number_of_slots *
+		sizeof(hash_table_u64_slot_t), table->allocator.context);
+}
+
+/* Robin Hood placement of a key known not to be in slots: it takes the slot
+* of any key sitting nearer its home than it would, which then moves on */
+static void u64_place(hash_table_u64_slot_t * slots, unsigned long mask,
+	uint64_t key, void * object, unsigned long index, unsigned long distance)
+{
+	hash_table_u64_slot_t temp;
+	unsigned long slot_distance;
+
+	while (slots[index].object != NULL)
+	{
+		slot_distance = u64_distance(slots[index].key, index, mask);
+		if (slot_distance < distance)
+		{
+			temp = slots[index];
+			slots[index].key = key;
+			slots[index].object = object;
+			key = temp.key;
+			object = temp.object;
+			distance = slot_distance;
+		}
+
+		index = (index + 1) & mask;
+		distance++;
+	}
+
+	slots[index].key = key;
+	slots[index].object = object;
+}
+
+/* Move everything into a slot array twice the size.
+* Return 1 if successful - 0 if failure (memory allocation).
+*/
+static int u64_grow(hash_table_u64_t * table)
+{
+	hash_table_u64_slot_t * new_slots;
+	unsigned long i, new_mask, number_of_slots = table->number_of_slots * 2;
+
+	if (number_of_slots < table->number_of_slots)
+		return 0;
+
+	new_slots = u64_allocate_slots(table, number_of_slots);
+	if (new_slots == NULL)
+		return 0;
+
+	new_mask = number_of_slots - 1;
+	for (i = 0; i < table->number_of_slots; i++)
+	{
+		if (table->slots[i].object != NULL)
+			u64_place(new_slots, new_mask, table->slots[i].key,
+				table->slots[i].object,
+				(unsigned long)(u64_hash(table->slots[i].key) & new_mask), 0);
+	}
+
+	table->allocator.release(table->slots, (size_t)table->number_of_slots *
+		sizeof(hash_table_u64_slot_t), table->allocator.context);
+	table->slots = new_slots;
+	table->number_of_slots = number_of_slots;
+	table->grow_threshold = U64_GROW_THRESHOLD(number_of_slots);
+
+	return 1;
+}
+
+/* Index of the slot holding key, number_of_slots if none */
+static unsigned long u64_locate(hash_table_u64_t * table, uint64_t key)
+{
+	hash_table_u64_slot_t * slots = table->slots;
+	unsigned long mask = table->number_of_slots - 1,
+		index = (unsigned long)(u64_hash(key) & mask), distance;
+
+	for (distance = 0; slots[index].object != NULL; distance++)
+	{
+		if (slots[index].key == key)
+			return index;
+
+		/* key would have taken this slot had it been inserted */
+		if (u64_distance(slots[index].key, index, mask) < distance)
+			break;
+
+		index = (index + 1) & mask;
+	}
+
+	return table->number_of_slots;
+}
+
+/*
+* Returns a new allocated hash_table_u64_t
+* Returns NULL if failure (memory allocation).
+*/
+hash_table_u64_t * Hash_Table_U64_Init(unsigned long number_of_slots,
+	void(*free_function)(void * object), hash_table_allocator_t * allocator)
+{
+	hash_table_u64_t * new_table;
+	hash_table_allocator_t no_allocator, table_allocator;
+	unsigned long rounded_slots = U64_MIN_SLOTS;
+
+	if (allocator == NULL)
+	{
+		memset(&no_allocator, 0, sizeof(no_allocator));
+		allocator = &no_allocator;
+	}
+	table_allocator = Hash_Table_Allocator_Or_Default(allocator);
+
+	while (rounded_slots < number_of_slots && rounded_slots * 2 > rounded_slots)
+		rounded_slots *= 2;
+
+	new_table = table_allocator.allocate(sizeof(hash_table_u64_t),
+		table_allocator.context);
+	if (new_table == NULL)
+		return NULL;
+
+	new_table->allocator = table_allocator;
+	new_table->free_function = free_function;
+	new_table->number_of_entries = 0;
+	new_table->number_of_slots = rounded_slots;
+	new_table->grow_threshold = U64_GROW_THRESHOLD(rounded_slots);
+
+	new_table->slots = u64_allocate_slots(new_table, rounded_slots);
+	if (new_table->slots == NULL)
+	{
+		table_allocator.release(new_table, sizeof(hash_table_u64_t),
+			table_allocator.context);
+		return NULL;
+	}
+
+	return new_table;
+}
+
+/* Free table and contained objects */
+void Hash_Table_U64_Free(hash_table_u64_t * table)
+{
+	hash_table_allocator_t allocator;
+	unsigned long i;
+
+	assert(table != NULL);
+
+	if (table->free_function != NULL)
+	{
+		for (i = 0; i < table->number_of_slots; i++)
+		{
+			if (table->slots[i].object != NULL)
+				table->free_function(table->slots[i].object);
+		}
+	}
+
+	allocator = table->allocator;
+	allocator.release(table->slots, (size_t)table->number_of_slots *
+		sizeof(hash_table_u64_slot_t), allocator.context);
+	allocator.release(table, sizeof(hash_table_u64_t), allocator.context);
+}
+
+/* Insert object under key unless key is already there.
+* Return 1 if successful, 0 already exists, -1 if failure (memory
+* allocation).
+*/
+int Hash_Table_U64_Insert(hash_table_u64_t * table, uint64_t key,
+	void * object, void ** found_duplicate)
+{
+	hash_table_u64_slot_t * slots;
+	unsigned long mask, index, distance;
+
+	assert(table != NULL);
+	assert(object != NULL);
+
+	if (table->number_of_entries >= table->grow_threshold &&
+		!u64_grow(table))
+	{
+		/* a full table cannot take another key */
+		if (table->number_of_entries == table->number_of_slots)
+			return -1;
+	}
+
+	slots = table->slots;
+	mask = table->number_of_slots - 1;
+	index = (unsigned long)(u64_hash(key) & mask);
+
+	/* walk the keys nearer their home than key would be, one may be key */
+	for (distance = 0; slots[index].object != NULL; distance++)
+	{
+		if (slots[index].key == key)
+		{
+			/* already exists */
+			*found_duplicate = slots[index].object;
+			return 0;
+		}
+
+		if (u64_distance(slots[index].key, index, mask) < distance)
+			break;
+
+		index = (index + 1) & mask;
+	}
+
+	u64_place(slots, mask, key, object, index, distance);
+	(table->number_of_entries)++;
+
+	return 1;
+}
+
+/* Returns the object stored under key, NULL if none */
+void * Hash_Table_U64_Find(hash_table_u64_t * table, uint64_t key)
+{
+	unsigned long index;
+
+	assert(table != NULL);
+
+	index = u64_locate(table, key);
+	if (index == table->number_of_slots)
+		return NULL;
+
+	return table->slots[index].object;
+}
+
+/* Take key out of the table and shift the keys after it back toward their
+* home slots, so no tombstone is left.
+* Returns the object it held, NULL if key was not in the table.
+*/
+void * Hash_Table_U64_Remove(hash_table_u64_t * table, uint64_t key)
+{
+	hash_table_u64_slot_t * slots;
+	unsigned long mask, hole, next;
+	void * object;
+
+	assert(table != NULL);
+
+	hole = u64_locate(table, key);
+	if (hole == table->number_of_slots)
+		return NULL;
+
+	slots = table->slots;
+	mask = table->number_of_slots - 1;
+	object = slots[hole].object;
+
+	next = (hole + 1) & mask;
+	while (slots[next].object != NULL &&
+		u64_distance(slots[next].key, next, mask) > 0)
+	{
+		slots[hole] = slots[next];
+		hole = next;
+		next = (next + 1) & mask;
+	}
+
+	slots[hole].object = NULL;
+	(table->number_of_entries)--;
+
+	return object;
+}
+
+/* Returns number of keys in table */
+unsigned long Hash_Table_U64_Count(hash_table_u64_t * table)
+{
+	assert(table != NULL);
+
+	return table->number_of_entries;
+}
+
+/* Returns number of bytes allocated for table, not including objects it
+* holds */
+unsigned long Hash_Table_U64_Size(hash_table_u64_t * table)
+{
+	assert(table != NULL);
+
+	return (unsigned long)(sizeof(hash_table_u64_t) +
+		table->number_of_slots * sizeof(hash_table_u64_slot_t));
+}
@@ -0,0 +1,76 @@
+/* hash_table_u64.h - Hash table keyed by uint64_t, for tables of IDs. Keys
+* are compared and hashed by the table itself, so there are no callbacks to
+* call on a probe and no key to turn into a string first. One object per
+* key, kept next to its key in a single Robin Hood probed slot array.
+*
+*
+* Copyright 2014 Joshua Nithsdale
+*
+*  Licensed under the Apache License, Version 2.0 (the "License");
+*  you may not use this file except in compliance with the License.
+*  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+*  Unless required by applicable law or agreed to in writing, software
+*  distributed under the License is distributed on an "AS IS" BASIS,
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*  See the License for the specific language governing permissions and
+*  limitations under the License.
+*/
+#ifndef __HASH_TABLE_U64_H
+#define __HASH_TABLE_U64_H
+
+#include "hash_table.h"
+
+/* A slot is empty when object is NULL */
+typedef struct hash_table_u64_slot_t {
+	uint64_t key;
+	void * object;
+} hash_table_u64_slot_t;
+
+typedef struct hash_table_u64_t {
+	hash_table_u64_slot_t * slots;
+	unsigned long number_of_slots; /* a power of 2 */
+	unsigned long number_of_entries;
+	unsigned long grow_threshold; /* entries at which slots is doubled */
+	void(*free_function)(void * object);
+	hash_table_allocator_t allocator;
+} hash_table_u64_t;
+
+/* Returns a new table with room for number_of_slots (rounded up to a power
+* of 2) before it first grows. free_function is called on each object by
+* Hash_Table_U64_Free and may be NULL. allocator may be NULL for calloc /
+* free.
+* Returns NULL if failure (memory allocation).
+*/
+hash_table_u64_t * Hash_Table_U64_Init(unsigned long number_of_slots,
+	void(*free_function)(void * object), hash_table_allocator_t * allocator);
+
+/* Free table and contained objects */
+void Hash_Table_U64_Free(hash_table_u64_t * table);
+
+/* Insert object (not NULL) under key, unless key is already there, in which
+* case its object is stored in found_duplicate.
+* Return 1 if successful, 0 already exists, -1 if failure (memory
+* allocation).
+*/
+int Hash_Table_U64_Insert(hash_table_u64_t * table, uint64_t key,
+	void * object, void ** found_duplicate);
+
+/* Returns the object stored under key, NULL if none */
+void * Hash_Table_U64_Find(hash_table_u64_t * table, uint64_t key);
+
+/* Take key out of the table, the object is not freed.
+* Returns the object it held, NULL if key was not in the table.
+*/
+void * Hash_Table_U64_Remove(hash_table_u64_t * table, uint64_t key);
+
+/* Returns number of keys in table */
+unsigned long Hash_Table_U64_Count(hash_table_u64_t * table);
+
+/* Returns number of bytes allocated for table, not including objects it
+* holds */
+unsigned long Hash_Table_U64_Size(hash_table_u64_t * table);
+
+#endif